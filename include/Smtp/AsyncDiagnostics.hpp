@@ -0,0 +1,129 @@
+#pragma once
+
+/**
+ * @file AsyncDiagnostics.hpp
+ *
+ * This module declares the Smtp::AsyncDiagnostics class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <memory>
+#include <stddef.h>
+#include <SystemAbstractions/DiagnosticsSender.hpp>
+
+namespace Smtp {
+
+    /**
+     * This delivers diagnostic messages to subscribers on a thread of its
+     * own, so that a slow subscriber never holds up the sender.
+     *
+     * Messages are queued in a fixed-size ring buffer, without taking any
+     * locks, and delivered in order by a logger thread.  If the ring is
+     * full, the message is dropped rather than making the sender wait,
+     * and the drop is counted.  Subscribers are told how many messages
+     * were dropped, by a warning delivered once the ring has room again.
+     *
+     * To use it with Smtp::Client, wrap the subscriber's delegate:
+     *
+     *     const auto wrappedDelegate = asyncDiagnostics->Wrap(delegate);
+     *     const auto unsubscribe = client.SubscribeToDiagnostics(
+     *         wrappedDelegate,
+     *         minLevel
+     *     );
+     *
+     * Messages are delivered some time after they're sent, so they may
+     * still be delivered to the subscriber's delegate after it's been
+     * unsubscribed.  Before destroying anything the delegate refers to,
+     * either call Flush after unsubscribing, or release the delegate:
+     *
+     *     unsubscribe();
+     *     asyncDiagnostics->Unwrap(wrappedDelegate);
+     */
+    class AsyncDiagnostics {
+        // Lifecycle management
+    public:
+        ~AsyncDiagnostics() noexcept;
+        AsyncDiagnostics(const AsyncDiagnostics&) = delete;
+        AsyncDiagnostics(AsyncDiagnostics&&) noexcept;
+        AsyncDiagnostics& operator=(const AsyncDiagnostics&) = delete;
+        AsyncDiagnostics& operator=(AsyncDiagnostics&&) noexcept;
+
+        // Public methods
+    public:
+        /**
+         * This is the constructor.
+         *
+         * @param[in] capacity
+         *     This is the number of messages the ring buffer can hold.
+         *     It's rounded up to a power of two.
+         */
+        explicit AsyncDiagnostics(size_t capacity = 1024);
+
+        /**
+         * Make a delegate which queues the diagnostic messages given to it,
+         * to be delivered to the given delegate on the logger thread.
+         *
+         * @param[in] delegate
+         *     This is the function to call on the logger thread to deliver
+         *     the messages.
+         *
+         * @return
+         *     A delegate which queues the messages given to it is returned.
+         *     Once this object is destroyed, or the delegate is released
+         *     by Unwrap, it discards them instead.  The given delegate is
+         *     kept only as long as the returned delegate, or any message
+         *     queued for it.
+         */
+        SystemAbstractions::DiagnosticsSender::DiagnosticMessageDelegate Wrap(
+            SystemAbstractions::DiagnosticsSender::DiagnosticMessageDelegate delegate
+        );
+
+        /**
+         * Release the delegate given to Wrap when it made the given
+         * delegate, so that no more messages are delivered to it, not
+         * even those already queued, or warnings about dropped messages.
+         * If a message is being delivered to it, wait for that to finish
+         * first, unless called by the delegate itself.
+         *
+         * @param[in] wrappedDelegate
+         *     This is the delegate returned by Wrap.
+         */
+        void Unwrap(
+            const SystemAbstractions::DiagnosticsSender::DiagnosticMessageDelegate& wrappedDelegate
+        );
+
+        /**
+         * Wait until every message queued so far has been delivered.
+         * If called by a subscriber's delegate, on the logger thread,
+         * this returns at once instead, since the messages after the
+         * one being delivered can't be delivered until it returns.
+         */
+        void Flush();
+
+        /**
+         * Return the number of messages dropped because the ring buffer
+         * was full.
+         *
+         * @return
+         *     The number of messages dropped because the ring buffer
+         *     was full is returned.
+         */
+        size_t GetDroppedCount() const;
+
+        // Private properties
+    private:
+        /**
+         * This is the type of structure that contains the private
+         * properties of the instance.  It is defined in the implementation
+         * and declared here to ensure that it is scoped inside the class.
+         */
+        struct Impl;
+
+        /**
+         * This contains the private properties of the instance.
+         */
+        std::shared_ptr< Impl > impl_;
+    };
+
+}
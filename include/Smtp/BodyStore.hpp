@@ -0,0 +1,179 @@
+#pragma once
+
+/**
+ * @file BodyStore.hpp
+ *
+ * This module declares the Smtp::BodyStore class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <memory>
+#include <stddef.h>
+#include <string>
+
+namespace Smtp {
+
+    /**
+     * This holds e-mail bodies keyed by a hash of their contents, so that
+     * an application sending the same body to many envelopes keeps only
+     * one copy of it.  Bodies are stored already processed for
+     * transmission (line endings normalized to CRLF and "dot-stuffed"),
+     * so the client can send them as they are.
+     *
+     * The store may optionally be backed by a directory, in which case
+     * each distinct body is written to a file named after its key, once,
+     * and is no longer held in memory, but loaded from there when
+     * requested.  The number of references to each body is written to a
+     * file next to the body's file each time a reference is added or
+     * released, so that it survives the store being remade, even after
+     * a crash.  Files are written in full to a temporary file, which is
+     * synchronized to disk before being moved into place, so a crash or
+     * full disk never leaves one partly written.
+     */
+    class BodyStore {
+        // Types
+    public:
+        /**
+         * This is how a stored body is handed out.  All holders of the
+         * same body share one copy of it.
+         */
+        using Body = std::shared_ptr< const std::string >;
+
+        /**
+         * This locates the file in which a stored body is kept,
+         * so that it can be sent straight from the file.
+         */
+        struct BodyFile {
+            /**
+             * This is the path to the file, or an empty string if
+             * there is no such file.
+             */
+            std::string path;
+
+            /**
+             * This is the size, in bytes, of the body.
+             */
+            size_t length = 0;
+        };
+
+        // Lifecycle management
+    public:
+        ~BodyStore() noexcept;
+        BodyStore(const BodyStore&) = delete;
+        BodyStore(BodyStore&&) noexcept;
+        BodyStore& operator=(const BodyStore&) = delete;
+        BodyStore& operator=(BodyStore&&) noexcept;
+
+        // Public methods
+    public:
+        /**
+         * This is the default constructor.
+         */
+        BodyStore();
+
+        /**
+         * Back the store with the given directory.
+         *
+         * @param[in] directory
+         *     This is the path to an existing directory in which to keep
+         *     a file for each distinct body stored.
+         */
+        void Configure(const std::string& directory);
+
+        /**
+         * Process the given e-mail body for transmission and store it,
+         * unless an identical body is already stored, adding a reference
+         * to it in either case.
+         *
+         * @param[in] body
+         *     This is the e-mail body to store.
+         *
+         * @return
+         *     The key under which the processed body is stored
+         *     is returned.  If the store is backed by a directory, and
+         *     the body or its new number of references could not be
+         *     written there, no reference is added, and an empty string
+         *     is returned instead.
+         */
+        std::string Add(const std::string& body);
+
+        /**
+         * Return the processed body stored under the given key.
+         *
+         * @note
+         *     A body found in the backing directory, rather than one
+         *     added since the store was made, has as many references as
+         *     were last written there.  If that number can't be read,
+         *     the body is taken to have one reference.
+         *
+         * @param[in] key
+         *     This is the key returned by Add when the body was stored.
+         *
+         * @return
+         *     The processed body stored under the given key is returned,
+         *     or nullptr is returned if there is no such body.
+         */
+        Body Get(const std::string& key);
+
+        /**
+         * Return where to find the file in which the processed body
+         * stored under the given key is kept.  The body is not loaded
+         * into memory.
+         *
+         * @param[in] key
+         *     This is the key returned by Add when the body was stored.
+         *
+         * @return
+         *     The location of the body's file is returned.  Its path is
+         *     empty if the store is not backed by a directory, or there
+         *     is no such body.
+         */
+        BodyFile GetFile(const std::string& key);
+
+        /**
+         * Drop one reference to the body stored under the given key.
+         * Once no references remain, the body is removed from the store,
+         * along with its file if the store is backed by a directory.
+         * Anyone still holding the body itself may continue to use it.
+         * The body is not loaded into memory to release it.
+         *
+         * @param[in] key
+         *     This is the key returned by Add when the body was stored.
+         */
+        void Release(const std::string& key);
+
+        /**
+         * Return the number of distinct bodies held in memory, which
+         * doesn't include bodies kept in the backing directory.
+         *
+         * @return
+         *     The number of distinct bodies held in memory is returned.
+         */
+        size_t GetBodyCount();
+
+        /**
+         * Return the total size of the distinct bodies held in memory.
+         *
+         * @return
+         *     The total size, in bytes, of the distinct bodies held
+         *     in memory is returned.
+         */
+        size_t GetStoredBytes();
+
+        // Private properties
+    private:
+        /**
+         * This is the type of structure that contains the private
+         * properties of the instance.  It is defined in the implementation
+         * and declared here to ensure that it is scoped inside the class.
+         */
+        struct Impl;
+
+        /**
+         * This contains the private properties of the instance.
+         */
+        std::shared_ptr< Impl > impl_;
+    };
+
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+/**
+ * @file CachingResolver.hpp
+ *
+ * This module declares the Smtp::CachingResolver class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "Resolver.hpp"
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+namespace Smtp {
+
+    /**
+     * This is a resolver which remembers the answers given by another
+     * resolver, both positive (addresses found) and negative (host not
+     * found), for as long as they may be reused.  Requests to look up a host
+     * whose lookup is already in progress are attached to that lookup rather
+     * than starting another one.  If the resolver is destroyed while
+     * lookups are still in progress, everyone waiting on them is given
+     * an empty answer, as if the hosts could not be found.
+     */
+    class CachingResolver
+        : public Resolver
+    {
+        // Lifecycle management
+    public:
+        ~CachingResolver() noexcept;
+        CachingResolver(const CachingResolver&) = delete;
+        CachingResolver(CachingResolver&&) noexcept;
+        CachingResolver& operator=(const CachingResolver&) = delete;
+        CachingResolver& operator=(CachingResolver&&) noexcept;
+
+        // Public methods
+    public:
+        /**
+         * This is the default constructor.
+         */
+        CachingResolver();
+
+        /**
+         * Provide the dependencies the class needs to operate.
+         *
+         * @param[in] upstream
+         *     This is the resolver to ask about hosts whose answers
+         *     are not already cached.
+         *
+         * @param[in] negativeTimeToLive
+         *     This is how long to remember that a host could not be found.
+         */
+        void Configure(
+            std::shared_ptr< Resolver > upstream,
+            std::chrono::milliseconds negativeTimeToLive = std::chrono::seconds(30)
+        );
+
+        /**
+         * Forget all cached answers.
+         */
+        void Flush();
+
+        // Smtp::Resolver
+    public:
+        virtual void Resolve(
+            const std::string& hostNameOrAddress,
+            ResolutionDelegate onResolved
+        ) override;
+
+        // Private properties
+    private:
+        /**
+         * This is the type of structure that contains the private
+         * properties of the instance.  It is defined in the implementation
+         * and declared here to ensure that it is scoped inside the class.
+         */
+        struct Impl;
+
+        /**
+         * This contains the private properties of the instance.
+         */
+        std::shared_ptr< Impl > impl_;
+    };
+
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+/**
+ * @file CancellationToken.hpp
+ *
+ * This module declares the Smtp::CancellationToken class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <functional>
+#include <memory>
+
+namespace Smtp {
+
+    /**
+     * This is used to ask an operation in progress, such as sending an
+     * e-mail, to give up early.  Copies of a token share the same state,
+     * so the caller keeps one copy and hands another to the operation.
+     */
+    class CancellationToken {
+        // Types
+    public:
+        /**
+         * This is the type of function called when a token is cancelled.
+         */
+        using CancellationDelegate = std::function< void() >;
+
+        /**
+         * This is the type of function returned when subscribing to the
+         * cancellation of a token, which may be called to end the
+         * subscription.
+         */
+        using UnsubscribeDelegate = std::function< void() >;
+
+        // Lifecycle management
+    public:
+        ~CancellationToken() noexcept;
+        CancellationToken(const CancellationToken&);
+        CancellationToken(CancellationToken&&) noexcept;
+        CancellationToken& operator=(const CancellationToken&);
+        CancellationToken& operator=(CancellationToken&&) noexcept;
+
+        // Public methods
+    public:
+        /**
+         * This is the default constructor.  It makes a new token which
+         * has not been cancelled.
+         */
+        CancellationToken();
+
+        /**
+         * Cancel the token, calling any functions subscribed to its
+         * cancellation.  Only the first call has any effect.
+         */
+        void Cancel();
+
+        /**
+         * Determine whether or not the token has been cancelled.
+         *
+         * @return
+         *     An indication of whether or not the token has been cancelled
+         *     is returned.
+         */
+        bool IsCancelled() const;
+
+        /**
+         * Form a new subscription to the cancellation of the token.
+         *
+         * @param[in] delegate
+         *     This is the function to call when the token is cancelled.
+         *     It's called from the thread which cancels the token, or
+         *     before this method returns if the token is already cancelled.
+         *
+         * @return
+         *     A function is returned which may be called
+         *     to terminate the subscription.
+         */
+        UnsubscribeDelegate SubscribeToCancellation(CancellationDelegate delegate);
+
+        // Private properties
+    private:
+        /**
+         * This is the type of structure that contains the private
+         * properties of the instance.  It is defined in the implementation
+         * and declared here to ensure that it is scoped inside the class.
+         */
+        struct Impl;
+
+        /**
+         * This contains the private properties of the instance.
+         */
+        std::shared_ptr< Impl > impl_;
+    };
+
+}
@@ -8,10 +8,16 @@
  * © 2019 by Richard Walters
  */
 
+#include "BodyStore.hpp"
+#include "CancellationToken.hpp"
+#include "DestinationHealth.hpp"
+#include "SpanSink.hpp"
+
 #include <functional>
 #include <future>
 #include <memory>
 #include <MessageHeaders/MessageHeaders.hpp>
+#include <stddef.h>
 #include <string>
 #include <SystemAbstractions/DiagnosticsSender.hpp>
 #include <SystemAbstractions/INetworkConnection.hpp>
@@ -78,7 +84,8 @@ namespace Smtp {
 
         /**
          * This is used to hold onto the pieces of a disassembled message
-         * received from an SMTP server.
+         * received from an SMTP server.  A reply made up of several lines
+         * is put back together and delivered as one message.
          */
         struct ParsedMessage {
             /**
@@ -87,15 +94,11 @@ namespace Smtp {
              */
             int code = 0;
 
-            /**
-             * This indicates whether or not the server indicated that this is
-             * the last line it will send in the current protocol stage.
-             */
-            bool last = false;
-
             /**
              * This is a human-readable string provided with the message that
              * can be delivered to the user to explain what's going on.
+             * If the server's reply was made up of several lines, the text
+             * of each line is included, separated by line feeds.
              */
             std::string text;
         };
@@ -161,6 +164,39 @@ namespace Smtp {
                 const std::string& input
             );
 
+            /**
+             * Allow the extension to modify the given message about to be
+             * sent from the client to the server, delivering the result
+             * whenever it's ready.  The client holds back this message,
+             * and any sent after it, until then.
+             *
+             * The default implementation calls ModifyMessage and delivers
+             * its result right away.  An extension which needs to wait on
+             * something slow may instead return at once, and deliver the
+             * result later from another thread, such as one of
+             * a WorkerPool's.
+             *
+             * @param[in] context
+             *     This holds any information that needs to be shared between
+             *     the protocol handler and the extension.  It's only valid
+             *     until the function returns.
+             *
+             * @param[in] input
+             *     This is the message about to the sent from the client
+             *     to the server.  The newline at the end is not included.
+             *     It's only valid until the function returns.
+             *
+             * @param[in] onModified
+             *     This is the function to call, once, with the input
+             *     message, possibly modified by the extension.  The newline
+             *     at the end is not included.
+             */
+            virtual void ModifyMessageAsync(
+                const MessageContext& context,
+                const std::string& input,
+                std::function< void(const std::string& output) > onModified
+            );
+
             /**
              * Ask the extension whether or not it wants to handle a custom
              * protocol step at the current time.
@@ -198,6 +234,9 @@ namespace Smtp {
              *     complete.  The parameter indicates whether or not the
              *     client may proceed to the next stage.
              *
+             * @note
+             *     The extension may return before its stage is done, and
+             *     call these functions later from any thread.
              */
             virtual void GoAhead(
                 std::function< void(const std::string& data) > onSendMessage,
@@ -229,8 +268,174 @@ namespace Smtp {
                 const MessageContext& context,
                 const ParsedMessage& message
             );
+
+            /**
+             * Give the extension a message received from the SMTP server
+             * during its custom protocol stage, and let it deliver the
+             * outcome whenever it's ready.  The client holds back any
+             * later messages from the server until then.
+             *
+             * The default implementation calls HandleServerMessage and
+             * delivers its result right away.  An extension which needs to
+             * wait on something slow may instead return at once, and
+             * deliver the outcome later from another thread, such as one
+             * of a WorkerPool's.
+             *
+             * @param[in] context
+             *     This holds any information that needs to be shared between
+             *     the protocol handler and the extension.  It's only valid
+             *     until the function returns.
+             *
+             * @param[in] message
+             *     This is the message received from the server.
+             *     It's only valid until the function returns.
+             *
+             * @param[in] onHandled
+             *     This is the function to call, once, with an indication
+             *     of whether or not the message was handled successfully.
+             *     If false is given, the client considers the protocol to
+             *     have encountered a "hard failure", and drops the
+             *     connection.
+             */
+            virtual void HandleServerMessageAsync(
+                const MessageContext& context,
+                const ParsedMessage& message,
+                std::function< void(bool success) > onHandled
+            );
         };
 
+        /**
+         * This is the type of function used to make a new instance of an
+         * SMTP extension for one connection.  The same factory may be
+         * registered with many clients, so it may be called from several
+         * threads at once.
+         *
+         * @return
+         *     A new instance of the extension is returned.  If nullptr is
+         *     returned, the extension is not used for the connection.
+         */
+        using ExtensionFactory = std::function< std::shared_ptr< Extension >() >;
+
+        /**
+         * This holds factories for SMTP extensions, keyed by extension
+         * name, to be shared by many clients, such as those in a pool,
+         * so that each client refers to one set of factories rather than
+         * keeping a copy of its own.  It may be used from several threads
+         * at once: factories may be registered while clients on other
+         * threads look them up, in which case a new factory is used for
+         * connections made after it was registered.
+         */
+        class ExtensionRegistry {
+            // Lifecycle management
+        public:
+            ~ExtensionRegistry() noexcept;
+            ExtensionRegistry(const ExtensionRegistry&) = delete;
+            ExtensionRegistry(ExtensionRegistry&&) noexcept;
+            ExtensionRegistry& operator=(const ExtensionRegistry&) = delete;
+            ExtensionRegistry& operator=(ExtensionRegistry&&) noexcept;
+
+            // Public methods
+        public:
+            /**
+             * This is the default constructor.
+             */
+            ExtensionRegistry();
+
+            /**
+             * Provide a factory used to make a new instance of an SMTP
+             * extension for each connection, made by a client using
+             * this registry, whose server supports it.
+             *
+             * @param[in] extensionName
+             *     This is the name used by the SMTP server to identify the
+             *     extension.  It's matched without regard to case.
+             *
+             * @param[in] extensionFactory
+             *     This is the function used to make instances of the
+             *     extension.
+             */
+            void Register(
+                const std::string& extensionName,
+                ExtensionFactory extensionFactory
+            );
+
+            /**
+             * Return the factory registered under the given name.
+             *
+             * @param[in] extensionName
+             *     This is the name of the extension, matched without
+             *     regard to case.
+             *
+             * @return
+             *     The factory registered under the given name is returned,
+             *     or nullptr is returned if there is no such factory.
+             */
+            ExtensionFactory Find(const std::string& extensionName) const;
+
+            // Private properties
+        private:
+            /**
+             * This is the type of structure that contains the private
+             * properties of the instance.  It is defined in the
+             * implementation and declared here to ensure that it is
+             * scoped inside the class.
+             */
+            struct Impl;
+
+            /**
+             * This contains the private properties of the instance.
+             */
+            std::shared_ptr< Impl > impl_;
+        };
+
+        /**
+         * These are the possible outcomes of sending an e-mail, as reported
+         * by SendMailForResult.
+         */
+        enum class SendResult {
+            /**
+             * The server accepted the e-mail.
+             */
+            Sent,
+
+            /**
+             * The e-mail was not sent, but trying again later may work,
+             * because the server rejected it only temporarily (4xx reply),
+             * the connection was lost, or the e-mail was cancelled.
+             */
+            TransientFailure,
+
+            /**
+             * The e-mail was not sent, and trying again won't help, because
+             * every rejection by the server was permanent (5xx reply), or
+             * the e-mail itself was not valid.
+             */
+            PermanentFailure,
+        };
+
+        /**
+         * This is the type of function called to report the outcome of an
+         * e-mail for one of its recipients.  It's called when the server
+         * rejects the recipient, and when the server gives its final
+         * reply about the e-mail for the recipient.
+         *
+         * @param[in] headers
+         *     These are the headers of the e-mail.
+         *
+         * @param[in] recipient
+         *     This is the e-mail address of the recipient.
+         *
+         * @param[in] reply
+         *     This is the server's reply for the recipient.
+         */
+        using RecipientOutcomeDelegate = std::function<
+            void(
+                const MessageHeaders::MessageHeaders& headers,
+                const std::string& recipient,
+                const ParsedMessage& reply
+            )
+        >;
+
         /**
          * This is the interface to the dependency of the class which
          * implements network connections the class needs to communicate with
@@ -280,6 +485,12 @@ namespace Smtp {
          * This method forms a new subscription to diagnostic
          * messages published by the class.
          *
+         * @note
+         *     The delegate is called while the client is handling network
+         *     traffic, so a slow delegate holds up the connection.  Wrap
+         *     it with an AsyncDiagnostics to have it called on a thread
+         *     of its own instead.
+         *
          * @param[in] delegate
          *     This is the function to call to deliver messages
          *     to the subscriber.
@@ -306,13 +517,66 @@ namespace Smtp {
          */
         void Configure(std::shared_ptr< Transport > transport);
 
+        /**
+         * Provide an object in which to record how well the SMTP servers
+         * to which the client connects are performing: how long they take
+         * to connect, greet, and give their final reply about each e-mail,
+         * and how often they reply with transient failures.
+         *
+         * @param[in] destinationHealth
+         *     This is the object in which to record server performance.
+         *     It may be shared between clients.
+         */
+        void SetDestinationHealth(std::shared_ptr< DestinationHealth > destinationHealth);
+
+        /**
+         * Provide an object to which to hand timed spans describing the
+         * phases of connecting to SMTP servers and sending each e-mail.
+         * Once this is set, each connection and each e-mail handed to
+         * SendMail gets its own trace identifier.
+         *
+         * @param[in] spanSink
+         *     This is the object to which to hand spans.
+         */
+        void SetSpanSink(std::shared_ptr< SpanSink > spanSink);
+
+        /**
+         * Select whether the client speaks the Local Mail Transfer Protocol
+         * (LMTP -- RFC 2033) rather than SMTP in subsequent connections.
+         * In LMTP mode, the client introduces itself with LHLO instead of
+         * EHLO, and expects one final reply about each e-mail for each of
+         * its recipients, rather than one for all of them.  The future
+         * returned by SendMail then reports success only if every
+         * recipient's final reply did; use SetRecipientOutcomeDelegate
+         * to learn the outcome for each recipient.
+         *
+         * @param[in] lmtpMode
+         *     This indicates whether or not the client speaks LMTP.
+         */
+        void SetLmtpMode(bool lmtpMode);
+
+        /**
+         * Provide a function to call to report the outcome of each e-mail
+         * for each of its recipients.
+         *
+         * @note
+         *     The function is called while the client is handling network
+         *     traffic, so it should return quickly, and must not call back
+         *     into the client.
+         *
+         * @param[in] recipientOutcomeDelegate
+         *     This is the function to call to report the outcome of each
+         *     e-mail for each of its recipients.
+         */
+        void SetRecipientOutcomeDelegate(RecipientOutcomeDelegate recipientOutcomeDelegate);
+
         /**
          * Provide the implementation of an SMTP extension to be used (if the
          * server supports it) in any subsequent connection.
          *
          * @param[in] extensionName
          *     This is the name used by the SMTP server to identify the
-         *     extension.
+         *     extension.  It's matched without regard to case.
          *
          * @param[in] extensionImplementation
          *     This is the object which implements the extension being
@@ -323,6 +587,49 @@ namespace Smtp {
             std::shared_ptr< Extension > extensionImplementation
         );
 
+        /**
+         * Provide a factory used to make a new instance of an SMTP extension
+         * for each subsequent connection whose server supports it.  Unlike
+         * an extension registered as an object, which is shared by every
+         * connection the client makes and reset at the start of each one,
+         * an instance made by the factory holds state for one connection
+         * only, and is not made at all if the server doesn't support the
+         * extension.  This lets many clients, such as those in a pool,
+         * share one set of factories without sharing extension state.
+         *
+         * @note
+         *     If an extension object is also registered under the same name,
+         *     the object is used, and the factory is ignored.  A factory
+         *     registered with the client itself is used instead of one in
+         *     the registry given to SetExtensionRegistry.
+         *
+         * @param[in] extensionName
+         *     This is the name used by the SMTP server to identify the
+         *     extension.  It's matched without regard to case.
+         *
+         * @param[in] extensionFactory
+         *     This is the function used to make instances of the extension.
+         */
+        void RegisterExtensionFactory(
+            const std::string& extensionName,
+            ExtensionFactory extensionFactory
+        );
+
+        /**
+         * Provide a registry of SMTP extension factories, shared with other
+         * clients, from which to make instances of any extensions supported
+         * by the server in subsequent connections, other than those
+         * registered with the client itself.  The client only refers to the
+         * registry, so many clients given the same registry share one set
+         * of factories, and registering an extension with one client
+         * doesn't change what the others use.
+         *
+         * @param[in] extensionRegistry
+         *     This is the registry of extension factories to use,
+         *     or nullptr if none is to be used.
+         */
+        void SetExtensionRegistry(std::shared_ptr< const ExtensionRegistry > extensionRegistry);
+
         /**
          * Asynchronously initiate a connection to an SMTP server.
          *
@@ -332,13 +639,19 @@ namespace Smtp {
          * @param[in] serverPortNumber
          *     This is the TCP port number of the SMTP server.
          *
+         * @param[in] cancellationToken
+         *     This may be cancelled to give up on the connection.  If the
+         *     client has not yet become ready to send e-mail, the
+         *     connection is closed.
+         *
          * @return
          *     A future is returned that is set when the connection
          *     process is completed.
          */
         std::future< bool > Connect(
             const std::string& serverHostName,
-            const uint16_t serverPortNumber
+            const uint16_t serverPortNumber,
+            CancellationToken cancellationToken = CancellationToken()
         );
 
         /**
@@ -355,21 +668,179 @@ namespace Smtp {
          *     method and wait for the returned future to be ready
          *     before attempting to call this method.
          *
+         * @note
+         *     If another e-mail is still being sent, this one is queued
+         *     and sent once the server has replied about the others.
+         *     If the server supports pipelining (RFC 2920), the envelope
+         *     of the next queued e-mail is sent along with the end of the
+         *     data of the e-mail before it.
+         *
          * @param[in] headers
          *     These are the headers to use for the message to send.
          *
          * @param[in] body
          *     This is the body of the message to send.
          *
+         * @param[in] cancellationToken
+         *     This may be cancelled to give up on the e-mail.  A queued
+         *     e-mail is dropped, an e-mail whose envelope was sent is
+         *     abandoned with RSET, and an e-mail whose data the server
+         *     is accepting causes the connection to be closed, since that
+         *     is the only way to stop it being delivered.  Cancelling has
+         *     no effect once the whole e-mail has been sent.
+         *
          * @return
          *     A future is returned that is set when the e-mail has
-         *     either been received or rejected by the server.  The value
-         *     relayed through the future indicates whether or not the
-         *     e-mail was received successfully.
+         *     either been received or rejected by the server, or
+         *     cancelled.  The value relayed through the future indicates
+         *     whether or not the e-mail was received successfully.
          */
         std::future< bool > SendMail(
             const MessageHeaders::MessageHeaders& headers,
-            const std::string& body
+            const std::string& body,
+            CancellationToken cancellationToken = CancellationToken()
+        );
+
+        /**
+         * Asynchronously initiate the sending of an e-mail through
+         * the SMTP server, taking ownership of the headers and body
+         * rather than copying them.  If the body needs no processing
+         * for transmission, it is kept as it is rather than rewritten.
+         * Like any body, it is still copied into the client's send
+         * buffer, a chunk at a time, as it is sent.
+         *
+         * @note
+         *     The same notes apply as for the other forms of this method.
+         *
+         * @param[in] headers
+         *     These are the headers to use for the message to send.
+         *
+         * @param[in] body
+         *     This is the body of the message to send.
+         *
+         * @param[in] cancellationToken
+         *     This may be cancelled to give up on the e-mail.
+         *
+         * @return
+         *     A future is returned that is set when the e-mail has
+         *     either been received or rejected by the server, or
+         *     cancelled.  The value relayed through the future indicates
+         *     whether or not the e-mail was received successfully.
+         */
+        std::future< bool > SendMail(
+            MessageHeaders::MessageHeaders&& headers,
+            std::string&& body,
+            CancellationToken cancellationToken = CancellationToken()
+        );
+
+        /**
+         * Asynchronously initiate the sending of an e-mail through
+         * the SMTP server, using a body which has already been processed
+         * for transmission, such as one held by a BodyStore.  The body
+         * is sent as it is, and shared rather than copied while the
+         * e-mail waits to be sent.  Like any body, it is still copied
+         * into the client's send buffer, a chunk at a time, as it is
+         * sent.
+         *
+         * @note
+         *     The same notes apply as for the other forms of this method.
+         *
+         * @param[in] headers
+         *     These are the headers to use for the message to send.
+         *
+         * @param[in] processedBody
+         *     This is the body of the message to send.  All of its lines
+         *     must end in CRLF and be "dot-stuffed".  This is checked
+         *     only in debug builds.
+         *
+         * @param[in] cancellationToken
+         *     This may be cancelled to give up on the e-mail.
+         *
+         * @return
+         *     A future is returned that is set when the e-mail has
+         *     either been received or rejected by the server, or
+         *     cancelled.  The value relayed through the future indicates
+         *     whether or not the e-mail was received successfully.
+         */
+        std::future< bool > SendMail(
+            const MessageHeaders::MessageHeaders& headers,
+            BodyStore::Body processedBody,
+            CancellationToken cancellationToken = CancellationToken()
+        );
+
+        /**
+         * Asynchronously initiate the sending of an e-mail through
+         * the SMTP server, using a body which has already been processed
+         * for transmission and is kept in a file, such as one returned
+         * by BodyStore::GetFile.  If the connection to the server is a
+         * FileSender, the body is sent straight from the file, without
+         * being read into memory.  Otherwise, it's read and sent a chunk
+         * at a time.
+         *
+         * @note
+         *     The same notes apply as for the other forms of this method,
+         *     except that cancelling the e-mail has no effect once the
+         *     connection has been handed the body's file to send.
+         *
+         * @note
+         *     The file must not be changed or removed until the e-mail
+         *     has either been received or rejected by the server,
+         *     or cancelled.
+         *
+         * @param[in] headers
+         *     These are the headers to use for the message to send.
+         *
+         * @param[in] processedBodyFile
+         *     This locates the file holding the body of the message
+         *     to send.  All of its lines must end in CRLF and be
+         *     "dot-stuffed".
+         *
+         * @param[in] cancellationToken
+         *     This may be cancelled to give up on the e-mail.
+         *
+         * @return
+         *     A future is returned that is set when the e-mail has
+         *     either been received or rejected by the server, or
+         *     cancelled.  The value relayed through the future indicates
+         *     whether or not the e-mail was received successfully.
+         */
+        std::future< bool > SendMail(
+            const MessageHeaders::MessageHeaders& headers,
+            const BodyStore::BodyFile& processedBodyFile,
+            CancellationToken cancellationToken = CancellationToken()
+        );
+
+        /**
+         * Asynchronously initiate the sending of an e-mail through the
+         * SMTP server, using a body which has already been processed for
+         * transmission, as for the SendMail form taking such a body, but
+         * reporting whether a failure is worth retrying, rather than only
+         * whether the e-mail was sent.
+         *
+         * @note
+         *     The same notes apply as for the other forms of SendMail.
+         *
+         * @param[in] headers
+         *     These are the headers to use for the message to send.
+         *
+         * @param[in] processedBody
+         *     This is the body of the message to send.  All of its lines
+         *     must end in CRLF and be "dot-stuffed".  This is checked
+         *     only in debug builds.
+         *
+         * @param[in] cancellationToken
+         *     This may be cancelled to give up on the e-mail.
+         *
+         * @return
+         *     A future is returned that is set when the e-mail has
+         *     either been received or rejected by the server, or
+         *     cancelled.  The value relayed through the future is the
+         *     outcome of sending the e-mail.
+         */
+        std::future< SendResult > SendMailForResult(
+            const MessageHeaders::MessageHeaders& headers,
+            BodyStore::Body processedBody,
+            CancellationToken cancellationToken = CancellationToken()
         );
 
         /**
@@ -385,6 +856,19 @@ namespace Smtp {
          */
         std::future< bool > GetReadyOrBrokenFuture();
 
+        /**
+         * Return an estimate of the memory held by the client, including
+         * its own state, its buffers, and any e-mails waiting to be sent.
+         * While the client is ready to send and has nothing to send, it
+         * gives back the buffers it used for earlier e-mails, so that
+         * this shrinks to a minimum.
+         *
+         * @return
+         *     An estimate of the number of bytes of memory held by the
+         *     client is returned.
+         */
+        size_t GetMemoryFootprint();
+
         // Private properties
     private:
         /**
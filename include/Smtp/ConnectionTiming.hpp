@@ -0,0 +1,41 @@
+#pragma once
+
+/**
+ * @file ConnectionTiming.hpp
+ *
+ * This module declares the Smtp::ConnectionTiming interface.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <chrono>
+
+namespace Smtp {
+
+    /**
+     * This is the interface to a network connection which can report when
+     * it was made, for connections which are handed over some time after
+     * being made, such as those Smtp::NetworkTransport makes while racing
+     * connection attempts, which are only handed over once the server has
+     * greeted the client over them.
+     *
+     * Smtp::Client uses it, where the connection to the server provides
+     * it, to tell the time taken to connect apart from the time the server
+     * took to greet the client.  Otherwise, the client takes the connection
+     * to have been made when the transport handed it over.
+     */
+    class ConnectionTiming {
+        // Methods
+    public:
+        virtual ~ConnectionTiming() noexcept = default;
+
+        /**
+         * Return the time at which the connection was made.
+         *
+         * @return
+         *     The time at which the connection was made is returned.
+         */
+        virtual std::chrono::steady_clock::time_point GetConnectedTime() const = 0;
+    };
+
+}
@@ -0,0 +1,373 @@
+#pragma once
+
+/**
+ * @file DestinationHealth.hpp
+ *
+ * This module declares the Smtp::DestinationHealth class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <chrono>
+#include <memory>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace Smtp {
+
+    /**
+     * This keeps rolling statistics about how well each SMTP server (host)
+     * has been performing, as reported by the clients talking to them, and
+     * scores the hosts so that the fastest ones can be preferred.
+     *
+     * It also acts as a circuit breaker for each host.  When a host keeps
+     * failing (refusing connections, not greeting, replying 421, or giving
+     * mostly transient failures), its circuit is opened, and the host is
+     * reported as unavailable for a while.  After that, a single trial is
+     * allowed through; if it succeeds the circuit closes, and if it fails
+     * the circuit opens again.
+     *
+     * Finally, it can tune how many connections to make in parallel to
+     * each host, for applications which keep a pool of clients per host.
+     * The limit for a host grows by one connection at the end of each
+     * evaluation period in which the pool was using every connection it
+     * was allowed and the rate of e-mails accepted by the host went up.
+     * The limit is cut by a factor as soon as the host replies 421,
+     * refuses a connection or greeting, or its average final reply
+     * latency rises well above the best seen for it.
+     */
+    class DestinationHealth {
+        // Types
+    public:
+        /**
+         * This holds the statistics kept for one host.  Times are
+         * exponentially-weighted moving averages, in seconds.
+         */
+        struct Statistics {
+            /**
+             * This is the average time taken to connect to the host.
+             */
+            double connectTime = 0.0;
+
+            /**
+             * This is the average time between connecting to the host
+             * and receiving its greeting.
+             */
+            double greetingDelay = 0.0;
+
+            /**
+             * This is the average time between finishing sending an e-mail
+             * to the host and receiving its final reply about it.
+             */
+            double finalReplyLatency = 0.0;
+
+            /**
+             * This is the moving average fraction of replies from the host
+             * which were transient failures (4xx).
+             */
+            double transientFailureRate = 0.0;
+
+            /**
+             * This is the number of connection attempts made to the host.
+             */
+            size_t connectAttempts = 0;
+
+            /**
+             * This is the number of replies received from the host while
+             * sending e-mail.
+             */
+            size_t replies = 0;
+
+            /**
+             * This is the number of failures in a row observed for the
+             * host.
+             */
+            size_t consecutiveFailures = 0;
+
+            /**
+             * This indicates whether or not the circuit for the host
+             * is currently open.
+             */
+            bool circuitOpen = false;
+
+            /**
+             * This is the number of connections currently allowed to be
+             * made in parallel to the host.
+             */
+            size_t concurrencyLimit = 0;
+
+            /**
+             * This is the number of connections to the host currently
+             * acquired through TryAcquireConnection and not yet released.
+             */
+            size_t activeConnections = 0;
+
+            /**
+             * This is the rate, in e-mails per second, at which the host
+             * accepted e-mail during the last complete evaluation period.
+             */
+            double throughput = 0.0;
+        };
+
+        // Lifecycle management
+    public:
+        ~DestinationHealth() noexcept;
+        DestinationHealth(const DestinationHealth&) = delete;
+        DestinationHealth(DestinationHealth&&) noexcept;
+        DestinationHealth& operator=(const DestinationHealth&) = delete;
+        DestinationHealth& operator=(DestinationHealth&&) noexcept;
+
+        // Public methods
+    public:
+        /**
+         * This is the default constructor.
+         */
+        DestinationHealth();
+
+        /**
+         * Set when the circuit for a host should be opened, and for how long.
+         *
+         * @param[in] failureThreshold
+         *     This is the number of failures in a row after which
+         *     to open the circuit.
+         *
+         * @param[in] transientFailureRateThreshold
+         *     This is the moving average fraction of transient failure
+         *     replies at or above which to open the circuit, once at least
+         *     failureThreshold replies have been received.
+         *
+         * @param[in] openTime
+         *     This is how long to keep the circuit open before allowing
+         *     a trial through, and how long to wait for the outcome of
+         *     a trial before allowing another one through.
+         */
+        void SetCircuitBreakerPolicy(
+            size_t failureThreshold,
+            double transientFailureRateThreshold,
+            std::chrono::milliseconds openTime
+        );
+
+        /**
+         * Set how the number of connections to make in parallel
+         * to each host is tuned.
+         *
+         * @param[in] minimumConnections
+         *     This is the fewest connections to allow to each host.
+         *     It's also the limit for hosts with no history.
+         *
+         * @param[in] maximumConnections
+         *     This is the most connections to allow to each host.
+         *
+         * @param[in] evaluationPeriod
+         *     This is how long to measure the rate of e-mails accepted by
+         *     a host before deciding whether or not to allow it another
+         *     connection.  It's also the shortest time between cuts.
+         *
+         * @param[in] backoffFactor
+         *     This is the factor by which to multiply the limit for a host
+         *     when it shows signs of being overloaded.
+         */
+        void SetConcurrencyPolicy(
+            size_t minimumConnections,
+            size_t maximumConnections,
+            std::chrono::milliseconds evaluationPeriod,
+            double backoffFactor
+        );
+
+        /**
+         * Return the number of connections currently allowed to be made
+         * in parallel to the given host.
+         *
+         * @param[in] host
+         *     This is the name of the host.
+         *
+         * @return
+         *     The number of connections currently allowed to be made
+         *     in parallel to the given host is returned.
+         */
+        size_t GetConcurrencyLimit(const std::string& host);
+
+        /**
+         * Claim one of the connections allowed to be made in parallel
+         * to the given host, if any are left.  A pool of clients should
+         * call this before connecting another client to the host, and
+         * call ReleaseConnection once that client has disconnected.
+         *
+         * @param[in] host
+         *     This is the name of the host.
+         *
+         * @return
+         *     An indication of whether or not a connection was claimed
+         *     is returned.
+         */
+        bool TryAcquireConnection(const std::string& host);
+
+        /**
+         * Give back a connection to the given host claimed through
+         * TryAcquireConnection.
+         *
+         * @param[in] host
+         *     This is the name of the host.
+         */
+        void ReleaseConnection(const std::string& host);
+
+        /**
+         * Record the outcome of an attempt to connect to the given host.
+         *
+         * @param[in] host
+         *     This is the name of the host.
+         *
+         * @param[in] duration
+         *     This is how long the attempt took.
+         *
+         * @param[in] success
+         *     This indicates whether or not the connection was made.
+         */
+        void RecordConnect(
+            const std::string& host,
+            std::chrono::steady_clock::duration duration,
+            bool success
+        );
+
+        /**
+         * Record the greeting received from the given host.
+         *
+         * @param[in] host
+         *     This is the name of the host.
+         *
+         * @param[in] delay
+         *     This is how long after connecting the greeting arrived.
+         *
+         * @param[in] code
+         *     This is the reply code of the greeting.
+         */
+        void RecordGreeting(
+            const std::string& host,
+            std::chrono::steady_clock::duration delay,
+            int code
+        );
+
+        /**
+         * Record a reply received from the given host to a command sent
+         * while sending an e-mail.
+         *
+         * @param[in] host
+         *     This is the name of the host.
+         *
+         * @param[in] code
+         *     This is the reply code.
+         */
+        void RecordReply(
+            const std::string& host,
+            int code
+        );
+
+        /**
+         * Record the final reply received from the given host about an
+         * e-mail sent to it.
+         *
+         * @param[in] host
+         *     This is the name of the host.
+         *
+         * @param[in] latency
+         *     This is how long after the e-mail was sent the reply arrived.
+         *
+         * @param[in] code
+         *     This is the reply code.
+         */
+        void RecordFinalReply(
+            const std::string& host,
+            std::chrono::steady_clock::duration latency,
+            int code
+        );
+
+        /**
+         * Return the statistics kept for the given host.
+         *
+         * @param[in] host
+         *     This is the name of the host.
+         *
+         * @return
+         *     The statistics kept for the given host are returned.
+         */
+        Statistics GetStatistics(const std::string& host);
+
+        /**
+         * Return the score of the given host, which is an estimate of how
+         * long it takes, in seconds, to deliver an e-mail through the host,
+         * inflated by its rate of transient failures.  Lower is better.
+         * Hosts with no statistics score zero, so that they get tried.
+         *
+         * @param[in] host
+         *     This is the name of the host.
+         *
+         * @return
+         *     The score of the given host is returned.
+         */
+        double GetScore(const std::string& host);
+
+        /**
+         * Determine whether or not the given host may be used.  If the
+         * circuit for the host is open, this is true only once the circuit
+         * has been open long enough and until the single trial allowed
+         * through is claimed by TryAcquireHost.  Nothing is changed, so
+         * hosts may be asked about freely, such as when ranking them.
+         *
+         * @param[in] host
+         *     This is the name of the host.
+         *
+         * @return
+         *     An indication of whether or not the given host may be used
+         *     is returned.
+         */
+        bool IsAvailable(const std::string& host);
+
+        /**
+         * Claim the given host for use, which should be done for the host
+         * actually picked, just before connecting to it.  If the circuit
+         * for the host is open and has been open long enough, this claims
+         * the single trial allowed through, so that no other caller gets
+         * the host until the outcome of the trial is recorded.  If the
+         * outcome isn't recorded within the open time, the trial is taken
+         * to have been abandoned, and another one is allowed through.
+         *
+         * @param[in] host
+         *     This is the name of the host.
+         *
+         * @return
+         *     An indication of whether or not the given host was claimed,
+         *     meaning it may be used, is returned.
+         */
+        bool TryAcquireHost(const std::string& host);
+
+        /**
+         * Return the given hosts which may be used, best first.  This
+         * doesn't claim any of them; call TryAcquireHost for the one
+         * picked.
+         *
+         * @param[in] hosts
+         *     These are the names of the hosts to rank.
+         *
+         * @return
+         *     The given hosts which may be used are returned,
+         *     in order of score, best first.
+         */
+        std::vector< std::string > RankHosts(const std::vector< std::string >& hosts);
+
+        // Private properties
+    private:
+        /**
+         * This is the type of structure that contains the private
+         * properties of the instance.  It is defined in the implementation
+         * and declared here to ensure that it is scoped inside the class.
+         */
+        struct Impl;
+
+        /**
+         * This contains the private properties of the instance.
+         */
+        std::shared_ptr< Impl > impl_;
+    };
+
+}
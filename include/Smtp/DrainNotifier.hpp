@@ -0,0 +1,56 @@
+#pragma once
+
+/**
+ * @file DrainNotifier.hpp
+ *
+ * This module declares the Smtp::DrainNotifier interface.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <functional>
+
+namespace Smtp {
+
+    /**
+     * This is the interface to a network connection which can report when
+     * everything queued to be sent on it has been sent.
+     *
+     * Smtp::Client uses it, where the connection to the server provides
+     * it, to send large e-mail bodies a chunk at a time, queueing each
+     * chunk only once the ones before it have been sent, so that an e-mail
+     * cancelled partway through its body stops being sent.  Otherwise, the
+     * client queues every chunk of the body at once.
+     */
+    class DrainNotifier {
+        // Types
+    public:
+        /**
+         * This is the type of function called once everything queued to
+         * be sent on a connection has been sent.
+         */
+        using DrainedDelegate = std::function< void() >;
+
+        // Methods
+    public:
+        virtual ~DrainNotifier() noexcept = default;
+
+        /**
+         * Arrange for the given function to be called once everything
+         * queued so far to be sent on the connection has been sent, or
+         * has been discarded because the connection failed.
+         *
+         * @param[in] onDrained
+         *     This is the function to call, possibly from another thread.
+         *     It may be called before this method returns, if nothing is
+         *     waiting to be sent.
+         *
+         * @return
+         *     An indication of whether or not the function will be called
+         *     is returned.  If not, the caller has no way of knowing when
+         *     the data queued has been sent.
+         */
+        virtual bool NotifyWhenDrained(DrainedDelegate onDrained) = 0;
+    };
+
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+/**
+ * @file FileSender.hpp
+ *
+ * This module declares the Smtp::FileSender interface.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <stdint.h>
+#include <string>
+
+namespace Smtp {
+
+    /**
+     * This is the interface to a network connection which can send the
+     * contents of a file straight from the file to the network, without
+     * the data passing through the memory of the process.
+     *
+     * Smtp::Client uses it, where the connection to the server provides
+     * it, to send e-mail bodies kept in files, such as those of a
+     * directory-backed Smtp::BodyStore.  Otherwise, the client reads
+     * such bodies in chunks and sends them as usual.
+     */
+    class FileSender {
+        // Methods
+    public:
+        virtual ~FileSender() noexcept = default;
+
+        /**
+         * Queue part of the given file to be sent, behind any messages
+         * already queued to be sent on the connection.
+         *
+         * @param[in] path
+         *     This is the path to the file to send.
+         *
+         * @param[in] offset
+         *     This is the position in the file of the first byte to send.
+         *
+         * @param[in] length
+         *     This is the number of bytes to send.
+         *
+         * @return
+         *     An indication of whether or not the file was queued to be
+         *     sent is returned.  If not, nothing was queued, and the
+         *     caller may send the data some other way.
+         */
+        virtual bool SendFile(
+            const std::string& path,
+            uint64_t offset,
+            uint64_t length
+        ) = 0;
+    };
+
+}
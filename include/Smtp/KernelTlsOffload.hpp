@@ -0,0 +1,139 @@
+#pragma once
+
+/**
+ * @file KernelTlsOffload.hpp
+ *
+ * This module declares the Smtp::KernelTlsOffload interface.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <stdint.h>
+#include <vector>
+
+namespace Smtp {
+
+    /**
+     * This is the interface to a network connection which can hand the
+     * encryption of a TLS session over to the operating system kernel
+     * (kernel TLS), once the session has been negotiated.
+     *
+     * A TLS layer over such a connection, which can export the keys of
+     * the session it negotiated, may call EnableKernelTls after the
+     * handshake.  From then on, it passes plaintext straight through to
+     * the connection, which the kernel encrypts into TLS records as it's
+     * sent.  The connection can then also keep sending files without
+     * reading them into memory (see FileSender), even over TLS.
+     *
+     * If kernel TLS is not available, EnableKernelTls returns false,
+     * and the TLS layer carries on encrypting in the process.
+     */
+    class KernelTlsOffload {
+        // Types
+    public:
+        /**
+         * These are the ciphers which may be handed to the kernel.
+         */
+        enum class Cipher {
+            /**
+             * This is AES in Galois/Counter Mode with a 128-bit key.
+             */
+            Aes128Gcm,
+
+            /**
+             * This is AES in Galois/Counter Mode with a 256-bit key.
+             */
+            Aes256Gcm,
+
+            /**
+             * This is ChaCha20 with the Poly1305 authenticator.
+             */
+            ChaCha20Poly1305,
+        };
+
+        /**
+         * This holds the state of one direction of a TLS session.
+         */
+        struct Keys {
+            /**
+             * This is the traffic key.
+             */
+            std::vector< uint8_t > key;
+
+            /**
+             * This is the 12-byte initialization vector.  For AES-GCM
+             * in TLS 1.2, it's the 4-byte implicit part ("salt")
+             * followed by the 8-byte explicit part used for the next
+             * record.
+             */
+            std::vector< uint8_t > iv;
+
+            /**
+             * This is the sequence number of the next record.
+             */
+            uint64_t sequenceNumber = 0;
+        };
+
+        /**
+         * This holds the negotiated state of a TLS session.
+         */
+        struct Session {
+            /**
+             * This is the protocol version, as it appears on the wire:
+             * 0x0303 for TLS 1.2, or 0x0304 for TLS 1.3.
+             */
+            uint16_t version = 0x0303;
+
+            /**
+             * This is the cipher negotiated for the session.
+             */
+            Cipher cipher = Cipher::Aes128Gcm;
+
+            /**
+             * This holds the state of the direction from this end
+             * to the peer.
+             */
+            Keys transmit;
+
+            /**
+             * This indicates whether or not the kernel should also
+             * decrypt the records received from the peer.
+             *
+             * @note
+             *     Once it does, a record which doesn't hold application
+             *     data, such as an alert or a TLS 1.3 session ticket,
+             *     breaks the connection.
+             */
+            bool offloadReceive = false;
+
+            /**
+             * This holds the state of the direction from the peer
+             * to this end, if offloadReceive is set.
+             */
+            Keys receive;
+        };
+
+        // Methods
+    public:
+        virtual ~KernelTlsOffload() noexcept = default;
+
+        /**
+         * Hand the encryption of the given TLS session over to the kernel.
+         *
+         * @note
+         *     This fails if messages given to the connection earlier,
+         *     which were encrypted in the process, are still waiting
+         *     to be sent.
+         *
+         * @param[in] session
+         *     This holds the negotiated state of the TLS session.
+         *
+         * @return
+         *     An indication of whether or not the kernel took over the
+         *     session is returned.  If not, nothing about the connection
+         *     has changed, and encryption must carry on in the process.
+         */
+        virtual bool EnableKernelTls(const Session& session) = 0;
+    };
+
+}
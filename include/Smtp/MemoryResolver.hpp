@@ -0,0 +1,102 @@
+#pragma once
+
+/**
+ * @file MemoryResolver.hpp
+ *
+ * This module declares the Smtp::MemoryResolver class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "Resolver.hpp"
+
+#include <chrono>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace Smtp {
+
+    /**
+     * This is a resolver which answers from a table held in memory, which
+     * may be filled in directly or loaded from a file in the format of the
+     * "hosts" file.  It stands in for the system resolver in tests, or
+     * wherever the addresses of mail servers are fixed.  Hosts not in the
+     * table are reported as not found.
+     */
+    class MemoryResolver
+        : public Resolver
+    {
+        // Lifecycle management
+    public:
+        ~MemoryResolver() noexcept;
+        MemoryResolver(const MemoryResolver&) = delete;
+        MemoryResolver(MemoryResolver&&) noexcept;
+        MemoryResolver& operator=(const MemoryResolver&) = delete;
+        MemoryResolver& operator=(MemoryResolver&&) noexcept;
+
+        // Public methods
+    public:
+        /**
+         * This is the default constructor.
+         */
+        MemoryResolver();
+
+        /**
+         * Set the answer to give when the given host is looked up.
+         *
+         * @param[in] hostName
+         *     This is the name of the host.
+         *
+         * @param[in] addresses
+         *     These are the IPv4 addresses of the host.  If empty,
+         *     the host will be reported as not found.
+         *
+         * @param[in] timeToLive
+         *     This is the time to live to report with the answer.
+         */
+        void SetAddresses(
+            const std::string& hostName,
+            const std::vector< uint32_t >& addresses,
+            std::chrono::milliseconds timeToLive = std::chrono::minutes(5)
+        );
+
+        /**
+         * Add to the table the hosts listed in the given file, which is in
+         * the format of the "hosts" file: one IPv4 address per line,
+         * followed by one or more names for the host at that address.
+         * Anything following a '#' is a comment.
+         *
+         * @param[in] path
+         *     This is the path to the file to load.
+         *
+         * @return
+         *     An indication of whether or not the file could be read
+         *     is returned.
+         */
+        bool LoadHostsFile(const std::string& path);
+
+        // Smtp::Resolver
+    public:
+        virtual void Resolve(
+            const std::string& hostNameOrAddress,
+            ResolutionDelegate onResolved
+        ) override;
+
+        // Private properties
+    private:
+        /**
+         * This is the type of structure that contains the private
+         * properties of the instance.  It is defined in the implementation
+         * and declared here to ensure that it is scoped inside the class.
+         */
+        struct Impl;
+
+        /**
+         * This contains the private properties of the instance.
+         */
+        std::shared_ptr< Impl > impl_;
+    };
+
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+/**
+ * @file NetworkTransport.hpp
+ *
+ * This module declares the Smtp::NetworkTransport class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "Client.hpp"
+#include "Resolver.hpp"
+#include "SourceAddressPool.hpp"
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <SystemAbstractions/INetworkConnection.hpp>
+
+namespace Smtp {
+
+    /**
+     * This is the default implementation of the transport dependency of
+     * Smtp::Client, which makes plain TCP connections to SMTP servers,
+     * looking up their addresses with a resolver.
+     *
+     * Unless configured otherwise, addresses are looked up by the operating
+     * system, and the answers cached, so that many connections made to the
+     * same server in a short time only cause one lookup.  Share one
+     * transport (or one resolver) between clients to share the cache.
+     * The resolver itself is asynchronous, but Connect, like the rest of
+     * the Smtp::Client::Transport interface, is not: it blocks the calling
+     * thread until the lookup is finished.  Smtp::Client always calls it
+     * from a thread of its own, so the user of the client is not held up,
+     * but that thread is tied up for the lookup.
+     *
+     * If a server has more than one address, connection attempts are
+     * raced ("Happy Eyeballs", RFC 8305): an attempt is started for each
+     * address in turn, a short delay apart, and the first connection over
+     * which the server completes a 220 greeting is used.  If the server
+     * refuses every connection with some other greeting, such as 421, the
+     * first such connection is used instead.  All other attempts are
+     * abandoned and their connections closed.  The greeting is left for
+     * the client to read, as it is over a connection made to a server
+     * with only one address, and the connection reports when it was made
+     * (see ConnectionTiming), so that the client can time the greeting.
+     * Each attempt runs on a thread of its own, the number of which is
+     * bounded, and which the transport waits for when it's destroyed.
+     *
+     * If configured with a pool of source addresses, each connection is
+     * made from a source address picked from the pool, and counted against
+     * that address and the server until the connection is closed.  When
+     * connection attempts are raced, each attempt picks a source address
+     * of its own, which is given back as soon as the attempt loses.
+     */
+    class NetworkTransport
+        : public Client::Transport
+    {
+        // Types
+    public:
+        /**
+         * This is the type of function used to make new, unconnected
+         * network connection objects.
+         */
+        using ConnectionFactory = std::function<
+            std::shared_ptr< SystemAbstractions::INetworkConnection >()
+        >;
+
+        /**
+         * This is the type of function used to make new, unconnected network
+         * connection objects which will connect from the given local
+         * (source) address.
+         *
+         * @param[in] sourceAddress
+         *     This is the IPv4 address to which to bind the connection.
+         */
+        using SourceConnectionFactory = std::function<
+            std::shared_ptr< SystemAbstractions::INetworkConnection >(
+                uint32_t sourceAddress
+            )
+        >;
+
+        // Lifecycle management
+    public:
+        ~NetworkTransport() noexcept;
+        NetworkTransport(const NetworkTransport&) = delete;
+        NetworkTransport(NetworkTransport&&) noexcept;
+        NetworkTransport& operator=(const NetworkTransport&) = delete;
+        NetworkTransport& operator=(NetworkTransport&&) noexcept;
+
+        // Public methods
+    public:
+        /**
+         * This is the default constructor.
+         */
+        NetworkTransport();
+
+        /**
+         * Provide the dependencies the class needs to operate.
+         *
+         * @param[in] resolver
+         *     This is the object used to look up the addresses of
+         *     SMTP servers.  If nullptr, no server can be found.
+         */
+        void Configure(std::shared_ptr< Resolver > resolver);
+
+        /**
+         * Set the function used to make new, unconnected network connection
+         * objects.  By default, SystemAbstractions::NetworkConnection
+         * objects are made.
+         *
+         * @param[in] connectionFactory
+         *     This is the function used to make new connection objects.
+         */
+        void SetConnectionFactory(ConnectionFactory connectionFactory);
+
+        /**
+         * Set the timing of connection attempts raced between the
+         * addresses of a server.
+         *
+         * @param[in] attemptDelay
+         *     This is how long to wait for one attempt to succeed before
+         *     starting the next one in parallel.
+         *
+         * @param[in] raceTimeout
+         *     This is how long to wait in total for any attempt to succeed.
+         */
+        void SetConnectionRaceTiming(
+            std::chrono::milliseconds attemptDelay,
+            std::chrono::milliseconds raceTimeout
+        );
+
+        /**
+         * Set the most connection attempts which may be in progress at
+         * once.  An attempt abandoned by a race which is already over
+         * keeps running until its connection is made or fails, since a
+         * connection still being made can't be cut short, so it still
+         * counts against this limit.  Races don't start attempts beyond
+         * the limit.  By default, up to 16 attempts may be in progress.
+         *
+         * @param[in] maxAttemptsInProgress
+         *     This is the most connection attempts which may be in
+         *     progress at once.
+         */
+        void SetMaxAttemptsInProgress(size_t maxAttemptsInProgress);
+
+        /**
+         * Make connections from source addresses picked from the given
+         * pool.  The client gives the server the address to which its
+         * connection is bound, in the EHLO command, so this is always the
+         * source address picked.
+         *
+         * @param[in] sourceAddressPool
+         *     This is the pool from which to pick source addresses,
+         *     or nullptr to stop using one.
+         *
+         * @param[in] sourceConnectionFactory
+         *     This is the function used to make connection objects bound
+         *     to the source addresses picked.
+         */
+        void SetSourceAddressPool(
+            std::shared_ptr< SourceAddressPool > sourceAddressPool,
+            SourceConnectionFactory sourceConnectionFactory
+        );
+
+        // Smtp::Client::Transport
+    public:
+        virtual std::shared_ptr< SystemAbstractions::INetworkConnection > Connect(
+            const std::string& hostNameOrAddress,
+            uint16_t port
+        ) override;
+
+        // Private properties
+    private:
+        /**
+         * This is the type of structure that contains the private
+         * properties of the instance.  It is defined in the implementation
+         * and declared here to ensure that it is scoped inside the class.
+         */
+        struct Impl;
+
+        /**
+         * This contains the private properties of the instance.
+         */
+        std::shared_ptr< Impl > impl_;
+    };
+
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+/**
+ * @file OutboundQueue.hpp
+ *
+ * This module declares the Smtp::OutboundQueue class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "Client.hpp"
+
+#include <future>
+#include <limits>
+#include <memory>
+#include <MessageHeaders/MessageHeaders.hpp>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace Smtp {
+
+    /**
+     * This holds e-mails waiting to be sent, indexed by destination (the
+     * SMTP server host, or the domain, through which they're to be sent),
+     * so that when a connection to a destination is ready, every e-mail
+     * bound for it can be sent back-to-back on that connection, instead
+     * of making a new connection for each e-mail taken in arrival order.
+     *
+     * Destinations are matched without regard to case.  E-mails bound for
+     * the same destination are always taken in the order they were added.
+     *
+     * E-mails handed to a client by SendPending are kept by the queue, but
+     * not taken again, until the client is done with them.  Any the client
+     * fails to send, for reasons which may pass (a temporary rejection by
+     * the server, or the connection being lost), are then put back in the
+     * queue, where they were before.  Any the server rejects permanently
+     * are dropped, with the failure reported to the caller of SendPending.
+     * This is noticed whenever the queue is next used.
+     */
+    class OutboundQueue {
+        // Types
+    public:
+        /**
+         * This holds one e-mail waiting to be sent.
+         */
+        struct Message {
+            /**
+             * This identifies the SMTP server host, or the domain, through
+             * which the e-mail is to be sent.
+             */
+            std::string destination;
+
+            /**
+             * These are the headers of the e-mail.
+             */
+            MessageHeaders::MessageHeaders headers;
+
+            /**
+             * This is the body of the e-mail, already processed for
+             * transmission, such as one held by a BodyStore.  It's shared
+             * rather than copied each time the e-mail is handed to a client.
+             */
+            BodyStore::Body body;
+        };
+
+        // Lifecycle management
+    public:
+        ~OutboundQueue() noexcept;
+        OutboundQueue(const OutboundQueue&) = delete;
+        OutboundQueue(OutboundQueue&&) noexcept;
+        OutboundQueue& operator=(const OutboundQueue&) = delete;
+        OutboundQueue& operator=(OutboundQueue&&) noexcept;
+
+        // Public methods
+    public:
+        /**
+         * This is the default constructor.
+         */
+        OutboundQueue();
+
+        /**
+         * Add the given e-mail to the end of the queue.
+         *
+         * @param[in] message
+         *     This is the e-mail to add.
+         */
+        void Add(Message&& message);
+
+        /**
+         * Return the number of e-mails in the queue waiting to be sent.
+         * This doesn't count e-mails handed to a client by SendPending,
+         * unless the client failed to send them.
+         *
+         * @return
+         *     The number of e-mails in the queue waiting to be sent
+         *     is returned.
+         */
+        size_t GetPendingCount();
+
+        /**
+         * Return the number of e-mails in the queue bound for
+         * the given destination.
+         *
+         * @param[in] destination
+         *     This identifies the destination of the e-mails to count.
+         *
+         * @return
+         *     The number of e-mails in the queue bound for the given
+         *     destination is returned.
+         */
+        size_t GetPendingCount(const std::string& destination);
+
+        /**
+         * Return the number of e-mails handed to clients by SendPending
+         * which the clients are not yet done with.
+         *
+         * @return
+         *     The number of e-mails handed to clients by SendPending
+         *     which the clients are not yet done with is returned.
+         */
+        size_t GetInFlightCount();
+
+        /**
+         * Return the destination of the e-mail which has been in the queue
+         * the longest.  This is where the next new connection should be
+         * made, if connections to every other destination are busy.
+         *
+         * @return
+         *     The destination of the e-mail which has been in the queue
+         *     the longest is returned, or an empty string is returned
+         *     if the queue is empty.
+         */
+        std::string GetOldestDestination();
+
+        /**
+         * Remove and return the e-mails in the queue bound for the given
+         * destination, in the order they were added.  The queue keeps
+         * nothing of them, so it's up to the caller to add back any which
+         * aren't sent.
+         *
+         * @param[in] destination
+         *     This identifies the destination of the e-mails to take.
+         *
+         * @param[in] maxMessages
+         *     This is the most e-mails to take.
+         *
+         * @return
+         *     The e-mails taken are returned.
+         */
+        std::vector< Message > Take(
+            const std::string& destination,
+            size_t maxMessages = std::numeric_limits< size_t >::max()
+        );
+
+        /**
+         * Take the e-mails in the queue bound for the given destination,
+         * and hand them all to the given client, which should be connected
+         * to that destination, to be sent back-to-back.  The e-mails are
+         * kept until the client is done with them.  Any the client fails
+         * to send are then put back in the queue, unless the server
+         * rejected them permanently, in which case they are dropped.
+         *
+         * @param[in,out] client
+         *     This is the client through which to send the e-mails.
+         *
+         * @param[in] destination
+         *     This identifies the destination of the e-mails to send.
+         *
+         * @param[in] maxMessages
+         *     This is the most e-mails to send.
+         *
+         * @return
+         *     For each e-mail handed to the client, in order, the future
+         *     returned by Client::SendMailForResult is returned, shared
+         *     with the queue.
+         */
+        std::vector< std::shared_future< Client::SendResult > > SendPending(
+            Client& client,
+            const std::string& destination,
+            size_t maxMessages = std::numeric_limits< size_t >::max()
+        );
+
+        // Private properties
+    private:
+        /**
+         * This is the type of structure that contains the private
+         * properties of the instance.  It is defined in the implementation
+         * and declared here to ensure that it is scoped inside the class.
+         */
+        struct Impl;
+
+        /**
+         * This contains the private properties of the instance.
+         */
+        std::shared_ptr< Impl > impl_;
+    };
+
+}
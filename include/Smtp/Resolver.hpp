@@ -0,0 +1,76 @@
+#pragma once
+
+/**
+ * @file Resolver.hpp
+ *
+ * This module declares the Smtp::Resolver interface.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <chrono>
+#include <functional>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace Smtp {
+
+    /**
+     * This is the interface to an object which looks up the network
+     * addresses of hosts by name, asynchronously.
+     */
+    class Resolver {
+        // Types
+    public:
+        /**
+         * This holds the outcome of looking up the addresses of a host.
+         */
+        struct Answer {
+            /**
+             * These are the IPv4 addresses of the host.  If empty, the host
+             * could not be found.
+             */
+            std::vector< uint32_t > addresses;
+
+            /**
+             * This is how long the answer may be reused before the host
+             * should be looked up again.  If zero, the answer should not
+             * be reused.
+             */
+            std::chrono::milliseconds timeToLive = std::chrono::milliseconds(0);
+        };
+
+        /**
+         * This is the type of function called to deliver the outcome of
+         * looking up the addresses of a host.
+         *
+         * @param[in] answer
+         *     This holds the outcome of the lookup.
+         */
+        using ResolutionDelegate = std::function<
+            void(const Answer& answer)
+        >;
+
+        // Methods
+    public:
+        virtual ~Resolver() noexcept = default;
+
+        /**
+         * Begin looking up the addresses of the given host.
+         *
+         * @param[in] hostNameOrAddress
+         *     This is the name or IPv4 address of the host to look up.
+         *
+         * @param[in] onResolved
+         *     This is the function to call, possibly from another thread,
+         *     once the lookup is complete.  It may be called before this
+         *     method returns, if the answer is already known.
+         */
+        virtual void Resolve(
+            const std::string& hostNameOrAddress,
+            ResolutionDelegate onResolved
+        ) = 0;
+    };
+
+}
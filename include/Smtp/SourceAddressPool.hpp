@@ -0,0 +1,163 @@
+#pragma once
+
+/**
+ * @file SourceAddressPool.hpp
+ *
+ * This module declares the Smtp::SourceAddressPool class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <chrono>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace Smtp {
+
+    /**
+     * This keeps a set of local (source) addresses from which to make
+     * connections to SMTP servers, and shares connections out between
+     * them.  Many providers limit how many connections, and how many
+     * connections in a given time, they accept from any one address, so
+     * the pool keeps count of both, for each pairing of source address and
+     * destination (server host), and picks the least busy source address
+     * which is still within the limits.
+     */
+    class SourceAddressPool {
+        // Types
+    public:
+        /**
+         * This holds the counts kept for one pairing of source address
+         * and destination.
+         */
+        struct Usage {
+            /**
+             * This is the number of connections currently open.
+             */
+            size_t activeConnections = 0;
+
+            /**
+             * This is the number of connections made within the current
+             * rate interval.
+             */
+            size_t recentConnections = 0;
+        };
+
+        // Lifecycle management
+    public:
+        ~SourceAddressPool() noexcept;
+        SourceAddressPool(const SourceAddressPool&) = delete;
+        SourceAddressPool(SourceAddressPool&&) noexcept;
+        SourceAddressPool& operator=(const SourceAddressPool&) = delete;
+        SourceAddressPool& operator=(SourceAddressPool&&) noexcept;
+
+        // Public methods
+    public:
+        /**
+         * This is the default constructor.
+         */
+        SourceAddressPool();
+
+        /**
+         * Set the local addresses from which connections may be made.
+         *
+         * @param[in] addresses
+         *     These are the IPv4 addresses from which connections
+         *     may be made, in order of preference.
+         */
+        void SetAddresses(const std::vector< uint32_t >& addresses);
+
+        /**
+         * Set the limits on connections made from any one source address
+         * to any one destination.  A limit of zero means no limit.
+         *
+         * @param[in] maxConnections
+         *     This is the most connections which may be open at once.
+         *
+         * @param[in] maxConnectionsPerInterval
+         *     This is the most connections which may be made within
+         *     any one rate interval.
+         *
+         * @param[in] rateInterval
+         *     This is the length of time over which connections made
+         *     are counted against maxConnectionsPerInterval.
+         */
+        void SetLimits(
+            size_t maxConnections,
+            size_t maxConnectionsPerInterval,
+            std::chrono::milliseconds rateInterval
+        );
+
+        /**
+         * Pick the source address from which to make a new connection to
+         * the given destination, and count the connection against it.
+         * The least busy source address within its limits is picked.
+         *
+         * @param[in] destination
+         *     This is the name or address of the server to which to connect.
+         *
+         * @param[out] sourceAddress
+         *     This is where to store the source address picked.
+         *
+         * @return
+         *     An indication of whether or not any source address is within
+         *     its limits for the destination is returned.
+         */
+        bool Acquire(
+            const std::string& destination,
+            uint32_t& sourceAddress
+        );
+
+        /**
+         * Record that a connection from the given source address to the
+         * given destination, previously acquired, has been closed.
+         *
+         * @param[in] sourceAddress
+         *     This is the source address of the connection.
+         *
+         * @param[in] destination
+         *     This is the name or address of the server of the connection.
+         */
+        void Release(
+            uint32_t sourceAddress,
+            const std::string& destination
+        );
+
+        /**
+         * Return the counts kept for the given source address
+         * and destination.
+         *
+         * @param[in] sourceAddress
+         *     This is the source address.
+         *
+         * @param[in] destination
+         *     This is the name or address of the server.
+         *
+         * @return
+         *     The counts kept for the given source address and
+         *     destination are returned.
+         */
+        Usage GetUsage(
+            uint32_t sourceAddress,
+            const std::string& destination
+        );
+
+        // Private properties
+    private:
+        /**
+         * This is the type of structure that contains the private
+         * properties of the instance.  It is defined in the implementation
+         * and declared here to ensure that it is scoped inside the class.
+         */
+        struct Impl;
+
+        /**
+         * This contains the private properties of the instance.
+         */
+        std::shared_ptr< Impl > impl_;
+    };
+
+}
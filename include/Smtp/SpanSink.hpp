@@ -0,0 +1,87 @@
+#pragma once
+
+/**
+ * @file SpanSink.hpp
+ *
+ * This module declares the Smtp::SpanSink interface.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <chrono>
+#include <map>
+#include <string>
+
+namespace Smtp {
+
+    /**
+     * This is the interface to an object which receives timed spans
+     * describing the phases of a client's work, so that they can be
+     * exported to a tracing system.
+     *
+     * Each connection, and each e-mail handed to SendMail, gets its own
+     * trace identifier.  The spans of a connection are "connect",
+     * "greeting" and "ehlo".  The spans of an e-mail are "envelope",
+     * "data" (from the DATA command until the end of the message data
+     * is written) and "final-reply".  Extension protocol stages are
+     * reported as "extension" spans, in the trace of the e-mail being
+     * sent at the time, if any, or else of the connection.  The spans of
+     * an e-mail carry the trace identifier of the connection over which
+     * it was sent, as their "connection" attribute, so that the two
+     * traces can be tied together.
+     */
+    class SpanSink {
+        // Types
+    public:
+        /**
+         * This describes one timed phase of a client's work.
+         */
+        struct Span {
+            /**
+             * This identifies the connection or e-mail to which the
+             * span belongs.
+             */
+            std::string traceId;
+
+            /**
+             * This is the name of the phase.
+             */
+            std::string name;
+
+            /**
+             * This is the time at which the phase started.
+             */
+            std::chrono::steady_clock::time_point start;
+
+            /**
+             * This is how long the phase lasted.
+             */
+            std::chrono::steady_clock::duration duration;
+
+            /**
+             * These are additional facts about the phase, such as
+             * "host", "peer" (the address of the server), "connection",
+             * "code", "size" and "recipients".
+             */
+            std::map< std::string, std::string > attributes;
+        };
+
+        // Methods
+    public:
+        virtual ~SpanSink() noexcept = default;
+
+        /**
+         * Receive the given span.
+         *
+         * @note
+         *     This is called while the client is handling network traffic,
+         *     so it should return quickly, and must not call back into
+         *     the client.
+         *
+         * @param[in] span
+         *     This is the span to receive.
+         */
+        virtual void RecordSpan(const Span& span) = 0;
+    };
+
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+/**
+ * @file SystemResolver.hpp
+ *
+ * This module declares the Smtp::SystemResolver class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "Resolver.hpp"
+
+#include <chrono>
+#include <memory>
+#include <stddef.h>
+#include <string>
+
+namespace Smtp {
+
+    /**
+     * This is the resolver which asks the operating system to look up the
+     * addresses of hosts.  Lookups run on a fixed set of worker threads
+     * owned by the resolver, so that the caller is never blocked while the
+     * operating system waits on the name service, and so that a burst of
+     * lookups can't start an unbounded number of threads.  Lookups beyond
+     * the number of worker threads wait their turn.
+     *
+     * @note
+     *     The operating system does not report how long its answers may be
+     *     reused, so a fixed time to live (configurable) is reported with
+     *     each answer.  Wrap this resolver in a CachingResolver to avoid
+     *     repeating identical lookups.
+     */
+    class SystemResolver
+        : public Resolver
+    {
+        // Lifecycle management
+    public:
+        ~SystemResolver() noexcept;
+        SystemResolver(const SystemResolver&) = delete;
+        SystemResolver(SystemResolver&&) noexcept;
+        SystemResolver& operator=(const SystemResolver&) = delete;
+        SystemResolver& operator=(SystemResolver&&) noexcept;
+
+        // Public methods
+    public:
+        /**
+         * This is the constructor.
+         *
+         * @param[in] lookupThreadCount
+         *     This is the number of worker threads on which to run lookups,
+         *     which is the most lookups which may be in progress at once.
+         *     At least one thread is always used.
+         */
+        explicit SystemResolver(size_t lookupThreadCount = 4);
+
+        /**
+         * Set the time to live to report with each answer.
+         *
+         * @param[in] timeToLive
+         *     This is the time to live to report with each answer.
+         */
+        void SetTimeToLive(std::chrono::milliseconds timeToLive);
+
+        // Smtp::Resolver
+    public:
+        virtual void Resolve(
+            const std::string& hostNameOrAddress,
+            ResolutionDelegate onResolved
+        ) override;
+
+        // Private properties
+    private:
+        /**
+         * This is the type of structure that contains the private
+         * properties of the instance.  It is defined in the implementation
+         * and declared here to ensure that it is scoped inside the class.
+         */
+        struct Impl;
+
+        /**
+         * This contains the private properties of the instance.
+         */
+        std::shared_ptr< Impl > impl_;
+    };
+
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+/**
+ * @file UringNetwork.hpp
+ *
+ * This module declares the Smtp::UringNetwork class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <SystemAbstractions/DiagnosticsSender.hpp>
+#include <SystemAbstractions/INetworkConnection.hpp>
+
+namespace Smtp {
+
+    /**
+     * This makes network connections whose input and output is all driven
+     * by a single thread through a Linux io_uring, rather than by a thread
+     * per connection.  The operations of all connections are submitted to
+     * the kernel together, in batches, so that many connections are served
+     * with few system calls.
+     *
+     * Data is received into buffers registered with the kernel up front,
+     * for as many connections as there are such buffers.  Large messages
+     * are sent without copying them into the kernel (zero-copy send),
+     * where the kernel supports it.  Its connections are also FileSender
+     * objects, which move files into their sockets with splice(2), so
+     * e-mail bodies kept in files never pass through the memory of the
+     * process, and DrainNotifier objects, which report when everything
+     * queued to be sent has been sent.
+     *
+     * To use it with Smtp::Client, give it to Smtp::NetworkTransport
+     * as the function used to make connection objects:
+     *
+     *     networkTransport->SetConnectionFactory(
+     *         [uringNetwork]{ return uringNetwork->MakeConnection(); }
+     *     );
+     *
+     * Connections made by it can also be bound to a given local address,
+     * as needed by Smtp::NetworkTransport::SetSourceAddressPool.
+     *
+     * On systems without io_uring, IsSupported returns false, and plain
+     * SystemAbstractions::NetworkConnection objects are made instead,
+     * which can't be bound to a given local address.
+     */
+    class UringNetwork {
+        // Types
+    public:
+        /**
+         * This holds counts of the work done by the network, which can be
+         * used to see how well operations are being batched.
+         */
+        struct Statistics {
+            /**
+             * This is the number of times the network thread has called
+             * into the kernel to submit operations or wait for them to
+             * complete.
+             */
+            size_t systemCalls = 0;
+
+            /**
+             * This is the number of operations submitted to the kernel.
+             */
+            size_t operations = 0;
+
+            /**
+             * This is the number of receive operations which used one
+             * of the registered buffers.
+             */
+            size_t registeredBufferReceives = 0;
+
+            /**
+             * This is the number of send operations done without copying
+             * the data into the kernel.
+             */
+            size_t zeroCopySends = 0;
+
+            /**
+             * This is the number of bytes of files sent straight from
+             * the files to the network.
+             */
+            size_t splicedBytes = 0;
+        };
+
+        // Lifecycle management
+    public:
+        ~UringNetwork() noexcept;
+        UringNetwork(const UringNetwork&) = delete;
+        UringNetwork(UringNetwork&&) noexcept;
+        UringNetwork& operator=(const UringNetwork&) = delete;
+        UringNetwork& operator=(UringNetwork&&) noexcept;
+
+        // Public methods
+    public:
+        /**
+         * This is the constructor.
+         *
+         * @param[in] receiveBufferCount
+         *     This is the number of receive buffers to register with the
+         *     kernel.  Connections beyond this number receive data into
+         *     buffers of their own.
+         *
+         * @param[in] receiveBufferSize
+         *     This is the size, in bytes, of each receive buffer.
+         */
+        explicit UringNetwork(
+            size_t receiveBufferCount = 64,
+            size_t receiveBufferSize = 16384
+        );
+
+        /**
+         * Determine whether or not the network is able to make connections.
+         *
+         * @return
+         *     An indication of whether or not the system supports io_uring,
+         *     and the network was set up successfully, is returned.
+         */
+        bool IsSupported() const;
+
+        /**
+         * Set the smallest message which is sent without copying it into
+         * the kernel, if the kernel supports it.  Zero-copy sends cost
+         * more to set up, so they only pay off for large messages.
+         *
+         * @param[in] zeroCopyThreshold
+         *     This is the size, in bytes, of the smallest message to send
+         *     without copying.
+         */
+        void SetZeroCopyThreshold(size_t zeroCopyThreshold);
+
+        /**
+         * Make a new, unconnected network connection object.
+         *
+         * @param[in] sourceAddress
+         *     This is the local IPv4 address to which to bind the
+         *     connection, or zero to let the system pick one.
+         *
+         * @return
+         *     The new connection object is returned.
+         */
+        std::shared_ptr< SystemAbstractions::INetworkConnection > MakeConnection(
+            uint32_t sourceAddress = 0
+        );
+
+        /**
+         * Form a new subscription to diagnostic messages published by the
+         * network itself, such as an error which stops it, breaking every
+         * connection.  Messages about one connection are published by the
+         * connection.
+         *
+         * @param[in] delegate
+         *     This is the function to call to deliver messages
+         *     to the subscriber.
+         *
+         * @param[in] minLevel
+         *     This is the minimum level of message that this subscriber
+         *     desires to receive.
+         *
+         * @return
+         *     A function is returned which may be called
+         *     to terminate the subscription.
+         */
+        SystemAbstractions::DiagnosticsSender::UnsubscribeDelegate SubscribeToDiagnostics(
+            SystemAbstractions::DiagnosticsSender::DiagnosticMessageDelegate delegate,
+            size_t minLevel = 0
+        );
+
+        /**
+         * Return counts of the work done by the network so far.
+         *
+         * @return
+         *     Counts of the work done by the network so far are returned.
+         */
+        Statistics GetStatistics() const;
+
+        // Private properties
+    private:
+        /**
+         * This is the type of structure that contains the private
+         * properties of the instance.  It is defined in the implementation
+         * and declared here to ensure that it is scoped inside the class.
+         */
+        struct Impl;
+
+        /**
+         * This contains the private properties of the instance.
+         */
+        std::shared_ptr< Impl > impl_;
+    };
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+/**
+ * @file WorkerPool.hpp
+ *
+ * This module declares the Smtp::WorkerPool class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <functional>
+#include <memory>
+#include <stddef.h>
+
+namespace Smtp {
+
+    /**
+     * This runs tasks on a fixed set of threads of its own.  SMTP
+     * extensions which need to wait on something slow (such as looking up
+     * a signing key or refreshing an access token) can use one to do the
+     * waiting, and deliver the results of their asynchronous hooks from
+     * there, so that the client's connection is never held up.
+     *
+     * Tasks are started in the order they're posted.  Tasks still waiting
+     * to start when the pool is destroyed are run before it finishes.
+     */
+    class WorkerPool {
+        // Lifecycle management
+    public:
+        ~WorkerPool() noexcept;
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool(WorkerPool&&) noexcept;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+        WorkerPool& operator=(WorkerPool&&) noexcept;
+
+        // Public methods
+    public:
+        /**
+         * This is the constructor.
+         *
+         * @param[in] workerCount
+         *     This is the number of threads on which to run tasks.
+         *     At least one thread is always used.
+         */
+        explicit WorkerPool(size_t workerCount = 1);
+
+        /**
+         * Queue the given task to be run on one of the pool's threads.
+         *
+         * @param[in] task
+         *     This is the task to run.
+         */
+        void Post(std::function< void() > task);
+
+        // Private properties
+    private:
+        /**
+         * This is the type of structure that contains the private
+         * properties of the instance.  It is defined in the implementation
+         * and declared here to ensure that it is scoped inside the class.
+         */
+        struct Impl;
+
+        /**
+         * This contains the private properties of the instance.
+         */
+        std::shared_ptr< Impl > impl_;
+    };
+
+}
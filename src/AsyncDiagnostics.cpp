@@ -0,0 +1,485 @@
+/**
+ * @file AsyncDiagnostics.cpp
+ *
+ * This module contains the implementation of the Smtp::AsyncDiagnostics
+ * class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <Smtp/AsyncDiagnostics.hpp>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <StringExtensions/StringExtensions.hpp>
+#include <SystemAbstractions/DiagnosticsSender.hpp>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    /**
+     * This holds one delegate given to Wrap.
+     */
+    struct Subscriber {
+        /**
+         * This is the function to which to deliver messages.
+         */
+        SystemAbstractions::DiagnosticsSender::DiagnosticMessageDelegate delegate;
+
+        /**
+         * This is set once the delegate has been released by Unwrap,
+         * after which no more messages are delivered to it.
+         */
+        std::atomic< bool > released{false};
+    };
+
+    /**
+     * This holds one message in the ring buffer.
+     */
+    struct Slot {
+        /**
+         * This tells producers and the consumer whose turn it is to use
+         * the slot.  A slot at ring position P is free for the producer
+         * of message P when this is P, and holds message P, ready for the
+         * consumer, when this is P + 1.
+         */
+        std::atomic< size_t > sequence{0};
+
+        /**
+         * This holds the function to which to deliver the message.
+         */
+        std::shared_ptr< Subscriber > subscriber;
+
+        /**
+         * This is the name of the sender of the message.
+         */
+        std::string senderName;
+
+        /**
+         * This is the level of the message.
+         */
+        size_t level = 0;
+
+        /**
+         * This is the message.
+         */
+        std::string message;
+    };
+
+}
+
+namespace Smtp {
+
+    /**
+     * This contains the private properties of an AsyncDiagnostics instance.
+     */
+    struct AsyncDiagnostics::Impl {
+        // Types
+
+        /**
+         * This is the type of function object made by Wrap, which queues
+         * the messages given to it for one subscriber.
+         */
+        struct WrappedDelegate {
+            /**
+             * This is the object which delivers the queued messages.
+             */
+            std::weak_ptr< Impl > implWeak;
+
+            /**
+             * This holds the function to which to deliver the messages.
+             */
+            std::shared_ptr< Subscriber > subscriber;
+
+            /**
+             * Queue the given message for the subscriber, unless it has
+             * been released, or the object which delivers the messages
+             * is gone.
+             *
+             * @param[in] senderName
+             *     This is the name of the sender of the message.
+             *
+             * @param[in] level
+             *     This is the level of the message.
+             *
+             * @param[in] message
+             *     This is the message.
+             */
+            void operator()(
+                std::string senderName,
+                size_t level,
+                std::string message
+            ) const {
+                if (subscriber->released) {
+                    return;
+                }
+                const auto impl = implWeak.lock();
+                if (impl == nullptr) {
+                    return;
+                }
+                impl->Enqueue(
+                    subscriber,
+                    std::move(senderName),
+                    level,
+                    std::move(message)
+                );
+            }
+        };
+
+        // Properties
+
+        /**
+         * This is the ring buffer.
+         */
+        std::unique_ptr< Slot[] > slots;
+
+        /**
+         * This is the number of slots in the ring buffer, minus one.
+         * The number of slots is a power of two.
+         */
+        size_t mask = 0;
+
+        /**
+         * This is the ring position at which to queue the next message.
+         */
+        std::atomic< size_t > enqueuePosition{0};
+
+        /**
+         * This is the ring position of the next message to deliver.
+         * It's only used by the logger thread.
+         */
+        size_t dequeuePosition = 0;
+
+        /**
+         * This is the number of messages dropped because the ring buffer
+         * was full.
+         */
+        std::atomic< size_t > dropped{0};
+
+        /**
+         * This is the number of dropped messages subscribers have been
+         * told about.  It's only used by the logger thread.
+         */
+        size_t droppedReported = 0;
+
+        /**
+         * This is set while the logger thread is waiting for messages,
+         * so that senders know to wake it up.  It's only changed while
+         * the mutex is held.
+         */
+        std::atomic< bool > loggerWaiting{false};
+
+        /**
+         * This is used to protect the properties below, which aren't
+         * used by senders.
+         */
+        std::mutex mutex;
+
+        /**
+         * This is used to wake up the logger thread, or threads waiting
+         * for messages to be delivered.
+         */
+        std::condition_variable condition;
+
+        /**
+         * These refer to the delegates given to Wrap, so that they can be
+         * told about dropped messages.  Each is kept alive only by the
+         * delegate Wrap made for it and any messages queued for it.
+         */
+        std::vector< std::weak_ptr< Subscriber > > subscribers;
+
+        /**
+         * This is held by the logger thread while it delivers a message,
+         * so that Unwrap can wait for any delivery in progress to the
+         * delegate it releases.  It's recursive so that a delegate may
+         * release itself.
+         */
+        std::recursive_mutex deliveryMutex;
+
+        /**
+         * This is the ring position of the next message to deliver, as of
+         * the last time the logger thread finished delivering messages
+         * and reporting drops.
+         */
+        size_t deliveredPosition = 0;
+
+        /**
+         * This is set when the logger thread should stop.
+         */
+        bool stopping = false;
+
+        /**
+         * This is the thread which delivers messages.
+         */
+        std::thread thread;
+
+        // Methods
+
+        /**
+         * Queue the given message, unless the ring buffer is full.
+         *
+         * @param[in] subscriber
+         *     This holds the function to which to deliver the message.
+         *
+         * @param[in] senderName
+         *     This is the name of the sender of the message.
+         *
+         * @param[in] level
+         *     This is the level of the message.
+         *
+         * @param[in] message
+         *     This is the message.
+         */
+        void Enqueue(
+            const std::shared_ptr< Subscriber >& subscriber,
+            std::string&& senderName,
+            size_t level,
+            std::string&& message
+        ) {
+            auto position = enqueuePosition.load(std::memory_order_relaxed);
+            for (;;) {
+                auto& slot = slots[position & mask];
+                const auto sequence = slot.sequence.load(std::memory_order_acquire);
+                const auto difference = (intptr_t)sequence - (intptr_t)position;
+                if (difference == 0) {
+                    if (
+                        enqueuePosition.compare_exchange_weak(
+                            position,
+                            position + 1,
+                            std::memory_order_relaxed
+                        )
+                    ) {
+                        slot.subscriber = subscriber;
+                        slot.senderName = std::move(senderName);
+                        slot.level = level;
+                        slot.message = std::move(message);
+                        slot.sequence.store(position + 1, std::memory_order_release);
+                        break;
+                    }
+                } else if (difference < 0) {
+                    ++dropped;
+                    return;
+                } else {
+                    position = enqueuePosition.load(std::memory_order_relaxed);
+                }
+            }
+
+            // The fence pairs with the one in Run, so that either the
+            // logger thread sees this message before it waits, or this
+            // sees that it's waiting.  Taking the mutex before waking it
+            // makes sure it's really waiting, rather than just about to,
+            // and so can't miss the wake-up.  Senders only take the mutex
+            // when the logger thread is idle.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (loggerWaiting.load(std::memory_order_relaxed)) {
+                {
+                    std::lock_guard< decltype(mutex) > lock(mutex);
+                }
+                condition.notify_all();
+            }
+        }
+
+        /**
+         * Deliver the next message in the ring buffer, if any.
+         * This is only called by the logger thread.
+         *
+         * @return
+         *     An indication of whether or not a message was delivered
+         *     is returned.
+         */
+        bool Dequeue() {
+            const auto position = dequeuePosition;
+            auto& slot = slots[position & mask];
+            if (slot.sequence.load(std::memory_order_acquire) != position + 1) {
+                return false;
+            }
+            std::shared_ptr< Subscriber > subscriber;
+            subscriber.swap(slot.subscriber);
+            std::string senderName;
+            std::string message;
+            senderName.swap(slot.senderName);
+            message.swap(slot.message);
+            const auto level = slot.level;
+            slot.sequence.store(position + mask + 1, std::memory_order_release);
+            dequeuePosition = position + 1;
+            std::lock_guard< decltype(deliveryMutex) > lock(deliveryMutex);
+            if (!subscriber->released) {
+                subscriber->delegate(std::move(senderName), level, std::move(message));
+            }
+            return true;
+        }
+
+        /**
+         * Tell every subscriber not yet released about any messages
+         * dropped since they were last told.  This is only called by the
+         * logger thread.
+         */
+        void ReportDropped() {
+            const auto droppedNow = dropped.load();
+            if (droppedNow == droppedReported) {
+                return;
+            }
+            const auto message = StringExtensions::sprintf(
+                "%zu diagnostic messages dropped",
+                droppedNow - droppedReported
+            );
+            droppedReported = droppedNow;
+            std::vector< std::shared_ptr< Subscriber > > subscribers;
+            {
+                std::lock_guard< decltype(mutex) > lock(mutex);
+                PruneSubscribers();
+                for (const auto& subscriberWeak: this->subscribers) {
+                    const auto subscriber = subscriberWeak.lock();
+                    if (subscriber != nullptr) {
+                        subscribers.push_back(subscriber);
+                    }
+                }
+            }
+            for (const auto& subscriber: subscribers) {
+                std::lock_guard< decltype(deliveryMutex) > lock(deliveryMutex);
+                if (subscriber->released) {
+                    continue;
+                }
+                subscriber->delegate(
+                    "Smtp::AsyncDiagnostics",
+                    SystemAbstractions::DiagnosticsSender::Levels::WARNING,
+                    message
+                );
+            }
+        }
+
+        /**
+         * Forget any subscribers which are gone or have been released.
+         * The mutex must be held when this is called.
+         */
+        void PruneSubscribers() {
+            subscribers.erase(
+                std::remove_if(
+                    subscribers.begin(),
+                    subscribers.end(),
+                    [](const std::weak_ptr< Subscriber >& subscriberWeak){
+                        const auto subscriber = subscriberWeak.lock();
+                        return (
+                            (subscriber == nullptr)
+                            || subscriber->released
+                        );
+                    }
+                ),
+                subscribers.end()
+            );
+        }
+
+        /**
+         * This is the body of the logger thread.
+         */
+        void Run() {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            for (;;) {
+                lock.unlock();
+                while (Dequeue()) {
+                }
+                ReportDropped();
+                lock.lock();
+                deliveredPosition = dequeuePosition;
+                condition.notify_all();
+                if (stopping) {
+                    break;
+                }
+                loggerWaiting.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (slots[dequeuePosition & mask].sequence.load(std::memory_order_acquire) != dequeuePosition + 1) {
+                    condition.wait(lock);
+                }
+                loggerWaiting.store(false, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    AsyncDiagnostics::~AsyncDiagnostics() noexcept {
+        if (impl_ == nullptr) {
+            return;
+        }
+        {
+            std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+            impl_->stopping = true;
+        }
+        impl_->condition.notify_all();
+        impl_->thread.join();
+    }
+    AsyncDiagnostics::AsyncDiagnostics(AsyncDiagnostics&& other) noexcept = default;
+    AsyncDiagnostics& AsyncDiagnostics::operator=(AsyncDiagnostics&& other) noexcept = default;
+
+    AsyncDiagnostics::AsyncDiagnostics(size_t capacity)
+        : impl_(new Impl)
+    {
+        size_t slotCount = 1;
+        while (slotCount < capacity) {
+            slotCount <<= 1;
+        }
+        impl_->slots.reset(new Slot[slotCount]);
+        for (size_t i = 0; i < slotCount; ++i) {
+            impl_->slots[i].sequence = i;
+        }
+        impl_->mask = slotCount - 1;
+        const auto impl = impl_.get();
+        impl_->thread = std::thread(
+            [impl]{
+                impl->Run();
+            }
+        );
+    }
+
+    auto AsyncDiagnostics::Wrap(
+        SystemAbstractions::DiagnosticsSender::DiagnosticMessageDelegate delegate
+    ) -> SystemAbstractions::DiagnosticsSender::DiagnosticMessageDelegate {
+        Impl::WrappedDelegate wrappedDelegate;
+        wrappedDelegate.implWeak = impl_;
+        wrappedDelegate.subscriber = std::make_shared< Subscriber >();
+        wrappedDelegate.subscriber->delegate = delegate;
+        {
+            std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+            impl_->PruneSubscribers();
+            impl_->subscribers.push_back(wrappedDelegate.subscriber);
+        }
+        return wrappedDelegate;
+    }
+
+    void AsyncDiagnostics::Unwrap(
+        const SystemAbstractions::DiagnosticsSender::DiagnosticMessageDelegate& wrappedDelegate
+    ) {
+        const auto wrappedDelegateTarget = wrappedDelegate.target< Impl::WrappedDelegate >();
+        if (wrappedDelegateTarget == nullptr) {
+            return;
+        }
+        wrappedDelegateTarget->subscriber->released = true;
+
+        // Wait for any delivery in progress to the delegate to finish.
+        std::lock_guard< decltype(impl_->deliveryMutex) > lock(impl_->deliveryMutex);
+    }
+
+    void AsyncDiagnostics::Flush() {
+        if (std::this_thread::get_id() == impl_->thread.get_id()) {
+            return;
+        }
+        const auto target = impl_->enqueuePosition.load();
+        std::unique_lock< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->condition.notify_all();
+        impl_->condition.wait(
+            lock,
+            [this, target]{
+                return (impl_->deliveredPosition >= target);
+            }
+        );
+    }
+
+    size_t AsyncDiagnostics::GetDroppedCount() const {
+        return impl_->dropped;
+    }
+
+}
@@ -0,0 +1,159 @@
+/**
+ * @file BodyProcessing.cpp
+ *
+ * This module contains the implementation of functions used inside the
+ * Smtp library to prepare e-mail bodies for transmission.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "BodyProcessing.hpp"
+
+#include <stddef.h>
+#include <string.h>
+#include <string>
+#include <utility>
+
+namespace {
+
+    /**
+     * Count the occurrences of the given character in the given data.
+     *
+     * @param[in] data
+     *     This points to the data to search.
+     *
+     * @param[in] length
+     *     This is the number of bytes of data to search.
+     *
+     * @param[in] c
+     *     This is the character to count.
+     *
+     * @return
+     *     The number of occurrences of the given character is returned.
+     */
+    size_t Count(
+        const char* data,
+        size_t length,
+        char c
+    ) {
+        size_t count = 0;
+        const auto end = data + length;
+        for (;;) {
+            const auto next = (const char*)memchr(data, c, end - data);
+            if (next == nullptr) {
+                return count;
+            }
+            ++count;
+            data = next + 1;
+        }
+    }
+
+    /**
+     * Check that every line of the given e-mail body ends in CRLF, that
+     * there are no other carriage returns or line feeds, and that lines
+     * begin with '.' only where allowed.
+     *
+     * @param[in] body
+     *     This is the e-mail body to check.
+     *
+     * @param[in] dotStuffed
+     *     If true, lines may begin with '.' as long as they begin with
+     *     "..", as every line beginning with '.' does once "dot-stuffed".
+     *     Otherwise, no line may begin with '.'.
+     *
+     * @return
+     *     An indication of whether or not the given e-mail body passed
+     *     the check is returned.
+     */
+    bool CheckLines(
+        const std::string& body,
+        bool dotStuffed
+    ) {
+        // The scans below use memchr, which the C library vectorizes,
+        // rather than examining the body one byte at a time.
+        const auto length = body.length();
+        if (length == 0) {
+            return true;
+        }
+        const auto data = body.data();
+        const auto end = data + length;
+        if (
+            (length < 2)
+            || (data[length - 2] != '\r')
+            || (data[length - 1] != '\n')
+        ) {
+            return false;
+        }
+        size_t lineFeeds = 0;
+        for (auto lineStart = data; lineStart < end;) {
+            if (
+                (*lineStart == '.')
+                && (
+                    !dotStuffed
+                    || (lineStart[1] != '.')
+                )
+            ) {
+                return false;
+            }
+            const auto lineFeed = (const char*)memchr(lineStart, '\n', end - lineStart);
+            if (
+                (lineFeed == lineStart)
+                || (lineFeed[-1] != '\r')
+            ) {
+                return false;
+            }
+            ++lineFeeds;
+            lineStart = lineFeed + 1;
+        }
+        return (Count(data, length, '\r') == lineFeeds);
+    }
+
+}
+
+namespace Smtp {
+
+    bool IsCanonicalBody(const std::string& body) {
+        return CheckLines(body, false);
+    }
+
+    bool IsProcessedBody(const std::string& body) {
+        return CheckLines(body, true);
+    }
+
+    std::string ProcessBody(const std::string& body) {
+        if (IsCanonicalBody(body)) {
+            return body;
+        }
+        std::string output;
+        const auto length = body.length();
+        output.reserve(length + length / 32 + 2);
+        bool first = true;
+        for (size_t i = 0; i < length; ++i) {
+            const auto next = body[i];
+            if (next == '\n') {
+                output += "\r\n";
+                first = true;
+            } else if (next != '\r') {
+                if (first) {
+                    first = false;
+                    if (next == '.') {
+                        output += '.';
+                    }
+                }
+                output += next;
+            }
+        }
+        if (!first) {
+            output += "\r\n";
+        }
+        return output;
+    }
+
+    std::string ProcessBody(std::string&& body) {
+        if (IsCanonicalBody(body)) {
+            return std::move(body);
+        }
+        return ProcessBody(static_cast< const std::string& >(body));
+    }
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+/**
+ * @file BodyProcessing.hpp
+ *
+ * This module declares functions used inside the Smtp library to prepare
+ * e-mail bodies for transmission.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <string>
+
+namespace Smtp {
+
+    /**
+     * Determine whether or not the given e-mail body is already in the
+     * form in which it's sent to the server: every line ends in CRLF,
+     * there are no other carriage returns or line feeds, and no line
+     * begins with '.'.
+     *
+     * @param[in] body
+     *     This is the e-mail body to check.
+     *
+     * @return
+     *     An indication of whether or not the given e-mail body is
+     *     already in the form in which it's sent is returned.
+     */
+    bool IsCanonicalBody(const std::string& body);
+
+    /**
+     * Determine whether or not the given e-mail body is in the form
+     * returned by ProcessBody, and so can be sent to the server as it is:
+     * every line ends in CRLF, there are no other carriage returns or
+     * line feeds, and every line beginning with '.' begins with "..", as
+     * it does once "dot-stuffed".  A line beginning with more than one
+     * '.' can't be told apart from one left unstuffed, so such lines
+     * are taken to have been stuffed.
+     *
+     * @param[in] body
+     *     This is the e-mail body to check.
+     *
+     * @return
+     *     An indication of whether or not the given e-mail body is safe
+     *     to send as it is is returned.
+     */
+    bool IsProcessedBody(const std::string& body);
+
+    /**
+     * Normalize all line endings of the given e-mail body to be CRLF and
+     * perform "dot-stuffing" (extra '.' added at the beginning of a line if
+     * that line started with '.', as described in RFC 5321 section 4.5.2).
+     *
+     * @param[in] body
+     *     This is the e-mail body to process.
+     *
+     * @return
+     *     The processed version of the given e-mail body is returned.
+     *     This is always a new string, even if the body needed no changes.
+     */
+    std::string ProcessBody(const std::string& body);
+
+    /**
+     * Normalize all line endings of the given e-mail body to be CRLF and
+     * perform "dot-stuffing", taking ownership of the body so that it
+     * can be returned without a copy if it needs no changes.
+     *
+     * @param[in] body
+     *     This is the e-mail body to process.
+     *
+     * @return
+     *     The processed version of the given e-mail body is returned.
+     */
+    std::string ProcessBody(std::string&& body);
+
+}
@@ -0,0 +1,616 @@
+/**
+ * @file BodyStore.cpp
+ *
+ * This module contains the implementation of the Smtp::BodyStore class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "BodyProcessing.hpp"
+
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <Smtp/BodyStore.hpp>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <StringExtensions/StringExtensions.hpp>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else /* not _WIN32 */
+#include <fcntl.h>
+#include <unistd.h>
+#endif /* _WIN32 / not _WIN32 */
+
+namespace {
+
+    /**
+     * Compute the 64-bit FNV-1a hash of the given data.
+     *
+     * @param[in] data
+     *     This is the data to hash.
+     *
+     * @return
+     *     The hash of the given data is returned.
+     */
+    uint64_t Hash(const std::string& data) {
+        uint64_t hash = 0xcbf29ce484222325;
+        for (const auto next: data) {
+            hash ^= (uint8_t)next;
+            hash *= 0x100000001b3;
+        }
+        return hash;
+    }
+
+    /**
+     * Write the given contents to a new file at the given path, and wait
+     * for them to reach the disk.
+     *
+     * @param[in] path
+     *     This is the path to the file to write.
+     *
+     * @param[in] contents
+     *     These are the contents to write to the file.
+     *
+     * @return
+     *     An indication of whether or not the file was written
+     *     is returned.
+     */
+    bool WriteAndSync(
+        const std::string& path,
+        const std::string& contents
+    ) {
+#ifdef _WIN32
+        const auto file = CreateFileA(
+            path.c_str(),
+            GENERIC_WRITE,
+            0,
+            NULL,
+            CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL,
+            NULL
+        );
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        DWORD amountWritten = 0;
+        const auto written = (
+            (WriteFile(file, contents.data(), (DWORD)contents.length(), &amountWritten, NULL) != 0)
+            && (amountWritten == (DWORD)contents.length())
+            && (FlushFileBuffers(file) != 0)
+        );
+        (void)CloseHandle(file);
+        return written;
+#else /* not _WIN32 */
+        const auto file = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (file < 0) {
+            return false;
+        }
+        size_t offset = 0;
+        while (offset < contents.length()) {
+            const auto amountWritten = write(
+                file,
+                contents.data() + offset,
+                contents.length() - offset
+            );
+            if (amountWritten <= 0) {
+                break;
+            }
+            offset += (size_t)amountWritten;
+        }
+        const auto written = (
+            (offset == contents.length())
+            && (fsync(file) == 0)
+        );
+        (void)close(file);
+        return written;
+#endif /* _WIN32 / not _WIN32 */
+    }
+
+    /**
+     * Wait for the entries of the directory at the given path, such as
+     * files just moved into it, to reach the disk.
+     *
+     * @param[in] path
+     *     This is the path to the directory.
+     *
+     * @return
+     *     An indication of whether or not the directory was synchronized
+     *     is returned.
+     */
+    bool SyncDirectory(const std::string& path) {
+#ifdef _WIN32
+        // Moves are made with MOVEFILE_WRITE_THROUGH, which does not
+        // return until the move has reached the disk.
+        return true;
+#else /* not _WIN32 */
+        const auto directory = open(path.c_str(), O_RDONLY);
+        if (directory < 0) {
+            return false;
+        }
+        const auto synced = (fsync(directory) == 0);
+        (void)close(directory);
+        return synced;
+#endif /* _WIN32 / not _WIN32 */
+    }
+
+    /**
+     * Move the file at the given path to the other given path, replacing
+     * any file already there, in one step, so that anyone opening the
+     * destination finds either the old file or the new one, whole.
+     *
+     * @param[in] from
+     *     This is the path to the file to move.
+     *
+     * @param[in] to
+     *     This is the path to which to move the file.
+     *
+     * @return
+     *     An indication of whether or not the file was moved is returned.
+     */
+    bool MoveIntoPlace(
+        const std::string& from,
+        const std::string& to
+    ) {
+#ifdef _WIN32
+        return (
+            MoveFileExA(
+                from.c_str(),
+                to.c_str(),
+                MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH
+            ) != 0
+        );
+#else /* not _WIN32 */
+        return (rename(from.c_str(), to.c_str()) == 0);
+#endif /* _WIN32 / not _WIN32 */
+    }
+
+}
+
+namespace Smtp {
+
+    /**
+     * This contains the private properties of a BodyStore instance.
+     */
+    struct BodyStore::Impl {
+        // Types
+
+        /**
+         * This holds one distinct body known to the store.
+         */
+        struct Entry {
+            /**
+             * This is the processed body, if the store holds it in memory,
+             * which it does only if it isn't backed by a directory.
+             */
+            Body body;
+
+            /**
+             * This is the processed body last loaded from the backing
+             * directory, if anyone is still holding it, so that they share
+             * it with anyone else asking for it.
+             */
+            std::weak_ptr< const std::string > loadedBody;
+
+            /**
+             * This is the size, in bytes, of the processed body.
+             */
+            size_t length = 0;
+
+            /**
+             * This is the number of references to the body which have
+             * not yet been released.
+             */
+            size_t references = 0;
+        };
+
+        // Properties
+
+        /**
+         * This is used to protect the other properties of this structure
+         * when accessed simultaneously by multiple threads.
+         */
+        std::mutex mutex;
+
+        /**
+         * If not empty, this is the path to the directory backing the store.
+         */
+        std::string directory;
+
+        /**
+         * These are the bodies known to the store, keyed by content hash.
+         */
+        std::map< std::string, Entry > entries;
+
+        /**
+         * This is the total size, in bytes, of the bodies held in memory.
+         */
+        size_t storedBytes = 0;
+
+        // Methods
+
+        /**
+         * Return the path to the file in which to keep the body with
+         * the given key.
+         *
+         * @param[in] key
+         *     This is the key of the body.
+         *
+         * @return
+         *     The path to the file in which to keep the body with the
+         *     given key is returned.
+         */
+        std::string GetPath(const std::string& key) const {
+            return directory + "/" + key;
+        }
+
+        /**
+         * Return the path to the file in which to keep the number of
+         * references to the body with the given key.
+         *
+         * @param[in] key
+         *     This is the key of the body.
+         *
+         * @return
+         *     The path to the file in which to keep the number of
+         *     references to the body with the given key is returned.
+         */
+        std::string GetReferencesPath(const std::string& key) const {
+            return GetPath(key) + ".refs";
+        }
+
+        /**
+         * Write the given contents to the file at the given path, by
+         * writing them to a temporary file first, waiting for it to reach
+         * the disk, and then moving it into place, so that a crash or
+         * full disk never leaves the file partly written.
+         *
+         * @param[in] path
+         *     This is the path to the file to write.
+         *
+         * @param[in] contents
+         *     These are the contents to write to the file.
+         *
+         * @return
+         *     An indication of whether or not the file was written
+         *     is returned.
+         */
+        bool WriteAtomically(
+            const std::string& path,
+            const std::string& contents
+        ) const {
+            const auto temporaryPath = path + ".tmp";
+            if (
+                !WriteAndSync(temporaryPath, contents)
+                || !MoveIntoPlace(temporaryPath, path)
+            ) {
+                (void)remove(temporaryPath.c_str());
+                return false;
+            }
+            return SyncDirectory(directory);
+        }
+
+        /**
+         * Load the number of references to the body with the given key
+         * from the backing directory.
+         *
+         * @param[in] key
+         *     This is the key of the body.
+         *
+         * @return
+         *     The number of references to the body is returned.  If it
+         *     could not be read, the body is taken to have one reference.
+         */
+        size_t LoadReferences(const std::string& key) const {
+            std::ifstream file(GetReferencesPath(key));
+            size_t references = 0;
+            if (
+                !(file >> references)
+                || (references == 0)
+            ) {
+                return 1;
+            }
+            return references;
+        }
+
+        /**
+         * Write the number of references to the body with the given key
+         * to the backing directory, if the store is backed by one.
+         *
+         * @param[in] key
+         *     This is the key of the body.
+         *
+         * @param[in] references
+         *     This is the number of references to write.
+         *
+         * @return
+         *     An indication of whether or not the number of references
+         *     was written is returned.
+         */
+        bool SaveReferences(
+            const std::string& key,
+            size_t references
+        ) const {
+            if (directory.empty()) {
+                return true;
+            }
+            return WriteAtomically(
+                GetReferencesPath(key),
+                std::to_string(references)
+            );
+        }
+
+        /**
+         * Load the body with the given key from the backing directory.
+         *
+         * @param[in] key
+         *     This is the key of the body to load.
+         *
+         * @return
+         *     The body is returned, or nullptr is returned if the store
+         *     is not backed by a directory or the body's file could not
+         *     be read.
+         */
+        Body Load(const std::string& key) const {
+            if (directory.empty()) {
+                return nullptr;
+            }
+            std::ifstream file(GetPath(key), std::ios::binary);
+            if (!file) {
+                return nullptr;
+            }
+            return std::make_shared< const std::string >(
+                std::istreambuf_iterator< char >(file),
+                std::istreambuf_iterator< char >()
+            );
+        }
+
+        /**
+         * Return the body of the given entry, loading it from the backing
+         * directory if it isn't held in memory and nobody else is holding
+         * it already.
+         *
+         * @param[in] key
+         *     This is the key of the body.
+         *
+         * @param[in,out] entry
+         *     This is the entry for the body.
+         *
+         * @return
+         *     The body is returned, or nullptr is returned if it could
+         *     not be loaded.
+         */
+        Body GetBody(
+            const std::string& key,
+            Entry& entry
+        ) const {
+            if (entry.body != nullptr) {
+                return entry.body;
+            }
+            auto body = entry.loadedBody.lock();
+            if (body == nullptr) {
+                body = Load(key);
+                entry.loadedBody = body;
+            }
+            return body;
+        }
+
+        /**
+         * Return the entry for the body with the given key, looking for its
+         * file and number of references in the backing directory if the
+         * store doesn't know about it yet.  The body itself isn't loaded.
+         *
+         * @param[in] key
+         *     This is the key of the body.
+         *
+         * @return
+         *     The entry for the body is returned, or nullptr is returned
+         *     if there is no such body.
+         */
+        Entry* Find(const std::string& key) {
+            auto entriesEntry = entries.find(key);
+            if (entriesEntry != entries.end()) {
+                return &entriesEntry->second;
+            }
+            if (directory.empty()) {
+                return nullptr;
+            }
+            std::ifstream file(GetPath(key), std::ios::binary | std::ios::ate);
+            if (!file) {
+                return nullptr;
+            }
+            auto& entry = entries[key];
+            entry.length = (size_t)file.tellg();
+            entry.references = LoadReferences(key);
+            return &entry;
+        }
+
+        /**
+         * Add a new body to the store under the given key, writing it
+         * and its one reference to the backing directory if the store
+         * is backed by one.
+         *
+         * @param[in] key
+         *     This is the key of the body.
+         *
+         * @param[in] body
+         *     This is the processed body to add.
+         *
+         * @return
+         *     An indication of whether or not the body was added
+         *     is returned.
+         */
+        bool AddNew(
+            const std::string& key,
+            const std::string& body
+        ) {
+            if (directory.empty()) {
+                auto& entry = entries[key];
+                entry.body = std::make_shared< const std::string >(body);
+                entry.length = body.length();
+                entry.references = 1;
+                storedBytes += body.length();
+                return true;
+            }
+            if (!WriteAtomically(GetPath(key), body)) {
+                return false;
+            }
+            if (!SaveReferences(key, 1)) {
+                (void)remove(GetPath(key).c_str());
+                return false;
+            }
+            auto& entry = entries[key];
+            entry.length = body.length();
+            entry.references = 1;
+            return true;
+        }
+
+        /**
+         * Forget the body with the given key, removing its files from the
+         * backing directory if the store is backed by one.
+         *
+         * @param[in] key
+         *     This is the key of the body.
+         */
+        void Remove(const std::string& key) {
+            const auto entriesEntry = entries.find(key);
+            if (entriesEntry != entries.end()) {
+                if (entriesEntry->second.body != nullptr) {
+                    storedBytes -= entriesEntry->second.length;
+                }
+                (void)entries.erase(entriesEntry);
+            }
+            if (!directory.empty()) {
+                (void)remove(GetPath(key).c_str());
+                (void)remove(GetReferencesPath(key).c_str());
+            }
+        }
+    };
+
+    BodyStore::~BodyStore() noexcept = default;
+    BodyStore::BodyStore(BodyStore&& other) noexcept = default;
+    BodyStore& BodyStore::operator=(BodyStore&& other) noexcept = default;
+
+    BodyStore::BodyStore()
+        : impl_(new Impl)
+    {
+    }
+
+    void BodyStore::Configure(const std::string& directory) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+
+        // Forget what was learned about bodies in any directory
+        // previously backing the store.  Bodies held in memory
+        // remain available.
+        for (
+            auto entriesEntry = impl_->entries.begin();
+            entriesEntry != impl_->entries.end();
+        ) {
+            if (entriesEntry->second.body == nullptr) {
+                entriesEntry = impl_->entries.erase(entriesEntry);
+            } else {
+                ++entriesEntry;
+            }
+        }
+        impl_->directory = directory;
+    }
+
+    std::string BodyStore::Add(const std::string& body) {
+        const auto processedBody = ProcessBody(body);
+        const auto hash = StringExtensions::sprintf(
+            "%016llx",
+            (unsigned long long)Hash(processedBody)
+        );
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        for (size_t collisions = 0;; ++collisions) {
+            const auto key = (
+                (collisions == 0)
+                ? hash
+                : StringExtensions::sprintf("%s-%zu", hash.c_str(), collisions)
+            );
+            const auto entry = impl_->Find(key);
+            if (entry == nullptr) {
+                if (!impl_->AddNew(key, processedBody)) {
+                    return "";
+                }
+                return key;
+            }
+            if (entry->length != processedBody.length()) {
+                continue;
+            }
+            const auto storedBody = impl_->GetBody(key, *entry);
+            if (
+                (storedBody != nullptr)
+                && (*storedBody == processedBody)
+            ) {
+                if (!impl_->SaveReferences(key, entry->references + 1)) {
+                    return "";
+                }
+                ++entry->references;
+                return key;
+            }
+        }
+    }
+
+    auto BodyStore::Get(const std::string& key) -> Body {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        const auto entry = impl_->Find(key);
+        if (entry == nullptr) {
+            return nullptr;
+        }
+        return impl_->GetBody(key, *entry);
+    }
+
+    auto BodyStore::GetFile(const std::string& key) -> BodyFile {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        BodyFile bodyFile;
+        if (impl_->directory.empty()) {
+            return bodyFile;
+        }
+        const auto entry = impl_->Find(key);
+        if (entry == nullptr) {
+            return bodyFile;
+        }
+        bodyFile.path = impl_->GetPath(key);
+        bodyFile.length = entry->length;
+        return bodyFile;
+    }
+
+    void BodyStore::Release(const std::string& key) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        const auto entry = impl_->Find(key);
+        if (entry == nullptr) {
+            return;
+        }
+        if (--entry->references > 0) {
+            // If this can't be written, the body just outlives its last
+            // reference, rather than being removed while still referenced
+            // should the store be remade.
+            (void)impl_->SaveReferences(key, entry->references);
+            return;
+        }
+        impl_->Remove(key);
+    }
+
+    size_t BodyStore::GetBodyCount() {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        size_t bodyCount = 0;
+        for (const auto& entriesEntry: impl_->entries) {
+            if (entriesEntry.second.body != nullptr) {
+                ++bodyCount;
+            }
+        }
+        return bodyCount;
+    }
+
+    size_t BodyStore::GetStoredBytes() {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        return impl_->storedBytes;
+    }
+
+}
@@ -0,0 +1,224 @@
+/**
+ * @file CachingResolver.cpp
+ *
+ * This module contains the implementation of the Smtp::CachingResolver class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <Smtp/CachingResolver.hpp>
+#include <string>
+#include <vector>
+
+namespace Smtp {
+
+    /**
+     * This contains the private properties of a CachingResolver instance.
+     */
+    struct CachingResolver::Impl
+        : public std::enable_shared_from_this< Impl >
+    {
+        // Types
+
+        /**
+         * This holds an answer remembered by the resolver.
+         */
+        struct CacheEntry {
+            /**
+             * This is the answer given by the upstream resolver.
+             */
+            Answer answer;
+
+            /**
+             * This is the time after which the answer may no longer
+             * be reused.
+             */
+            std::chrono::steady_clock::time_point expiration;
+        };
+
+        // Properties
+
+        /**
+         * This is used to protect the other properties of this structure
+         * when accessed simultaneously by multiple threads.
+         */
+        std::mutex mutex;
+
+        /**
+         * This is the resolver to ask about hosts whose answers are not
+         * already cached.
+         */
+        std::shared_ptr< Resolver > upstream;
+
+        /**
+         * This is how long to remember that a host could not be found.
+         */
+        std::chrono::milliseconds negativeTimeToLive = std::chrono::seconds(30);
+
+        /**
+         * These are the answers remembered by the resolver, keyed by the
+         * host name or address looked up.
+         */
+        std::map< std::string, CacheEntry > cache;
+
+        /**
+         * These are the functions to call once the lookups currently in
+         * progress are complete, keyed by the host name or address
+         * being looked up.
+         */
+        std::map< std::string, std::vector< ResolutionDelegate > > lookupsInProgress;
+
+        // Methods
+
+        /**
+         * Remember the given answer from the upstream resolver, and deliver
+         * it to everyone waiting on it.
+         *
+         * @param[in] hostNameOrAddress
+         *     This is the name or address of the host that was looked up.
+         *
+         * @param[in] answer
+         *     This is the answer given by the upstream resolver.
+         */
+        void OnResolved(
+            const std::string& hostNameOrAddress,
+            const Answer& answer
+        ) {
+            std::vector< ResolutionDelegate > waiting;
+            {
+                std::lock_guard< decltype(mutex) > lock(mutex);
+                const auto timeToLive = (
+                    answer.addresses.empty()
+                    ? negativeTimeToLive
+                    : answer.timeToLive
+                );
+                if (timeToLive > std::chrono::milliseconds(0)) {
+                    auto& cacheEntry = cache[hostNameOrAddress];
+                    cacheEntry.answer = answer;
+                    cacheEntry.answer.timeToLive = timeToLive;
+                    cacheEntry.expiration = std::chrono::steady_clock::now() + timeToLive;
+                }
+                auto lookupsInProgressEntry = lookupsInProgress.find(hostNameOrAddress);
+                if (lookupsInProgressEntry != lookupsInProgress.end()) {
+                    waiting.swap(lookupsInProgressEntry->second);
+                    lookupsInProgress.erase(lookupsInProgressEntry);
+                }
+            }
+            for (const auto& onResolved: waiting) {
+                onResolved(answer);
+            }
+        }
+
+        /**
+         * Give an empty answer to everyone waiting on a lookup still in
+         * progress.  This is done when the resolver goes away, since the
+         * answers given by the upstream resolver after that are dropped.
+         */
+        void AbandonLookups() {
+            decltype(lookupsInProgress) abandoned;
+            {
+                std::lock_guard< decltype(mutex) > lock(mutex);
+                abandoned.swap(lookupsInProgress);
+            }
+            for (const auto& lookup: abandoned) {
+                for (const auto& onResolved: lookup.second) {
+                    onResolved(Answer());
+                }
+            }
+        }
+    };
+
+    CachingResolver::~CachingResolver() noexcept {
+        if (impl_ != nullptr) {
+            impl_->AbandonLookups();
+        }
+    }
+
+    CachingResolver::CachingResolver(CachingResolver&& other) noexcept = default;
+
+    CachingResolver& CachingResolver::operator=(CachingResolver&& other) noexcept {
+        if (this != &other) {
+            if (impl_ != nullptr) {
+                impl_->AbandonLookups();
+            }
+            impl_ = std::move(other.impl_);
+        }
+        return *this;
+    }
+
+    CachingResolver::CachingResolver()
+        : impl_(new Impl)
+    {
+    }
+
+    void CachingResolver::Configure(
+        std::shared_ptr< Resolver > upstream,
+        std::chrono::milliseconds negativeTimeToLive
+    ) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->upstream = upstream;
+        impl_->negativeTimeToLive = negativeTimeToLive;
+    }
+
+    void CachingResolver::Flush() {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->cache.clear();
+    }
+
+    void CachingResolver::Resolve(
+        const std::string& hostNameOrAddress,
+        ResolutionDelegate onResolved
+    ) {
+        std::shared_ptr< Resolver > upstream;
+        Answer cachedAnswer;
+        bool cached = false;
+        {
+            std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+            auto cacheEntry = impl_->cache.find(hostNameOrAddress);
+            if (cacheEntry != impl_->cache.end()) {
+                const auto now = std::chrono::steady_clock::now();
+                if (now < cacheEntry->second.expiration) {
+                    cachedAnswer = cacheEntry->second.answer;
+                    cachedAnswer.timeToLive = std::chrono::duration_cast< std::chrono::milliseconds >(
+                        cacheEntry->second.expiration - now
+                    );
+                    cached = true;
+                } else {
+                    impl_->cache.erase(cacheEntry);
+                }
+            }
+            if (!cached) {
+                auto& waiting = impl_->lookupsInProgress[hostNameOrAddress];
+                waiting.push_back(onResolved);
+                if (waiting.size() > 1) {
+                    return;
+                }
+                upstream = impl_->upstream;
+            }
+        }
+        if (cached) {
+            onResolved(cachedAnswer);
+            return;
+        }
+        if (upstream == nullptr) {
+            impl_->OnResolved(hostNameOrAddress, Answer());
+            return;
+        }
+        std::weak_ptr< Impl > implWeak(impl_);
+        upstream->Resolve(
+            hostNameOrAddress,
+            [implWeak, hostNameOrAddress](const Answer& answer){
+                auto impl = implWeak.lock();
+                if (impl == nullptr) {
+                    return;
+                }
+                impl->OnResolved(hostNameOrAddress, answer);
+            }
+        );
+    }
+
+}
@@ -0,0 +1,97 @@
+/**
+ * @file CancellationToken.cpp
+ *
+ * This module contains the implementation of the Smtp::CancellationToken
+ * class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <Smtp/CancellationToken.hpp>
+
+namespace Smtp {
+
+    /**
+     * This contains the private properties of a CancellationToken instance.
+     */
+    struct CancellationToken::Impl {
+        /**
+         * This is used to protect the other properties of this structure
+         * when accessed simultaneously by multiple threads.
+         */
+        std::mutex mutex;
+
+        /**
+         * This is set once the token is cancelled.
+         */
+        std::atomic< bool > cancelled{false};
+
+        /**
+         * These are the functions to call when the token is cancelled,
+         * keyed by subscription identifier.
+         */
+        std::map< int, CancellationDelegate > subscribers;
+
+        /**
+         * This is the identifier to give the next subscription.
+         */
+        int nextSubscriptionId = 1;
+    };
+
+    CancellationToken::~CancellationToken() noexcept = default;
+    CancellationToken::CancellationToken(const CancellationToken& other) = default;
+    CancellationToken::CancellationToken(CancellationToken&& other) noexcept = default;
+    CancellationToken& CancellationToken::operator=(const CancellationToken& other) = default;
+    CancellationToken& CancellationToken::operator=(CancellationToken&& other) noexcept = default;
+
+    CancellationToken::CancellationToken()
+        : impl_(new Impl)
+    {
+    }
+
+    void CancellationToken::Cancel() {
+        decltype(impl_->subscribers) subscribers;
+        {
+            std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+            if (impl_->cancelled) {
+                return;
+            }
+            impl_->cancelled = true;
+            subscribers.swap(impl_->subscribers);
+        }
+        for (const auto& subscriber: subscribers) {
+            subscriber.second();
+        }
+    }
+
+    bool CancellationToken::IsCancelled() const {
+        return impl_->cancelled;
+    }
+
+    auto CancellationToken::SubscribeToCancellation(
+        CancellationDelegate delegate
+    ) -> UnsubscribeDelegate {
+        std::unique_lock< decltype(impl_->mutex) > lock(impl_->mutex);
+        if (impl_->cancelled) {
+            lock.unlock();
+            delegate();
+            return []{};
+        }
+        const auto subscriptionId = impl_->nextSubscriptionId++;
+        impl_->subscribers[subscriptionId] = delegate;
+        std::weak_ptr< Impl > implWeak(impl_);
+        return [implWeak, subscriptionId]{
+            auto impl = implWeak.lock();
+            if (impl == nullptr) {
+                return;
+            }
+            std::lock_guard< decltype(impl->mutex) > lock(impl->mutex);
+            (void)impl->subscribers.erase(subscriptionId);
+        };
+    }
+
+}
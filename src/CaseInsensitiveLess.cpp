@@ -0,0 +1,55 @@
+/**
+ * @file CaseInsensitiveLess.cpp
+ *
+ * This module contains the implementation of the Smtp::CaseInsensitiveLess
+ * structure.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "CaseInsensitiveLess.hpp"
+
+#include <algorithm>
+#include <stddef.h>
+#include <string>
+
+namespace {
+
+    /**
+     * Return the upper-case form of the given character, if it's
+     * an ASCII letter, or the character itself otherwise.
+     *
+     * @param[in] c
+     *     This is the character to fold.
+     *
+     * @return
+     *     The upper-case form of the given character is returned.
+     */
+    unsigned Fold(char c) {
+        return (
+            ((c >= 'a') && (c <= 'z'))
+            ? (unsigned)(c - 'a' + 'A')
+            : (unsigned)(unsigned char)c
+        );
+    }
+
+}
+
+namespace Smtp {
+
+    bool CaseInsensitiveLess::operator()(
+        const std::string& lhs,
+        const std::string& rhs
+    ) const {
+        const auto length = std::min(lhs.length(), rhs.length());
+        for (size_t i = 0; i < length; ++i) {
+            const auto lhsFolded = Fold(lhs[i]);
+            const auto rhsFolded = Fold(rhs[i]);
+            if (lhsFolded != rhsFolded) {
+                return (lhsFolded < rhsFolded);
+            }
+        }
+        return (lhs.length() < rhs.length());
+    }
+
+}
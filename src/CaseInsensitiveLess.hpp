@@ -0,0 +1,44 @@
+#pragma once
+
+/**
+ * @file CaseInsensitiveLess.hpp
+ *
+ * This module declares the Smtp::CaseInsensitiveLess structure, used inside
+ * the Smtp library to order names which are compared without regard to case,
+ * such as SMTP service extension keywords (RFC 5321 section 2.4) and host
+ * names (RFC 4343).
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <string>
+
+namespace Smtp {
+
+    /**
+     * This is used to order names without regard to case, for example as
+     * the comparison function of a std::map keyed by name.  Only the ASCII
+     * letters are folded.
+     */
+    struct CaseInsensitiveLess {
+        /**
+         * Determine whether or not the first given name comes before the
+         * second, without regard to case.
+         *
+         * @param[in] lhs
+         *     This is the first name to compare.
+         *
+         * @param[in] rhs
+         *     This is the second name to compare.
+         *
+         * @return
+         *     An indication of whether or not the first given name comes
+         *     before the second is returned.
+         */
+        bool operator()(
+            const std::string& lhs,
+            const std::string& rhs
+        ) const;
+    };
+
+}
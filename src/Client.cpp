@@ -6,60 +6,53 @@
  * © 2019 by Richard Walters
  */
 
+#include "BodyProcessing.hpp"
+#include "CaseInsensitiveLess.hpp"
+#include "Commands.hpp"
+#include "Keywords.hpp"
+#include "Probes.hpp"
+
 #include <algorithm>
+#include <assert.h>
+#include <atomic>
 #include <chrono>
+#include <deque>
+#include <fstream>
 #include <functional>
 #include <future>
-#include <inttypes.h>
+#include <iterator>
 #include <map>
 #include <memory>
 #include <mutex>
-#include <queue>
-#include <set>
+#include <random>
 #include <Smtp/Client.hpp>
-#include <sstream>
+#include <Smtp/ConnectionTiming.hpp>
+#include <Smtp/DrainNotifier.hpp>
+#include <Smtp/FileSender.hpp>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
-#include <StringExtensions/StringExtensions.hpp>
+#include <string>
+#include <string.h>
 #include <thread>
+#include <utility>
 #include <vector>
 
 namespace {
 
     /**
-     * Normalize all line endings of the given e-mail body to be CRLF and
-     * perform "dot-stuffing" (extra '.' added at the beginning of a line if
-     * that line started with '.', as described in RFC 5321 section 4.5.2).
-     *
-     * @param[in] body
-     *     This is the e-mail body to process.
+     * Return a random 64-bit number, for use in making up trace
+     * identifiers.  One generator is shared by all clients, so that
+     * each client doesn't carry the considerable state of its own.
      *
      * @return
-     *     The processed version of the given e-mail body is returned.
+     *     A random 64-bit number is returned.
      */
-    std::string ProcessBody(const std::string& body) {
-        std::ostringstream builder;
-        const auto length = body.length();
-        bool first = true;
-        for (size_t i = 0; i < length; ++i) {
-            const auto next = body[i];
-            if (next == '\n') {
-                builder << "\r\n";
-                first = true;
-            } else if (next != '\r') {
-                if (first) {
-                    first = false;
-                    if (next == '.') {
-                        builder << '.';
-                    }
-                }
-                builder << next;
-            }
-        }
-        if (!first) {
-            builder << "\r\n";
-        }
-        return builder.str();
+    uint64_t RandomTraceIdPart() {
+        static std::mutex mutex;
+        static std::mt19937_64 generator(std::random_device{}());
+        std::lock_guard< decltype(mutex) > lock(mutex);
+        return generator();
     }
 
 }
@@ -79,6 +72,14 @@ namespace Smtp {
         return input;
     }
 
+    void Client::Extension::ModifyMessageAsync(
+        const MessageContext& context,
+        const std::string& input,
+        std::function< void(const std::string& output) > onModified
+    ) {
+        onModified(ModifyMessage(context, input));
+    }
+
     bool Client::Extension::IsExtraProtocolStageNeededHere(
         const MessageContext& context
     ) {
@@ -98,6 +99,60 @@ namespace Smtp {
         return false;
     }
 
+    void Client::Extension::HandleServerMessageAsync(
+        const MessageContext& context,
+        const ParsedMessage& message,
+        std::function< void(bool success) > onHandled
+    ) {
+        onHandled(HandleServerMessage(context, message));
+    }
+
+    /**
+     * This contains the private properties of a Client::ExtensionRegistry
+     * instance.
+     */
+    struct Client::ExtensionRegistry::Impl {
+        /**
+         * This is used to protect the other properties of this structure
+         * when accessed simultaneously by multiple threads.
+         */
+        mutable std::mutex mutex;
+
+        /**
+         * These are the extension factories registered, keyed by
+         * extension name without regard to case.
+         */
+        std::map< std::string, ExtensionFactory, CaseInsensitiveLess > factories;
+    };
+
+    Client::ExtensionRegistry::~ExtensionRegistry() noexcept = default;
+    Client::ExtensionRegistry::ExtensionRegistry(ExtensionRegistry&& other) noexcept = default;
+    Client::ExtensionRegistry& Client::ExtensionRegistry::operator=(ExtensionRegistry&& other) noexcept = default;
+
+    Client::ExtensionRegistry::ExtensionRegistry()
+        : impl_(new Impl)
+    {
+    }
+
+    void Client::ExtensionRegistry::Register(
+        const std::string& extensionName,
+        ExtensionFactory extensionFactory
+    ) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->factories[extensionName] = extensionFactory;
+    }
+
+    auto Client::ExtensionRegistry::Find(
+        const std::string& extensionName
+    ) const -> ExtensionFactory {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        const auto factoriesEntry = impl_->factories.find(extensionName);
+        if (factoriesEntry == impl_->factories.end()) {
+            return nullptr;
+        }
+        return factoriesEntry->second;
+    }
+
     /**
      * This contains the private properties of a Client instance.
      */
@@ -106,6 +161,406 @@ namespace Smtp {
     {
         // Types
 
+        /**
+         * This holds what has been registered for use by the client
+         * under one SMTP extension name.
+         */
+        struct RegisteredExtension {
+            /**
+             * This is the name under which the extension was registered.
+             */
+            std::string name;
+
+            /**
+             * If not nullptr, this is the extension object registered,
+             * which is shared by every connection the client makes.
+             */
+            std::shared_ptr< Extension > extension;
+
+            /**
+             * If not nullptr, this is the factory registered to make
+             * a new instance of the extension for each connection.
+             */
+            ExtensionFactory factory;
+        };
+
+        /**
+         * This holds a message to be sent to the SMTP server which has
+         * been held back behind one still being modified by an extension.
+         */
+        struct OutgoingMessage {
+            /**
+             * This is the message, without the newline at the end if it
+             * is still to be processed by extensions, or the raw data
+             * to send otherwise.
+             */
+            std::string text;
+
+            /**
+             * This indicates whether or not the message is to be processed
+             * by the supported extensions before it's sent.
+             */
+            bool throughExtensions = false;
+
+            /**
+             * This is the number of supported extensions which have
+             * processed the message so far.
+             */
+            size_t extensionsApplied = 0;
+
+            /**
+             * This is the message context as of when the message was
+             * queued, which is given to the extensions processing it.
+             */
+            MessageContext context;
+        };
+
+        /**
+         * This holds the e-mail addresses of the recipients of an e-mail,
+         * packed back to back in one buffer, with an array marking where
+         * each one ends, so that even very large envelopes take only two
+         * allocations.
+         */
+        struct RecipientList {
+            /**
+             * These are the e-mail addresses, back to back.
+             */
+            std::string addresses;
+
+            /**
+             * For each e-mail address, in order, this is the offset into
+             * the buffer just past its end.
+             */
+            std::vector< size_t > ends;
+
+            /**
+             * Fill the list with the given e-mail addresses.
+             *
+             * @param[in] recipients
+             *     These are the e-mail addresses to put in the list.
+             */
+            void Assign(const std::vector< std::string >& recipients) {
+                size_t length = 0;
+                for (const auto& recipient: recipients) {
+                    length += recipient.length();
+                }
+                addresses.clear();
+                addresses.reserve(length);
+                ends.clear();
+                ends.reserve(recipients.size());
+                for (const auto& recipient: recipients) {
+                    (void)addresses.append(recipient);
+                    ends.push_back(addresses.length());
+                }
+            }
+
+            /**
+             * Return the number of e-mail addresses in the list.
+             *
+             * @return
+             *     The number of e-mail addresses in the list is returned.
+             */
+            size_t GetCount() const {
+                return ends.size();
+            }
+
+            /**
+             * Return the e-mail address at the given index in the list,
+             * where it's kept, for use in a command.
+             *
+             * @param[in] index
+             *     This is the index of the e-mail address to return.
+             *
+             * @return
+             *     The e-mail address at the given index is returned.
+             */
+            CommandPart GetPart(size_t index) const {
+                const auto start = ((index == 0) ? 0 : ends[index - 1]);
+                CommandPart part;
+                part.data = addresses.data() + start;
+                part.length = ends[index] - start;
+                return part;
+            }
+
+            /**
+             * Return a copy of the e-mail address at the given index
+             * in the list.
+             *
+             * @param[in] index
+             *     This is the index of the e-mail address to return.
+             *
+             * @return
+             *     The e-mail address at the given index is returned.
+             */
+            std::string Get(size_t index) const {
+                const auto part = GetPart(index);
+                return std::string(part.data, part.length);
+            }
+
+            /**
+             * Drop every e-mail address in the list after the given
+             * number of them, letting go of the memory they held.
+             *
+             * @param[in] count
+             *     This is the number of e-mail addresses to keep.
+             */
+            void Truncate(size_t count) {
+                if (count >= ends.size()) {
+                    return;
+                }
+                addresses.resize((count == 0) ? 0 : ends[count - 1]);
+                addresses.shrink_to_fit();
+                ends.resize(count);
+                ends.shrink_to_fit();
+            }
+
+            /**
+             * Return the number of bytes of memory held by the list.
+             *
+             * @return
+             *     The number of bytes of memory held by the list
+             *     is returned.
+             */
+            size_t GetMemoryFootprint() const {
+                return addresses.capacity() + ends.capacity() * sizeof(size_t);
+            }
+        };
+
+        /**
+         * This holds everything the client needs to keep track of for one
+         * e-mail which has been handed to SendMail, from the time it's
+         * queued until the server gives its final reply about it.
+         */
+        struct Transaction {
+            /**
+             * This is a copy of the headers for the e-mail.
+             */
+            MessageHeaders::MessageHeaders headers;
+
+            /**
+             * This is the body of the e-mail, which may be shared with
+             * other e-mails or a body store.  It has been
+             * processed so that all lines end in a CRLF and "dot-stuffing"
+             * is performed (extra '.' added at the beginning of a line if
+             * that line started with '.', as described in RFC 5321 section
+             * 4.5.2).  It's nullptr if the body is kept in a file.
+             */
+            BodyStore::Body body;
+
+            /**
+             * This locates the file holding the body of the e-mail,
+             * processed in the same way, if the body isn't held in memory.
+             */
+            BodyStore::BodyFile bodyFile;
+
+            /**
+             * This is the number of bytes of the body queued to be sent
+             * so far, once the server is ready to accept the message data.
+             */
+            size_t bodyBytesQueued = 0;
+
+            /**
+             * This is the file holding the body of the e-mail, opened once
+             * the server is ready to accept the message data, if the body
+             * is kept in a file and read a chunk at a time.
+             */
+            std::shared_ptr< std::ifstream > bodyFileStream;
+
+            /**
+             * This indicates whether or not the body of the e-mail ends
+             * with a line ending, so that none needs to be added before
+             * the end of the message data.
+             */
+            bool bodyEndsWithLineEnding = false;
+
+            /**
+             * This is set once the whole body of the e-mail, and the end
+             * of its message data, have been queued to be sent.
+             */
+            bool dataEnded = false;
+
+            /**
+             * This is set when the SMTP client is finished sending the
+             * e-mail.
+             */
+            std::promise< bool > sendCompleted;
+
+            /**
+             * If not nullptr, this is also set when the SMTP client is
+             * finished sending the e-mail, to the outcome of sending it.
+             */
+            std::unique_ptr< std::promise< SendResult > > sendResult;
+
+            /**
+             * This holds the e-mail addresses of the recipients of the e-mail,
+             * in the order they're given to the server.
+             */
+            RecipientList recipients;
+
+            /**
+             * This is the number of recipients of the e-mail that have been
+             * given to the server.  They're the first ones in the list.
+             */
+            size_t recipientsAnnounced = 0;
+
+            /**
+             * This indicates whether or not the MAIL FROM command for the
+             * e-mail has been sent to the server.
+             */
+            bool envelopeSent = false;
+
+            /**
+             * This indicates whether or not the MAIL FROM and all RCPT TO
+             * commands for the e-mail were sent to the server as one group,
+             * without waiting for replies in between (RFC 2920).
+             */
+            bool pipelined = false;
+
+            /**
+             * This is the number of envelope commands sent to the server
+             * for the e-mail for which the server has not yet replied.
+             */
+            size_t repliesPending = 0;
+
+            /**
+             * This is set if the server rejected any of the envelope commands
+             * sent for the e-mail.
+             */
+            bool failed = false;
+
+            /**
+             * This is set if the server accepted the MAIL FROM command for
+             * the e-mail, in which case the server holds the transaction
+             * open until it's either finished or reset.
+             */
+            bool senderAccepted = false;
+
+            /**
+             * This is used to identify the e-mail when the caller cancels it.
+             */
+            uint64_t id = 0;
+
+            /**
+             * This is the token the caller may use to cancel sending the
+             * e-mail.
+             */
+            CancellationToken cancellationToken;
+
+            /**
+             * This function is called to end the subscription to the
+             * cancellation of the e-mail's token.
+             */
+            CancellationToken::UnsubscribeDelegate unsubscribeCancellation;
+
+            /**
+             * This is set if the caller cancelled the e-mail after its
+             * envelope was sent, in which case the client resets the
+             * transaction once the server has replied to the envelope.
+             */
+            bool cancelled = false;
+
+            /**
+             * This indicates whether or not the RSET command has been sent to
+             * abandon the e-mail after it was cancelled or rejected.
+             */
+            bool resetSent = false;
+
+            /**
+             * If spans are being recorded, this identifies the e-mail
+             * in them.
+             */
+            std::string traceId;
+
+            /**
+             * This is the time at which the current phase of sending
+             * the e-mail started, for spans.
+             */
+            std::chrono::steady_clock::time_point phaseStarted;
+
+            /**
+             * This is the number of recipients of the e-mail.
+             */
+            size_t recipientCount = 0;
+
+            /**
+             * This is the code of the first envelope reply rejecting
+             * anything, or 250 if nothing was rejected.
+             */
+            int envelopeReplyCode = 250;
+
+            /**
+             * This is the number of replies received from the server to
+             * the envelope commands sent for the e-mail.
+             */
+            size_t envelopeRepliesReceived = 0;
+
+            /**
+             * This is the number of final replies received from the server
+             * about the e-mail.  In LMTP mode, there is one per recipient.
+             */
+            size_t finalRepliesReceived = 0;
+
+            /**
+             * This is cleared if any final reply about the e-mail indicated
+             * that it was not delivered.
+             */
+            bool delivered = true;
+
+            /**
+             * This is set if the server rejected anything about the e-mail
+             * permanently (5xx reply).
+             */
+            bool rejectedPermanently = false;
+
+            /**
+             * This is set if the server rejected anything about the e-mail
+             * other than permanently (such as with a 4xx reply).
+             */
+            bool rejectedTransiently = false;
+
+            /**
+             * Note that the server rejected something about the e-mail
+             * with the given reply code.
+             *
+             * @param[in] code
+             *     This is the code of the server's reply.
+             */
+            void NoteRejection(int code) {
+                if (
+                    (code >= 500)
+                    && (code < 600)
+                ) {
+                    rejectedPermanently = true;
+                } else {
+                    rejectedTransiently = true;
+                }
+            }
+
+            /**
+             * Determine whether or not every recipient of the e-mail
+             * has been given to the server.
+             *
+             * @return
+             *     An indication of whether or not every recipient of the
+             *     e-mail has been given to the server is returned.
+             */
+            bool AllRecipientsAnnounced() const {
+                return (recipientsAnnounced >= recipients.GetCount());
+            }
+
+            /**
+             * Let go of the memory holding the e-mail's contents, which is
+             * no longer needed once the e-mail has been cancelled.  The
+             * recipients already given to the server are kept, so that the
+             * outcome for them can still be reported.
+             */
+            void ReleaseContents() {
+                headers = MessageHeaders::MessageHeaders();
+                body.reset();
+                recipients.Truncate(recipientsAnnounced);
+            }
+        };
+
         /**
          * This is the type of collection which holds onto promises made
          * to be completed when either the SMTP client and server are ready
@@ -116,6 +571,15 @@ namespace Smtp {
          */
         using ReadyOrBrokenPromises = std::vector< std::promise< bool > >;
 
+        // Constants
+
+        /**
+         * This is the largest number of bytes of an e-mail body queued to
+         * be sent to the server at once.  Cancellation is checked between
+         * chunks.
+         */
+        static constexpr size_t BODY_CHUNK_SIZE = 65536;
+
         // Properties
 
         /**
@@ -131,15 +595,45 @@ namespace Smtp {
         std::recursive_mutex mutex;
 
         /**
-         * These are the SMTP extensions registered for use by the client.
+         * These are the SMTP extensions registered for use by the client
+         * under the names of registered SMTP service extension keywords,
+         * indexed by keyword.  The table is only made once an extension
+         * is registered under such a name, since most clients have none.
+         */
+        std::unique_ptr< RegisteredExtension[] > keywordExtensions;
+
+        /**
+         * These are the SMTP extensions registered for use by the client
+         * under any other names, keyed by name without regard to case.
+         */
+        std::map< std::string, RegisteredExtension, CaseInsensitiveLess > customExtensions;
+
+        /**
+         * If not nullptr, this is the registry, shared with other clients,
+         * of factories from which to make instances of any extensions
+         * supported by the server other than those registered with the
+         * client itself.
+         */
+        std::shared_ptr< const ExtensionRegistry > extensionRegistry;
+
+        /**
+         * This indicates whether or not the client speaks LMTP (RFC 2033)
+         * rather than SMTP.
          */
-        std::map< std::string, std::shared_ptr< Extension > > extensions;
+        bool lmtpMode = false;
 
         /**
-         * These are the names of the SMTP extensions that the server supports
-         * and that the client has registered.
+         * If not nullptr, this is the function to call to report the
+         * outcome of an e-mail for each of its recipients.
          */
-        std::set< std::string > supportedExtensionNames;
+        RecipientOutcomeDelegate recipientOutcomeDelegate;
+
+        /**
+         * These are the SMTP extensions that the server supports and that
+         * the client has registered (or made from a registered factory for
+         * the current connection), keyed by name.
+         */
+        std::map< std::string, std::shared_ptr< Extension > > supportedExtensions;
 
         /**
          * This is the object used to establish new network connections to SMTP
@@ -147,6 +641,65 @@ namespace Smtp {
          */
         std::shared_ptr< Transport > transport;
 
+        /**
+         * If not nullptr, this is the object in which to record how well
+         * the SMTP servers to which the client connects are performing.
+         */
+        std::shared_ptr< DestinationHealth > destinationHealth;
+
+        /**
+         * This is the name of the SMTP server's host, as given to Connect.
+         */
+        std::string serverHostName;
+
+        /**
+         * This identifies the current connection to the SMTP server in
+         * static tracepoints.
+         */
+        uint64_t connectionId = 0;
+
+        /**
+         * If not nullptr, this is the object to which to hand timed spans
+         * describing the phases of the client's work.
+         */
+        std::shared_ptr< SpanSink > spanSink;
+
+        /**
+         * This identifies the current connection in spans.
+         */
+        std::string connectionTraceId;
+
+        /**
+         * This is the time at which the current phase of the connection
+         * (greeting or EHLO) started, for spans.
+         */
+        std::chrono::steady_clock::time_point connectionPhaseStarted;
+
+        /**
+         * This indicates whether or not the client is waiting for the
+         * server's reply to the EHLO command, for spans.
+         */
+        bool ehloSpanPending = false;
+
+        /**
+         * This is the name of the extension which is currently talking
+         * to the SMTP server, if any.
+         */
+        std::string activeExtensionName;
+
+        /**
+         * This is the time at which the current extension protocol stage
+         * started, for spans.
+         */
+        std::chrono::steady_clock::time_point extensionStageStarted;
+
+        /**
+         * This is the time at which the client last moved to a new stage
+         * in the SMTP protocol, or, while awaiting the reply to an e-mail,
+         * finished sending its message data.
+         */
+        std::chrono::steady_clock::time_point protocolStageStarted;
+
         /**
          * This is the interface to the next layer down in protocols
          * (either the TLS layer or the TCP layer, depending on whether
@@ -161,17 +714,83 @@ namespace Smtp {
          */
         ReadyOrBrokenPromises readyOrBrokenPromises;
 
-        /**
-         * This is set when the SMTP client is finished sending an e-mail.
-         */
-        std::promise< bool > sendCompleted;
-
         /**
          * This holds any data received from the server, before that data
          * has been chopped up into lines.
          */
         std::vector< uint8_t > dataReceived;
 
+        /**
+         * These are replies received from the server which are held back
+         * while an extension finishes handling an earlier one.
+         */
+        std::deque< Client::ParsedMessage > repliesHeldBack;
+
+        /**
+         * This indicates whether or not an extension is still handling
+         * a reply received from the server.
+         */
+        bool replyHandlingPending = false;
+
+        /**
+         * This is set while replies received from the server are being
+         * handled, so that an extension finishing with a reply right away
+         * doesn't cause the next one to be handled out of turn.
+         */
+        bool handlingReplies = false;
+
+        /**
+         * These are messages to be sent to the server which are held back
+         * behind the first one, which is being processed by extensions.
+         */
+        std::deque< OutgoingMessage > outgoingMessages;
+
+        /**
+         * This indicates whether or not an extension is still modifying
+         * the first of the messages held back.
+         */
+        bool messageModificationPending = false;
+
+        /**
+         * This is set while messages held back are being processed by
+         * extensions, so that an extension finishing with a message right
+         * away doesn't cause the next one to be processed out of turn.
+         */
+        bool processingOutgoingMessages = false;
+
+        /**
+         * This is incremented whenever the connection to the server is
+         * dropped or replaced, so that results delivered late by
+         * extensions for an earlier connection are ignored.
+         */
+        uint64_t hookGeneration = 0;
+
+        /**
+         * This is set while the client waits for the connection to send
+         * everything queued, before queueing the next chunk of the body
+         * of the e-mail whose message data is being sent.
+         */
+        bool waitingForDrain = false;
+
+        /**
+         * This is set while the client asks the connection to report when
+         * everything queued has been sent, so that a report made right
+         * away is noted rather than handled out of turn.
+         */
+        bool requestingDrainNotification = false;
+
+        /**
+         * This holds the lines received so far of a reply from the server
+         * made up of several lines, put together into one reply.
+         */
+        Client::ParsedMessage replyInProgress;
+
+        /**
+         * This is the number of lines received so far of the reply
+         * from the server that is in progress.
+         */
+        size_t replyLinesReceived = 0;
+
         /**
          * This holds any information that needs to be shared between the
          * protocol handler and any extensions.
@@ -186,24 +805,37 @@ namespace Smtp {
         std::shared_ptr< Extension > activeExtension;
 
         /**
-         * This is a copy of the headers for the e-mail currently being sent.
+         * These are the e-mails handed to SendMail which the server has not
+         * yet given its final reply about.  The one at the front is the
+         * e-mail currently being sent.
+         */
+        std::deque< Transaction > transactions;
+
+        /**
+         * This indicates whether or not the server supports command
+         * pipelining (RFC 2920), in which case the client sends envelope
+         * commands in groups rather than waiting for each reply.
          */
-        MessageHeaders::MessageHeaders headers;
+        bool pipeliningSupported = false;
 
         /**
-         * This is a copy of the body of the e-mail currently being sent.  It
-         * has been processed so that all lines end in a CRLF and
-         * "dot-stuffing" is performed (extra '.' added at the beginning of a
-         * line if that line started with '.', as described in RFC 5321 section
-         * 4.5.2).
+         * This holds messages to be sent to the server the next time
+         * FlushQueuedMessages is called, so that they go out in a single
+         * write.
          */
-        std::string body;
+        std::vector< uint8_t > queuedMessages;
 
         /**
-         * This holds the e-mail addresses of the recipients of the e-mail
-         * currently being sent, that have not yet been given to the server.
+         * This is the identifier to give the next e-mail handed to SendMail.
          */
-        std::queue< std::string > recipients;
+        uint64_t nextTransactionId = 1;
+
+        /**
+         * This function is called to end the subscription to the
+         * cancellation of the token given to Connect, once the connection
+         * is ready.
+         */
+        CancellationToken::UnsubscribeDelegate unsubscribeConnectCancellation;
 
         // Methods
 
@@ -215,6 +847,90 @@ namespace Smtp {
         {
         }
 
+        /**
+         * Make up a new identifier for a trace.
+         *
+         * @return
+         *     A new trace identifier is returned.
+         */
+        std::string NewTraceId() {
+            char buffer[33];
+            (void)snprintf(
+                buffer,
+                sizeof(buffer),
+                "%016llx%016llx",
+                (unsigned long long)RandomTraceIdPart(),
+                (unsigned long long)RandomTraceIdPart()
+            );
+            return buffer;
+        }
+
+        /**
+         * Hand a span to the span sink, if there is one.
+         *
+         * @param[in] traceId
+         *     This identifies the connection or e-mail to which the
+         *     span belongs.
+         *
+         * @param[in] name
+         *     This is the name of the phase.
+         *
+         * @param[in] start
+         *     This is the time at which the phase started.  The phase
+         *     is taken to have ended now.
+         *
+         * @param[in] attributes
+         *     These are additional facts about the phase.  The name of
+         *     the server's host is added to them, along with the address
+         *     of the server, if connected, and the trace identifier of
+         *     the connection, if the span belongs to an e-mail.
+         */
+        void RecordSpan(
+            const std::string& traceId,
+            const char* name,
+            std::chrono::steady_clock::time_point start,
+            std::map< std::string, std::string > attributes = {}
+        ) {
+            if (spanSink == nullptr) {
+                return;
+            }
+            SpanSink::Span span;
+            span.traceId = traceId;
+            span.name = name;
+            span.start = start;
+            span.duration = std::chrono::steady_clock::now() - start;
+            attributes["host"] = serverHostName;
+            if (serverConnection != nullptr) {
+                const auto addressLiteral = FormatAddressLiteral(serverConnection->GetPeerAddress());
+                attributes["peer"] = addressLiteral.substr(1, addressLiteral.length() - 2);
+            }
+            if (traceId != connectionTraceId) {
+                attributes["connection"] = connectionTraceId;
+            }
+            span.attributes = std::move(attributes);
+            spanSink->RecordSpan(span);
+        }
+
+        /**
+         * Hand the span for the EHLO command to the span sink, if the
+         * client was waiting for the server's reply to it.
+         *
+         * @param[in] code
+         *     This is the code of the server's reply.
+         */
+        void RecordEhloSpan(int code) {
+            if (!ehloSpanPending) {
+                return;
+            }
+            ehloSpanPending = false;
+            RecordSpan(
+                connectionTraceId,
+                "ehlo",
+                connectionPhaseStarted,
+                {{"code", std::to_string(code)}}
+            );
+        }
+
         /**
          * Take the current ready-or-broken promises and return them, placing
          * an empty collection in its place.
@@ -229,14 +945,57 @@ namespace Smtp {
             return promisesReturned;
         }
 
+        /**
+         * Publish the outcome of the given e-mail and stop listening for
+         * its cancellation.  The caller is responsible for removing the
+         * e-mail from the transaction queue.
+         *
+         * @param[in,out] transaction
+         *     This is the e-mail whose outcome is known.
+         *
+         * @param[in] success
+         *     This indicates whether or not the e-mail was sent.
+         */
+        static void CompleteTransaction(
+            Transaction& transaction,
+            bool success
+        ) {
+            if (transaction.unsubscribeCancellation != nullptr) {
+                transaction.unsubscribeCancellation();
+                transaction.unsubscribeCancellation = nullptr;
+            }
+            transaction.sendCompleted.set_value(success);
+            if (transaction.sendResult != nullptr) {
+                if (success) {
+                    transaction.sendResult->set_value(SendResult::Sent);
+                } else if (
+                    transaction.rejectedPermanently
+                    && !transaction.rejectedTransiently
+                    && !transaction.cancelled
+                ) {
+                    transaction.sendResult->set_value(SendResult::PermanentFailure);
+                } else {
+                    transaction.sendResult->set_value(SendResult::TransientFailure);
+                }
+            }
+        }
+
         /**
          * Handle a failure in communication with the SMTP server.
          */
         void OnHardFailure() {
+            SMTP_PROBE2(hard_failure, connectionId, (int)currentMessageContext.protocolStage);
             auto promises = SwapOutReadyOrBrokenPromises();
             for (auto& promise: promises) {
                 promise.set_value(false);
             }
+            for (auto& transaction: transactions) {
+                CompleteTransaction(transaction, false);
+            }
+            transactions.clear();
+            queuedMessages.clear();
+            DropPendingHooks();
+            currentMessageContext.protocolStage = Client::ProtocolStage::Greeting;
             if (serverConnection != nullptr) {
                 serverConnection->Close();
             }
@@ -247,6 +1006,10 @@ namespace Smtp {
          * to process the next message.
          */
         void OnReady() {
+            if (unsubscribeConnectCancellation != nullptr) {
+                unsubscribeConnectCancellation();
+                unsubscribeConnectCancellation = nullptr;
+            }
             auto promises = SwapOutReadyOrBrokenPromises();
             for (auto& promise: promises) {
                 promise.set_value(true);
@@ -262,18 +1025,55 @@ namespace Smtp {
          */
         void TransitionProtocolStage(Client::ProtocolStage nextProtocolStage) {
             activeExtension = nullptr;
+            if (currentMessageContext.protocolStage != nextProtocolStage) {
+                SMTP_PROBE3(
+                    stage,
+                    connectionId,
+                    (int)currentMessageContext.protocolStage,
+                    (int)nextProtocolStage
+                );
+                protocolStageStarted = std::chrono::steady_clock::now();
+            }
             currentMessageContext.protocolStage = nextProtocolStage;
-            for (const auto& supportedExtensionName: supportedExtensionNames) {
-                const auto extension = extensions[supportedExtensionName];
+            if (IsPipelinedGroupOutstanding()) {
+                return;
+            }
+            for (const auto& supportedExtension: supportedExtensions) {
+                const auto& extension = supportedExtension.second;
                 if (
                     extension->IsExtraProtocolStageNeededHere(
                         currentMessageContext
                     )
                 ) {
                     activeExtension = extension;
+                    activeExtensionName = supportedExtension.first;
+                    extensionStageStarted = std::chrono::steady_clock::now();
+                    std::weak_ptr< Impl > implWeak(shared_from_this());
+                    const auto generation = hookGeneration;
                     activeExtension->GoAhead(
-                        std::bind(&Impl::SendMessageDirectlyWithoutLogging, this, std::placeholders::_1),
-                        std::bind(&Impl::OnExtensionStageComplete, this, std::placeholders::_1)
+                        [implWeak, generation](const std::string& data){
+                            const auto impl = implWeak.lock();
+                            if (impl == nullptr) {
+                                return;
+                            }
+                            std::lock_guard< decltype(impl->mutex) > lock(impl->mutex);
+                            if (generation != impl->hookGeneration) {
+                                return;
+                            }
+                            impl->QueueDataWithoutLogging(data.data(), data.length());
+                            impl->FlushQueuedMessages();
+                        },
+                        [implWeak, generation](bool success){
+                            const auto impl = implWeak.lock();
+                            if (impl == nullptr) {
+                                return;
+                            }
+                            std::lock_guard< decltype(impl->mutex) > lock(impl->mutex);
+                            if (generation != impl->hookGeneration) {
+                                return;
+                            }
+                            impl->OnExtensionStageComplete(success);
+                        }
                     );
                     break;
                 }
@@ -282,8 +1082,87 @@ namespace Smtp {
                 (currentMessageContext.protocolStage == Client::ProtocolStage::ReadyToSend)
                 && (activeExtension == nullptr)
             ) {
-                OnReady();
+                if (transactions.empty()) {
+                    ReleaseIdleBuffers();
+                    OnReady();
+                } else {
+                    StartTransaction();
+                }
+            }
+        }
+
+        /**
+         * Give back any memory held in buffers which are empty once there
+         * are no more e-mails to send, so that an idle client takes up as
+         * little memory as possible.  Buffers holding data still in
+         * progress (such as part of a reply from the server) are kept.
+         */
+        void ReleaseIdleBuffers() {
+            if (dataReceived.empty()) {
+                dataReceived.shrink_to_fit();
+            }
+            if (repliesHeldBack.empty()) {
+                std::deque< Client::ParsedMessage >().swap(repliesHeldBack);
+            }
+            if (outgoingMessages.empty()) {
+                std::deque< OutgoingMessage >().swap(outgoingMessages);
+            }
+            if (replyLinesReceived == 0) {
+                replyInProgress.text.shrink_to_fit();
             }
+            queuedMessages.shrink_to_fit();
+            transactions.shrink_to_fit();
+            activeExtensionName.clear();
+            activeExtensionName.shrink_to_fit();
+        }
+
+        /**
+         * Return an estimate of the memory held by the client.
+         *
+         * @return
+         *     An estimate of the number of bytes of memory held by the
+         *     client is returned.
+         */
+        size_t GetMemoryFootprint() const {
+            size_t footprint = (
+                sizeof(Impl)
+                + dataReceived.capacity()
+                + queuedMessages.capacity()
+                + replyInProgress.text.capacity()
+                + serverHostName.capacity()
+                + connectionTraceId.capacity()
+                + activeExtensionName.capacity()
+            );
+            if (keywordExtensions != nullptr) {
+                footprint += KEYWORD_COUNT * sizeof(RegisteredExtension);
+            }
+            for (const auto& transaction: transactions) {
+                footprint += sizeof(Transaction);
+                if (transaction.body != nullptr) {
+                    footprint += transaction.body->capacity();
+                }
+                footprint += transaction.bodyFile.path.capacity();
+                footprint += transaction.recipients.GetMemoryFootprint();
+            }
+            return footprint;
+        }
+
+        /**
+         * Determine whether or not the server still owes replies to a group
+         * of pipelined commands.  Extensions are not offered custom protocol
+         * stages at such times, because the server's replies to the rest
+         * of the group are already on their way.
+         *
+         * @return
+         *     An indication of whether or not the server still owes replies
+         *     to a group of pipelined commands is returned.
+         */
+        bool IsPipelinedGroupOutstanding() const {
+            return (
+                !transactions.empty()
+                && transactions.front().pipelined
+                && (transactions.front().repliesPending > 0)
+            );
         }
 
         /**
@@ -299,7 +1178,11 @@ namespace Smtp {
          * attempt another transaction if it wants to.
          */
         void OnSoftFailure() {
-            sendCompleted.set_value(false);
+            SMTP_PROBE2(soft_failure, connectionId, (int)currentMessageContext.protocolStage);
+            if (!transactions.empty()) {
+                CompleteTransaction(transactions.front(), false);
+                transactions.pop_front();
+            }
             OnMessageReady();
         }
 
@@ -312,6 +1195,19 @@ namespace Smtp {
          *     to the next stage.
          */
         void OnExtensionStageComplete(bool success) {
+            RecordSpan(
+                (
+                    transactions.empty()
+                    ? connectionTraceId
+                    : transactions.front().traceId
+                ),
+                "extension",
+                extensionStageStarted,
+                {
+                    {"extension", activeExtensionName},
+                    {"success", (success ? "true" : "false")},
+                }
+            );
             if (success) {
                 TransitionProtocolStage(currentMessageContext.protocolStage);
             } else {
@@ -320,403 +1216,1665 @@ namespace Smtp {
         }
 
         /**
-         * Append the given data to the reassembly buffer.
-         * Then extract and return any completed lines of text.
+         * Append the given data to the reassembly buffer.  Then extract
+         * any completed lines of text, and put them together into
+         * complete replies from the server.  A reply made up of several
+         * lines is only produced once its last line is received.
          *
          * @param[in] data
          *     This is the sequence of raw bytes received from the server.
          *
+         * @param[out] parsedMessages
+         *     This is where to store the completed replies.
+         *
          * @return
-         *     A collection of completed lines of text reassembled from
-         *     the data received now and previously is returned.
+         *     An indication of whether or not the data received so far
+         *     was valid is returned.
+         *
+         * @note
+         *     If a problem was detected, a failure event will be published,
+         *     and the connection to the server closed.
          */
-        std::vector< std::string > AssembleLinesReceived(
-            const std::vector< uint8_t >& data
+        bool DisassembleRepliesReceived(
+            const std::vector< uint8_t >& data,
+            std::vector< Client::ParsedMessage >& parsedMessages
         ) {
-            std::vector< std::string > linesReceived;
             dataReceived.insert(
                 dataReceived.end(),
                 data.begin(),
                 data.end()
             );
-            while (!dataReceived.empty()) {
-                auto cr = std::find(
-                    dataReceived.begin(),
-                    dataReceived.end(),
-                    (uint8_t)'\r'
-                );
-                if (
-                    (cr == dataReceived.end())
-                    || (cr + 1 == dataReceived.end())
-                    || (*(cr + 1) != '\n')
-                ) {
-                    break;
-                }
-                linesReceived.push_back(
-                    std::string(
-                        dataReceived.begin(),
-                        cr + 2
+            const auto begin = (const char*)dataReceived.data();
+            const auto end = begin + dataReceived.size();
+            auto lineStart = begin;
+            for (;;) {
+                auto searchStart = lineStart;
+                const char* cr = nullptr;
+                for (;;) {
+                    cr = (const char*)memchr(searchStart, '\r', end - searchStart);
+                    if (
+                        (cr == nullptr)
+                        || (cr + 1 == end)
+                        || (cr[1] == '\n')
+                    ) {
+                        break;
+                    }
+                    searchStart = cr + 1;
+                }
+                if (
+                    (cr == nullptr)
+                    || (cr + 1 == end)
+                ) {
+                    break;
+                }
+                const auto lineLength = (size_t)(cr - lineStart);
+                if (!activeExtension) {
+                    diagnosticsSender.SendDiagnosticInformationString(
+                        1,
+                        "S: " + std::string(lineStart, lineLength)
+                    );
+                }
+                bool valid = (
+                    (lineLength >= 4)
+                    && (
+                        (lineStart[3] == '-')
+                        || (lineStart[3] == ' ')
                     )
                 );
-                (void)dataReceived.erase(
-                    dataReceived.begin(),
-                    cr + 2
+                int code = 0;
+                for (size_t i = 0; valid && (i < 3); ++i) {
+                    if (
+                        (lineStart[i] < '0')
+                        || (lineStart[i] > '9')
+                    ) {
+                        valid = false;
+                    } else {
+                        code = code * 10 + (lineStart[i] - '0');
+                    }
+                }
+                if (!valid) {
+                    OnHardFailure();
+                    return false;
+                }
+                if (replyLinesReceived > 0) {
+                    replyInProgress.text += '\n';
+                }
+                ++replyLinesReceived;
+                replyInProgress.code = code;
+                replyInProgress.text.append(lineStart + 4, lineLength - 4);
+                if (lineStart[3] == ' ') {
+                    parsedMessages.push_back(std::move(replyInProgress));
+                    replyInProgress = Client::ParsedMessage();
+                    replyLinesReceived = 0;
+                }
+                lineStart = cr + 2;
+            }
+            (void)dataReceived.erase(
+                dataReceived.begin(),
+                dataReceived.begin() + (lineStart - begin)
+            );
+            return true;
+        }
+
+        /**
+         * Go through the lines of the server's reply to the EHLO (or LHLO)
+         * command, picking out the extensions the server supports, and
+         * configuring the matching extensions the client has.
+         *
+         * @param[in] text
+         *     This is the text of the server's reply, with one line
+         *     for each extension after the first line, which identifies
+         *     the server.
+         */
+        void ParseOptions(const std::string& text) {
+            const auto begin = text.data();
+            const auto end = begin + text.length();
+            auto lineStart = (const char*)memchr(begin, '\n', text.length());
+            while (lineStart != nullptr) {
+                ++lineStart;
+                auto lineEnd = (const char*)memchr(lineStart, '\n', end - lineStart);
+                if (lineEnd == nullptr) {
+                    lineEnd = end;
+                }
+                auto delimiter = (const char*)memchr(lineStart, ' ', lineEnd - lineStart);
+                auto parametersStart = delimiter + 1;
+                if (delimiter == nullptr) {
+                    delimiter = lineEnd;
+                    parametersStart = lineEnd;
+                }
+                const auto nameLength = (size_t)(delimiter - lineStart);
+                const auto keyword = FindKeyword(lineStart, nameLength);
+                if (keyword == Keyword::Pipelining) {
+                    pipeliningSupported = true;
+                }
+                const auto registeredExtension = FindRegisteredExtension(
+                    keyword,
+                    lineStart,
+                    nameLength
+                );
+                std::shared_ptr< Extension > extension;
+                std::string extensionName;
+                if (registeredExtension != nullptr) {
+                    extension = (
+                        (registeredExtension->extension == nullptr)
+                        ? registeredExtension->factory()
+                        : registeredExtension->extension
+                    );
+                    extensionName = registeredExtension->name;
+                } else if (extensionRegistry != nullptr) {
+                    extensionName.assign(lineStart, nameLength);
+                    const auto factory = extensionRegistry->Find(extensionName);
+                    if (factory != nullptr) {
+                        extension = factory();
+                    }
+                }
+                if (extension != nullptr) {
+                    supportedExtensions[extensionName] = extension;
+                    extension->Configure(
+                        std::string(parametersStart, lineEnd - parametersStart)
+                    );
+                }
+                lineStart = (
+                    (lineEnd == end)
+                    ? nullptr
+                    : lineEnd
                 );
             }
-            return linesReceived;
         }
 
         /**
-         * Break up the given lines of text received from the SMTP server,
-         * and detect if there is any problem.
+         * Send the given message to the SMTP server without processing it
+         * with any extensions.
          *
-         * @param[in] lines
-         *     These are the lines of text received from the SMTP server.
+         * @param[in] message
+         *     This is the message to send.  Each line of the message should
+         *     have a newline at the end.
+         */
+        void SendMessageDirectly(const std::string& message) {
+            QueueMessageDirectly(message);
+            FlushQueuedMessages();
+        }
+
+        /**
+         * Hold onto the given message, without processing it with any
+         * extensions, until the next time FlushQueuedMessages is called.
          *
-         * @param[out] parsedMessages
-         *     This is where to store the disassembled messages.
+         * @param[in] message
+         *     This is the message to send.  Each line of the message should
+         *     have a newline at the end.
+         */
+        void QueueMessageDirectly(const std::string& message) {
+            diagnosticsSender.SendDiagnosticInformationString(
+                1,
+                "C: " + message.substr(0, message.length() - 2)
+            );
+            QueueDataWithoutLogging(message.data(), message.length());
+        }
+
+        /**
+         * Hold onto the given data, without processing it with any extensions
+         * and without publishing any diagnostic messages, until the next time
+         * FlushQueuedMessages is called.  If any messages are held back
+         * while an extension modifies one, the data is held back behind
+         * them.
          *
-         * @return
-         *     An indication of whether or not a problem was detected
-         *     is returned.
+         * @param[in] data
+         *     This points to the data to send.
          *
-         * @note
-         *     If a problem was detected, a failure event will be published,
-         *     and the connection to the server closed.
+         * @param[in] length
+         *     This is the number of bytes of data to send.
          */
-        bool DisassembleMessagesReceived(
-            const std::vector< std::string >& lines,
-            std::vector< Client::ParsedMessage >& parsedMessages
+        void QueueDataWithoutLogging(
+            const char* data,
+            size_t length
         ) {
-            for (const auto& line: lines) {
-                if (!activeExtension) {
+            if (!outgoingMessages.empty()) {
+                OutgoingMessage outgoingMessage;
+                outgoingMessage.text.assign(data, length);
+                outgoingMessages.push_back(std::move(outgoingMessage));
+                return;
+            }
+            AppendQueuedData(data, length);
+        }
+
+        /**
+         * Add the given data to the end of the data to send the next time
+         * FlushQueuedMessages is called.
+         *
+         * @param[in] data
+         *     This points to the data to send.
+         *
+         * @param[in] length
+         *     This is the number of bytes of data to send.
+         */
+        void AppendQueuedData(
+            const char* data,
+            size_t length
+        ) {
+            queuedMessages.insert(
+                queuedMessages.end(),
+                (const uint8_t*)data,
+                (const uint8_t*)data + length
+            );
+        }
+
+        /**
+         * Send any messages held by QueueMessageDirectly to the SMTP server,
+         * all together in a single write.
+         */
+        void FlushQueuedMessages() {
+            if (queuedMessages.empty()) {
+                return;
+            }
+            SMTP_PROBE3(
+                send,
+                connectionId,
+                (int)currentMessageContext.protocolStage,
+                queuedMessages.size()
+            );
+            serverConnection->SendMessage(queuedMessages);
+            queuedMessages.clear();
+        }
+
+        /**
+         * Process the given message through all supported and registered
+         * extensions, and then hold onto it until the next time
+         * FlushQueuedMessages is called.
+         *
+         * @note
+         *     A newline is added to the processed message before it's queued.
+         *
+         * @param[in] input
+         *     This is the message to be processed and then queued.  It does
+         *     not have a newline at the end.
+         */
+        void QueueMessageThroughExtensions(std::string input) {
+            if (
+                supportedExtensions.empty()
+                && outgoingMessages.empty()
+            ) {
+                input += "\r\n";
+                QueueMessageDirectly(input);
+                return;
+            }
+            OutgoingMessage outgoingMessage;
+            outgoingMessage.text = std::move(input);
+            outgoingMessage.throughExtensions = true;
+            outgoingMessage.context = currentMessageContext;
+            outgoingMessages.push_back(std::move(outgoingMessage));
+            ProcessOutgoingMessages();
+        }
+
+        /**
+         * Have the supported extensions process the messages held back,
+         * in order, queueing each one to be sent once they're done with
+         * it, until one of the extensions needs time to finish.
+         */
+        void ProcessOutgoingMessages() {
+            processingOutgoingMessages = true;
+            while (
+                !outgoingMessages.empty()
+                && !messageModificationPending
+            ) {
+                auto& outgoingMessage = outgoingMessages.front();
+                if (
+                    outgoingMessage.throughExtensions
+                    && (outgoingMessage.extensionsApplied < supportedExtensions.size())
+                ) {
+                    auto supportedExtensionsEntry = supportedExtensions.begin();
+                    std::advance(
+                        supportedExtensionsEntry,
+                        outgoingMessage.extensionsApplied++
+                    );
+                    std::weak_ptr< Impl > implWeak(shared_from_this());
+                    const auto generation = hookGeneration;
+                    messageModificationPending = true;
+                    supportedExtensionsEntry->second->ModifyMessageAsync(
+                        outgoingMessage.context,
+                        outgoingMessage.text,
+                        [implWeak, generation](const std::string& output){
+                            const auto impl = implWeak.lock();
+                            if (impl == nullptr) {
+                                return;
+                            }
+                            std::lock_guard< decltype(impl->mutex) > lock(impl->mutex);
+                            impl->OnMessageModified(generation, output);
+                        }
+                    );
+                    continue;
+                }
+                auto text = std::move(outgoingMessage.text);
+                const auto throughExtensions = outgoingMessage.throughExtensions;
+                outgoingMessages.pop_front();
+                if (throughExtensions) {
                     diagnosticsSender.SendDiagnosticInformationString(
                         1,
-                        "S: " + line.substr(0, line.length() - 2)
+                        "C: " + text
                     );
+                    text += "\r\n";
                 }
-                Client::ParsedMessage parsedMessage;
-                if (
-                    (line.length() < 4)
-                    || (sscanf(line.c_str(), "%d", &parsedMessage.code) != 1)
-                ) {
+                AppendQueuedData(text.data(), text.length());
+            }
+            processingOutgoingMessages = false;
+        }
+
+        /**
+         * Handle an extension delivering the result of modifying the first
+         * of the messages held back.  If the extension took its time,
+         * carry on processing the messages held back, and send whatever
+         * is ready.
+         *
+         * @param[in] generation
+         *     This identifies the connection for which the message
+         *     was modified.
+         *
+         * @param[in] output
+         *     This is the message as modified by the extension.
+         */
+        void OnMessageModified(
+            uint64_t generation,
+            const std::string& output
+        ) {
+            if (
+                (generation != hookGeneration)
+                || !messageModificationPending
+            ) {
+                return;
+            }
+            messageModificationPending = false;
+            outgoingMessages.front().text = output;
+            if (!processingOutgoingMessages) {
+                ProcessOutgoingMessages();
+                FlushQueuedMessages();
+            }
+        }
+
+        /**
+         * Forget any messages held back for extensions, and ignore any
+         * results extensions deliver late, because the connection to the
+         * server has been dropped or replaced.
+         */
+        void DropPendingHooks() {
+            ++hookGeneration;
+            outgoingMessages.clear();
+            messageModificationPending = false;
+            repliesHeldBack.clear();
+            replyHandlingPending = false;
+            waitingForDrain = false;
+        }
+
+        /**
+         * Process the given message through all supported and registered
+         * extensions, and then send it to the SMTP server.
+         *
+         * @note
+         *     A newline is added to the processed message before it's sent.
+         *
+         * @param[in] input
+         *     This is the message to be processed and then sent.  It does not
+         *     have a newline at the end.
+         */
+        void SendMessageThroughExtensions(std::string input) {
+            QueueMessageThroughExtensions(std::move(input));
+            FlushQueuedMessages();
+        }
+
+        /**
+         * Record in the destination health object, if any, what the given
+         * message from the SMTP server says about how well the server is
+         * performing.
+         *
+         * @param[in] parsedMessage
+         *     This is the message received from the SMTP server.
+         */
+        void RecordDestinationHealth(const Client::ParsedMessage& parsedMessage) {
+            if (destinationHealth == nullptr) {
+                return;
+            }
+            switch (currentMessageContext.protocolStage) {
+                case ProtocolStage::Greeting: {
+                    destinationHealth->RecordGreeting(
+                        serverHostName,
+                        std::chrono::steady_clock::now() - protocolStageStarted,
+                        parsedMessage.code
+                    );
+                } break;
+
+                case ProtocolStage::DeclaringSender:
+                case ProtocolStage::DeclaringRecipients:
+                case ProtocolStage::SendingData: {
+                    destinationHealth->RecordReply(
+                        serverHostName,
+                        parsedMessage.code
+                    );
+                } break;
+
+                case ProtocolStage::AwaitingSendResponse: {
+                    destinationHealth->RecordFinalReply(
+                        serverHostName,
+                        std::chrono::steady_clock::now() - protocolStageStarted,
+                        parsedMessage.code
+                    );
+                } break;
+
+                default: {
+                    if (parsedMessage.code == 421) {
+                        destinationHealth->RecordReply(
+                            serverHostName,
+                            parsedMessage.code
+                        );
+                    }
+                } break;
+            }
+        }
+
+        /**
+         * Handle the receipt of raw bytes from the underlying transport
+         * layer.
+         *
+         * @param[in] message
+         *     This holds the raw bytes received from the transport layer.
+         */
+        void OnMessageReceived(const std::vector< uint8_t >& message) {
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            SMTP_PROBE2(receive, connectionId, message.size());
+            std::vector< ParsedMessage > parsedMessages;
+            if (!DisassembleRepliesReceived(message, parsedMessages)) {
+                return;
+            }
+            for (auto& parsedMessage: parsedMessages) {
+                repliesHeldBack.push_back(std::move(parsedMessage));
+            }
+            HandleRepliesHeldBack();
+        }
+
+        /**
+         * Handle the replies received from the server which have not yet
+         * been handled, in order, until an extension needs time to finish
+         * handling one of them.
+         */
+        void HandleRepliesHeldBack() {
+            handlingReplies = true;
+            while (
+                !repliesHeldBack.empty()
+                && !replyHandlingPending
+            ) {
+                const auto parsedMessage = std::move(repliesHeldBack.front());
+                repliesHeldBack.pop_front();
+                if (!HandleReply(parsedMessage)) {
+                    repliesHeldBack.clear();
+                    break;
+                }
+            }
+            handlingReplies = false;
+        }
+
+        /**
+         * Handle an extension delivering the outcome of handling a reply
+         * received from the server.  If the extension took its time, carry
+         * on handling any replies held back in the meantime.
+         *
+         * @param[in] generation
+         *     This identifies the connection on which the reply
+         *     was received.
+         *
+         * @param[in] success
+         *     This indicates whether or not the extension handled the
+         *     reply successfully.
+         */
+        void OnReplyHandledByExtension(
+            uint64_t generation,
+            bool success
+        ) {
+            if (
+                (generation != hookGeneration)
+                || !replyHandlingPending
+            ) {
+                return;
+            }
+            replyHandlingPending = false;
+            if (!success) {
+                OnHardFailure();
+                return;
+            }
+            if (!handlingReplies) {
+                HandleRepliesHeldBack();
+            }
+        }
+
+        /**
+         * Handle the given reply received from the server.
+         *
+         * @param[in] parsedMessage
+         *     This is the reply received from the server.
+         *
+         * @return
+         *     An indication of whether or not to carry on handling
+         *     any later replies is returned.
+         */
+        bool HandleReply(const Client::ParsedMessage& parsedMessage) {
+            SMTP_PROBE3(
+                reply,
+                connectionId,
+                (int)currentMessageContext.protocolStage,
+                parsedMessage.code
+            );
+            if (activeExtension) {
+                std::weak_ptr< Impl > implWeak(shared_from_this());
+                const auto generation = hookGeneration;
+                replyHandlingPending = true;
+                activeExtension->HandleServerMessageAsync(
+                    currentMessageContext,
+                    parsedMessage,
+                    [implWeak, generation](bool success){
+                        const auto impl = implWeak.lock();
+                        if (impl == nullptr) {
+                            return;
+                        }
+                        std::lock_guard< decltype(impl->mutex) > lock(impl->mutex);
+                        impl->OnReplyHandledByExtension(generation, success);
+                    }
+                );
+                return true;
+            }
+            RecordDestinationHealth(parsedMessage);
+            switch (currentMessageContext.protocolStage) {
+                case ProtocolStage::Greeting: {
+                    RecordSpan(
+                        connectionTraceId,
+                        "greeting",
+                        connectionPhaseStarted,
+                        {{"code", std::to_string(parsedMessage.code)}}
+                    );
+                    if (parsedMessage.code == 220) {
+                        connectionPhaseStarted = std::chrono::steady_clock::now();
+                        ehloSpanPending = true;
+                        const auto addressLiteral = FormatAddressLiteral(
+                            serverConnection->GetBoundAddress()
+                        );
+                        SendMessageDirectly(
+                            lmtpMode
+                            ? BuildCommand("LHLO ", addressLiteral, "\r\n")
+                            : BuildCommand("EHLO ", addressLiteral, "\r\n")
+                        );
+                        TransitionProtocolStage(ProtocolStage::Options);
+                    } else {
+                        OnHardFailure();
+                        return false;
+                    }
+                } break;
+
+                case ProtocolStage::HelloResponse:
+                case ProtocolStage::Options: {
+                    RecordEhloSpan(parsedMessage.code);
+                    if (parsedMessage.code == 250) {
+                        ParseOptions(parsedMessage.text);
+                        OnMessageReady();
+                    } else {
+                        OnHardFailure();
+                        return false;
+                    }
+                } break;
+
+                case ProtocolStage::DeclaringSender:
+                case ProtocolStage::DeclaringRecipients: {
+                    OnEnvelopeReply(parsedMessage);
+                } break;
+
+                case ProtocolStage::SendingData: {
+                    if (parsedMessage.code == 354) {
+                        if (transactions.front().cancelled) {
+                            AbandonMessageData();
+                            return false;
+                        }
+                        TransitionProtocolStage(ProtocolStage::AwaitingSendResponse);
+                        auto& transaction = transactions.front();
+                        QueueMessageDirectly(transaction.headers.GenerateRawHeaders());
+                        if (
+                            !StartBody(transaction)
+                            || !FeedBody()
+                        ) {
+                            AbandonMessageData();
+                            return false;
+                        }
+                    } else if (transactions.front().resetSent) {
+                        OnSoftFailure();
+                    } else {
+                        transactions.front().NoteRejection(parsedMessage.code);
+                        RecordSpan(
+                            transactions.front().traceId,
+                            "data",
+                            transactions.front().phaseStarted,
+                            {{"code", std::to_string(parsedMessage.code)}}
+                        );
+                        SendReset(transactions.front());
+                    }
+                } break;
+
+                case ProtocolStage::AwaitingSendResponse: {
+                    auto& transaction = transactions.front();
+                    if (!OnFinalReply(transaction, parsedMessage)) {
+                        break;
+                    }
+                    RecordSpan(
+                        transaction.traceId,
+                        "final-reply",
+                        transaction.phaseStarted,
+                        {{"code", std::to_string(parsedMessage.code)}}
+                    );
+                    CompleteTransaction(transaction, transaction.delivered);
+                    transactions.pop_front();
+                    if (
+                        !transactions.empty()
+                        && transactions.front().envelopeSent
+                    ) {
+                        TransitionProtocolStage(ProtocolStage::DeclaringSender);
+                    } else {
+                        OnMessageReady();
+                    }
+                } break;
+
+                default: {
                     OnHardFailure();
                     return false;
                 }
-                switch (line[3]) {
-                    case '-': {
-                        parsedMessage.last = false;
-                        break;
+            }
+            return true;
+        }
+
+        /**
+         * Find what has been registered for use by the client under the
+         * given name of an SMTP extension supported by the server.
+         * Registered keywords are found by slot, without allocating
+         * memory.  Only other names are looked up by name.
+         *
+         * @param[in] keyword
+         *     This is the keyword recognized from the name, if any.
+         *
+         * @param[in] name
+         *     This points to the name of the extension supported
+         *     by the server.
+         *
+         * @param[in] length
+         *     This is the length of the name.
+         *
+         * @return
+         *     What has been registered under the given name is returned,
+         *     or nullptr is returned if nothing has been registered.
+         */
+        const RegisteredExtension* FindRegisteredExtension(
+            Keyword keyword,
+            const char* name,
+            size_t length
+        ) const {
+            const RegisteredExtension* registeredExtension = nullptr;
+            if (keyword == Keyword::Unknown) {
+                if (customExtensions.empty()) {
+                    return nullptr;
+                }
+                const auto customExtensionsEntry = customExtensions.find(
+                    std::string(name, length)
+                );
+                if (customExtensionsEntry == customExtensions.end()) {
+                    return nullptr;
+                }
+                registeredExtension = &customExtensionsEntry->second;
+            } else {
+                if (keywordExtensions == nullptr) {
+                    return nullptr;
+                }
+                registeredExtension = &keywordExtensions[(size_t)keyword];
+            }
+            if (
+                (registeredExtension->extension == nullptr)
+                && (registeredExtension->factory == nullptr)
+            ) {
+                return nullptr;
+            }
+            return registeredExtension;
+        }
+
+        /**
+         * Return the place in which to register an SMTP extension
+         * under the given name.
+         *
+         * @param[in] name
+         *     This is the name of the extension.
+         *
+         * @return
+         *     The place in which to register the extension is returned.
+         */
+        RegisteredExtension& GetRegisteredExtension(const std::string& name) {
+            const auto keyword = FindKeyword(name.data(), name.length());
+            if (
+                (keyword != Keyword::Unknown)
+                && (keywordExtensions == nullptr)
+            ) {
+                keywordExtensions.reset(new RegisteredExtension[KEYWORD_COUNT]);
+            }
+            auto& registeredExtension = (
+                (keyword == Keyword::Unknown)
+                ? customExtensions[name]
+                : keywordExtensions[(size_t)keyword]
+            );
+            registeredExtension.name = name;
+            return registeredExtension;
+        }
+
+        /**
+         * Handle the publishing of the event that the underlying transport
+         * layer was closed.
+         *
+         * @param[in] graceful
+         *     This indicates whether or not the connection was closed
+         *     without being reset by the peer.
+         */
+        void OnBroken(bool graceful) {
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            OnHardFailure();
+        }
+
+        /**
+         * Synchronously initiate a connection to an SMTP server.
+         *
+         * @param[in] serverHostName
+         *     This is the name of the SMTP server's host.
+         *
+         * @param[in] serverPortNumber
+         *     This is the TCP port number of the SMTP server.
+         *
+         * @return
+         *     An indication of whether or not the connection to the SMTP
+         *     server was successfully made is returned.
+         */
+        bool Connect(
+            const std::string& serverHostName,
+            const uint16_t serverPortNumber,
+            CancellationToken cancellationToken
+        ) {
+            if (cancellationToken.IsCancelled()) {
+                return false;
+            }
+            {
+                // Hook and drain completions from the previous connection
+                // may still be arriving, and they check the hook generation
+                // and the state below while holding the mutex.
+                std::lock_guard< decltype(mutex) > lock(mutex);
+                if (keywordExtensions != nullptr) {
+                    for (size_t i = 0; i < KEYWORD_COUNT; ++i) {
+                        const auto& extension = keywordExtensions[i].extension;
+                        if (extension != nullptr) {
+                            extension->Reset();
+                        }
+                    }
+                }
+                for (auto& customExtension: customExtensions) {
+                    if (customExtension.second.extension != nullptr) {
+                        customExtension.second.extension->Reset();
+                    }
+                }
+                supportedExtensions.clear();
+                pipeliningSupported = false;
+                DropPendingHooks();
+                dataReceived.clear();
+                replyInProgress = ParsedMessage();
+                replyLinesReceived = 0;
+                this->serverHostName = serverHostName;
+                static std::atomic< uint64_t > nextConnectionId(1);
+                connectionId = nextConnectionId++;
+            }
+            const auto connectStarted = std::chrono::steady_clock::now();
+            serverConnection = transport->Connect(serverHostName, serverPortNumber);
+            protocolStageStarted = std::chrono::steady_clock::now();
+
+            // The transport may have held on to the connection until the
+            // server greeted the client over it, so time the greeting from
+            // when the connection was actually made, if it can tell us.
+            const auto connectionTiming = std::dynamic_pointer_cast< ConnectionTiming >(serverConnection);
+            if (connectionTiming != nullptr) {
+                protocolStageStarted = connectionTiming->GetConnectedTime();
+            }
+            connectionPhaseStarted = protocolStageStarted;
+            ehloSpanPending = false;
+            if (spanSink != nullptr) {
+                connectionTraceId = NewTraceId();
+                RecordSpan(
+                    connectionTraceId,
+                    "connect",
+                    connectStarted,
+                    {{"success", ((serverConnection == nullptr) ? "false" : "true")}}
+                );
+            }
+            if (destinationHealth != nullptr) {
+                destinationHealth->RecordConnect(
+                    serverHostName,
+                    protocolStageStarted - connectStarted,
+                    (serverConnection != nullptr)
+                );
+            }
+            if (serverConnection == nullptr) {
+                diagnosticsSender.SendDiagnosticInformationString(
+                    SystemAbstractions::DiagnosticsSender::Levels::WARNING,
+                    "Unable to connect to SMTP server"
+                );
+                return false;
+            }
+            if (cancellationToken.IsCancelled()) {
+                serverConnection->Close();
+                return false;
+            }
+            serverConnection->SubscribeToDiagnostics(diagnosticsSender.Chain());
+            std::weak_ptr< Impl > selfWeak(shared_from_this());
+            const auto messageReceivedDelegate = [selfWeak](
+                const std::vector< uint8_t >& message
+            ){
+                auto self = selfWeak.lock();
+                if (self == nullptr) {
+                    return;
+                }
+                self->OnMessageReceived(message);
+            };
+            const auto brokenDelegate = [selfWeak](
+                bool graceful
+            ){
+                auto self = selfWeak.lock();
+                if (self == nullptr) {
+                    return;
+                }
+                self->OnBroken(graceful);
+            };
+            if (
+                !serverConnection->Process(
+                    messageReceivedDelegate,
+                    brokenDelegate
+                )
+            ) {
+                return false;
+            }
+            auto unsubscribe = cancellationToken.SubscribeToCancellation(
+                [selfWeak]{
+                    auto self = selfWeak.lock();
+                    if (self == nullptr) {
+                        return;
                     }
+                    self->OnConnectCancelled();
+                }
+            );
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            if (currentMessageContext.protocolStage == ProtocolStage::ReadyToSend) {
+                unsubscribe();
+            } else {
+                unsubscribeConnectCancellation = unsubscribe;
+            }
+            return !cancellationToken.IsCancelled();
+        }
 
-                    case ' ': {
-                        parsedMessage.last = true;
-                        break;
+        /**
+         * Handle the cancellation of the token given to Connect.  If the
+         * client is still being introduced to the server, the connection
+         * is closed.  Once the client is ready to send, the token no longer
+         * has any effect.
+         */
+        void OnConnectCancelled() {
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            const auto protocolStage = currentMessageContext.protocolStage;
+            if (
+                (serverConnection == nullptr)
+                || (
+                    (protocolStage != ProtocolStage::Greeting)
+                    && (protocolStage != ProtocolStage::HelloResponse)
+                    && (protocolStage != ProtocolStage::Options)
+                )
+            ) {
+                return;
+            }
+            diagnosticsSender.SendDiagnosticInformationString(
+                SystemAbstractions::DiagnosticsSender::Levels::WARNING,
+                "Connection cancelled"
+            );
+            OnHardFailure();
+        }
+
+        /**
+         * Handle the cancellation of the e-mail with the given identifier.
+         *
+         * An e-mail whose envelope has not yet been sent is simply taken off
+         * the queue.  Otherwise the client waits for the server to reply to
+         * the envelope and then sends RSET to abandon the transaction.  If the
+         * server has already been asked to accept the message data, there is
+         * no way to back out other than closing the connection, since ending
+         * the data would deliver the e-mail.  This is done right away, even
+         * if the body is waiting for the connection to drain, since that may
+         * never happen if the server has stopped reading.  Once the whole
+         * e-mail has been queued to be sent, cancelling it has no effect on
+         * its outcome, because the server is then responsible for it, but
+         * its contents are let go right away rather than when the server
+         * replies.
+         *
+         * @param[in] id
+         *     This identifies the e-mail which was cancelled.
+         */
+        void OnTransactionCancelled(uint64_t id) {
+            std::shared_ptr< SystemAbstractions::INetworkConnection > serverConnection;
+            {
+                std::lock_guard< decltype(mutex) > lock(mutex);
+                serverConnection = CancelTransaction(id);
+            }
+
+            // Close the connection only after letting go of the mutex, for
+            // the same reason as in Disconnect.
+            if (serverConnection != nullptr) {
+                serverConnection->Close();
+            }
+        }
+
+        /**
+         * Cancel the e-mail with the given identifier, as described for
+         * OnTransactionCancelled.  The mutex must be held when this is
+         * called.
+         *
+         * @param[in] id
+         *     This identifies the e-mail which was cancelled.
+         *
+         * @return
+         *     If the connection to the server has to be closed to abandon
+         *     the e-mail, the connection is returned, for the caller to
+         *     close once it has let go of the mutex.  Otherwise, nullptr
+         *     is returned.
+         */
+        std::shared_ptr< SystemAbstractions::INetworkConnection > CancelTransaction(uint64_t id) {
+            std::shared_ptr< SystemAbstractions::INetworkConnection > connectionToClose;
+            const auto transactionsEntry = std::find_if(
+                transactions.begin(),
+                transactions.end(),
+                [id](const Transaction& transaction){
+                    return transaction.id == id;
+                }
+            );
+            if (transactionsEntry == transactions.end()) {
+                return connectionToClose;
+            }
+            auto& transaction = *transactionsEntry;
+            const auto isFront = (transactionsEntry == transactions.begin());
+            if (
+                isFront
+                && (currentMessageContext.protocolStage == ProtocolStage::AwaitingSendResponse)
+            ) {
+                if (transaction.dataEnded) {
+                    transaction.ReleaseContents();
+                } else {
+                    connectionToClose.swap(serverConnection);
+                    AbandonMessageData();
+                }
+                return connectionToClose;
+            }
+            diagnosticsSender.SendDiagnosticInformationString(
+                2,
+                "E-mail cancelled"
+            );
+            if (!transaction.envelopeSent) {
+                CompleteTransaction(transaction, false);
+                (void)transactions.erase(transactionsEntry);
+                if (
+                    isFront
+                    && (currentMessageContext.protocolStage == ProtocolStage::ReadyToSend)
+                    && (activeExtension == nullptr)
+                ) {
+                    OnMessageReady();
+                }
+                return connectionToClose;
+            }
+            transaction.cancelled = true;
+            transaction.ReleaseContents();
+            if (
+                isFront
+                && (
+                    (currentMessageContext.protocolStage == ProtocolStage::DeclaringSender)
+                    || (currentMessageContext.protocolStage == ProtocolStage::DeclaringRecipients)
+                )
+                && (transaction.repliesPending == 0)
+                && (activeExtension == nullptr)
+            ) {
+                SendReset(transaction);
+            }
+            return connectionToClose;
+        }
+
+        /**
+         * Send the RSET command to abandon the given e-mail, whose envelope
+         * the server has already seen.  The client moves on to the next
+         * e-mail only once the server has replied, so that the next MAIL
+         * FROM command doesn't land in a transaction the server still
+         * holds open.
+         *
+         * @param[in,out] transaction
+         *     This is the e-mail to abandon.
+         */
+        void SendReset(Transaction& transaction) {
+            transaction.resetSent = true;
+            transaction.failed = true;
+            ++transaction.repliesPending;
+            SendMessageThroughExtensions("RSET");
+        }
+
+        /**
+         * Give up on the e-mail whose message data the server is ready to
+         * accept (or is already accepting), because it was cancelled or its
+         * body could not be read.  The only way to do this without
+         * delivering the e-mail is to close the connection.
+         */
+        void AbandonMessageData() {
+            diagnosticsSender.SendDiagnosticInformationString(
+                SystemAbstractions::DiagnosticsSender::Levels::WARNING,
+                "E-mail abandoned during message data; closing connection"
+            );
+            queuedMessages.clear();
+            OnHardFailure();
+        }
+
+        /**
+         * Return the length of the body of the given e-mail.
+         *
+         * @param[in] transaction
+         *     This is the e-mail whose body length to return.
+         *
+         * @return
+         *     The length of the body of the given e-mail is returned.
+         */
+        static size_t GetBodyLength(const Transaction& transaction) {
+            return (
+                (transaction.body == nullptr)
+                ? (size_t)transaction.bodyFile.length
+                : transaction.body->length()
+            );
+        }
+
+        /**
+         * Get ready to send the body of the given e-mail, behind the headers
+         * already queued.  If the body is kept in a file, the file is opened,
+         * and if the connection is a FileSender, it's handed the whole file
+         * to send straight from the file, behind the headers.
+         *
+         * @param[in,out] transaction
+         *     This is the e-mail whose body to send.
+         *
+         * @return
+         *     An indication of whether or not the body can be sent is
+         *     returned.  If not, the body could not be read.
+         */
+        bool StartBody(Transaction& transaction) {
+            transaction.bodyBytesQueued = 0;
+            if (transaction.body != nullptr) {
+                const auto& body = *transaction.body;
+                const auto length = body.length();
+                transaction.bodyEndsWithLineEnding = (
+                    (length >= 2)
+                    && (body.compare(length - 2, 2, "\r\n") == 0)
+                );
+                return true;
+            }
+            const auto& bodyFile = transaction.bodyFile;
+            transaction.bodyFileStream = std::make_shared< std::ifstream >(
+                bodyFile.path,
+                std::ios::binary
+            );
+            auto& file = *transaction.bodyFileStream;
+            if (!file) {
+                diagnosticsSender.SendDiagnosticInformationFormatted(
+                    SystemAbstractions::DiagnosticsSender::Levels::ERROR,
+                    "Unable to open e-mail body file '%s'",
+                    bodyFile.path.c_str()
+                );
+                return false;
+            }
+            const auto length = bodyFile.length;
+            char lastTwo[2] = {0, 0};
+            if (length >= 2) {
+                (void)file.seekg(length - 2);
+                (void)file.read(lastTwo, 2);
+                (void)file.seekg(0);
+            }
+            transaction.bodyEndsWithLineEnding = (
+                (length >= 2)
+                && (lastTwo[0] == '\r')
+                && (lastTwo[1] == '\n')
+            );
+            FlushQueuedMessages();
+            const auto fileSender = std::dynamic_pointer_cast< FileSender >(serverConnection);
+            if (
+                (length > 0)
+                && (fileSender != nullptr)
+                && fileSender->SendFile(bodyFile.path, 0, length)
+            ) {
+                SMTP_PROBE3(
+                    send,
+                    connectionId,
+                    (int)currentMessageContext.protocolStage,
+                    length
+                );
+                transaction.bodyBytesQueued = (size_t)length;
+                transaction.bodyFileStream.reset();
+            }
+            return true;
+        }
+
+        /**
+         * Queue the next chunk of the body of the given e-mail to be sent
+         * to the SMTP server.
+         *
+         * @param[in,out] transaction
+         *     This is the e-mail whose body to send.
+         *
+         * @return
+         *     An indication of whether or not the chunk was queued is
+         *     returned.  If not, the body could not be read.
+         */
+        bool QueueBodyChunk(Transaction& transaction) {
+            const auto chunkLength = std::min(
+                BODY_CHUNK_SIZE,
+                GetBodyLength(transaction) - transaction.bodyBytesQueued
+            );
+            if (transaction.body != nullptr) {
+                QueueDataWithoutLogging(
+                    transaction.body->data() + transaction.bodyBytesQueued,
+                    chunkLength
+                );
+            } else {
+                std::vector< char > chunk(chunkLength);
+                if (!transaction.bodyFileStream->read(chunk.data(), chunkLength)) {
+                    diagnosticsSender.SendDiagnosticInformationFormatted(
+                        SystemAbstractions::DiagnosticsSender::Levels::ERROR,
+                        "Unable to read e-mail body file '%s'",
+                        transaction.bodyFile.path.c_str()
+                    );
+                    return false;
+                }
+                QueueDataWithoutLogging(chunk.data(), chunkLength);
+            }
+            transaction.bodyBytesQueued += chunkLength;
+            return true;
+        }
+
+        /**
+         * Ask the connection to the server to report when everything
+         * queued has been sent, if it's able to, so that the next chunk
+         * of the body of the e-mail whose message data is being sent can
+         * be queued then.
+         *
+         * @return
+         *     An indication of whether or not to wait for the connection's
+         *     report before queueing the next chunk is returned.
+         */
+        bool AwaitDrain() {
+            const auto drainNotifier = std::dynamic_pointer_cast< DrainNotifier >(serverConnection);
+            if (drainNotifier == nullptr) {
+                return false;
+            }
+            std::weak_ptr< Impl > implWeak(shared_from_this());
+            const auto generation = hookGeneration;
+            waitingForDrain = true;
+            requestingDrainNotification = true;
+            const auto willNotify = drainNotifier->NotifyWhenDrained(
+                [implWeak, generation]{
+                    const auto impl = implWeak.lock();
+                    if (impl == nullptr) {
+                        return;
                     }
+                    std::lock_guard< decltype(impl->mutex) > lock(impl->mutex);
+                    if (generation != impl->hookGeneration) {
+                        return;
+                    }
+                    impl->OnDrained();
+                }
+            );
+            requestingDrainNotification = false;
+            if (!willNotify) {
+                waitingForDrain = false;
+            }
+            return waitingForDrain;
+        }
 
-                    default: {
-                        OnHardFailure();
-                        return false;
+        /**
+         * Handle the connection to the server reporting that everything
+         * queued has been sent, by carrying on with the body of the e-mail
+         * whose message data is being sent.
+         */
+        void OnDrained() {
+            if (!waitingForDrain) {
+                return;
+            }
+            waitingForDrain = false;
+            if (requestingDrainNotification) {
+                return;
+            }
+            if (!FeedBody()) {
+                AbandonMessageData();
+            }
+        }
+
+        /**
+         * Queue the rest of the body of the e-mail whose message data the
+         * server is accepting, a chunk at a time, behind anything already
+         * queued (such as the e-mail's headers), and then the end of the
+         * data.  Whether the e-mail has been cancelled is checked before
+         * each chunk.  If the connection is a DrainNotifier, each chunk
+         * after the first is queued only once everything queued before it
+         * has been sent, so this may return before the whole body is
+         * queued, and be called again once the connection has caught up.
+         * Otherwise, every chunk is queued at once.  The last chunk stays
+         * queued, so that it goes out in the same write as the end of the
+         * data.
+         *
+         * @return
+         *     An indication of whether or not the body is being sent is
+         *     returned.  If not, the e-mail was cancelled or its body could
+         *     not be read, and the message data should be abandoned.
+         */
+        bool FeedBody() {
+            auto& transaction = transactions.front();
+            const auto length = GetBodyLength(transaction);
+            while (transaction.bodyBytesQueued < length) {
+                if (transaction.cancellationToken.IsCancelled()) {
+                    return false;
+                }
+                if (!QueueBodyChunk(transaction)) {
+                    return false;
+                }
+                if (transaction.bodyBytesQueued < length) {
+                    FlushQueuedMessages();
+                    if (AwaitDrain()) {
+                        return true;
                     }
                 }
-                parsedMessage.text = line.substr(4, line.length() - 6);
-                parsedMessages.push_back(std::move(parsedMessage));
             }
+            FinishMessageData(transaction);
             return true;
         }
 
         /**
-         * Send the given message to the SMTP server without processing it with
-         * any extensions, and without publishing any diagnostic messages.
+         * Queue the end of the message data of the given e-mail, whose body
+         * has been queued, along with the envelope of the next e-mail if it
+         * can be pipelined, and send everything queued.  The wait for the
+         * server's final reply about the e-mail is timed from here, rather
+         * than from the 354 reply, so that it doesn't include the time
+         * taken to send the body.
          *
-         * @param[in] message
-         *     This is the message to send.  Each line of the message should
-         *     have a newline at the end.
+         * @param[in,out] transaction
+         *     This is the e-mail whose message data to finish.
          */
-        void SendMessageDirectlyWithoutLogging(const std::string& message) {
-            serverConnection->SendMessage(
-                std::vector< uint8_t >(
-                    message.begin(),
-                    message.end()
-                )
+        void FinishMessageData(Transaction& transaction) {
+            if (!transaction.bodyEndsWithLineEnding) {
+                QueueMessageDirectly("\r\n");
+            }
+            const auto size = GetBodyLength(transaction);
+            transaction.body.reset();
+            transaction.bodyFile = BodyStore::BodyFile();
+            transaction.bodyFileStream.reset();
+            QueueMessageDirectly(".\r\n");
+            transaction.dataEnded = true;
+            if (
+                pipeliningSupported
+                && (transactions.size() > 1)
+            ) {
+                QueueEnvelope(transactions[1]);
+            }
+            FlushQueuedMessages();
+            RecordSpan(
+                transaction.traceId,
+                "data",
+                transaction.phaseStarted,
+                {
+                    {"code", "354"},
+                    {"size", std::to_string(size)},
+                }
             );
+            transaction.phaseStarted = std::chrono::steady_clock::now();
+            protocolStageStarted = transaction.phaseStarted;
         }
 
         /**
-         * Send the given message to the SMTP server without processing it
-         * with any extensions.
+         * Queue the envelope commands for the given e-mail to be sent to the
+         * SMTP server.  If the server supports pipelining, the MAIL FROM and
+         * all RCPT TO commands are queued together.  Otherwise, only the
+         * MAIL FROM command is queued, and each RCPT TO command is sent once
+         * the server has replied to the one before it.  Nothing is queued
+         * if the envelope has already been sent.
          *
-         * @param[in] message
-         *     This is the message to send.  Each line of the message should
-         *     have a newline at the end.
+         * @param[in,out] transaction
+         *     This holds the e-mail for which to queue envelope commands.
          */
-        void SendMessageDirectly(const std::string& message) {
-            diagnosticsSender.SendDiagnosticInformationString(
-                1,
-                "C: " + message.substr(0, message.length() - 2)
+        void QueueEnvelope(Transaction& transaction) {
+            if (transaction.envelopeSent) {
+                return;
+            }
+            transaction.recipients.Assign(
+                transaction.headers.GetHeaderMultiValue("To")
+            );
+            transaction.recipientCount = transaction.recipients.GetCount();
+            transaction.phaseStarted = std::chrono::steady_clock::now();
+            QueueMessageThroughExtensions(
+                BuildCommand(
+                    "MAIL FROM:",
+                    transaction.headers.GetHeaderValue("From")
+                )
             );
-            SendMessageDirectlyWithoutLogging(message);
+            transaction.envelopeSent = true;
+            transaction.repliesPending = 1;
+            if (pipeliningSupported) {
+                transaction.pipelined = true;
+                while (!transaction.AllRecipientsAnnounced()) {
+                    QueueNextRecipient(transaction);
+                }
+            }
         }
 
         /**
-         * Process the given message through all supported and registered
-         * extensions, and then send it to the SMTP server.
-         *
-         * @note
-         *     A newline is added to the processed message before it's sent.
-         *
-         * @param[in] input
-         *     This is the message to be processed and then sent.  It does not
-         *     have a newline at the end.
+         * Begin sending the e-mail at the front of the transaction queue.
          */
-        void SendMessageThroughExtensions(const std::string& input) {
-            std::string output(input);
-            for (const auto& supportedExtensionName: supportedExtensionNames) {
-                output = extensions[supportedExtensionName]->ModifyMessage(
-                    currentMessageContext,
-                    output
-                );
-            }
-            SendMessageDirectly(output + "\r\n");
+        void StartTransaction() {
+            QueueEnvelope(transactions.front());
+            FlushQueuedMessages();
+            TransitionProtocolStage(Client::ProtocolStage::DeclaringSender);
         }
 
         /**
-         * Handle the receipt of raw bytes from the underlying transport
-         * layer.
+         * Handle a final reply from the server about the given e-mail,
+         * reporting the outcome for the recipients to which it applies.
+         * In SMTP mode, there is one final reply for all recipients.  In
+         * LMTP mode, there is one final reply for each recipient, in the
+         * order the recipients were given to the server.
          *
-         * @param[in] message
-         *     This holds the raw bytes received from the transport layer.
+         * @param[in,out] transaction
+         *     This is the e-mail about which the server replied.
+         *
+         * @param[in] parsedMessage
+         *     This is the final reply received from the server.
+         *
+         * @return
+         *     An indication of whether or not all the final replies about
+         *     the e-mail have now been received is returned.
          */
-        void OnMessageReceived(const std::vector< uint8_t >& message) {
-            std::lock_guard< decltype(mutex) > lock(mutex);
-            const auto lines = AssembleLinesReceived(message);
-            if (lines.empty()) {
-                return;
-            }
-            std::vector< ParsedMessage > parsedMessages;
-            if (!DisassembleMessagesReceived(lines, parsedMessages)) {
-                return;
+        bool OnFinalReply(
+            Transaction& transaction,
+            const Client::ParsedMessage& parsedMessage
+        ) {
+            const auto& recipients = transaction.recipients;
+            const auto recipientsAnnounced = transaction.recipientsAnnounced;
+            const auto replyIndex = transaction.finalRepliesReceived++;
+            if (parsedMessage.code != 250) {
+                transaction.delivered = false;
+                transaction.NoteRejection(parsedMessage.code);
             }
-            for (const auto& parsedMessage: parsedMessages) {
-                if (activeExtension) {
-                    if (
-                        activeExtension->HandleServerMessage(
-                            currentMessageContext,
+            if (recipientOutcomeDelegate != nullptr) {
+                if (lmtpMode) {
+                    if (replyIndex < recipientsAnnounced) {
+                        recipientOutcomeDelegate(
+                            transaction.headers,
+                            recipients.Get(replyIndex),
                             parsedMessage
-                        )
-                    ) {
-                        continue;
-                    } else {
-                        OnHardFailure();
-                        return;
+                        );
                     }
-                }
-                switch (currentMessageContext.protocolStage) {
-                    case ProtocolStage::Greeting: {
-                        if (parsedMessage.code == 220) {
-                            const auto address = serverConnection->GetBoundAddress();
-                            SendMessageDirectly(
-                                StringExtensions::sprintf(
-                                    "EHLO [%" PRIu8 ".%" PRIu8 ".%" PRIu8 ".%" PRIu8 "]\r\n",
-                                    (uint8_t)((address >> 24) & 0xff),
-                                    (uint8_t)((address >> 16) & 0xff),
-                                    (uint8_t)((address >> 8) & 0xff),
-                                    (uint8_t)(address & 0xff)
-                                )
-                            );
-                            TransitionProtocolStage(ProtocolStage::Options);
-                        } else {
-                            OnHardFailure();
-                            return;
-                        }
-                    } break;
-
-                    case ProtocolStage::HelloResponse: {
-                        if (parsedMessage.code == 250) {
-                            if (parsedMessage.last) {
-                                OnMessageReady();
-                            } else {
-                                TransitionProtocolStage(ProtocolStage::Options);
-                            }
-                        } else {
-                            OnHardFailure();
-                            return;
-                        }
-                    } break;
-
-                    case ProtocolStage::Options: {
-                        if (parsedMessage.code == 250) {
-                            auto delimiter = parsedMessage.text.find(' ');
-                            decltype(delimiter) parametersStart = delimiter + 1;
-                            if (delimiter == std::string::npos) {
-                                delimiter = parsedMessage.text.length();
-                                parametersStart = delimiter;
-                            }
-                            const auto supportedExtensionName = parsedMessage.text.substr(
-                                0,
-                                delimiter
-                            );
-                            auto extensionsEntry = extensions.find(supportedExtensionName);
-                            if (extensionsEntry != extensions.end()) {
-                                (void)supportedExtensionNames.insert(supportedExtensionName);
-                                extensionsEntry->second->Configure(
-                                    parsedMessage.text.substr(parametersStart)
-                                );
-                            }
-                            if (parsedMessage.last) {
-                                OnMessageReady();
-                            }
-                        } else {
-                            OnHardFailure();
-                            return;
-                        }
-                    } break;
-
-                    case ProtocolStage::DeclaringSender: {
-                        if (parsedMessage.code == 250) {
-                            TransitionProtocolStage(ProtocolStage::DeclaringRecipients);
-                            for (const auto& recipient: headers.GetHeaderMultiValue("To")) {
-                                recipients.push(recipient);
-                            }
-                            AnnounceNextRecipient();
-                        } else {
-                            OnSoftFailure();
-                            return;
-                        }
-                    } break;
-
-                    case ProtocolStage::DeclaringRecipients: {
-                        if (parsedMessage.code == 250) {
-                            if (recipients.empty()) {
-                                SendMessageThroughExtensions("DATA");
-                                TransitionProtocolStage(ProtocolStage::SendingData);
-                            } else {
-                                AnnounceNextRecipient();
-                            }
-                        } else {
-                            OnSoftFailure();
-                            return;
-                        }
-                    } break;
-
-                    case ProtocolStage::SendingData: {
-                        if (parsedMessage.code == 354) {
-                            TransitionProtocolStage(ProtocolStage::AwaitingSendResponse);
-                            SendMessageDirectly(headers.GenerateRawHeaders());
-                            SendMessageDirectly(body);
-                            if (
-                                (body.length() < 2)
-                                || (body.substr(body.length() - 2) != "\r\n")
-                            ) {
-                                SendMessageDirectly("\r\n");
-                            }
-                            SendMessageDirectly(".\r\n");
-                        } else {
-                            OnSoftFailure();
-                            return;
-                        }
-                    } break;
-
-                    case ProtocolStage::AwaitingSendResponse: {
-                        sendCompleted.set_value(parsedMessage.code == 250);
-                        OnMessageReady();
-                    } break;
-
-                    default: {
-                        OnHardFailure();
-                        return;
+                } else {
+                    for (size_t i = 0; i < recipientsAnnounced; ++i) {
+                        recipientOutcomeDelegate(
+                            transaction.headers,
+                            recipients.Get(i),
+                            parsedMessage
+                        );
                     }
                 }
             }
+            return (
+                !lmtpMode
+                || (transaction.finalRepliesReceived >= std::max(recipientsAnnounced, (size_t)1))
+            );
         }
 
         /**
-         * Handle the publishing of the event that the underlying transport
-         * layer was closed.
-         *
-         * @param[in] graceful
-         *     This indicates whether or not the connection was closed
-         *     without being reset by the peer.
-         */
-        void OnBroken(bool graceful) {
-            std::lock_guard< decltype(mutex) > lock(mutex);
-            OnHardFailure();
-        }
-
-        /**
-         * Synchronously initiate a connection to an SMTP server.
-         *
-         * @param[in] serverHostName
-         *     This is the name of the SMTP server's host.
-         *
-         * @param[in] serverPortNumber
-         *     This is the TCP port number of the SMTP server.
+         * Handle a reply from the SMTP server to one of the envelope commands
+         * (MAIL FROM or RCPT TO) sent for the e-mail currently being sent.
+         * Once the server has replied to every envelope command sent, either
+         * announce the next recipient, ask to send the message data, or
+         * give up on the e-mail if the server rejected anything.  If the
+         * server accepted the MAIL FROM command, giving up means resetting
+         * the transaction first.
          *
-         * @return
-         *     An indication of whether or not the connection to the SMTP
-         *     server was successfully made is returned.
+         * @param[in] parsedMessage
+         *     This is the reply received from the SMTP server.
          */
-        bool Connect(
-            const std::string& serverHostName,
-            const uint16_t serverPortNumber
-        ) {
-            for (auto& extension: extensions) {
-                extension.second->Reset();
+        void OnEnvelopeReply(const Client::ParsedMessage& parsedMessage) {
+            auto& transaction = transactions.front();
+            if (transaction.repliesPending > 0) {
+                --transaction.repliesPending;
             }
-            serverConnection = transport->Connect(serverHostName, serverPortNumber);
-            if (serverConnection == nullptr) {
-                diagnosticsSender.SendDiagnosticInformationString(
-                    SystemAbstractions::DiagnosticsSender::Levels::WARNING,
-                    "Unable to connect to SMTP server"
+            const auto replyIndex = transaction.envelopeRepliesReceived++;
+            if (
+                (replyIndex == 0)
+                && (parsedMessage.code == 250)
+            ) {
+                transaction.senderAccepted = true;
+            }
+            if (
+                (parsedMessage.code != 250)
+                && (replyIndex > 0)
+                && (replyIndex <= transaction.recipientsAnnounced)
+                && (recipientOutcomeDelegate != nullptr)
+            ) {
+                recipientOutcomeDelegate(
+                    transaction.headers,
+                    transaction.recipients.Get(replyIndex - 1),
+                    parsedMessage
                 );
-                return false;
             }
-            serverConnection->SubscribeToDiagnostics(diagnosticsSender.Chain());
-            std::weak_ptr< Impl > selfWeak(shared_from_this());
-            const auto messageReceivedDelegate = [selfWeak](
-                const std::vector< uint8_t >& message
-            ){
-                auto self = selfWeak.lock();
-                if (self == nullptr) {
-                    return;
+            if (parsedMessage.code != 250) {
+                if (!transaction.failed) {
+                    transaction.envelopeReplyCode = parsedMessage.code;
                 }
-                self->OnMessageReceived(message);
-            };
-            const auto brokenDelegate = [selfWeak](
-                bool graceful
-            ){
-                auto self = selfWeak.lock();
-                if (self == nullptr) {
-                    return;
+                transaction.failed = true;
+                transaction.NoteRejection(parsedMessage.code);
+            }
+            if (
+                (currentMessageContext.protocolStage == Client::ProtocolStage::DeclaringSender)
+                && (
+                    !transaction.failed
+                    || (transaction.repliesPending > 0)
+                )
+            ) {
+                TransitionProtocolStage(Client::ProtocolStage::DeclaringRecipients);
+            }
+            if (transaction.repliesPending > 0) {
+                return;
+            }
+            if (
+                !transaction.resetSent
+                && (spanSink != nullptr)
+                && (
+                    transaction.cancelled
+                    || transaction.failed
+                    || transaction.AllRecipientsAnnounced()
+                )
+            ) {
+                std::map< std::string, std::string > attributes{
+                    {"code", std::to_string(transaction.envelopeReplyCode)},
+                    {"recipients", std::to_string(transaction.recipientCount)},
+                };
+                if (transaction.cancelled) {
+                    attributes["cancelled"] = "true";
+                } else if (transaction.headers.HasHeader("Message-ID")) {
+                    attributes["message-id"] = transaction.headers.GetHeaderValue("Message-ID");
                 }
-                self->OnBroken(graceful);
-            };
+                RecordSpan(
+                    transaction.traceId,
+                    "envelope",
+                    transaction.phaseStarted,
+                    std::move(attributes)
+                );
+            }
             if (
-                !serverConnection->Process(
-                    messageReceivedDelegate,
-                    brokenDelegate
+                !transaction.resetSent
+                && (
+                    transaction.cancelled
+                    || (
+                        transaction.failed
+                        && transaction.senderAccepted
+                    )
                 )
             ) {
-                return false;
+                SendReset(transaction);
+            } else if (transaction.failed) {
+                OnSoftFailure();
+            } else if (transaction.AllRecipientsAnnounced()) {
+                transaction.phaseStarted = std::chrono::steady_clock::now();
+                SendMessageThroughExtensions("DATA");
+                TransitionProtocolStage(Client::ProtocolStage::SendingData);
+            } else {
+                QueueNextRecipient(transaction);
+                FlushQueuedMessages();
             }
-            return true;
         }
 
         /**
-         * Send the next recipient e-mail address to the SMTP server.
+         * Queue the next recipient e-mail address of the given e-mail to be
+         * sent to the SMTP server.
+         *
+         * @param[in,out] transaction
+         *     This holds the e-mail whose next recipient to announce.
+         */
+        void QueueNextRecipient(Transaction& transaction) {
+            QueueMessageThroughExtensions(
+                BuildCommand(
+                    "RCPT TO:",
+                    transaction.recipients.GetPart(transaction.recipientsAnnounced++)
+                )
+            );
+            ++transaction.repliesPending;
+        }
+
+        /**
+         * Queue the given e-mail to be sent through the SMTP server, and
+         * begin sending it if nothing else is being sent.
+         *
+         * @param[in] headers
+         *     These are the headers to use for the message to send.
+         *     They are moved into the transaction queue.
+         *
+         * @param[in] processedBody
+         *     This is the body of the message to send, already processed
+         *     for transmission, or nullptr if the body is kept in a file.
+         *
+         * @param[in] processedBodyFile
+         *     This locates the file holding the body of the message to
+         *     send, already processed for transmission, if the body
+         *     isn't held in memory.
+         *
+         * @param[in] cancellationToken
+         *     This may be cancelled to give up on the e-mail.
+         *
+         * @param[in] sendResult
+         *     If not nullptr, this is also set when the e-mail has either
+         *     been received or rejected by the server, or cancelled,
+         *     to the outcome of sending it.
+         *
+         * @return
+         *     A future is returned that is set when the e-mail has
+         *     either been received or rejected by the server, or
+         *     cancelled.
          */
-        void AnnounceNextRecipient() {
-            const auto nextRecipient = recipients.front();
-            recipients.pop();
-            SendMessageThroughExtensions(
-                StringExtensions::sprintf(
-                    "RCPT TO:%s",
-                    nextRecipient.c_str()
+        std::future< bool > SendMail(
+            MessageHeaders::MessageHeaders headers,
+            BodyStore::Body processedBody,
+            BodyStore::BodyFile processedBodyFile,
+            CancellationToken cancellationToken,
+            std::unique_ptr< std::promise< SendResult > > sendResult = nullptr
+        ) {
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            Transaction transaction;
+            auto sendCompleted = transaction.sendCompleted.get_future();
+            transaction.sendResult = std::move(sendResult);
+            const auto protocolStage = currentMessageContext.protocolStage;
+            const auto readyToQueue = (
+                (protocolStage == ProtocolStage::ReadyToSend)
+                || (protocolStage == ProtocolStage::DeclaringSender)
+                || (protocolStage == ProtocolStage::DeclaringRecipients)
+                || (protocolStage == ProtocolStage::SendingData)
+                || (protocolStage == ProtocolStage::AwaitingSendResponse)
+            );
+            const auto valid = (
+                headers.HasHeader("From")
+                && (
+                    (processedBody != nullptr)
+                    || !processedBodyFile.path.empty()
                 )
             );
+            if (
+                readyToQueue
+                && valid
+                && !cancellationToken.IsCancelled()
+            ) {
+                transaction.headers = std::move(headers);
+                transaction.body = std::move(processedBody);
+                transaction.bodyFile = std::move(processedBodyFile);
+                transaction.id = nextTransactionId++;
+                if (spanSink != nullptr) {
+                    transaction.traceId = NewTraceId();
+                }
+                transaction.cancellationToken = cancellationToken;
+                const auto id = transaction.id;
+                transactions.push_back(std::move(transaction));
+
+                // Subscribe only once the e-mail is in the queue, since the
+                // token may be cancelled in the meantime, in which case the
+                // e-mail is taken back off the queue right away.
+                std::weak_ptr< Impl > implWeak(shared_from_this());
+                const auto unsubscribeCancellation = cancellationToken.SubscribeToCancellation(
+                    [implWeak, id]{
+                        auto impl = implWeak.lock();
+                        if (impl == nullptr) {
+                            return;
+                        }
+                        impl->OnTransactionCancelled(id);
+                    }
+                );
+                if (
+                    transactions.empty()
+                    || (transactions.back().id != id)
+                ) {
+                    unsubscribeCancellation();
+                    return sendCompleted;
+                }
+                transactions.back().unsubscribeCancellation = unsubscribeCancellation;
+                if (transactions.size() == 1) {
+                    if (
+                        (protocolStage == ProtocolStage::ReadyToSend)
+                        && (activeExtension == nullptr)
+                    ) {
+                        StartTransaction();
+                    }
+                } else if (
+                    pipeliningSupported
+                    && (transactions.size() == 2)
+                    && (protocolStage == ProtocolStage::AwaitingSendResponse)
+                    && transactions.front().dataEnded
+                    && (activeExtension == nullptr)
+                ) {
+                    QueueEnvelope(transactions[1]);
+                    FlushQueuedMessages();
+                }
+            } else {
+                if (
+                    readyToQueue
+                    && !valid
+                ) {
+                    transaction.rejectedPermanently = true;
+                }
+                CompleteTransaction(transaction, false);
+            }
+            return sendCompleted;
         }
     };
 
+    const size_t Client::Impl::BODY_CHUNK_SIZE;
+
     Client::~Client() noexcept = default;
     Client::Client(Client&& other) noexcept = default;
     Client& Client::operator=(Client&& other) noexcept = default;
@@ -737,16 +2895,48 @@ namespace Smtp {
         impl_->transport = transport;
     }
 
+    void Client::SetDestinationHealth(std::shared_ptr< DestinationHealth > destinationHealth) {
+        impl_->destinationHealth = destinationHealth;
+    }
+
+    void Client::SetLmtpMode(bool lmtpMode) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->lmtpMode = lmtpMode;
+    }
+
+    void Client::SetRecipientOutcomeDelegate(RecipientOutcomeDelegate recipientOutcomeDelegate) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->recipientOutcomeDelegate = recipientOutcomeDelegate;
+    }
+
+    void Client::SetSpanSink(std::shared_ptr< SpanSink > spanSink) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->spanSink = spanSink;
+    }
+
+    void Client::SetExtensionRegistry(std::shared_ptr< const ExtensionRegistry > extensionRegistry) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->extensionRegistry = extensionRegistry;
+    }
+
     void Client::RegisterExtension(
         const std::string& extensionName,
         std::shared_ptr< Extension > extensionImplementation
     ) {
-        impl_->extensions[extensionName] = extensionImplementation;
+        impl_->GetRegisteredExtension(extensionName).extension = extensionImplementation;
+    }
+
+    void Client::RegisterExtensionFactory(
+        const std::string& extensionName,
+        ExtensionFactory extensionFactory
+    ) {
+        impl_->GetRegisteredExtension(extensionName).factory = extensionFactory;
     }
 
     std::future< bool > Client::Connect(
         const std::string& serverHostName,
-        const uint16_t serverPortNumber
+        const uint16_t serverPortNumber,
+        CancellationToken cancellationToken
     ) {
         auto impl(impl_);
         return std::async(
@@ -754,45 +2944,117 @@ namespace Smtp {
             [
                 impl,
                 serverHostName,
-                serverPortNumber
+                serverPortNumber,
+                cancellationToken
             ]{
                 return impl->Connect(
                     serverHostName,
-                    serverPortNumber
+                    serverPortNumber,
+                    cancellationToken
                 );
             }
         );
     }
 
     void Client::Disconnect() {
-        impl_->serverConnection->Close(true);
-        impl_->serverConnection = nullptr;
-        impl_->currentMessageContext = MessageContext();
+        std::shared_ptr< SystemAbstractions::INetworkConnection > serverConnection;
+        {
+            std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+            serverConnection.swap(impl_->serverConnection);
+            impl_->DropPendingHooks();
+            impl_->currentMessageContext = MessageContext();
+            for (auto& transaction: impl_->transactions) {
+                Impl::CompleteTransaction(transaction, false);
+            }
+            impl_->transactions.clear();
+        }
+
+        // Close the connection only after letting go of the mutex, because
+        // closing the connection waits for its reader thread, which may be
+        // waiting on the mutex in order to deliver a message or report
+        // that the connection broke.
+        if (serverConnection != nullptr) {
+            serverConnection->Close(true);
+        }
     }
 
     std::future< bool > Client::SendMail(
         const MessageHeaders::MessageHeaders& headers,
-        const std::string& body
+        const std::string& body,
+        CancellationToken cancellationToken
     ) {
-        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
-        impl_->sendCompleted = std::promise< bool >();
-        if (
-            (impl_->currentMessageContext.protocolStage == ProtocolStage::ReadyToSend)
-            && (headers.HasHeader("From"))
-        ) {
-            impl_->headers = headers;
-            impl_->body = ProcessBody(body);
-            impl_->SendMessageThroughExtensions(
-                StringExtensions::sprintf(
-                    "MAIL FROM:%s",
-                    headers.GetHeaderValue("From").c_str()
-                )
-            );
-            impl_->TransitionProtocolStage(Client::ProtocolStage::DeclaringSender);
-        } else {
-            impl_->sendCompleted.set_value(false);
-        }
-        return impl_->sendCompleted.get_future();
+        return impl_->SendMail(
+            headers,
+            std::make_shared< const std::string >(ProcessBody(body)),
+            BodyStore::BodyFile(),
+            cancellationToken
+        );
+    }
+
+    std::future< bool > Client::SendMail(
+        MessageHeaders::MessageHeaders&& headers,
+        std::string&& body,
+        CancellationToken cancellationToken
+    ) {
+        return impl_->SendMail(
+            std::move(headers),
+            std::make_shared< const std::string >(ProcessBody(std::move(body))),
+            BodyStore::BodyFile(),
+            cancellationToken
+        );
+    }
+
+    std::future< bool > Client::SendMail(
+        const MessageHeaders::MessageHeaders& headers,
+        BodyStore::Body processedBody,
+        CancellationToken cancellationToken
+    ) {
+        assert(
+            (processedBody == nullptr)
+            || IsProcessedBody(*processedBody)
+        );
+        return impl_->SendMail(
+            headers,
+            processedBody,
+            BodyStore::BodyFile(),
+            cancellationToken
+        );
+    }
+
+    std::future< bool > Client::SendMail(
+        const MessageHeaders::MessageHeaders& headers,
+        const BodyStore::BodyFile& processedBodyFile,
+        CancellationToken cancellationToken
+    ) {
+        return impl_->SendMail(
+            headers,
+            nullptr,
+            processedBodyFile,
+            cancellationToken
+        );
+    }
+
+    auto Client::SendMailForResult(
+        const MessageHeaders::MessageHeaders& headers,
+        BodyStore::Body processedBody,
+        CancellationToken cancellationToken
+    ) -> std::future< SendResult > {
+        assert(
+            (processedBody == nullptr)
+            || IsProcessedBody(*processedBody)
+        );
+        std::unique_ptr< std::promise< SendResult > > sendResult(
+            new std::promise< SendResult >()
+        );
+        auto sendResultFuture = sendResult->get_future();
+        (void)impl_->SendMail(
+            headers,
+            processedBody,
+            BodyStore::BodyFile(),
+            cancellationToken,
+            std::move(sendResult)
+        );
+        return sendResultFuture;
     }
 
     std::future< bool > Client::GetReadyOrBrokenFuture() {
@@ -802,4 +3064,9 @@ namespace Smtp {
         return newReadyOrBrokenPromise.get_future();
     }
 
+    size_t Client::GetMemoryFootprint() {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        return impl_->GetMemoryFootprint();
+    }
+
 }
@@ -0,0 +1,36 @@
+/**
+ * @file Commands.cpp
+ *
+ * This module contains the implementation of functions used inside the
+ * Smtp library to put together the commands sent to SMTP servers.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "Commands.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace Smtp {
+
+    std::string FormatAddressLiteral(uint32_t address) {
+        char buffer[sizeof("[255.255.255.255]")];
+        size_t length = 0;
+        buffer[length++] = '[';
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            const auto octet = (unsigned int)((address >> shift) & 0xff);
+            if (octet >= 100) {
+                buffer[length++] = (char)('0' + octet / 100);
+            }
+            if (octet >= 10) {
+                buffer[length++] = (char)('0' + (octet / 10) % 10);
+            }
+            buffer[length++] = (char)('0' + octet % 10);
+            buffer[length++] = ((shift == 0) ? ']' : '.');
+        }
+        return std::string(buffer, length);
+    }
+
+}
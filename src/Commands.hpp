@@ -0,0 +1,217 @@
+#pragma once
+
+/**
+ * @file Commands.hpp
+ *
+ * This module declares functions used inside the Smtp library to put
+ * together the commands sent to SMTP servers.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace Smtp {
+
+    /**
+     * This refers to a command part kept somewhere else, such as inside
+     * a larger buffer, so that it can be added to a command without
+     * first being copied into a string of its own.
+     */
+    struct CommandPart {
+        /**
+         * This points to the first character of the part.
+         */
+        const char* data = nullptr;
+
+        /**
+         * This is the number of characters in the part.
+         */
+        size_t length = 0;
+    };
+
+    /**
+     * Return the length of the given command part, which is a string
+     * literal, whose length is known at compile time.
+     *
+     * @param[in] part
+     *     This is the command part whose length to return.
+     *
+     * @return
+     *     The length of the given command part, not counting the
+     *     null terminator, is returned.
+     */
+    template< size_t N > constexpr size_t CommandPartLength(const char (&)[N]) {
+        return N - 1;
+    }
+
+    /**
+     * Return the length of the given command part.
+     *
+     * @param[in] part
+     *     This is the command part whose length to return.
+     *
+     * @return
+     *     The length of the given command part is returned.
+     */
+    inline size_t CommandPartLength(const std::string& part) {
+        return part.length();
+    }
+
+    /**
+     * Return the length of the given command part, which is kept
+     * somewhere else.
+     *
+     * @param[in] part
+     *     This is the command part whose length to return.
+     *
+     * @return
+     *     The length of the given command part is returned.
+     */
+    inline size_t CommandPartLength(const CommandPart& part) {
+        return part.length;
+    }
+
+    /**
+     * Return the total length of the given command parts.
+     *
+     * @return
+     *     Zero is returned, since there are no command parts.
+     */
+    inline size_t CommandPartsLength() {
+        return 0;
+    }
+
+    /**
+     * Return the total length of the given command parts.
+     *
+     * @param[in] first
+     *     This is the first command part.
+     *
+     * @param[in] rest
+     *     These are the remaining command parts.
+     *
+     * @return
+     *     The total length of the given command parts is returned.
+     */
+    template< typename First, typename... Rest > size_t CommandPartsLength(
+        const First& first,
+        const Rest&... rest
+    ) {
+        return CommandPartLength(first) + CommandPartsLength(rest...);
+    }
+
+    /**
+     * Append the given command part, which is a string literal,
+     * to the given command.
+     *
+     * @param[in,out] command
+     *     This is the command to which to append the part.
+     *
+     * @param[in] part
+     *     This is the command part to append.
+     */
+    template< size_t N > void AppendCommandPart(
+        std::string& command,
+        const char (&part)[N]
+    ) {
+        (void)command.append(part, N - 1);
+    }
+
+    /**
+     * Append the given command part to the given command.
+     *
+     * @param[in,out] command
+     *     This is the command to which to append the part.
+     *
+     * @param[in] part
+     *     This is the command part to append.
+     */
+    inline void AppendCommandPart(
+        std::string& command,
+        const std::string& part
+    ) {
+        (void)command.append(part);
+    }
+
+    /**
+     * Append the given command part, which is kept somewhere else,
+     * to the given command.
+     *
+     * @param[in,out] command
+     *     This is the command to which to append the part.
+     *
+     * @param[in] part
+     *     This is the command part to append.
+     */
+    inline void AppendCommandPart(
+        std::string& command,
+        const CommandPart& part
+    ) {
+        (void)command.append(part.data, part.length);
+    }
+
+    /**
+     * Append the given command parts to the given command.
+     *
+     * @param[in,out] command
+     *     This is the command to which to append the parts.
+     */
+    inline void AppendCommandParts(std::string&) {
+    }
+
+    /**
+     * Append the given command parts to the given command.
+     *
+     * @param[in,out] command
+     *     This is the command to which to append the parts.
+     *
+     * @param[in] first
+     *     This is the first command part to append.
+     *
+     * @param[in] rest
+     *     These are the remaining command parts to append.
+     */
+    template< typename First, typename... Rest > void AppendCommandParts(
+        std::string& command,
+        const First& first,
+        const Rest&... rest
+    ) {
+        AppendCommandPart(command, first);
+        AppendCommandParts(command, rest...);
+    }
+
+    /**
+     * Put together an SMTP command from the given parts, which may be
+     * string literals, strings, or parts kept somewhere else.  The command
+     * is allocated once, with room left for the CRLF which ends it.
+     * The CRLF itself is not added.
+     *
+     * @param[in] parts
+     *     These are the parts of the command, in order.
+     *
+     * @return
+     *     The command is returned.
+     */
+    template< typename... Parts > std::string BuildCommand(const Parts&... parts) {
+        std::string command;
+        command.reserve(CommandPartsLength(parts...) + 2);
+        AppendCommandParts(command, parts...);
+        return command;
+    }
+
+    /**
+     * Format the given IPv4 address as an SMTP address literal, such as
+     * "[192.0.2.1]" (RFC 5321 section 4.1.3).
+     *
+     * @param[in] address
+     *     This is the IPv4 address to format.
+     *
+     * @return
+     *     The address literal is returned.
+     */
+    std::string FormatAddressLiteral(uint32_t address);
+
+}
@@ -0,0 +1,694 @@
+/**
+ * @file DestinationHealth.cpp
+ *
+ * This module contains the implementation of the Smtp::DestinationHealth
+ * class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <Smtp/DestinationHealth.hpp>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+    /**
+     * This is the weight given to each new sample in the moving averages
+     * kept for each host.
+     */
+    constexpr double movingAverageWeight = 0.2;
+
+    /**
+     * This is the lowest fraction of successful replies used when
+     * inflating the score of a host by its transient failure rate.
+     */
+    constexpr double minimumSuccessRate = 0.01;
+
+    /**
+     * This is the factor by which the average final reply latency of a
+     * host must rise above the best seen for it to be taken as a sign that
+     * the host is overloaded.
+     */
+    constexpr double latencyRiseFactor = 2.0;
+
+    /**
+     * This is the fraction by which the rate of e-mails accepted by a host
+     * must go up from one evaluation period to the next for the host to be
+     * allowed another connection.
+     */
+    constexpr double throughputImprovementMargin = 0.05;
+
+    /**
+     * Convert the given duration to a number of seconds.
+     *
+     * @param[in] duration
+     *     This is the duration to convert.
+     *
+     * @return
+     *     The number of seconds in the given duration is returned.
+     */
+    double ToSeconds(std::chrono::steady_clock::duration duration) {
+        return std::chrono::duration_cast< std::chrono::duration< double > >(duration).count();
+    }
+
+    /**
+     * Add the given sample to the given moving average.
+     *
+     * @param[in,out] average
+     *     This is the moving average to update.
+     *
+     * @param[in] firstSample
+     *     This indicates whether or not this is the first sample, in which
+     *     case it replaces the average outright.
+     *
+     * @param[in] sample
+     *     This is the sample to add.
+     */
+    void AddSample(
+        double& average,
+        bool firstSample,
+        double sample
+    ) {
+        if (firstSample) {
+            average = sample;
+        } else {
+            average += movingAverageWeight * (sample - average);
+        }
+    }
+
+}
+
+namespace Smtp {
+
+    /**
+     * This contains the private properties of a DestinationHealth instance.
+     */
+    struct DestinationHealth::Impl {
+        // Types
+
+        /**
+         * This holds everything kept for one host.
+         */
+        struct HostState {
+            /**
+             * These are the statistics kept for the host.
+             */
+            Statistics statistics;
+
+            /**
+             * This is the number of greetings received from the host.
+             */
+            size_t greetings = 0;
+
+            /**
+             * This is the number of final replies received from the host.
+             */
+            size_t finalReplies = 0;
+
+            /**
+             * This is the time at which the circuit for the host was
+             * last opened.
+             */
+            std::chrono::steady_clock::time_point circuitOpened;
+
+            /**
+             * This indicates whether or not a trial has been allowed
+             * through the open circuit for the host, and its outcome
+             * not yet recorded.
+             */
+            bool trialInProgress = false;
+
+            /**
+             * This is the time at which the trial allowed through the open
+             * circuit for the host was claimed.  A trial whose outcome is
+             * not recorded within the open time is taken to have been
+             * abandoned, and another is allowed through.
+             */
+            std::chrono::steady_clock::time_point trialStarted;
+
+            /**
+             * This is the time at which the current evaluation period
+             * for the host started.
+             */
+            std::chrono::steady_clock::time_point periodStarted;
+
+            /**
+             * This is the number of e-mails accepted by the host during
+             * the current evaluation period.
+             */
+            size_t periodAccepted = 0;
+
+            /**
+             * This is the sum of the final reply latencies, in seconds,
+             * measured for the host during the current evaluation period.
+             */
+            double periodLatencyTotal = 0.0;
+
+            /**
+             * This is the number of final reply latencies measured for
+             * the host during the current evaluation period.
+             */
+            size_t periodLatencySamples = 0;
+
+            /**
+             * This indicates whether or not every connection allowed to
+             * the host was in use at some point during the current
+             * evaluation period.
+             */
+            bool limitReached = false;
+
+            /**
+             * This indicates whether or not the throughput in the
+             * statistics was measured at the current limit, so that the
+             * next measurement can be compared with it.
+             */
+            bool throughputMeasured = false;
+
+            /**
+             * This is the lowest average final reply latency, in seconds,
+             * measured for the host over an evaluation period, or zero if
+             * none has been measured yet.
+             */
+            double bestLatency = 0.0;
+
+            /**
+             * This indicates whether or not the limit for the host
+             * has ever been cut.
+             */
+            bool limitCut = false;
+
+            /**
+             * This is the time at which the limit for the host
+             * was last cut.
+             */
+            std::chrono::steady_clock::time_point limitLastCut;
+        };
+
+        // Properties
+
+        /**
+         * This is used to protect the other properties of this structure
+         * when accessed simultaneously by multiple threads.
+         */
+        std::mutex mutex;
+
+        /**
+         * This is the number of failures in a row after which to open
+         * the circuit for a host.
+         */
+        size_t failureThreshold = 5;
+
+        /**
+         * This is the moving average fraction of transient failure replies
+         * at or above which to open the circuit for a host.
+         */
+        double transientFailureRateThreshold = 0.5;
+
+        /**
+         * This is how long to keep the circuit for a host open before
+         * allowing a trial through.
+         */
+        std::chrono::milliseconds openTime = std::chrono::seconds(60);
+
+        /**
+         * This is the fewest connections to allow to each host.
+         */
+        size_t minimumConnections = 1;
+
+        /**
+         * This is the most connections to allow to each host.
+         */
+        size_t maximumConnections = 20;
+
+        /**
+         * This is how long to measure the rate of e-mails accepted by
+         * a host before deciding whether or not to allow it another
+         * connection.
+         */
+        std::chrono::milliseconds evaluationPeriod = std::chrono::seconds(10);
+
+        /**
+         * This is the factor by which to multiply the limit for a host
+         * when it shows signs of being overloaded.
+         */
+        double backoffFactor = 0.5;
+
+        /**
+         * This holds everything kept for each host, keyed by host name.
+         */
+        std::map< std::string, HostState > hosts;
+
+        // Methods
+
+        /**
+         * Begin a new evaluation period for the given host.
+         *
+         * @param[in,out] hostState
+         *     This holds everything kept for the host.
+         *
+         * @param[in] now
+         *     This is the current time.
+         */
+        void StartPeriod(
+            HostState& hostState,
+            std::chrono::steady_clock::time_point now
+        ) {
+            hostState.periodStarted = now;
+            hostState.periodAccepted = 0;
+            hostState.periodLatencyTotal = 0.0;
+            hostState.periodLatencySamples = 0;
+            hostState.limitReached = (
+                hostState.statistics.activeConnections
+                >= hostState.statistics.concurrencyLimit
+            );
+        }
+
+        /**
+         * Cut the number of connections allowed to the given host,
+         * unless it was already cut less than an evaluation period ago.
+         *
+         * @param[in,out] hostState
+         *     This holds everything kept for the host.
+         */
+        void CutConcurrency(HostState& hostState) {
+            const auto now = std::chrono::steady_clock::now();
+            if (
+                hostState.limitCut
+                && (now - hostState.limitLastCut < evaluationPeriod)
+            ) {
+                return;
+            }
+            hostState.limitCut = true;
+            hostState.limitLastCut = now;
+            auto& concurrencyLimit = hostState.statistics.concurrencyLimit;
+            concurrencyLimit = std::max(
+                minimumConnections,
+                (size_t)(concurrencyLimit * backoffFactor)
+            );
+            hostState.throughputMeasured = false;
+            StartPeriod(hostState, now);
+        }
+
+        /**
+         * If the current evaluation period for the given host is over,
+         * decide whether to allow it another connection or cut the number
+         * of connections allowed to it, and begin the next period.
+         *
+         * @param[in,out] hostState
+         *     This holds everything kept for the host.
+         */
+        void UpdateConcurrency(HostState& hostState) {
+            auto& statistics = hostState.statistics;
+            statistics.concurrencyLimit = std::min(
+                std::max(statistics.concurrencyLimit, minimumConnections),
+                std::max(maximumConnections, minimumConnections)
+            );
+            const auto now = std::chrono::steady_clock::now();
+            const auto elapsed = now - hostState.periodStarted;
+            if (elapsed < evaluationPeriod) {
+                return;
+            }
+            bool latencyRose = false;
+            if (hostState.periodLatencySamples > 0) {
+                const auto latency = (
+                    hostState.periodLatencyTotal
+                    / hostState.periodLatencySamples
+                );
+                if (
+                    (hostState.bestLatency == 0.0)
+                    || (latency < hostState.bestLatency)
+                ) {
+                    hostState.bestLatency = latency;
+                } else if (latency > hostState.bestLatency * latencyRiseFactor) {
+                    if (statistics.concurrencyLimit > minimumConnections) {
+                        latencyRose = true;
+                    } else {
+                        hostState.bestLatency = latency;
+                    }
+                }
+            }
+            const auto throughput = hostState.periodAccepted / ToSeconds(elapsed);
+            const auto improved = (
+                (hostState.periodAccepted > 0)
+                && (
+                    !hostState.throughputMeasured
+                    || (
+                        throughput
+                        > statistics.throughput * (1.0 + throughputImprovementMargin)
+                    )
+                )
+            );
+            statistics.throughput = throughput;
+            hostState.throughputMeasured = true;
+            if (latencyRose) {
+                CutConcurrency(hostState);
+            } else if (
+                improved
+                && hostState.limitReached
+                && (statistics.concurrencyLimit < maximumConnections)
+            ) {
+                ++statistics.concurrencyLimit;
+            }
+            StartPeriod(hostState, now);
+        }
+
+        /**
+         * Return everything kept for the given host, bringing its
+         * concurrency limit up to date.
+         *
+         * @param[in] host
+         *     This is the name of the host.
+         *
+         * @return
+         *     Everything kept for the given host is returned.
+         */
+        HostState& GetHostState(const std::string& host) {
+            auto hostsEntry = hosts.find(host);
+            if (hostsEntry == hosts.end()) {
+                hostsEntry = hosts.insert(
+                    std::make_pair(host, HostState())
+                ).first;
+                auto& hostState = hostsEntry->second;
+                hostState.statistics.concurrencyLimit = minimumConnections;
+                StartPeriod(hostState, std::chrono::steady_clock::now());
+            }
+            auto& hostState = hostsEntry->second;
+            UpdateConcurrency(hostState);
+            return hostState;
+        }
+
+        /**
+         * Determine whether or not the given host should be used, without
+         * claiming the trial allowed through its circuit if it's open.
+         *
+         * @param[in] hostState
+         *     This holds everything kept for the host.
+         *
+         * @return
+         *     An indication of whether or not the given host should be used
+         *     is returned.
+         */
+        bool IsAvailable(const HostState& hostState) const {
+            if (!hostState.statistics.circuitOpen) {
+                return true;
+            }
+            const auto now = std::chrono::steady_clock::now();
+            if (hostState.trialInProgress) {
+                return (now - hostState.trialStarted >= openTime);
+            }
+            return (now - hostState.circuitOpened >= openTime);
+        }
+
+        /**
+         * Open the circuit for the given host.
+         *
+         * @param[in,out] hostState
+         *     This holds everything kept for the host.
+         */
+        void OpenCircuit(HostState& hostState) {
+            hostState.statistics.circuitOpen = true;
+            hostState.circuitOpened = std::chrono::steady_clock::now();
+            hostState.trialInProgress = false;
+        }
+
+        /**
+         * Record that the given host failed in a way that suggests it's
+         * in trouble.
+         *
+         * @param[in,out] hostState
+         *     This holds everything kept for the host.
+         */
+        void OnFailure(HostState& hostState) {
+            auto& statistics = hostState.statistics;
+            ++statistics.consecutiveFailures;
+            if (
+                hostState.trialInProgress
+                || (statistics.consecutiveFailures >= failureThreshold)
+            ) {
+                OpenCircuit(hostState);
+            }
+        }
+
+        /**
+         * Record that the given host succeeded in something, closing its
+         * circuit if it was open.
+         *
+         * @param[in,out] hostState
+         *     This holds everything kept for the host.
+         */
+        void OnSuccess(HostState& hostState) {
+            auto& statistics = hostState.statistics;
+            statistics.consecutiveFailures = 0;
+            if (statistics.circuitOpen) {
+                statistics.circuitOpen = false;
+                statistics.transientFailureRate = 0.0;
+                hostState.trialInProgress = false;
+            }
+        }
+
+        /**
+         * Record a reply from the given host.
+         *
+         * @param[in,out] hostState
+         *     This holds everything kept for the host.
+         *
+         * @param[in] code
+         *     This is the reply code.
+         */
+        void OnReply(
+            HostState& hostState,
+            int code
+        ) {
+            auto& statistics = hostState.statistics;
+            ++statistics.replies;
+            AddSample(
+                statistics.transientFailureRate,
+                (statistics.replies == 1),
+                ((code / 100 == 4) ? 1.0 : 0.0)
+            );
+            if (code == 421) {
+                OnFailure(hostState);
+                CutConcurrency(hostState);
+            } else if (
+                !statistics.circuitOpen
+                && (statistics.replies >= failureThreshold)
+                && (statistics.transientFailureRate >= transientFailureRateThreshold)
+            ) {
+                OpenCircuit(hostState);
+            }
+        }
+    };
+
+    DestinationHealth::~DestinationHealth() noexcept = default;
+    DestinationHealth::DestinationHealth(DestinationHealth&& other) noexcept = default;
+    DestinationHealth& DestinationHealth::operator=(DestinationHealth&& other) noexcept = default;
+
+    DestinationHealth::DestinationHealth()
+        : impl_(new Impl)
+    {
+    }
+
+    void DestinationHealth::SetCircuitBreakerPolicy(
+        size_t failureThreshold,
+        double transientFailureRateThreshold,
+        std::chrono::milliseconds openTime
+    ) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->failureThreshold = failureThreshold;
+        impl_->transientFailureRateThreshold = transientFailureRateThreshold;
+        impl_->openTime = openTime;
+    }
+
+    void DestinationHealth::SetConcurrencyPolicy(
+        size_t minimumConnections,
+        size_t maximumConnections,
+        std::chrono::milliseconds evaluationPeriod,
+        double backoffFactor
+    ) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->minimumConnections = minimumConnections;
+        impl_->maximumConnections = maximumConnections;
+        impl_->evaluationPeriod = evaluationPeriod;
+        impl_->backoffFactor = backoffFactor;
+    }
+
+    size_t DestinationHealth::GetConcurrencyLimit(const std::string& host) {
+        return GetStatistics(host).concurrencyLimit;
+    }
+
+    bool DestinationHealth::TryAcquireConnection(const std::string& host) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        auto& hostState = impl_->GetHostState(host);
+        auto& statistics = hostState.statistics;
+        if (statistics.activeConnections >= statistics.concurrencyLimit) {
+            hostState.limitReached = true;
+            return false;
+        }
+        ++statistics.activeConnections;
+        if (statistics.activeConnections >= statistics.concurrencyLimit) {
+            hostState.limitReached = true;
+        }
+        return true;
+    }
+
+    void DestinationHealth::ReleaseConnection(const std::string& host) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        auto& statistics = impl_->GetHostState(host).statistics;
+        if (statistics.activeConnections > 0) {
+            --statistics.activeConnections;
+        }
+    }
+
+    void DestinationHealth::RecordConnect(
+        const std::string& host,
+        std::chrono::steady_clock::duration duration,
+        bool success
+    ) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        auto& hostState = impl_->GetHostState(host);
+        auto& statistics = hostState.statistics;
+        ++statistics.connectAttempts;
+        AddSample(
+            statistics.connectTime,
+            (statistics.connectAttempts == 1),
+            ToSeconds(duration)
+        );
+        if (!success) {
+            impl_->OnFailure(hostState);
+            impl_->CutConcurrency(hostState);
+        }
+    }
+
+    void DestinationHealth::RecordGreeting(
+        const std::string& host,
+        std::chrono::steady_clock::duration delay,
+        int code
+    ) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        auto& hostState = impl_->GetHostState(host);
+        ++hostState.greetings;
+        AddSample(
+            hostState.statistics.greetingDelay,
+            (hostState.greetings == 1),
+            ToSeconds(delay)
+        );
+        if (code == 220) {
+            impl_->OnSuccess(hostState);
+        } else {
+            impl_->OnFailure(hostState);
+            impl_->CutConcurrency(hostState);
+        }
+    }
+
+    void DestinationHealth::RecordReply(
+        const std::string& host,
+        int code
+    ) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->OnReply(impl_->GetHostState(host), code);
+    }
+
+    void DestinationHealth::RecordFinalReply(
+        const std::string& host,
+        std::chrono::steady_clock::duration latency,
+        int code
+    ) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        auto& hostState = impl_->GetHostState(host);
+        ++hostState.finalReplies;
+        AddSample(
+            hostState.statistics.finalReplyLatency,
+            (hostState.finalReplies == 1),
+            ToSeconds(latency)
+        );
+        hostState.periodLatencyTotal += ToSeconds(latency);
+        ++hostState.periodLatencySamples;
+        impl_->OnReply(hostState, code);
+        if (code / 100 == 2) {
+            impl_->OnSuccess(hostState);
+            ++hostState.periodAccepted;
+        }
+    }
+
+    auto DestinationHealth::GetStatistics(const std::string& host) -> Statistics {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        const auto hostsEntry = impl_->hosts.find(host);
+        if (hostsEntry == impl_->hosts.end()) {
+            Statistics statistics;
+            statistics.concurrencyLimit = impl_->minimumConnections;
+            return statistics;
+        }
+        impl_->UpdateConcurrency(hostsEntry->second);
+        return hostsEntry->second.statistics;
+    }
+
+    double DestinationHealth::GetScore(const std::string& host) {
+        const auto statistics = GetStatistics(host);
+        return (
+            (
+                statistics.connectTime
+                + statistics.greetingDelay
+                + statistics.finalReplyLatency
+            )
+            / std::max(1.0 - statistics.transientFailureRate, minimumSuccessRate)
+        );
+    }
+
+    bool DestinationHealth::IsAvailable(const std::string& host) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        const auto hostsEntry = impl_->hosts.find(host);
+        if (hostsEntry == impl_->hosts.end()) {
+            return true;
+        }
+        return impl_->IsAvailable(hostsEntry->second);
+    }
+
+    bool DestinationHealth::TryAcquireHost(const std::string& host) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        const auto hostsEntry = impl_->hosts.find(host);
+        if (hostsEntry == impl_->hosts.end()) {
+            return true;
+        }
+        auto& hostState = hostsEntry->second;
+        if (!impl_->IsAvailable(hostState)) {
+            return false;
+        }
+        if (hostState.statistics.circuitOpen) {
+            hostState.trialInProgress = true;
+            hostState.trialStarted = std::chrono::steady_clock::now();
+        }
+        return true;
+    }
+
+    std::vector< std::string > DestinationHealth::RankHosts(const std::vector< std::string >& hosts) {
+        std::vector< std::pair< double, std::string > > rankedHosts;
+        for (const auto& host: hosts) {
+            if (IsAvailable(host)) {
+                rankedHosts.emplace_back(GetScore(host), host);
+            }
+        }
+        std::stable_sort(
+            rankedHosts.begin(),
+            rankedHosts.end(),
+            [](
+                const std::pair< double, std::string >& lhs,
+                const std::pair< double, std::string >& rhs
+            ){
+                return lhs.first < rhs.first;
+            }
+        );
+        std::vector< std::string > result;
+        for (const auto& rankedHost: rankedHosts) {
+            result.push_back(rankedHost.second);
+        }
+        return result;
+    }
+
+}
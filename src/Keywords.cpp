@@ -0,0 +1,209 @@
+/**
+ * @file Keywords.cpp
+ *
+ * This module contains the implementation of functions used inside the Smtp
+ * library to recognize the keywords of SMTP service extensions listed by
+ * servers in reply to EHLO (or LHLO).
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "Keywords.hpp"
+
+#include <stddef.h>
+
+namespace {
+
+    /**
+     * This is the number of slots in the keyword hash table.
+     */
+    constexpr size_t KEYWORD_TABLE_SIZE = 64;
+
+    /**
+     * This holds one slot of the keyword hash table.
+     */
+    struct KeywordEntry {
+        /**
+         * This is the keyword, in upper case, or nullptr if the slot
+         * is empty.
+         */
+        const char* name;
+
+        /**
+         * This is the length of the keyword.
+         */
+        size_t length;
+
+        /**
+         * This identifies the keyword.
+         */
+        Smtp::Keyword keyword;
+    };
+
+    /**
+     * Return the upper-case form of the given character, if it's a letter,
+     * or the character itself otherwise.
+     *
+     * @param[in] c
+     *     This is the character to convert.
+     *
+     * @return
+     *     The upper-case form of the given character is returned.
+     */
+    constexpr unsigned Fold(char c) {
+        return (
+            ((c >= 'a') && (c <= 'z'))
+            ? (unsigned)(c - 'a' + 'A')
+            : (unsigned)(unsigned char)c
+        );
+    }
+
+    /**
+     * Compute the slot in the keyword hash table for the given name.
+     * The hash only looks at the name's length and its first, middle and
+     * last characters, which is enough to tell all the keywords in the
+     * table apart.
+     *
+     * @param[in] name
+     *     This points to the name to hash.
+     *
+     * @param[in] length
+     *     This is the length of the name.  It must not be zero.
+     *
+     * @return
+     *     The slot in the keyword hash table for the given name
+     *     is returned.
+     */
+    constexpr size_t KeywordHash(
+        const char* name,
+        size_t length
+    ) {
+        return (
+            Fold(name[0]) * 4
+            + Fold(name[length - 1]) * 22
+            + Fold(name[length / 2]) * 7
+            + length
+        ) % KEYWORD_TABLE_SIZE;
+    }
+
+    /**
+     * This is the keyword hash table, with each keyword in the slot
+     * given by its hash.
+     */
+    constexpr KeywordEntry KEYWORDS[KEYWORD_TABLE_SIZE] = {
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {"UTF8SMTP", 8, Smtp::Keyword::Utf8Smtp},
+        {"STARTTLS", 8, Smtp::Keyword::StartTls},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {"AUTH", 4, Smtp::Keyword::Auth},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {"VERB", 4, Smtp::Keyword::Verb},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {"RRVS", 4, Smtp::Keyword::Rrvs},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {"ETRN", 4, Smtp::Keyword::Etrn},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {"DSN", 3, Smtp::Keyword::Dsn},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {"CONNEG", 6, Smtp::Keyword::Conneg},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {"FUTURERELEASE", 13, Smtp::Keyword::FutureRelease},
+        {"BURL", 4, Smtp::Keyword::Burl},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {"ENHANCEDSTATUSCODES", 19, Smtp::Keyword::EnhancedStatusCodes},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {"LIMITS", 6, Smtp::Keyword::Limits},
+        {"HELP", 4, Smtp::Keyword::Help},
+        {"DELIVERBY", 9, Smtp::Keyword::DeliverBy},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {"NO-SOLICITING", 13, Smtp::Keyword::NoSoliciting},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {"SUBMITTER", 9, Smtp::Keyword::Submitter},
+        {"CONPERM", 7, Smtp::Keyword::Conperm},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {"PIPELINING", 10, Smtp::Keyword::Pipelining},
+        {"MT-PRIORITY", 11, Smtp::Keyword::MtPriority},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {"MTRK", 4, Smtp::Keyword::Mtrk},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {"VRFY", 4, Smtp::Keyword::Vrfy},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {"BINARYMIME", 10, Smtp::Keyword::BinaryMime},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {"8BITMIME", 8, Smtp::Keyword::EightBitMime},
+        {"REQUIRETLS", 10, Smtp::Keyword::RequireTls},
+        {"ONEX", 4, Smtp::Keyword::Onex},
+        {"SIZE", 4, Smtp::Keyword::Size},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {"SMTPUTF8", 8, Smtp::Keyword::SmtpUtf8},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {"ATRN", 4, Smtp::Keyword::Atrn},
+        {"CHUNKING", 8, Smtp::Keyword::Chunking},
+        {"EXPN", 4, Smtp::Keyword::Expn},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+        {"CHECKPOINT", 10, Smtp::Keyword::Checkpoint},
+        {nullptr, 0, Smtp::Keyword::Unknown},
+    };
+
+    /**
+     * Check that every keyword in the hash table, from the given slot
+     * onward, is in the slot given by its hash, and so the hash is perfect.
+     *
+     * @param[in] slot
+     *     This is the first slot to check.
+     *
+     * @return
+     *     An indication of whether or not every keyword checked is in
+     *     the slot given by its hash is returned.
+     */
+    constexpr bool KeywordsInPlace(size_t slot) {
+        return (
+            (slot >= KEYWORD_TABLE_SIZE)
+            || (
+                (
+                    (KEYWORDS[slot].name == nullptr)
+                    || (KeywordHash(KEYWORDS[slot].name, KEYWORDS[slot].length) == slot)
+                )
+                && KeywordsInPlace(slot + 1)
+            )
+        );
+    }
+
+    static_assert(KeywordsInPlace(0), "keyword hash table is not a perfect hash");
+
+}
+
+namespace Smtp {
+
+    Keyword FindKeyword(
+        const char* name,
+        size_t length
+    ) {
+        if (length == 0) {
+            return Keyword::Unknown;
+        }
+        const auto& entry = KEYWORDS[KeywordHash(name, length)];
+        if (entry.length != length) {
+            return Keyword::Unknown;
+        }
+        for (size_t i = 0; i < length; ++i) {
+            if (Fold(name[i]) != (unsigned)(unsigned char)entry.name[i]) {
+                return Keyword::Unknown;
+            }
+        }
+        return entry.keyword;
+    }
+
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+/**
+ * @file Keywords.hpp
+ *
+ * This module declares functions used inside the Smtp library to recognize
+ * the keywords of SMTP service extensions listed by servers in reply to
+ * EHLO (or LHLO).
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Smtp {
+
+    /**
+     * These are the registered SMTP service extension keywords
+     * which the library recognizes without looking them up by name.
+     */
+    enum class Keyword : uint8_t {
+        /**
+         * This is the 8BITMIME keyword.
+         */
+        EightBitMime,
+
+        /**
+         * This is the ATRN keyword.
+         */
+        Atrn,
+
+        /**
+         * This is the AUTH keyword.
+         */
+        Auth,
+
+        /**
+         * This is the BINARYMIME keyword.
+         */
+        BinaryMime,
+
+        /**
+         * This is the BURL keyword.
+         */
+        Burl,
+
+        /**
+         * This is the CHECKPOINT keyword.
+         */
+        Checkpoint,
+
+        /**
+         * This is the CHUNKING keyword.
+         */
+        Chunking,
+
+        /**
+         * This is the CONNEG keyword.
+         */
+        Conneg,
+
+        /**
+         * This is the CONPERM keyword.
+         */
+        Conperm,
+
+        /**
+         * This is the DELIVERBY keyword.
+         */
+        DeliverBy,
+
+        /**
+         * This is the DSN keyword.
+         */
+        Dsn,
+
+        /**
+         * This is the ENHANCEDSTATUSCODES keyword.
+         */
+        EnhancedStatusCodes,
+
+        /**
+         * This is the ETRN keyword.
+         */
+        Etrn,
+
+        /**
+         * This is the EXPN keyword.
+         */
+        Expn,
+
+        /**
+         * This is the FUTURERELEASE keyword.
+         */
+        FutureRelease,
+
+        /**
+         * This is the HELP keyword.
+         */
+        Help,
+
+        /**
+         * This is the LIMITS keyword.
+         */
+        Limits,
+
+        /**
+         * This is the MT-PRIORITY keyword.
+         */
+        MtPriority,
+
+        /**
+         * This is the MTRK keyword.
+         */
+        Mtrk,
+
+        /**
+         * This is the NO-SOLICITING keyword.
+         */
+        NoSoliciting,
+
+        /**
+         * This is the ONEX keyword.
+         */
+        Onex,
+
+        /**
+         * This is the PIPELINING keyword.
+         */
+        Pipelining,
+
+        /**
+         * This is the REQUIRETLS keyword.
+         */
+        RequireTls,
+
+        /**
+         * This is the RRVS keyword.
+         */
+        Rrvs,
+
+        /**
+         * This is the SIZE keyword.
+         */
+        Size,
+
+        /**
+         * This is the SMTPUTF8 keyword.
+         */
+        SmtpUtf8,
+
+        /**
+         * This is the STARTTLS keyword.
+         */
+        StartTls,
+
+        /**
+         * This is the SUBMITTER keyword.
+         */
+        Submitter,
+
+        /**
+         * This is the UTF8SMTP keyword.
+         */
+        Utf8Smtp,
+
+        /**
+         * This is the VERB keyword.
+         */
+        Verb,
+
+        /**
+         * This is the VRFY keyword.
+         */
+        Vrfy,
+
+        /**
+         * This stands for any keyword not listed above.
+         */
+        Unknown,
+    };
+
+    /**
+     * This is the number of keywords recognized by FindKeyword.
+     */
+    constexpr size_t KEYWORD_COUNT = (size_t)Keyword::Unknown;
+
+    /**
+     * Recognize the given SMTP service extension keyword, without regard
+     * to case, using a perfect hash computed at compile time.  This
+     * doesn't allocate memory.
+     *
+     * @param[in] name
+     *     This points to the keyword to recognize.
+     *
+     * @param[in] length
+     *     This is the length of the keyword.
+     *
+     * @return
+     *     The recognized keyword is returned, or Keyword::Unknown is
+     *     returned if the given name isn't one of the keywords the
+     *     library recognizes.
+     */
+    Keyword FindKeyword(
+        const char* name,
+        size_t length
+    );
+
+}
@@ -0,0 +1,154 @@
+/**
+ * @file MemoryResolver.cpp
+ *
+ * This module contains the implementation of the Smtp::MemoryResolver class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <Smtp/MemoryResolver.hpp>
+#include <sstream>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+    /**
+     * Parse the given string as an IPv4 address in dotted-decimal notation.
+     *
+     * @param[in] text
+     *     This is the string to parse.
+     *
+     * @param[out] address
+     *     This is where to store the parsed address.
+     *
+     * @return
+     *     An indication of whether or not the string was a valid
+     *     IPv4 address is returned.
+     */
+    bool ParseAddress(
+        const std::string& text,
+        uint32_t& address
+    ) {
+        unsigned int octets[4];
+        char extra;
+        if (
+            sscanf(
+                text.c_str(),
+                "%u.%u.%u.%u%c",
+                &octets[0],
+                &octets[1],
+                &octets[2],
+                &octets[3],
+                &extra
+            ) != 4
+        ) {
+            return false;
+        }
+        address = 0;
+        for (const auto octet: octets) {
+            if (octet > 255) {
+                return false;
+            }
+            address = (address << 8) | octet;
+        }
+        return true;
+    }
+
+}
+
+namespace Smtp {
+
+    /**
+     * This contains the private properties of a MemoryResolver instance.
+     */
+    struct MemoryResolver::Impl {
+        /**
+         * This is used to protect the other properties of this structure
+         * when accessed simultaneously by multiple threads.
+         */
+        std::mutex mutex;
+
+        /**
+         * These are the answers to give, keyed by host name.
+         */
+        std::map< std::string, Answer > answers;
+    };
+
+    MemoryResolver::~MemoryResolver() noexcept = default;
+    MemoryResolver::MemoryResolver(MemoryResolver&& other) noexcept = default;
+    MemoryResolver& MemoryResolver::operator=(MemoryResolver&& other) noexcept = default;
+
+    MemoryResolver::MemoryResolver()
+        : impl_(new Impl)
+    {
+    }
+
+    void MemoryResolver::SetAddresses(
+        const std::string& hostName,
+        const std::vector< uint32_t >& addresses,
+        std::chrono::milliseconds timeToLive
+    ) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        auto& answer = impl_->answers[hostName];
+        answer.addresses = addresses;
+        answer.timeToLive = timeToLive;
+    }
+
+    bool MemoryResolver::LoadHostsFile(const std::string& path) {
+        std::ifstream file(path);
+        if (!file) {
+            return false;
+        }
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        std::string line;
+        while (std::getline(file, line)) {
+            const auto commentStart = line.find('#');
+            if (commentStart != std::string::npos) {
+                line.resize(commentStart);
+            }
+            std::istringstream fields(line);
+            std::string addressText;
+            uint32_t address;
+            if (
+                !(fields >> addressText)
+                || !ParseAddress(addressText, address)
+            ) {
+                continue;
+            }
+            std::string hostName;
+            while (fields >> hostName) {
+                auto& answer = impl_->answers[hostName];
+                answer.addresses.push_back(address);
+                answer.timeToLive = std::chrono::minutes(5);
+            }
+        }
+        return true;
+    }
+
+    void MemoryResolver::Resolve(
+        const std::string& hostNameOrAddress,
+        ResolutionDelegate onResolved
+    ) {
+        Answer answer;
+        uint32_t address;
+        if (ParseAddress(hostNameOrAddress, address)) {
+            answer.addresses.push_back(address);
+        } else {
+            std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+            const auto answersEntry = impl_->answers.find(hostNameOrAddress);
+            if (answersEntry != impl_->answers.end()) {
+                answer = answersEntry->second;
+            }
+        }
+        onResolved(answer);
+    }
+
+}
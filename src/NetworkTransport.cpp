@@ -0,0 +1,1149 @@
+/**
+ * @file NetworkTransport.cpp
+ *
+ * This module contains the implementation of the Smtp::NetworkTransport
+ * class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <Smtp/CachingResolver.hpp>
+#include <Smtp/ConnectionTiming.hpp>
+#include <Smtp/DrainNotifier.hpp>
+#include <Smtp/FileSender.hpp>
+#include <Smtp/KernelTlsOffload.hpp>
+#include <Smtp/NetworkTransport.hpp>
+#include <Smtp/SourceAddressPool.hpp>
+#include <Smtp/SystemResolver.hpp>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <SystemAbstractions/NetworkConnection.hpp>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+    /**
+     * Have the given connection call the given function once everything
+     * queued to be sent on it has been sent, if the connection is able to.
+     *
+     * @param[in] connection
+     *     This is the connection to watch.
+     *
+     * @param[in] onDrained
+     *     This is the function to call once everything queued to be sent
+     *     on the connection has been sent.
+     *
+     * @return
+     *     An indication of whether or not the function will be called
+     *     is returned.
+     */
+    bool NotifyWhenDrainedThrough(
+        std::shared_ptr< SystemAbstractions::INetworkConnection > connection,
+        Smtp::DrainNotifier::DrainedDelegate onDrained
+    ) {
+        const auto drainNotifier = std::dynamic_pointer_cast< Smtp::DrainNotifier >(connection);
+        if (drainNotifier == nullptr) {
+            return false;
+        }
+        return drainNotifier->NotifyWhenDrained(onDrained);
+    }
+
+    /**
+     * Have the given connection send part of the given file, if the
+     * connection is able to send files.
+     *
+     * @param[in] connection
+     *     This is the connection through which to send the file.
+     *
+     * @param[in] path
+     *     This is the path to the file to send.
+     *
+     * @param[in] offset
+     *     This is the position in the file of the first byte to send.
+     *
+     * @param[in] length
+     *     This is the number of bytes to send.
+     *
+     * @return
+     *     An indication of whether or not the file was queued to be
+     *     sent is returned.
+     */
+    bool SendFileThrough(
+        std::shared_ptr< SystemAbstractions::INetworkConnection > connection,
+        const std::string& path,
+        uint64_t offset,
+        uint64_t length
+    ) {
+        const auto fileSender = std::dynamic_pointer_cast< Smtp::FileSender >(connection);
+        if (fileSender == nullptr) {
+            return false;
+        }
+        return fileSender->SendFile(path, offset, length);
+    }
+
+    /**
+     * Have the given connection hand the encryption of the given TLS
+     * session over to the kernel, if the connection is able to.
+     *
+     * @param[in] connection
+     *     This is the connection whose TLS session to hand over.
+     *
+     * @param[in] session
+     *     This holds the negotiated state of the TLS session.
+     *
+     * @return
+     *     An indication of whether or not the kernel took over the
+     *     session is returned.
+     */
+    bool EnableKernelTlsThrough(
+        std::shared_ptr< SystemAbstractions::INetworkConnection > connection,
+        const Smtp::KernelTlsOffload::Session& session
+    ) {
+        const auto kernelTlsOffload = std::dynamic_pointer_cast< Smtp::KernelTlsOffload >(connection);
+        if (kernelTlsOffload == nullptr) {
+            return false;
+        }
+        return kernelTlsOffload->EnableKernelTls(session);
+    }
+
+    /**
+     * Return the time at which the given connection was made, if the
+     * connection is able to report it.
+     *
+     * @param[in] connection
+     *     This is the connection whose time of connecting to return.
+     *
+     * @param[out] connectedTime
+     *     This is where to store the time at which the connection
+     *     was made.
+     *
+     * @return
+     *     An indication of whether or not the connection reported the
+     *     time at which it was made is returned.
+     */
+    bool GetConnectedTimeThrough(
+        std::shared_ptr< SystemAbstractions::INetworkConnection > connection,
+        std::chrono::steady_clock::time_point& connectedTime
+    ) {
+        const auto connectionTiming = std::dynamic_pointer_cast< Smtp::ConnectionTiming >(connection);
+        if (connectionTiming == nullptr) {
+            return false;
+        }
+        connectedTime = connectionTiming->GetConnectedTime();
+        return true;
+    }
+
+    /**
+     * This is a network connection decorator which starts receiving data
+     * as soon as it's connected, in order to watch for the server's
+     * greeting.  Anything received before the user of the connection
+     * calls Process is held and delivered to the user once it does,
+     * greeting included, so that the user handles the greeting just as
+     * it would over a connection handed over before being greeted.
+     */
+    struct GreetedConnection
+        : public SystemAbstractions::INetworkConnection
+        , public Smtp::ConnectionTiming
+        , public Smtp::DrainNotifier
+        , public Smtp::FileSender
+        , public Smtp::KernelTlsOffload
+        , public std::enable_shared_from_this< GreetedConnection >
+    {
+        // Types
+
+        /**
+         * This is the type of function called once the server has either
+         * completed its greeting or given up on the connection.
+         *
+         * @param[in] greeted
+         *     This indicates whether or not the server completed a
+         *     220 greeting.
+         */
+        using GreetingDelegate = std::function< void(bool greeted) >;
+
+        // Properties
+
+        /**
+         * This is the connection being decorated.
+         */
+        std::shared_ptr< SystemAbstractions::INetworkConnection > connection;
+
+        /**
+         * This is the time at which the connection was made.
+         */
+        std::chrono::steady_clock::time_point connectedTime = std::chrono::steady_clock::now();
+
+        /**
+         * This is set once the server has completed its greeting, whether
+         * or not it was a 220 greeting.
+         */
+        bool greetingComplete = false;
+
+        /**
+         * This is used to protect the other properties of this structure
+         * when accessed simultaneously by multiple threads.
+         */
+        std::recursive_mutex mutex;
+
+        /**
+         * This is the function to call once the server has either
+         * completed its greeting or given up on the connection.
+         */
+        GreetingDelegate onGreeting;
+
+        /**
+         * This holds all data received before the user of the connection
+         * called Process.
+         */
+        std::vector< uint8_t > dataReceived;
+
+        /**
+         * This indicates whether or not the connection was broken before
+         * the user of the connection called Process.
+         */
+        bool broken = false;
+
+        /**
+         * This indicates whether or not the connection was broken
+         * gracefully, if it was broken before the user of the connection
+         * called Process.
+         */
+        bool brokenGracefully = false;
+
+        /**
+         * This is the function given by the user of the connection to call
+         * to deliver data received.
+         */
+        MessageReceivedDelegate messageReceivedDelegate;
+
+        /**
+         * This is the function given by the user of the connection to call
+         * if the connection is broken.
+         */
+        BrokenDelegate brokenDelegate;
+
+        // Methods
+
+        /**
+         * This is the constructor.
+         *
+         * @param[in] connection
+         *     This is the connection to decorate.  It must have just
+         *     been connected.
+         */
+        explicit GreetedConnection(
+            std::shared_ptr< SystemAbstractions::INetworkConnection > connection
+        )
+            : connection(connection)
+        {
+        }
+
+        /**
+         * Start receiving data, in order to watch for the server's greeting.
+         *
+         * @param[in] onGreeting
+         *     This is the function to call once the server has either
+         *     completed its greeting or given up on the connection.
+         *
+         * @return
+         *     An indication of whether or not the connection could start
+         *     receiving data is returned.
+         */
+        bool Start(GreetingDelegate onGreeting) {
+            this->onGreeting = onGreeting;
+            std::weak_ptr< GreetedConnection > selfWeak(shared_from_this());
+            return connection->Process(
+                [selfWeak](const std::vector< uint8_t >& message){
+                    auto self = selfWeak.lock();
+                    if (self == nullptr) {
+                        return;
+                    }
+                    self->OnMessageReceived(message);
+                },
+                [selfWeak](bool graceful){
+                    auto self = selfWeak.lock();
+                    if (self == nullptr) {
+                        return;
+                    }
+                    self->OnBroken(graceful);
+                }
+            );
+        }
+
+        /**
+         * Check the data received so far, before the user of the connection
+         * called Process, for the end of the server's greeting.
+         */
+        void CheckForGreeting() {
+            if (onGreeting == nullptr) {
+                return;
+            }
+            auto lineStart = dataReceived.begin();
+            for (;;) {
+                const auto lf = std::find(lineStart, dataReceived.end(), (uint8_t)'\n');
+                if (lf == dataReceived.end()) {
+                    return;
+                }
+                if (
+                    (lf - lineStart >= 4)
+                    && (lineStart[3] == ' ')
+                ) {
+                    break;
+                }
+                lineStart = lf + 1;
+            }
+            greetingComplete = true;
+            const auto greeted = (
+                (lineStart[0] == '2')
+                && (lineStart[1] == '2')
+                && (lineStart[2] == '0')
+            );
+            const auto greetingDelegate = onGreeting;
+            onGreeting = nullptr;
+            greetingDelegate(greeted);
+        }
+
+        /**
+         * Handle the receipt of data from the server.
+         *
+         * @param[in] message
+         *     This holds the raw bytes received from the server.
+         */
+        void OnMessageReceived(const std::vector< uint8_t >& message) {
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            if (messageReceivedDelegate == nullptr) {
+                dataReceived.insert(
+                    dataReceived.end(),
+                    message.begin(),
+                    message.end()
+                );
+                CheckForGreeting();
+            } else {
+                messageReceivedDelegate(message);
+            }
+        }
+
+        /**
+         * Handle the connection being broken.
+         *
+         * @param[in] graceful
+         *     This indicates whether or not the connection was closed
+         *     without being reset by the peer.
+         */
+        void OnBroken(bool graceful) {
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            if (brokenDelegate == nullptr) {
+                broken = true;
+                brokenGracefully = graceful;
+                if (onGreeting != nullptr) {
+                    const auto greetingDelegate = onGreeting;
+                    onGreeting = nullptr;
+                    greetingDelegate(false);
+                }
+            } else {
+                brokenDelegate(graceful);
+            }
+        }
+
+        // SystemAbstractions::INetworkConnection
+
+        virtual SystemAbstractions::DiagnosticsSender::UnsubscribeDelegate SubscribeToDiagnostics(
+            SystemAbstractions::DiagnosticsSender::DiagnosticMessageDelegate delegate,
+            size_t minLevel = 0
+        ) override {
+            return connection->SubscribeToDiagnostics(delegate, minLevel);
+        }
+
+        virtual bool Connect(uint32_t peerAddress, uint16_t peerPort) override {
+            return connection->Connect(peerAddress, peerPort);
+        }
+
+        virtual bool Process(
+            MessageReceivedDelegate messageReceivedDelegate,
+            BrokenDelegate brokenDelegate
+        ) override {
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            this->messageReceivedDelegate = messageReceivedDelegate;
+            this->brokenDelegate = brokenDelegate;
+            if (!dataReceived.empty()) {
+                messageReceivedDelegate(dataReceived);
+                dataReceived.clear();
+                dataReceived.shrink_to_fit();
+            }
+            if (broken) {
+                brokenDelegate(brokenGracefully);
+            }
+            return true;
+        }
+
+        virtual uint32_t GetPeerAddress() const override {
+            return connection->GetPeerAddress();
+        }
+
+        virtual uint16_t GetPeerPort() const override {
+            return connection->GetPeerPort();
+        }
+
+        virtual bool IsConnected() const override {
+            return connection->IsConnected();
+        }
+
+        virtual uint32_t GetBoundAddress() const override {
+            return connection->GetBoundAddress();
+        }
+
+        virtual uint16_t GetBoundPort() const override {
+            return connection->GetBoundPort();
+        }
+
+        virtual void SendMessage(const std::vector< uint8_t >& message) override {
+            connection->SendMessage(message);
+        }
+
+        virtual void Close(bool clean = false) override {
+            connection->Close(clean);
+        }
+
+        // Smtp::ConnectionTiming
+
+        virtual std::chrono::steady_clock::time_point GetConnectedTime() const override {
+            return connectedTime;
+        }
+
+        // Smtp::DrainNotifier
+
+        virtual bool NotifyWhenDrained(DrainedDelegate onDrained) override {
+            return NotifyWhenDrainedThrough(connection, onDrained);
+        }
+
+        // Smtp::FileSender
+
+        virtual bool SendFile(
+            const std::string& path,
+            uint64_t offset,
+            uint64_t length
+        ) override {
+            return SendFileThrough(connection, path, offset, length);
+        }
+
+        // Smtp::KernelTlsOffload
+
+        virtual bool EnableKernelTls(const Session& session) override {
+            return EnableKernelTlsThrough(connection, session);
+        }
+    };
+
+    /**
+     * This is a network connection decorator which calls a given function
+     * once the connection is closed, broken, or discarded, whichever
+     * happens first.  It's used to give back to its pool the source
+     * address from which the connection was made.
+     */
+    struct SourceBoundConnection
+        : public SystemAbstractions::INetworkConnection
+        , public Smtp::ConnectionTiming
+        , public Smtp::DrainNotifier
+        , public Smtp::FileSender
+        , public Smtp::KernelTlsOffload
+    {
+        // Properties
+
+        /**
+         * This is the connection being decorated.
+         */
+        std::shared_ptr< SystemAbstractions::INetworkConnection > connection;
+
+        /**
+         * This is the function to call once the connection is closed,
+         * broken, or discarded.  It may be called more than once,
+         * and must only take effect the first time.
+         */
+        std::function< void() > onClosed;
+
+        // Methods
+
+        /**
+         * This is the constructor.
+         *
+         * @param[in] connection
+         *     This is the connection to decorate.
+         *
+         * @param[in] onClosed
+         *     This is the function to call once the connection is closed,
+         *     broken, or discarded.  It may be called more than once,
+         *     and must only take effect the first time.
+         */
+        SourceBoundConnection(
+            std::shared_ptr< SystemAbstractions::INetworkConnection > connection,
+            std::function< void() > onClosed
+        )
+            : connection(connection)
+            , onClosed(onClosed)
+        {
+        }
+
+        /**
+         * This is the destructor.
+         */
+        ~SourceBoundConnection() noexcept {
+            onClosed();
+        }
+
+        // SystemAbstractions::INetworkConnection
+
+        virtual SystemAbstractions::DiagnosticsSender::UnsubscribeDelegate SubscribeToDiagnostics(
+            SystemAbstractions::DiagnosticsSender::DiagnosticMessageDelegate delegate,
+            size_t minLevel = 0
+        ) override {
+            return connection->SubscribeToDiagnostics(delegate, minLevel);
+        }
+
+        virtual bool Connect(uint32_t peerAddress, uint16_t peerPort) override {
+            return connection->Connect(peerAddress, peerPort);
+        }
+
+        virtual bool Process(
+            MessageReceivedDelegate messageReceivedDelegate,
+            BrokenDelegate brokenDelegate
+        ) override {
+            const auto onClosed = this->onClosed;
+            return connection->Process(
+                messageReceivedDelegate,
+                [onClosed, brokenDelegate](bool graceful){
+                    onClosed();
+                    brokenDelegate(graceful);
+                }
+            );
+        }
+
+        virtual uint32_t GetPeerAddress() const override {
+            return connection->GetPeerAddress();
+        }
+
+        virtual uint16_t GetPeerPort() const override {
+            return connection->GetPeerPort();
+        }
+
+        virtual bool IsConnected() const override {
+            return connection->IsConnected();
+        }
+
+        virtual uint32_t GetBoundAddress() const override {
+            return connection->GetBoundAddress();
+        }
+
+        virtual uint16_t GetBoundPort() const override {
+            return connection->GetBoundPort();
+        }
+
+        virtual void SendMessage(const std::vector< uint8_t >& message) override {
+            connection->SendMessage(message);
+        }
+
+        virtual void Close(bool clean = false) override {
+            connection->Close(clean);
+            onClosed();
+        }
+
+        // Smtp::ConnectionTiming
+
+        virtual std::chrono::steady_clock::time_point GetConnectedTime() const override {
+            auto connectedTime = std::chrono::steady_clock::now();
+            (void)GetConnectedTimeThrough(connection, connectedTime);
+            return connectedTime;
+        }
+
+        // Smtp::DrainNotifier
+
+        virtual bool NotifyWhenDrained(DrainedDelegate onDrained) override {
+            return NotifyWhenDrainedThrough(connection, onDrained);
+        }
+
+        // Smtp::FileSender
+
+        virtual bool SendFile(
+            const std::string& path,
+            uint64_t offset,
+            uint64_t length
+        ) override {
+            return SendFileThrough(connection, path, offset, length);
+        }
+
+        // Smtp::KernelTlsOffload
+
+        virtual bool EnableKernelTls(const Session& session) override {
+            return EnableKernelTlsThrough(connection, session);
+        }
+    };
+
+    /**
+     * Return a function which makes new, unconnected network connection
+     * objects, each bound to a source address picked from the given pool
+     * for it, and which gives that address back to the pool once the
+     * connection is closed, broken, or discarded.
+     *
+     * @param[in] sourceAddressPool
+     *     This is the pool from which to pick source addresses.
+     *
+     * @param[in] sourceConnectionFactory
+     *     This is the function used to make connection objects bound
+     *     to the source addresses picked.
+     *
+     * @param[in] hostNameOrAddress
+     *     This is the name or address of the server to which the
+     *     connections are to be made.
+     *
+     * @return
+     *     The function which makes source-bound connections is returned.
+     *     It returns nullptr if the pool has no source address to spare.
+     */
+    Smtp::NetworkTransport::ConnectionFactory BindToSourceAddresses(
+        std::shared_ptr< Smtp::SourceAddressPool > sourceAddressPool,
+        Smtp::NetworkTransport::SourceConnectionFactory sourceConnectionFactory,
+        const std::string& hostNameOrAddress
+    ) {
+        return [
+            sourceAddressPool,
+            sourceConnectionFactory,
+            hostNameOrAddress
+        ]() -> std::shared_ptr< SystemAbstractions::INetworkConnection > {
+            uint32_t sourceAddress = 0;
+            if (!sourceAddressPool->Acquire(hostNameOrAddress, sourceAddress)) {
+                return nullptr;
+            }
+            const auto released = std::make_shared< std::atomic< bool > >(false);
+            return std::make_shared< SourceBoundConnection >(
+                sourceConnectionFactory(sourceAddress),
+                [sourceAddressPool, sourceAddress, hostNameOrAddress, released]{
+                    if (!released->exchange(true)) {
+                        sourceAddressPool->Release(sourceAddress, hostNameOrAddress);
+                    }
+                }
+            );
+        };
+    }
+
+    /**
+     * This holds the state shared between the connection attempts raced
+     * for one call to NetworkTransport::Connect.
+     */
+    struct ConnectionRace {
+        /**
+         * This is used to protect the other properties of this structure
+         * when accessed simultaneously by multiple threads.
+         */
+        std::mutex mutex;
+
+        /**
+         * This is used to wake up the thread running the race when an
+         * attempt succeeds or fails.
+         */
+        std::condition_variable attemptFinished;
+
+        /**
+         * These are the connections made by attempts which are still
+         * waiting for the server's greeting.
+         */
+        std::vector< std::shared_ptr< GreetedConnection > > contenders;
+
+        /**
+         * This is the connection over which the server first completed
+         * its greeting.
+         */
+        std::shared_ptr< GreetedConnection > winner;
+
+        /**
+         * This is the first connection over which the server completed
+         * a greeting other than 220, such as 421 or 554.  It's kept open,
+         * with the greeting unread, to be handed over instead of nothing
+         * if no attempt wins the race, so that the user of the connection
+         * sees the server's refusal just as it would over the only
+         * connection to a server with one address.
+         */
+        std::shared_ptr< GreetedConnection > refused;
+
+        /**
+         * This is the number of attempts started.
+         */
+        size_t attemptsStarted = 0;
+
+        /**
+         * This is the number of attempts which have failed.
+         */
+        size_t attemptsFailed = 0;
+
+        /**
+         * This is set once the race is over, whether won or not.
+         */
+        bool over = false;
+
+        /**
+         * Record the outcome of the given attempt.
+         *
+         * @param[in] contender
+         *     This is the connection made by the attempt, if any.
+         *
+         * @param[in] greeted
+         *     This indicates whether or not the server completed a
+         *     220 greeting over the connection.
+         */
+        void OnAttemptFinished(
+            std::shared_ptr< GreetedConnection > contender,
+            bool greeted
+        ) {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            const auto contendersEntry = std::find(
+                contenders.begin(),
+                contenders.end(),
+                contender
+            );
+            if (contendersEntry != contenders.end()) {
+                (void)contenders.erase(contendersEntry);
+            }
+            if (greeted && !over) {
+                winner = contender;
+                over = true;
+            } else {
+                ++attemptsFailed;
+                if (
+                    (contender != nullptr)
+                    && contender->greetingComplete
+                    && (refused == nullptr)
+                    && !over
+                ) {
+                    refused = contender;
+                } else if (contender != nullptr) {
+                    lock.unlock();
+                    contender->Close();
+                    lock.lock();
+                }
+            }
+            attemptFinished.notify_all();
+        }
+    };
+
+    /**
+     * This holds the thread running one connection attempt, which may
+     * outlive the race of which it was a part, since there is no way to
+     * cut short a connection still being made.
+     */
+    struct Attempt {
+        /**
+         * This is the thread running the attempt.
+         */
+        std::thread thread;
+
+        /**
+         * This is set by the thread running the attempt once it has
+         * nothing left to do, so that the thread can be joined without
+         * waiting.
+         */
+        std::shared_ptr< std::atomic< bool > > finished = std::make_shared< std::atomic< bool > >(false);
+    };
+
+}
+
+namespace Smtp {
+
+    /**
+     * This contains the private properties of a NetworkTransport instance.
+     */
+    struct NetworkTransport::Impl {
+        // Properties
+
+        /**
+         * This is used to protect the other properties of this structure
+         * when accessed simultaneously by multiple threads.
+         */
+        std::mutex mutex;
+
+        /**
+         * This is the object used to look up the addresses of SMTP servers.
+         */
+        std::shared_ptr< Resolver > resolver;
+
+        /**
+         * This is the function used to make new, unconnected network
+         * connection objects.
+         */
+        ConnectionFactory connectionFactory = []{
+            return std::make_shared< SystemAbstractions::NetworkConnection >();
+        };
+
+        /**
+         * This is how long to wait for one connection attempt to succeed
+         * before starting the next one in parallel.
+         */
+        std::chrono::milliseconds attemptDelay = std::chrono::milliseconds(250);
+
+        /**
+         * This is how long to wait in total for any connection attempt
+         * to succeed.
+         */
+        std::chrono::milliseconds raceTimeout = std::chrono::seconds(30);
+
+        /**
+         * This is the most connection attempts which may be in progress
+         * at once, across all races.  Attempts abandoned by a race which
+         * is already over still count until their connections are made
+         * or fail, so that servers which never answer can't tie up an
+         * unbounded number of threads.
+         */
+        size_t maxAttemptsInProgress = 16;
+
+        /**
+         * These are the connection attempts started and not yet joined.
+         */
+        std::list< Attempt > attempts;
+
+        /**
+         * This is the pool from which to pick source addresses for
+         * connections, if any.
+         */
+        std::shared_ptr< SourceAddressPool > sourceAddressPool;
+
+        /**
+         * This is the function used to make new, unconnected network
+         * connection objects bound to source addresses picked from
+         * the pool.
+         */
+        SourceConnectionFactory sourceConnectionFactory;
+
+        // Methods
+
+        /**
+         * This is the destructor.
+         */
+        ~Impl() noexcept {
+            for (auto& attempt: attempts) {
+                attempt.thread.join();
+            }
+        }
+
+        /**
+         * Look up the addresses of the given host, waiting for the answer.
+         *
+         * @param[in] hostNameOrAddress
+         *     This is the name or IPv4 address of the host to look up.
+         *
+         * @return
+         *     The answer given by the resolver is returned.  It's empty
+         *     if no resolver is configured.
+         */
+        Resolver::Answer Resolve(const std::string& hostNameOrAddress) {
+            std::shared_ptr< Resolver > resolver;
+            {
+                std::lock_guard< decltype(mutex) > lock(mutex);
+                resolver = this->resolver;
+            }
+            if (resolver == nullptr) {
+                return Resolver::Answer();
+            }
+            const auto resolved = std::make_shared< std::promise< Resolver::Answer > >();
+            auto answer = resolved->get_future();
+            resolver->Resolve(
+                hostNameOrAddress,
+                [resolved](const Resolver::Answer& answer){
+                    resolved->set_value(answer);
+                }
+            );
+            return answer.get();
+        }
+
+        /**
+         * Make an attempt to connect to a server at the given address,
+         * as part of the given race.
+         *
+         * @param[in] race
+         *     This is the race of which the attempt is a part.
+         *
+         * @param[in] connectionFactory
+         *     This is the function used to make the connection object.
+         *     It may return nullptr if no connection can be made.
+         *
+         * @param[in] address
+         *     This is the IPv4 address of the server.
+         *
+         * @param[in] port
+         *     This is the port number of the server.
+         */
+        static void RunAttempt(
+            std::shared_ptr< ConnectionRace > race,
+            ConnectionFactory connectionFactory,
+            uint32_t address,
+            uint16_t port
+        ) {
+            const auto connection = connectionFactory();
+            if (
+                (connection == nullptr)
+                || !connection->Connect(address, port)
+            ) {
+                race->OnAttemptFinished(nullptr, false);
+                return;
+            }
+            const auto contender = std::make_shared< GreetedConnection >(connection);
+            {
+                std::lock_guard< decltype(race->mutex) > lock(race->mutex);
+                if (race->over) {
+                    contender->Close();
+                    return;
+                }
+                race->contenders.push_back(contender);
+            }
+            std::weak_ptr< GreetedConnection > contenderWeak(contender);
+            if (
+                !contender->Start(
+                    [race, contenderWeak](bool greeted){
+                        race->OnAttemptFinished(contenderWeak.lock(), greeted);
+                    }
+                )
+            ) {
+                race->OnAttemptFinished(contender, false);
+            }
+        }
+
+        /**
+         * Start an attempt to connect to a server at the given address,
+         * as part of the given race, on a thread of its own, unless too
+         * many attempts are already in progress.
+         *
+         * @param[in] race
+         *     This is the race of which the attempt is a part.
+         *
+         * @param[in] connectionFactory
+         *     This is the function used to make the connection object.
+         *
+         * @param[in] address
+         *     This is the IPv4 address of the server.
+         *
+         * @param[in] port
+         *     This is the port number of the server.
+         *
+         * @return
+         *     An indication of whether or not the attempt was started
+         *     is returned.
+         */
+        bool StartAttempt(
+            std::shared_ptr< ConnectionRace > race,
+            ConnectionFactory connectionFactory,
+            uint32_t address,
+            uint16_t port
+        ) {
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            auto attemptsEntry = attempts.begin();
+            while (attemptsEntry != attempts.end()) {
+                if (*attemptsEntry->finished) {
+                    attemptsEntry->thread.join();
+                    attemptsEntry = attempts.erase(attemptsEntry);
+                } else {
+                    ++attemptsEntry;
+                }
+            }
+            if (attempts.size() >= maxAttemptsInProgress) {
+                return false;
+            }
+            Attempt attempt;
+            const auto finished = attempt.finished;
+            attempt.thread = std::thread(
+                [race, connectionFactory, address, port, finished]{
+                    RunAttempt(race, connectionFactory, address, port);
+                    *finished = true;
+                }
+            );
+            attempts.push_back(std::move(attempt));
+            return true;
+        }
+
+        /**
+         * Race connection attempts to a server at the given addresses,
+         * starting them one at a time, a short delay apart, and return the
+         * first connection over which the server completes a 220 greeting,
+         * or else the first over which it completes any other greeting.
+         *
+         * @param[in] connectionFactory
+         *     This is the function used to make the connection objects.
+         *
+         * @param[in] addresses
+         *     These are the IPv4 addresses of the server, in the order
+         *     in which to attempt them.
+         *
+         * @param[in] port
+         *     This is the port number of the server.
+         *
+         * @return
+         *     The first connection over which the server completes a 220
+         *     greeting is returned, or else the first over which it
+         *     completes any other greeting, still to be read by the user
+         *     of the connection.
+         *
+         * @retval nullptr
+         *     This is returned if the server greeted the client over
+         *     no connection in time.
+         */
+        std::shared_ptr< SystemAbstractions::INetworkConnection > RaceConnections(
+            ConnectionFactory connectionFactory,
+            const std::vector< uint32_t >& addresses,
+            uint16_t port
+        ) {
+            std::chrono::milliseconds attemptDelay;
+            std::chrono::milliseconds raceTimeout;
+            {
+                std::lock_guard< decltype(mutex) > lock(mutex);
+                attemptDelay = this->attemptDelay;
+                raceTimeout = this->raceTimeout;
+            }
+            const auto race = std::make_shared< ConnectionRace >();
+            const auto deadline = std::chrono::steady_clock::now() + raceTimeout;
+            std::unique_lock< decltype(race->mutex) > lock(race->mutex);
+            for (const auto address: addresses) {
+                ++race->attemptsStarted;
+                const auto attemptsFailed = race->attemptsFailed;
+                lock.unlock();
+                const auto started = StartAttempt(race, connectionFactory, address, port);
+                lock.lock();
+                if (!started) {
+                    --race->attemptsStarted;
+                    break;
+                }
+                (void)race->attemptFinished.wait_until(
+                    lock,
+                    std::min(
+                        deadline,
+                        std::chrono::steady_clock::now() + attemptDelay
+                    ),
+                    [race, attemptsFailed]{
+                        return (
+                            race->over
+                            || (race->attemptsFailed > attemptsFailed)
+                        );
+                    }
+                );
+                if (
+                    race->over
+                    || (std::chrono::steady_clock::now() >= deadline)
+                ) {
+                    break;
+                }
+            }
+            (void)race->attemptFinished.wait_until(
+                lock,
+                deadline,
+                [race]{
+                    return (
+                        race->over
+                        || (race->attemptsFailed == race->attemptsStarted)
+                    );
+                }
+            );
+            race->over = true;
+            std::vector< std::shared_ptr< GreetedConnection > > losers;
+            losers.swap(race->contenders);
+            auto winner = race->winner;
+            if (winner == nullptr) {
+                winner = race->refused;
+            } else if (race->refused != nullptr) {
+                losers.push_back(race->refused);
+            }
+            race->refused = nullptr;
+            lock.unlock();
+            for (const auto& loser: losers) {
+                loser->Close();
+            }
+            return winner;
+        }
+    };
+
+    NetworkTransport::~NetworkTransport() noexcept = default;
+    NetworkTransport::NetworkTransport(NetworkTransport&& other) noexcept = default;
+    NetworkTransport& NetworkTransport::operator=(NetworkTransport&& other) noexcept = default;
+
+    NetworkTransport::NetworkTransport()
+        : impl_(new Impl)
+    {
+        const auto cachingResolver = std::make_shared< CachingResolver >();
+        cachingResolver->Configure(std::make_shared< SystemResolver >());
+        impl_->resolver = cachingResolver;
+    }
+
+    void NetworkTransport::Configure(std::shared_ptr< Resolver > resolver) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->resolver = resolver;
+    }
+
+    void NetworkTransport::SetConnectionFactory(ConnectionFactory connectionFactory) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->connectionFactory = connectionFactory;
+    }
+
+    void NetworkTransport::SetConnectionRaceTiming(
+        std::chrono::milliseconds attemptDelay,
+        std::chrono::milliseconds raceTimeout
+    ) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->attemptDelay = attemptDelay;
+        impl_->raceTimeout = raceTimeout;
+    }
+
+    void NetworkTransport::SetMaxAttemptsInProgress(size_t maxAttemptsInProgress) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->maxAttemptsInProgress = maxAttemptsInProgress;
+    }
+
+    void NetworkTransport::SetSourceAddressPool(
+        std::shared_ptr< SourceAddressPool > sourceAddressPool,
+        SourceConnectionFactory sourceConnectionFactory
+    ) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->sourceAddressPool = sourceAddressPool;
+        impl_->sourceConnectionFactory = sourceConnectionFactory;
+    }
+
+    std::shared_ptr< SystemAbstractions::INetworkConnection > NetworkTransport::Connect(
+        const std::string& hostNameOrAddress,
+        uint16_t port
+    ) {
+        const auto answer = impl_->Resolve(hostNameOrAddress);
+        if (answer.addresses.empty()) {
+            return nullptr;
+        }
+        ConnectionFactory connectionFactory;
+        std::shared_ptr< SourceAddressPool > sourceAddressPool;
+        SourceConnectionFactory sourceConnectionFactory;
+        {
+            std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+            connectionFactory = impl_->connectionFactory;
+            sourceAddressPool = impl_->sourceAddressPool;
+            sourceConnectionFactory = impl_->sourceConnectionFactory;
+        }
+        if (sourceAddressPool != nullptr) {
+            connectionFactory = BindToSourceAddresses(
+                sourceAddressPool,
+                sourceConnectionFactory,
+                hostNameOrAddress
+            );
+        }
+        if (answer.addresses.size() > 1) {
+            return impl_->RaceConnections(connectionFactory, answer.addresses, port);
+        }
+        auto connection = connectionFactory();
+        if (
+            (connection == nullptr)
+            || !connection->Connect(answer.addresses[0], port)
+        ) {
+            return nullptr;
+        }
+        return connection;
+    }
+
+}
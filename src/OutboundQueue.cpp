@@ -0,0 +1,258 @@
+/**
+ * @file OutboundQueue.cpp
+ *
+ * This module contains the implementation of the Smtp::OutboundQueue
+ * class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "CaseInsensitiveLess.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <Smtp/Client.hpp>
+#include <Smtp/OutboundQueue.hpp>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Smtp {
+
+    /**
+     * This contains the private properties of an OutboundQueue instance.
+     */
+    struct OutboundQueue::Impl {
+        // Types
+
+        /**
+         * This holds one e-mail handed to a client to be sent, until the
+         * client is done with it.
+         */
+        struct InFlight {
+            /**
+             * This is the e-mail, kept so that it can be put back in the
+             * queue if it isn't sent.
+             */
+            Message message;
+
+            /**
+             * This is set when the client is done with the e-mail,
+             * to the outcome of sending it.  It isn't valid until the
+             * e-mail has been handed to the client.
+             */
+            std::shared_future< Client::SendResult > sendCompleted;
+        };
+
+        // Properties
+
+        /**
+         * This is used to protect the other properties of this structure
+         * when accessed simultaneously by multiple threads.
+         */
+        std::mutex mutex;
+
+        /**
+         * These are the e-mails in the queue, keyed by the order in which
+         * they were added.
+         */
+        std::map< uint64_t, Message > messages;
+
+        /**
+         * This is the index of the e-mails in the queue by destination.
+         * For each destination, it holds the keys of the e-mails bound for
+         * it, in the order in which they were added.  Destinations with no
+         * e-mails in the queue are removed.
+         */
+        std::map< std::string, std::deque< uint64_t >, CaseInsensitiveLess > destinations;
+
+        /**
+         * These are the e-mails handed to clients which are not yet
+         * done with them, keyed by the order in which they were added.
+         */
+        std::map< uint64_t, InFlight > inFlight;
+
+        /**
+         * This is the key to give the next e-mail added to the queue.
+         */
+        uint64_t nextKey = 0;
+
+        // Methods
+
+        /**
+         * Remove the e-mails in the queue bound for the given destination,
+         * in the order they were added.
+         *
+         * @param[in] destination
+         *     This identifies the destination of the e-mails to remove.
+         *
+         * @param[in] maxMessages
+         *     This is the most e-mails to remove.
+         *
+         * @return
+         *     The e-mails removed are returned, along with their keys.
+         */
+        std::vector< std::pair< uint64_t, Message > > Remove(
+            const std::string& destination,
+            size_t maxMessages
+        ) {
+            std::vector< std::pair< uint64_t, Message > > removed;
+            const auto destinationsEntry = destinations.find(destination);
+            if (destinationsEntry == destinations.end()) {
+                return removed;
+            }
+            auto& keys = destinationsEntry->second;
+            while (
+                !keys.empty()
+                && (removed.size() < maxMessages)
+            ) {
+                const auto messagesEntry = messages.find(keys.front());
+                removed.push_back(
+                    std::make_pair(
+                        messagesEntry->first,
+                        std::move(messagesEntry->second)
+                    )
+                );
+                (void)messages.erase(messagesEntry);
+                keys.pop_front();
+            }
+            if (keys.empty()) {
+                (void)destinations.erase(destinationsEntry);
+            }
+            return removed;
+        }
+
+        /**
+         * Forget the e-mails which clients have finished sending, or which
+         * the server rejected permanently, and put back in the queue, where
+         * they were before, those which clients failed to send for reasons
+         * which may pass.
+         */
+        void Settle() {
+            auto inFlightEntry = inFlight.begin();
+            while (inFlightEntry != inFlight.end()) {
+                auto& sendCompleted = inFlightEntry->second.sendCompleted;
+                if (
+                    !sendCompleted.valid()
+                    || (
+                        sendCompleted.wait_for(std::chrono::seconds(0))
+                        != std::future_status::ready
+                    )
+                ) {
+                    ++inFlightEntry;
+                    continue;
+                }
+                if (sendCompleted.get() == Client::SendResult::TransientFailure) {
+                    const auto key = inFlightEntry->first;
+                    auto& message = inFlightEntry->second.message;
+                    auto& keys = destinations[message.destination];
+                    (void)keys.insert(
+                        std::lower_bound(keys.begin(), keys.end(), key),
+                        key
+                    );
+                    (void)messages.insert(std::make_pair(key, std::move(message)));
+                }
+                inFlightEntry = inFlight.erase(inFlightEntry);
+            }
+        }
+    };
+
+    OutboundQueue::~OutboundQueue() noexcept = default;
+    OutboundQueue::OutboundQueue(OutboundQueue&& other) noexcept = default;
+    OutboundQueue& OutboundQueue::operator=(OutboundQueue&& other) noexcept = default;
+
+    OutboundQueue::OutboundQueue()
+        : impl_(new Impl)
+    {
+    }
+
+    void OutboundQueue::Add(Message&& message) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        const auto key = impl_->nextKey++;
+        impl_->destinations[message.destination].push_back(key);
+        (void)impl_->messages.insert(std::make_pair(key, std::move(message)));
+    }
+
+    size_t OutboundQueue::GetPendingCount() {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->Settle();
+        return impl_->messages.size();
+    }
+
+    size_t OutboundQueue::GetPendingCount(const std::string& destination) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->Settle();
+        const auto destinationsEntry = impl_->destinations.find(destination);
+        if (destinationsEntry == impl_->destinations.end()) {
+            return 0;
+        }
+        return destinationsEntry->second.size();
+    }
+
+    size_t OutboundQueue::GetInFlightCount() {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->Settle();
+        return impl_->inFlight.size();
+    }
+
+    std::string OutboundQueue::GetOldestDestination() {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->Settle();
+        if (impl_->messages.empty()) {
+            return "";
+        }
+        return impl_->messages.begin()->second.destination;
+    }
+
+    auto OutboundQueue::Take(
+        const std::string& destination,
+        size_t maxMessages
+    ) -> std::vector< Message > {
+        std::vector< Message > taken;
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->Settle();
+        for (auto& removed: impl_->Remove(destination, maxMessages)) {
+            taken.push_back(std::move(removed.second));
+        }
+        return taken;
+    }
+
+    std::vector< std::shared_future< Client::SendResult > > OutboundQueue::SendPending(
+        Client& client,
+        const std::string& destination,
+        size_t maxMessages
+    ) {
+        std::vector< std::pair< uint64_t, const Message* > > sending;
+        {
+            std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+            impl_->Settle();
+            for (auto& removed: impl_->Remove(destination, maxMessages)) {
+                auto& inFlight = impl_->inFlight[removed.first];
+                inFlight.message = std::move(removed.second);
+                sending.push_back(std::make_pair(removed.first, &inFlight.message));
+            }
+        }
+        std::vector< std::shared_future< Client::SendResult > > sendsCompleted;
+        for (const auto& next: sending) {
+            sendsCompleted.push_back(
+                client.SendMailForResult(
+                    next.second->headers,
+                    next.second->body
+                ).share()
+            );
+        }
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        for (size_t i = 0; i < sending.size(); ++i) {
+            impl_->inFlight[sending[i].first].sendCompleted = sendsCompleted[i];
+        }
+        return sendsCompleted;
+    }
+
+}
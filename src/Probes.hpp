@@ -0,0 +1,46 @@
+#pragma once
+
+/**
+ * @file Probes.hpp
+ *
+ * This module declares the static tracepoints of the Smtp library.
+ *
+ * Where the system provides <sys/sdt.h> (SystemTap/USDT), each probe
+ * compiles to a single no-op instruction plus a note in the binary, so
+ * tools such as bpftrace or perf can attach to a running process without
+ * rebuilding it.  Elsewhere the probes compile to nothing, and their
+ * arguments are not evaluated.
+ *
+ * All probes are in the "smtp" provider, and the first argument of each
+ * is the identifier of the connection to which it relates:
+ *
+ * - stage(connection, from, to) -- the client moved from one protocol
+ *   stage to another.
+ * - hard_failure(connection, stage) -- communication with the server
+ *   failed, and the connection was closed.
+ * - soft_failure(connection, stage) -- an e-mail was not sent, but the
+ *   connection remains usable.
+ * - receive(connection, bytes) -- data was received from the server.
+ * - reply(connection, stage, code) -- a complete reply was received,
+ *   after any lines of a multiline reply were gathered together.
+ * - send(connection, stage, bytes) -- data was written to the server.
+ *
+ * Protocol stages are given as the integer values of
+ * Smtp::Client::ProtocolStage.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#ifdef SMTP_HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define SMTP_PROBE2(name, arg1, arg2) DTRACE_PROBE2(smtp, name, arg1, arg2)
+#define SMTP_PROBE3(name, arg1, arg2, arg3) DTRACE_PROBE3(smtp, name, arg1, arg2, arg3)
+
+#else /* not SMTP_HAVE_SYS_SDT_H */
+
+#define SMTP_PROBE2(name, arg1, arg2) ((void)0)
+#define SMTP_PROBE3(name, arg1, arg2, arg3) ((void)0)
+
+#endif /* SMTP_HAVE_SYS_SDT_H */
@@ -0,0 +1,234 @@
+/**
+ * @file SourceAddressPool.cpp
+ *
+ * This module contains the implementation of the Smtp::SourceAddressPool
+ * class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <Smtp/SourceAddressPool.hpp>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Smtp {
+
+    /**
+     * This contains the private properties of a SourceAddressPool instance.
+     */
+    struct SourceAddressPool::Impl {
+        // Types
+
+        /**
+         * This holds everything kept for one pairing of source address
+         * and destination.
+         */
+        struct PairingState {
+            /**
+             * This is the number of connections currently open.
+             */
+            size_t activeConnections = 0;
+
+            /**
+             * These are the times at which connections were made within
+             * the current rate interval, oldest first.
+             */
+            std::deque< std::chrono::steady_clock::time_point > connectionTimes;
+        };
+
+        /**
+         * This is the type used to identify one pairing of source address
+         * and destination.
+         */
+        using PairingKey = std::pair< uint32_t, std::string >;
+
+        // Properties
+
+        /**
+         * This is used to protect the other properties of this structure
+         * when accessed simultaneously by multiple threads.
+         */
+        std::mutex mutex;
+
+        /**
+         * These are the addresses from which connections may be made,
+         * in order of preference.
+         */
+        std::vector< uint32_t > addresses;
+
+        /**
+         * This is the most connections which may be open at once from any
+         * one source address to any one destination, or zero if there
+         * is no limit.
+         */
+        size_t maxConnections = 0;
+
+        /**
+         * This is the most connections which may be made within any one
+         * rate interval from any one source address to any one destination,
+         * or zero if there is no limit.
+         */
+        size_t maxConnectionsPerInterval = 0;
+
+        /**
+         * This is the length of time over which connections made are
+         * counted against maxConnectionsPerInterval.
+         */
+        std::chrono::milliseconds rateInterval = std::chrono::seconds(60);
+
+        /**
+         * This holds everything kept for each pairing of source address
+         * and destination.
+         */
+        std::map< PairingKey, PairingState > pairings;
+
+        // Methods
+
+        /**
+         * Forget about connections made before the current rate interval.
+         *
+         * @param[in,out] pairingState
+         *     This holds everything kept for the pairing.
+         *
+         * @param[in] now
+         *     This is the current time.
+         */
+        void ExpireConnectionTimes(
+            PairingState& pairingState,
+            std::chrono::steady_clock::time_point now
+        ) {
+            while (
+                !pairingState.connectionTimes.empty()
+                && (now - pairingState.connectionTimes.front() >= rateInterval)
+            ) {
+                pairingState.connectionTimes.pop_front();
+            }
+        }
+
+        /**
+         * Determine whether or not another connection may be made for the
+         * given pairing of source address and destination.
+         *
+         * @param[in] pairingState
+         *     This holds everything kept for the pairing.
+         *
+         * @return
+         *     An indication of whether or not another connection may be
+         *     made for the pairing is returned.
+         */
+        bool IsWithinLimits(const PairingState& pairingState) const {
+            return (
+                (
+                    (maxConnections == 0)
+                    || (pairingState.activeConnections < maxConnections)
+                )
+                && (
+                    (maxConnectionsPerInterval == 0)
+                    || (pairingState.connectionTimes.size() < maxConnectionsPerInterval)
+                )
+            );
+        }
+    };
+
+    SourceAddressPool::~SourceAddressPool() noexcept = default;
+    SourceAddressPool::SourceAddressPool(SourceAddressPool&& other) noexcept = default;
+    SourceAddressPool& SourceAddressPool::operator=(SourceAddressPool&& other) noexcept = default;
+
+    SourceAddressPool::SourceAddressPool()
+        : impl_(new Impl)
+    {
+    }
+
+    void SourceAddressPool::SetAddresses(const std::vector< uint32_t >& addresses) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->addresses = addresses;
+    }
+
+    void SourceAddressPool::SetLimits(
+        size_t maxConnections,
+        size_t maxConnectionsPerInterval,
+        std::chrono::milliseconds rateInterval
+    ) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->maxConnections = maxConnections;
+        impl_->maxConnectionsPerInterval = maxConnectionsPerInterval;
+        impl_->rateInterval = rateInterval;
+    }
+
+    bool SourceAddressPool::Acquire(
+        const std::string& destination,
+        uint32_t& sourceAddress
+    ) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        const auto now = std::chrono::steady_clock::now();
+        Impl::PairingState* best = nullptr;
+        for (const auto address: impl_->addresses) {
+            auto& pairingState = impl_->pairings[Impl::PairingKey(address, destination)];
+            impl_->ExpireConnectionTimes(pairingState, now);
+            if (!impl_->IsWithinLimits(pairingState)) {
+                continue;
+            }
+            if (
+                (best == nullptr)
+                || (pairingState.activeConnections < best->activeConnections)
+                || (
+                    (pairingState.activeConnections == best->activeConnections)
+                    && (pairingState.connectionTimes.size() < best->connectionTimes.size())
+                )
+            ) {
+                best = &pairingState;
+                sourceAddress = address;
+            }
+        }
+        if (best == nullptr) {
+            return false;
+        }
+        ++best->activeConnections;
+        best->connectionTimes.push_back(now);
+        return true;
+    }
+
+    void SourceAddressPool::Release(
+        uint32_t sourceAddress,
+        const std::string& destination
+    ) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        const auto pairingsEntry = impl_->pairings.find(
+            Impl::PairingKey(sourceAddress, destination)
+        );
+        if (
+            (pairingsEntry == impl_->pairings.end())
+            || (pairingsEntry->second.activeConnections == 0)
+        ) {
+            return;
+        }
+        --pairingsEntry->second.activeConnections;
+    }
+
+    auto SourceAddressPool::GetUsage(
+        uint32_t sourceAddress,
+        const std::string& destination
+    ) -> Usage {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        Usage usage;
+        const auto pairingsEntry = impl_->pairings.find(
+            Impl::PairingKey(sourceAddress, destination)
+        );
+        if (pairingsEntry == impl_->pairings.end()) {
+            return usage;
+        }
+        auto& pairingState = pairingsEntry->second;
+        impl_->ExpireConnectionTimes(pairingState, std::chrono::steady_clock::now());
+        usage.activeConnections = pairingState.activeConnections;
+        usage.recentConnections = pairingState.connectionTimes.size();
+        return usage;
+    }
+
+}
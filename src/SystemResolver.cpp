@@ -0,0 +1,157 @@
+/**
+ * @file SystemResolver.cpp
+ *
+ * This module contains the implementation of the Smtp::SystemResolver class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <Smtp/SystemResolver.hpp>
+#include <Smtp/WorkerPool.hpp>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <SystemAbstractions/NetworkConnection.hpp>
+#include <vector>
+
+#ifdef _WIN32
+#include <WS2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+namespace {
+
+    /**
+     * Ask the operating system for every IPv4 address of the given host.
+     *
+     * @param[in] hostNameOrAddress
+     *     This is the name or IPv4 address of the host to look up.
+     *
+     * @return
+     *     The IPv4 addresses of the host are returned, in the order given
+     *     by the operating system, without duplicates.  If empty, the host
+     *     could not be found.
+     */
+    std::vector< uint32_t > LookUpAddresses(const std::string& hostNameOrAddress) {
+        std::vector< uint32_t > addresses;
+        struct addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo* results = nullptr;
+        if (getaddrinfo(hostNameOrAddress.c_str(), nullptr, &hints, &results) == 0) {
+            for (auto result = results; result != nullptr; result = result->ai_next) {
+                if (result->ai_family != AF_INET) {
+                    continue;
+                }
+                const auto address = (uint32_t)ntohl(
+                    ((const struct sockaddr_in*)result->ai_addr)->sin_addr.s_addr
+                );
+                if (
+                    std::find(
+                        addresses.begin(),
+                        addresses.end(),
+                        address
+                    ) == addresses.end()
+                ) {
+                    addresses.push_back(address);
+                }
+            }
+            freeaddrinfo(results);
+        }
+
+        // Fall back to the lookup provided by the network library, which
+        // takes care of any platform setup needed (such as starting up
+        // Winsock) but only returns one address.
+        if (addresses.empty()) {
+            const auto address = SystemAbstractions::NetworkConnection::GetAddressOfHost(
+                hostNameOrAddress
+            );
+            if (address != 0) {
+                addresses.push_back(address);
+            }
+        }
+        return addresses;
+    }
+
+}
+
+namespace Smtp {
+
+    /**
+     * This contains the private properties of a SystemResolver instance.
+     */
+    struct SystemResolver::Impl {
+        // Properties
+
+        /**
+         * This is used to protect the other properties of this structure
+         * when accessed simultaneously by multiple threads.
+         */
+        std::mutex mutex;
+
+        /**
+         * This is the time to live reported with each answer.
+         */
+        std::chrono::milliseconds timeToLive = std::chrono::minutes(5);
+
+        /**
+         * These are the threads on which lookups are run.
+         */
+        WorkerPool lookupThreads;
+
+        // Methods
+
+        /**
+         * This is the constructor.
+         *
+         * @param[in] lookupThreadCount
+         *     This is the number of worker threads on which to run lookups.
+         */
+        explicit Impl(size_t lookupThreadCount)
+            : lookupThreads(lookupThreadCount)
+        {
+        }
+    };
+
+    SystemResolver::~SystemResolver() noexcept = default;
+    SystemResolver::SystemResolver(SystemResolver&& other) noexcept = default;
+    SystemResolver& SystemResolver::operator=(SystemResolver&& other) noexcept = default;
+
+    SystemResolver::SystemResolver(size_t lookupThreadCount)
+        : impl_(new Impl(lookupThreadCount))
+    {
+    }
+
+    void SystemResolver::SetTimeToLive(std::chrono::milliseconds timeToLive) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->timeToLive = timeToLive;
+    }
+
+    void SystemResolver::Resolve(
+        const std::string& hostNameOrAddress,
+        ResolutionDelegate onResolved
+    ) {
+        std::chrono::milliseconds timeToLive;
+        {
+            std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+            timeToLive = impl_->timeToLive;
+        }
+        impl_->lookupThreads.Post(
+            [hostNameOrAddress, onResolved, timeToLive]{
+                Answer answer;
+                answer.addresses = LookUpAddresses(hostNameOrAddress);
+                answer.timeToLive = timeToLive;
+                onResolved(answer);
+            }
+        );
+    }
+
+}
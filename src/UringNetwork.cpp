@@ -0,0 +1,2117 @@
+/**
+ * @file UringNetwork.cpp
+ *
+ * This module contains the implementation of the Smtp::UringNetwork class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <atomic>
+#include <memory>
+#include <Smtp/UringNetwork.hpp>
+#include <stddef.h>
+#include <stdint.h>
+#include <SystemAbstractions/NetworkConnection.hpp>
+
+#ifdef SMTP_HAVE_LINUX_IO_URING_H
+#include <algorithm>
+#include <arpa/inet.h>
+#include <deque>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <map>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <Smtp/DrainNotifier.hpp>
+#include <Smtp/FileSender.hpp>
+#include <Smtp/KernelTlsOffload.hpp>
+#include <string>
+#include <string.h>
+#include <SystemAbstractions/DiagnosticsSender.hpp>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#ifdef SMTP_HAVE_LINUX_TLS_H
+#include <linux/tls.h>
+#endif /* SMTP_HAVE_LINUX_TLS_H */
+#endif /* SMTP_HAVE_LINUX_IO_URING_H */
+
+#ifdef SMTP_HAVE_LINUX_IO_URING_H
+namespace {
+
+    /**
+     * This is the number of submission queue entries in the ring.
+     */
+    constexpr unsigned RING_ENTRIES = 256;
+
+    /**
+     * This is the operation identifier reserved for the operation which
+     * waits for the network thread to be woken up.
+     */
+    constexpr uint64_t WAKE_OPERATION_ID = 0;
+
+    /**
+     * This is the most data to move from a file into a connection's pipe
+     * in one operation, when sending the file.  It matches the default
+     * capacity of a pipe.
+     */
+    constexpr size_t SPLICE_CHUNK_SIZE = 65536;
+
+    /**
+     * This holds onto the memory shared with the kernel for one io_uring,
+     * and provides access to its submission and completion queues.
+     * It's only used by the network thread, except when being
+     * set up or torn down.
+     */
+    struct Ring {
+        // Properties
+
+        /**
+         * This is the file descriptor of the ring, or -1 if the ring
+         * isn't set up.
+         */
+        int fd = -1;
+
+        /**
+         * This is the memory holding the submission queue ring.
+         */
+        void* sqRing = MAP_FAILED;
+
+        /**
+         * This is the size of the memory holding the submission queue ring.
+         */
+        size_t sqRingSize = 0;
+
+        /**
+         * This is the memory holding the completion queue ring, which may
+         * be the same as the memory holding the submission queue ring.
+         */
+        void* cqRing = MAP_FAILED;
+
+        /**
+         * This is the size of the memory holding the completion queue ring.
+         */
+        size_t cqRingSize = 0;
+
+        /**
+         * This is the array of submission queue entries.
+         */
+        io_uring_sqe* sqes = (io_uring_sqe*)MAP_FAILED;
+
+        /**
+         * This is the size of the array of submission queue entries.
+         */
+        size_t sqesSize = 0;
+
+        /**
+         * This is the index of the first submission queue entry not yet
+         * taken by the kernel.
+         */
+        unsigned* sqHead = nullptr;
+
+        /**
+         * This is the index after the last submission queue entry added.
+         */
+        unsigned* sqTail = nullptr;
+
+        /**
+         * This is the mask applied to submission queue indexes to find
+         * entries in the queue.
+         */
+        unsigned* sqMask = nullptr;
+
+        /**
+         * This is the number of entries in the submission queue.
+         */
+        unsigned* sqEntries = nullptr;
+
+        /**
+         * This is the array mapping submission queue slots to entries.
+         */
+        unsigned* sqArray = nullptr;
+
+        /**
+         * This is the index of the first completion queue entry not yet
+         * handled.
+         */
+        unsigned* cqHead = nullptr;
+
+        /**
+         * This is the index after the last completion queue entry added
+         * by the kernel.
+         */
+        unsigned* cqTail = nullptr;
+
+        /**
+         * This is the mask applied to completion queue indexes to find
+         * entries in the queue.
+         */
+        unsigned* cqMask = nullptr;
+
+        /**
+         * This is the array of completion queue entries.
+         */
+        io_uring_cqe* cqes = nullptr;
+
+        // Methods
+
+        /**
+         * This is the destructor.
+         */
+        ~Ring() noexcept {
+            Close();
+        }
+
+        /**
+         * Set up the ring.
+         *
+         * @param[in] entries
+         *     This is the number of submission queue entries to have.
+         *
+         * @return
+         *     An indication of whether or not the ring was set up
+         *     successfully is returned.
+         */
+        bool Open(unsigned entries) {
+            io_uring_params params;
+            memset(&params, 0, sizeof(params));
+            fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+            if (fd < 0) {
+                return false;
+            }
+            sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            const auto singleMap = ((params.features & IORING_FEAT_SINGLE_MMAP) != 0);
+            if (singleMap) {
+                sqRingSize = std::max(sqRingSize, cqRingSize);
+                cqRingSize = sqRingSize;
+            }
+            sqRing = mmap(
+                nullptr, sqRingSize,
+                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                fd, IORING_OFF_SQ_RING
+            );
+            if (sqRing == MAP_FAILED) {
+                Close();
+                return false;
+            }
+            if (singleMap) {
+                cqRing = sqRing;
+            } else {
+                cqRing = mmap(
+                    nullptr, cqRingSize,
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    fd, IORING_OFF_CQ_RING
+                );
+                if (cqRing == MAP_FAILED) {
+                    Close();
+                    return false;
+                }
+            }
+            sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+            sqes = (io_uring_sqe*)mmap(
+                nullptr, sqesSize,
+                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                fd, IORING_OFF_SQES
+            );
+            if (sqes == MAP_FAILED) {
+                Close();
+                return false;
+            }
+            const auto sq = (uint8_t*)sqRing;
+            sqHead = (unsigned*)(sq + params.sq_off.head);
+            sqTail = (unsigned*)(sq + params.sq_off.tail);
+            sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+            sqEntries = (unsigned*)(sq + params.sq_off.ring_entries);
+            sqArray = (unsigned*)(sq + params.sq_off.array);
+            const auto cq = (uint8_t*)cqRing;
+            cqHead = (unsigned*)(cq + params.cq_off.head);
+            cqTail = (unsigned*)(cq + params.cq_off.tail);
+            cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+            cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+            return true;
+        }
+
+        /**
+         * Tear down the ring.  The kernel cancels any operations
+         * still in progress.
+         */
+        void Close() {
+            if (sqes != MAP_FAILED) {
+                (void)munmap(sqes, sqesSize);
+                sqes = (io_uring_sqe*)MAP_FAILED;
+            }
+            if (
+                (cqRing != MAP_FAILED)
+                && (cqRing != sqRing)
+            ) {
+                (void)munmap(cqRing, cqRingSize);
+            }
+            cqRing = MAP_FAILED;
+            if (sqRing != MAP_FAILED) {
+                (void)munmap(sqRing, sqRingSize);
+                sqRing = MAP_FAILED;
+            }
+            if (fd >= 0) {
+                (void)close(fd);
+                fd = -1;
+            }
+        }
+
+        /**
+         * Submit operations to the kernel, and optionally wait for
+         * at least one operation to complete.
+         *
+         * @param[in] wait
+         *     This indicates whether or not to wait for at least one
+         *     operation to complete.
+         *
+         * @return
+         *     An indication of whether or not the system call succeeded
+         *     (or was merely interrupted) is returned.
+         */
+        bool Enter(bool wait) {
+            const auto toSubmit = *sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+            const auto result = syscall(
+                __NR_io_uring_enter,
+                fd,
+                toSubmit,
+                (wait ? 1 : 0),
+                (wait ? IORING_ENTER_GETEVENTS : 0),
+                nullptr,
+                0
+            );
+            return (
+                (result >= 0)
+                || (errno == EINTR)
+                || (errno == EAGAIN)
+                || (errno == EBUSY)
+            );
+        }
+
+        /**
+         * Return the next free submission queue entry, cleared out,
+         * and add it to the submission queue.  The kernel only looks at
+         * the entry when the network thread next calls Enter, so the entry
+         * may be filled in after this returns.
+         *
+         * @return
+         *     The next free submission queue entry is returned.
+         *
+         * @retval nullptr
+         *     This is returned if the submission queue is full and
+         *     the kernel would not take any entries from it.
+         */
+        io_uring_sqe* GetSqe() {
+            const auto tail = *sqTail;
+            if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= *sqEntries) {
+                (void)Enter(false);
+                if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= *sqEntries) {
+                    return nullptr;
+                }
+            }
+            const auto index = tail & *sqMask;
+            const auto sqe = &sqes[index];
+            memset(sqe, 0, sizeof(*sqe));
+            sqArray[index] = index;
+            __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+            return sqe;
+        }
+
+        /**
+         * Remove and return the next completion queue entry, if any.
+         *
+         * @param[out] cqe
+         *     This is where to store the completion queue entry.
+         *
+         * @return
+         *     An indication of whether or not there was a completion
+         *     queue entry is returned.
+         */
+        bool GetCqe(io_uring_cqe& cqe) {
+            const auto head = *cqHead;
+            if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+                return false;
+            }
+            cqe = cqes[head & *cqMask];
+            __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+    };
+
+#ifdef SMTP_HAVE_LINUX_TLS_H
+    /**
+     * Fill in the structure which hands one direction of a TLS session
+     * over to the kernel.
+     *
+     * @param[in] version
+     *     This is the protocol version of the session.
+     *
+     * @param[in] cipherType
+     *     This is the kernel's identifier of the cipher of the session.
+     *
+     * @param[in] keys
+     *     This holds the state of the direction of the session.
+     *
+     * @param[out] cryptoInfo
+     *     This is where to store the structure to hand to the kernel.
+     *
+     * @return
+     *     An indication of whether or not the keys have the sizes
+     *     required by the cipher is returned.
+     */
+    template< typename CryptoInfo > bool MakeCryptoInfo(
+        uint16_t version,
+        uint16_t cipherType,
+        const Smtp::KernelTlsOffload::Keys& keys,
+        std::vector< uint8_t >& cryptoInfo
+    ) {
+        CryptoInfo info;
+        memset(&info, 0, sizeof(info));
+        if (
+            (keys.key.size() != sizeof(info.key))
+            || (keys.iv.size() != sizeof(info.salt) + sizeof(info.iv))
+        ) {
+            return false;
+        }
+        info.info.version = version;
+        info.info.cipher_type = cipherType;
+        memcpy(info.key, keys.key.data(), sizeof(info.key));
+        memcpy(info.salt, keys.iv.data(), sizeof(info.salt));
+        memcpy(info.iv, keys.iv.data() + sizeof(info.salt), sizeof(info.iv));
+        for (size_t i = 0; i < sizeof(info.rec_seq); ++i) {
+            info.rec_seq[i] = (uint8_t)(
+                keys.sequenceNumber >> (8 * (sizeof(info.rec_seq) - 1 - i))
+            );
+        }
+        cryptoInfo.assign(
+            (const uint8_t*)&info,
+            (const uint8_t*)&info + sizeof(info)
+        );
+        return true;
+    }
+
+    /**
+     * Fill in the structure which hands one direction of the given TLS
+     * session over to the kernel.
+     *
+     * @param[in] session
+     *     This holds the negotiated state of the session.
+     *
+     * @param[in] keys
+     *     This holds the state of the direction of the session.
+     *
+     * @param[out] cryptoInfo
+     *     This is where to store the structure to hand to the kernel.
+     *
+     * @return
+     *     An indication of whether or not the session can be handed
+     *     to the kernel is returned.
+     */
+    bool MakeCryptoInfo(
+        const Smtp::KernelTlsOffload::Session& session,
+        const Smtp::KernelTlsOffload::Keys& keys,
+        std::vector< uint8_t >& cryptoInfo
+    ) {
+        if (
+            (session.version != TLS_1_2_VERSION)
+            && (session.version != TLS_1_3_VERSION)
+        ) {
+            return false;
+        }
+        switch (session.cipher) {
+            case Smtp::KernelTlsOffload::Cipher::Aes128Gcm: {
+                return MakeCryptoInfo< tls12_crypto_info_aes_gcm_128 >(
+                    session.version,
+                    TLS_CIPHER_AES_GCM_128,
+                    keys,
+                    cryptoInfo
+                );
+            }
+
+            case Smtp::KernelTlsOffload::Cipher::Aes256Gcm: {
+                return MakeCryptoInfo< tls12_crypto_info_aes_gcm_256 >(
+                    session.version,
+                    TLS_CIPHER_AES_GCM_256,
+                    keys,
+                    cryptoInfo
+                );
+            }
+
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+            case Smtp::KernelTlsOffload::Cipher::ChaCha20Poly1305: {
+                return MakeCryptoInfo< tls12_crypto_info_chacha20_poly1305 >(
+                    session.version,
+                    TLS_CIPHER_CHACHA20_POLY1305,
+                    keys,
+                    cryptoInfo
+                );
+            }
+#endif /* TLS_CIPHER_CHACHA20_POLY1305 */
+
+            default: return false;
+        }
+    }
+#endif /* SMTP_HAVE_LINUX_TLS_H */
+
+    /**
+     * This holds a file opened to be sent on a connection, and closes it
+     * once it's no longer needed.
+     */
+    struct OpenFile {
+        /**
+         * This is the file descriptor of the file.
+         */
+        int fd = -1;
+
+        /**
+         * This is the destructor.
+         */
+        ~OpenFile() noexcept {
+            if (fd >= 0) {
+                (void)close(fd);
+            }
+        }
+    };
+
+    /**
+     * This holds one piece of data waiting to be sent on a connection,
+     * which is either a message or part of a file.
+     */
+    struct PendingSend {
+        /**
+         * This is the message to send, or nullptr if part of a file
+         * is to be sent instead.
+         */
+        std::shared_ptr< const std::vector< uint8_t > > data;
+
+        /**
+         * This is the file part of which is to be sent, if data
+         * is nullptr.
+         */
+        std::shared_ptr< OpenFile > file;
+
+        /**
+         * This is the position in the file of the first byte to send.
+         */
+        uint64_t fileOffset = 0;
+
+        /**
+         * This is the number of bytes to send.
+         */
+        size_t length = 0;
+    };
+
+    /**
+     * This holds the state of one connection shared between the
+     * connection object and the operations in progress for it.
+     */
+    struct ConnectionState {
+        // Properties
+
+        /**
+         * This is used to protect the delegates and sending state of the
+         * connection when accessed simultaneously by multiple threads.
+         */
+        std::mutex mutex;
+
+        /**
+         * This is the socket of the connection, or -1 if there isn't one.
+         */
+        int fd = -1;
+
+        /**
+         * This is the function to call to deliver data received.
+         */
+        SystemAbstractions::INetworkConnection::MessageReceivedDelegate messageReceivedDelegate;
+
+        /**
+         * This is the function to call if the connection is broken.
+         */
+        SystemAbstractions::INetworkConnection::BrokenDelegate brokenDelegate;
+
+        /**
+         * These are the messages and file parts waiting to be sent,
+         * oldest first.  The first one is being sent.
+         */
+        std::deque< PendingSend > sendQueue;
+
+        /**
+         * This is how much of the first message or file part waiting
+         * to be sent has been sent so far.
+         */
+        size_t sendOffset = 0;
+
+        /**
+         * This indicates whether or not a send operation is in progress.
+         */
+        bool sending = false;
+
+        /**
+         * This indicates whether or not the connection should be shut
+         * down once all the messages waiting to be sent have been sent.
+         */
+        bool closeWhenSent = false;
+
+        /**
+         * This is set once the connection has been closed by its user,
+         * or broken, after which it's no longer reported as connected,
+         * even while its socket remains open for the operations still
+         * in progress for it.
+         */
+        bool closed = false;
+
+        /**
+         * These are the functions to call once nothing is left waiting
+         * to be sent.
+         */
+        std::vector< Smtp::DrainNotifier::DrainedDelegate > drainedDelegates;
+
+        /**
+         * This is the index of the registered receive buffer used by the
+         * connection, or -1 if the connection doesn't have one.  It's only
+         * used by the network thread.
+         */
+        int receiveBufferIndex = -1;
+
+        /**
+         * This is the buffer into which data is received if the connection
+         * doesn't have a registered receive buffer.  It's only used by the
+         * network thread.
+         */
+        std::vector< uint8_t > receiveBuffer;
+
+        /**
+         * These are the read and write ends of the pipe through which
+         * files are moved into the socket, or -1 if the connection hasn't
+         * sent any files.  They're only used by the network thread.
+         */
+        int pipeFds[2] = {-1, -1};
+
+        /**
+         * This is the number of bytes of a file moved into the pipe and
+         * not yet moved from there into the socket.  It's only used by
+         * the network thread.
+         */
+        size_t pipeBytes = 0;
+
+        // Methods
+
+        /**
+         * This is the destructor.
+         */
+        ~ConnectionState() noexcept {
+            for (const auto pipeFd: pipeFds) {
+                if (pipeFd >= 0) {
+                    (void)close(pipeFd);
+                }
+            }
+            if (fd >= 0) {
+                (void)close(fd);
+            }
+        }
+    };
+
+    /**
+     * These are the kinds of operations submitted to the kernel.
+     */
+    enum class OperationType {
+        /**
+         * This is the operation which waits for the network thread
+         * to be woken up.
+         */
+        Wake,
+
+        /**
+         * This is an operation which receives data on a connection.
+         */
+        Receive,
+
+        /**
+         * This is an operation which sends data on a connection.
+         */
+        Send,
+
+        /**
+         * This is an operation which moves part of a file being sent on
+         * a connection into the connection's pipe.
+         */
+        SpliceIn,
+
+        /**
+         * This is an operation which moves part of a file being sent on
+         * a connection from the connection's pipe into its socket.
+         */
+        SpliceOut,
+    };
+
+    /**
+     * This holds what's needed to complete an operation submitted
+     * to the kernel.
+     */
+    struct Operation {
+        /**
+         * This is the kind of operation.
+         */
+        OperationType type;
+
+        /**
+         * This is the state of the connection for which the operation
+         * was submitted.
+         */
+        std::shared_ptr< ConnectionState > state;
+
+        /**
+         * This is the message being sent, held until the kernel is
+         * done with it.
+         */
+        std::shared_ptr< const std::vector< uint8_t > > data;
+
+        /**
+         * This is the file being sent, held open until the kernel is
+         * done with it.
+         */
+        std::shared_ptr< OpenFile > file;
+    };
+
+    /**
+     * This is the engine shared by all connections made by one
+     * UringNetwork, which owns the ring and the thread driving it.
+     */
+    struct Loop
+        : public std::enable_shared_from_this< Loop >
+    {
+        // Properties
+
+        /**
+         * This is used to protect the properties of this structure shared
+         * between the network thread and other threads.
+         */
+        std::mutex mutex;
+
+        /**
+         * This is the ring through which operations are submitted to
+         * the kernel.
+         */
+        Ring ring;
+
+        /**
+         * This is the thread which submits operations and handles
+         * their completion.
+         */
+        std::thread thread;
+
+        /**
+         * This is the event used to wake up the network thread when other
+         * threads have operations for it to submit.
+         */
+        int wakeFd = -1;
+
+        /**
+         * This is where the value of the wake event is read.
+         */
+        uint64_t wakeValue = 0;
+
+        /**
+         * This is set when the network thread should stop.
+         */
+        bool stopping = false;
+
+        /**
+         * This is set if the kernel refused to take or complete any more
+         * operations, after which the network thread is no longer running
+         * and no more requests are taken.
+         */
+        bool failed = false;
+
+        /**
+         * This is a helper object used to generate and publish
+         * diagnostic messages.
+         */
+        SystemAbstractions::DiagnosticsSender diagnosticsSender{"Smtp::UringNetwork"};
+
+        /**
+         * These are the connections for which other threads want the
+         * network thread to start receiving data.
+         */
+        std::vector< std::shared_ptr< ConnectionState > > receiveRequests;
+
+        /**
+         * These are the connections for which other threads want the
+         * network thread to start sending data.
+         */
+        std::vector< std::shared_ptr< ConnectionState > > sendRequests;
+
+        /**
+         * This is the memory holding the registered receive buffers.
+         */
+        std::vector< uint8_t > receiveBuffers;
+
+        /**
+         * This is the size, in bytes, of each receive buffer.
+         */
+        size_t receiveBufferSize = 0;
+
+        /**
+         * These are the indexes of the registered receive buffers not
+         * used by any connection.  It's only used by the network thread.
+         */
+        std::vector< int > freeReceiveBuffers;
+
+        /**
+         * These are the operations submitted to the kernel and not yet
+         * completed, keyed by operation identifier.  It's only used by
+         * the network thread.
+         */
+        std::map< uint64_t, Operation > operations;
+
+        /**
+         * This is the identifier to give the next operation.
+         */
+        uint64_t nextOperationId = WAKE_OPERATION_ID + 1;
+
+        /**
+         * These are the connections for which an operation to receive
+         * data could not be submitted because the submission queue was
+         * full, to be tried again once the kernel has taken entries from
+         * the queue.  It's only used by the network thread.
+         */
+        std::vector< std::shared_ptr< ConnectionState > > receiveRetries;
+
+        /**
+         * These are the connections for which an operation to send data
+         * could not be submitted because the submission queue was full,
+         * to be tried again once the kernel has taken entries from the
+         * queue.  It's only used by the network thread.
+         */
+        std::vector< std::shared_ptr< ConnectionState > > sendRetries;
+
+        /**
+         * This indicates whether or not the operation which waits for the
+         * network thread to be woken up could not be submitted because the
+         * submission queue was full, and should be tried again once the
+         * kernel has taken entries from the queue.  It's only used by the
+         * network thread.
+         */
+        bool wakeRetry = false;
+
+        /**
+         * This indicates whether or not the kernel supports sending data
+         * without copying it.
+         */
+        bool zeroCopySupported = false;
+
+        /**
+         * This indicates whether or not the kernel supports moving data
+         * between files, pipes and sockets (splice).
+         */
+        bool spliceSupported = false;
+
+        /**
+         * This is the size, in bytes, of the smallest message to send
+         * without copying it, if the kernel supports it.
+         */
+        std::atomic< size_t > zeroCopyThreshold{65536};
+
+        /**
+         * This is the number of times the network thread has called into
+         * the kernel to submit operations or wait for them to complete.
+         */
+        std::atomic< size_t > systemCalls{0};
+
+        /**
+         * This is the number of operations submitted to the kernel.
+         */
+        std::atomic< size_t > operationsSubmitted{0};
+
+        /**
+         * This is the number of receive operations which used one of
+         * the registered buffers.
+         */
+        std::atomic< size_t > registeredBufferReceives{0};
+
+        /**
+         * This is the number of send operations done without copying
+         * the data into the kernel.
+         */
+        std::atomic< size_t > zeroCopySends{0};
+
+        /**
+         * This is the number of bytes of files sent by moving them
+         * straight from the files into sockets.
+         */
+        std::atomic< size_t > splicedBytes{0};
+
+        // Methods
+
+        /**
+         * This is the destructor.
+         */
+        ~Loop() noexcept {
+            Stop();
+            ring.Close();
+            operations.clear();
+            if (wakeFd >= 0) {
+                (void)close(wakeFd);
+            }
+        }
+
+        /**
+         * Set up the ring and the receive buffers, and start the
+         * network thread.
+         *
+         * @param[in] receiveBufferCount
+         *     This is the number of receive buffers to register.
+         *
+         * @param[in] receiveBufferSize
+         *     This is the size, in bytes, of each receive buffer.
+         *
+         * @return
+         *     An indication of whether or not the network was set up
+         *     successfully is returned.
+         */
+        bool Start(
+            size_t receiveBufferCount,
+            size_t receiveBufferSize
+        ) {
+            if (!ring.Open(RING_ENTRIES)) {
+                return false;
+            }
+            wakeFd = eventfd(0, EFD_CLOEXEC);
+            if (wakeFd < 0) {
+                ring.Close();
+                return false;
+            }
+            this->receiveBufferSize = receiveBufferSize;
+            RegisterReceiveBuffers(receiveBufferCount);
+            ProbeOperations();
+            // The network thread holds onto the engine, in case the last
+            // other reference to it is released by a connection delegate
+            // called from the network thread.
+            const auto self = shared_from_this();
+            thread = std::thread(
+                [self]{
+                    self->Run();
+                }
+            );
+            return true;
+        }
+
+        /**
+         * Register the receive buffers with the kernel.  If this fails,
+         * every connection receives data into buffers of its own.
+         *
+         * @param[in] receiveBufferCount
+         *     This is the number of receive buffers to register.
+         */
+        void RegisterReceiveBuffers(size_t receiveBufferCount) {
+            if (receiveBufferCount == 0) {
+                return;
+            }
+            receiveBuffers.resize(receiveBufferCount * receiveBufferSize);
+            std::vector< iovec > iovecs(receiveBufferCount);
+            for (size_t i = 0; i < receiveBufferCount; ++i) {
+                iovecs[i].iov_base = &receiveBuffers[i * receiveBufferSize];
+                iovecs[i].iov_len = receiveBufferSize;
+            }
+            if (
+                syscall(
+                    __NR_io_uring_register,
+                    ring.fd,
+                    IORING_REGISTER_BUFFERS,
+                    iovecs.data(),
+                    (unsigned)iovecs.size()
+                ) < 0
+            ) {
+                receiveBuffers.clear();
+                receiveBuffers.shrink_to_fit();
+                return;
+            }
+            for (size_t i = receiveBufferCount; i > 0; --i) {
+                freeReceiveBuffers.push_back((int)(i - 1));
+            }
+        }
+
+        /**
+         * Ask the kernel whether or not it supports sending data
+         * without copying it, and moving data between files, pipes
+         * and sockets.
+         */
+        void ProbeOperations() {
+            std::vector< uint8_t > probeMemory(
+                sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op)
+            );
+            const auto probe = (io_uring_probe*)probeMemory.data();
+            if (
+                syscall(
+                    __NR_io_uring_register,
+                    ring.fd,
+                    IORING_REGISTER_PROBE,
+                    probe,
+                    (unsigned)IORING_OP_LAST
+                ) < 0
+            ) {
+                return;
+            }
+            spliceSupported = (
+                (probe->last_op >= IORING_OP_SPLICE)
+                && ((probe->ops[IORING_OP_SPLICE].flags & IO_URING_OP_SUPPORTED) != 0)
+            );
+#ifdef IORING_CQE_F_NOTIF
+            zeroCopySupported = (
+                (probe->last_op >= IORING_OP_SEND_ZC)
+                && ((probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED) != 0)
+            );
+#endif /* IORING_CQE_F_NOTIF */
+        }
+
+        /**
+         * Stop the network thread.
+         */
+        void Stop() {
+            {
+                std::lock_guard< decltype(mutex) > lock(mutex);
+                if (stopping) {
+                    return;
+                }
+                stopping = true;
+            }
+            Wake();
+            if (thread.joinable()) {
+                if (thread.get_id() == std::this_thread::get_id()) {
+                    thread.detach();
+                } else {
+                    thread.join();
+                }
+            }
+        }
+
+        /**
+         * Wake up the network thread.
+         */
+        void Wake() {
+            const uint64_t one = 1;
+            (void)!write(wakeFd, &one, sizeof(one));
+        }
+
+        /**
+         * Ask the network thread to start receiving data on the given
+         * connection.
+         *
+         * @param[in] state
+         *     This is the state of the connection.
+         *
+         * @return
+         *     An indication of whether or not the request was taken is
+         *     returned.  It isn't if the network thread has failed.
+         */
+        bool RequestReceive(std::shared_ptr< ConnectionState > state) {
+            {
+                std::lock_guard< decltype(mutex) > lock(mutex);
+                if (failed) {
+                    return false;
+                }
+                receiveRequests.push_back(state);
+            }
+            Wake();
+            return true;
+        }
+
+        /**
+         * Ask the network thread to start sending the data waiting to be
+         * sent on the given connection.
+         *
+         * @param[in] state
+         *     This is the state of the connection.
+         *
+         * @return
+         *     An indication of whether or not the request was taken is
+         *     returned.  It isn't if the network thread has failed.
+         */
+        bool RequestSend(std::shared_ptr< ConnectionState > state) {
+            {
+                std::lock_guard< decltype(mutex) > lock(mutex);
+                if (failed) {
+                    return false;
+                }
+                sendRequests.push_back(state);
+            }
+            Wake();
+            return true;
+        }
+
+        /**
+         * Add an operation to the submission queue.
+         *
+         * @param[in] operation
+         *     This holds what's needed to complete the operation.
+         *
+         * @param[in] operationId
+         *     This is the identifier to give the operation.
+         *
+         * @return
+         *     The submission queue entry to fill in for the operation is
+         *     returned, or nullptr if the submission queue is full.
+         */
+        io_uring_sqe* AddOperation(
+            Operation&& operation,
+            uint64_t operationId
+        ) {
+            const auto sqe = ring.GetSqe();
+            if (sqe == nullptr) {
+                return nullptr;
+            }
+            sqe->user_data = operationId;
+            if (operationId != WAKE_OPERATION_ID) {
+                operations[operationId] = std::move(operation);
+            }
+            ++operationsSubmitted;
+            return sqe;
+        }
+
+        /**
+         * Submit the operation which waits for the network thread
+         * to be woken up.
+         */
+        void PrepareWake() {
+            Operation operation;
+            operation.type = OperationType::Wake;
+            const auto sqe = AddOperation(std::move(operation), WAKE_OPERATION_ID);
+            if (sqe == nullptr) {
+                wakeRetry = true;
+                return;
+            }
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = wakeFd;
+            sqe->addr = (uint64_t)(uintptr_t)&wakeValue;
+            sqe->len = sizeof(wakeValue);
+        }
+
+        /**
+         * Submit an operation to receive data on the given connection.
+         *
+         * @param[in] state
+         *     This is the state of the connection.
+         */
+        void PrepareReceive(std::shared_ptr< ConnectionState > state) {
+            if (
+                (state->receiveBufferIndex < 0)
+                && state->receiveBuffer.empty()
+            ) {
+                if (freeReceiveBuffers.empty()) {
+                    state->receiveBuffer.resize(receiveBufferSize);
+                } else {
+                    state->receiveBufferIndex = freeReceiveBuffers.back();
+                    freeReceiveBuffers.pop_back();
+                }
+            }
+            const auto fd = state->fd;
+            const auto receiveBufferIndex = state->receiveBufferIndex;
+            const auto receiveBuffer = state->receiveBuffer.data();
+            Operation operation;
+            operation.type = OperationType::Receive;
+            operation.state = state;
+            const auto sqe = AddOperation(std::move(operation), nextOperationId++);
+            if (sqe == nullptr) {
+                receiveRetries.push_back(state);
+                return;
+            }
+            sqe->fd = fd;
+            sqe->len = (unsigned)receiveBufferSize;
+            if (receiveBufferIndex >= 0) {
+                sqe->opcode = IORING_OP_READ_FIXED;
+                sqe->addr = (uint64_t)(uintptr_t)&receiveBuffers[receiveBufferIndex * receiveBufferSize];
+                sqe->buf_index = (uint16_t)receiveBufferIndex;
+                sqe->off = (uint64_t)-1;
+                ++registeredBufferReceives;
+            } else {
+                sqe->opcode = IORING_OP_RECV;
+                sqe->addr = (uint64_t)(uintptr_t)receiveBuffer;
+            }
+        }
+
+        /**
+         * Submit an operation to send the next part of the data waiting
+         * to be sent on the given connection.
+         *
+         * @param[in] state
+         *     This is the state of the connection.
+         */
+        void PrepareSend(std::shared_ptr< ConnectionState > state) {
+            PendingSend pendingSend;
+            size_t offset;
+            std::vector< Smtp::DrainNotifier::DrainedDelegate > drainedDelegates;
+            {
+                std::lock_guard< decltype(state->mutex) > lock(state->mutex);
+                if (state->sendQueue.empty()) {
+                    state->sending = false;
+                    drainedDelegates.swap(state->drainedDelegates);
+                } else {
+                    pendingSend = state->sendQueue.front();
+                    offset = state->sendOffset;
+                }
+            }
+            if (
+                (pendingSend.data == nullptr)
+                && (pendingSend.file == nullptr)
+            ) {
+                for (const auto& drainedDelegate: drainedDelegates) {
+                    drainedDelegate();
+                }
+                return;
+            }
+            if (pendingSend.data == nullptr) {
+                PrepareSplice(state, pendingSend, offset);
+                return;
+            }
+            const auto& data = pendingSend.data;
+            const auto remaining = data->size() - offset;
+            const auto zeroCopy = (
+                zeroCopySupported
+                && (remaining >= zeroCopyThreshold)
+            );
+            Operation operation;
+            operation.type = OperationType::Send;
+            operation.state = state;
+            operation.data = data;
+            const auto sqe = AddOperation(std::move(operation), nextOperationId++);
+            if (sqe == nullptr) {
+                sendRetries.push_back(state);
+                return;
+            }
+#ifdef IORING_CQE_F_NOTIF
+            if (zeroCopy) {
+                sqe->opcode = IORING_OP_SEND_ZC;
+                ++zeroCopySends;
+            } else {
+                sqe->opcode = IORING_OP_SEND;
+            }
+#else /* IORING_CQE_F_NOTIF */
+            (void)zeroCopy;
+            sqe->opcode = IORING_OP_SEND;
+#endif /* IORING_CQE_F_NOTIF */
+            sqe->fd = state->fd;
+            sqe->addr = (uint64_t)(uintptr_t)(data->data() + offset);
+            sqe->len = (unsigned)remaining;
+            sqe->msg_flags = MSG_NOSIGNAL;
+        }
+
+        /**
+         * Submit an operation to move the next part of the file being sent
+         * on the given connection along, either from the file into the
+         * connection's pipe, or, if the pipe holds some of it, from the
+         * pipe into the socket.  The data never passes through the
+         * memory of the process.
+         *
+         * @param[in] state
+         *     This is the state of the connection.
+         *
+         * @param[in] pendingSend
+         *     This holds the file part being sent.
+         *
+         * @param[in] offset
+         *     This is how much of the file part has been sent so far.
+         */
+        void PrepareSplice(
+            std::shared_ptr< ConnectionState > state,
+            const PendingSend& pendingSend,
+            size_t offset
+        ) {
+            if (state->pipeFds[0] < 0) {
+                if (pipe2(state->pipeFds, O_CLOEXEC) != 0) {
+                    FailSend(state);
+                    return;
+                }
+            }
+            const auto pipeBytes = state->pipeBytes;
+            const auto fd = state->fd;
+            const auto pipeReadFd = state->pipeFds[0];
+            const auto pipeWriteFd = state->pipeFds[1];
+            Operation operation;
+            operation.state = state;
+            operation.file = pendingSend.file;
+            if (pipeBytes > 0) {
+                operation.type = OperationType::SpliceOut;
+            } else {
+                operation.type = OperationType::SpliceIn;
+            }
+            const auto sqe = AddOperation(std::move(operation), nextOperationId++);
+            if (sqe == nullptr) {
+                sendRetries.push_back(state);
+                return;
+            }
+            sqe->opcode = IORING_OP_SPLICE;
+            sqe->splice_flags = SPLICE_F_MOVE;
+            if (pipeBytes > 0) {
+                sqe->splice_fd_in = pipeReadFd;
+                sqe->splice_off_in = (uint64_t)-1;
+                sqe->fd = fd;
+                sqe->off = (uint64_t)-1;
+                sqe->len = (unsigned)pipeBytes;
+            } else {
+                sqe->splice_fd_in = pendingSend.file->fd;
+                sqe->splice_off_in = pendingSend.fileOffset + offset;
+                sqe->fd = pipeWriteFd;
+                sqe->off = (uint64_t)-1;
+                sqe->len = (unsigned)std::min(
+                    SPLICE_CHUNK_SIZE,
+                    pendingSend.length - offset
+                );
+            }
+        }
+
+        /**
+         * Give up sending data on the given connection, discarding
+         * whatever is waiting to be sent, and shut the connection down,
+         * since the peer would otherwise be left with partial data.
+         *
+         * @param[in] state
+         *     This is the state of the connection.
+         */
+        void FailSend(std::shared_ptr< ConnectionState > state) {
+            std::vector< Smtp::DrainNotifier::DrainedDelegate > drainedDelegates;
+            {
+                std::lock_guard< decltype(state->mutex) > lock(state->mutex);
+                state->sendQueue.clear();
+                state->sendOffset = 0;
+                state->sending = false;
+                drainedDelegates.swap(state->drainedDelegates);
+                (void)shutdown(state->fd, SHUT_RDWR);
+            }
+            for (const auto& drainedDelegate: drainedDelegates) {
+                drainedDelegate();
+            }
+        }
+
+        /**
+         * Handle the completion of an operation to receive data.
+         *
+         * @param[in] state
+         *     This is the state of the connection.
+         *
+         * @param[in] result
+         *     This is the result of the operation, which is either the
+         *     number of bytes received, zero if the connection was closed,
+         *     or a negated error number.
+         */
+        void OnReceiveComplete(
+            std::shared_ptr< ConnectionState > state,
+            int result
+        ) {
+            if (result > 0) {
+                const auto begin = (
+                    (state->receiveBufferIndex >= 0)
+                    ? &receiveBuffers[state->receiveBufferIndex * receiveBufferSize]
+                    : state->receiveBuffer.data()
+                );
+                const std::vector< uint8_t > message(begin, begin + result);
+                SystemAbstractions::INetworkConnection::MessageReceivedDelegate messageReceivedDelegate;
+                {
+                    std::lock_guard< decltype(state->mutex) > lock(state->mutex);
+                    messageReceivedDelegate = state->messageReceivedDelegate;
+                }
+                if (messageReceivedDelegate != nullptr) {
+                    messageReceivedDelegate(message);
+                }
+                PrepareReceive(state);
+                return;
+            }
+            if (state->receiveBufferIndex >= 0) {
+                freeReceiveBuffers.push_back(state->receiveBufferIndex);
+                state->receiveBufferIndex = -1;
+            }
+            state->receiveBuffer.clear();
+            state->receiveBuffer.shrink_to_fit();
+            SystemAbstractions::INetworkConnection::BrokenDelegate brokenDelegate;
+            {
+                std::lock_guard< decltype(state->mutex) > lock(state->mutex);
+                brokenDelegate = state->brokenDelegate;
+                state->messageReceivedDelegate = nullptr;
+                state->brokenDelegate = nullptr;
+                state->closed = true;
+            }
+            if (brokenDelegate != nullptr) {
+                brokenDelegate(result == 0);
+            }
+        }
+
+        /**
+         * Handle the completion of an operation to send data.
+         *
+         * @param[in] state
+         *     This is the state of the connection.
+         *
+         * @param[in] result
+         *     This is the result of the operation, which is either the
+         *     number of bytes sent or a negated error number.
+         */
+        void OnSendComplete(
+            std::shared_ptr< ConnectionState > state,
+            int result
+        ) {
+            bool sendMore = false;
+            std::vector< Smtp::DrainNotifier::DrainedDelegate > drainedDelegates;
+            {
+                std::lock_guard< decltype(state->mutex) > lock(state->mutex);
+                if (result < 0) {
+                    state->sendQueue.clear();
+                    state->sendOffset = 0;
+                } else {
+                    state->sendOffset += (size_t)result;
+                    const auto& front = state->sendQueue.front();
+                    const auto length = (
+                        (front.data == nullptr)
+                        ? front.length
+                        : front.data->size()
+                    );
+                    if (state->sendOffset >= length) {
+                        state->sendQueue.pop_front();
+                        state->sendOffset = 0;
+                    }
+                }
+                if (state->sendQueue.empty()) {
+                    state->sending = false;
+                    drainedDelegates.swap(state->drainedDelegates);
+                    if (state->closeWhenSent) {
+                        (void)shutdown(state->fd, SHUT_RDWR);
+                    }
+                } else {
+                    sendMore = true;
+                }
+            }
+            if (sendMore) {
+                PrepareSend(state);
+            }
+            for (const auto& drainedDelegate: drainedDelegates) {
+                drainedDelegate();
+            }
+        }
+
+        /**
+         * Handle the completion of an operation to move part of a file
+         * being sent on a connection into the connection's pipe.
+         *
+         * @param[in] state
+         *     This is the state of the connection.
+         *
+         * @param[in] result
+         *     This is the result of the operation, which is either the
+         *     number of bytes moved, zero if the file ended early,
+         *     or a negated error number.
+         */
+        void OnSpliceInComplete(
+            std::shared_ptr< ConnectionState > state,
+            int result
+        ) {
+            if (result <= 0) {
+                FailSend(state);
+                return;
+            }
+            state->pipeBytes += (size_t)result;
+            PrepareSend(state);
+        }
+
+        /**
+         * Handle the completion of an operation to move part of a file
+         * being sent on a connection from the connection's pipe into
+         * its socket.
+         *
+         * @param[in] state
+         *     This is the state of the connection.
+         *
+         * @param[in] result
+         *     This is the result of the operation, which is either the
+         *     number of bytes moved or a negated error number.
+         */
+        void OnSpliceOutComplete(
+            std::shared_ptr< ConnectionState > state,
+            int result
+        ) {
+            if (result > 0) {
+                state->pipeBytes -= (size_t)result;
+                splicedBytes += (size_t)result;
+            } else {
+                state->pipeBytes = 0;
+                if (result == 0) {
+                    result = -EPIPE;
+                }
+            }
+            OnSendComplete(state, result);
+        }
+
+        /**
+         * Handle the given completion queue entry.
+         *
+         * @param[in] cqe
+         *     This is the completion queue entry to handle.
+         */
+        void OnCompletion(const io_uring_cqe& cqe) {
+            if (cqe.user_data == WAKE_OPERATION_ID) {
+                PrepareWake();
+                return;
+            }
+            const auto operationsEntry = operations.find(cqe.user_data);
+            if (operationsEntry == operations.end()) {
+                return;
+            }
+#ifdef IORING_CQE_F_NOTIF
+            if ((cqe.flags & IORING_CQE_F_NOTIF) != 0) {
+                // The kernel is done with the data of a zero-copy send.
+                (void)operations.erase(operationsEntry);
+                return;
+            }
+#endif /* IORING_CQE_F_NOTIF */
+            const auto type = operationsEntry->second.type;
+            const auto state = operationsEntry->second.state;
+            if ((cqe.flags & IORING_CQE_F_MORE) == 0) {
+                (void)operations.erase(operationsEntry);
+            }
+            switch (type) {
+                case OperationType::Receive: {
+                    OnReceiveComplete(state, cqe.res);
+                } break;
+
+                case OperationType::Send: {
+                    OnSendComplete(state, cqe.res);
+                } break;
+
+                case OperationType::SpliceIn: {
+                    OnSpliceInComplete(state, cqe.res);
+                } break;
+
+                case OperationType::SpliceOut: {
+                    OnSpliceOutComplete(state, cqe.res);
+                } break;
+
+                default: break;
+            }
+        }
+
+        /**
+         * Try again to submit the operations which could not be submitted
+         * earlier because the submission queue was full.  Sends are tried
+         * again from the start, so whatever is waiting to be sent at the
+         * time is picked up.
+         */
+        void RetryOperations() {
+            if (wakeRetry) {
+                wakeRetry = false;
+                PrepareWake();
+            }
+            std::vector< std::shared_ptr< ConnectionState > > states;
+            states.swap(receiveRetries);
+            for (const auto& state: states) {
+                PrepareReceive(state);
+            }
+            states.clear();
+            states.swap(sendRetries);
+            for (const auto& state: states) {
+                PrepareSend(state);
+            }
+        }
+
+        /**
+         * Break the given connection, shutting down its socket and telling
+         * its user, unless it's already been broken.
+         *
+         * @param[in] state
+         *     This is the state of the connection.
+         */
+        void Break(std::shared_ptr< ConnectionState > state) {
+            SystemAbstractions::INetworkConnection::BrokenDelegate brokenDelegate;
+            {
+                std::lock_guard< decltype(state->mutex) > lock(state->mutex);
+                brokenDelegate = state->brokenDelegate;
+                state->messageReceivedDelegate = nullptr;
+                state->brokenDelegate = nullptr;
+                state->drainedDelegates.clear();
+                state->closed = true;
+                if (state->fd >= 0) {
+                    (void)shutdown(state->fd, SHUT_RDWR);
+                }
+            }
+            if (brokenDelegate != nullptr) {
+                brokenDelegate(false);
+            }
+        }
+
+        /**
+         * Give up on the network once the kernel refuses to take or
+         * complete any more operations: stop taking requests, report what
+         * went wrong, and break every connection with operations in
+         * progress or requested, so that none is left waiting for
+         * operations which will never complete.
+         *
+         * @param[in] error
+         *     This is the error number with which the kernel refused.
+         */
+        void Fail(int error) {
+            std::vector< std::shared_ptr< ConnectionState > > states;
+            {
+                std::lock_guard< decltype(mutex) > lock(mutex);
+                failed = true;
+                states.swap(receiveRequests);
+                states.insert(states.end(), sendRequests.begin(), sendRequests.end());
+                sendRequests.clear();
+            }
+            diagnosticsSender.SendDiagnosticInformationFormatted(
+                SystemAbstractions::DiagnosticsSender::Levels::ERROR,
+                "error entering kernel (%s); breaking all connections",
+                strerror(error)
+            );
+            states.insert(states.end(), receiveRetries.begin(), receiveRetries.end());
+            receiveRetries.clear();
+            states.insert(states.end(), sendRetries.begin(), sendRetries.end());
+            sendRetries.clear();
+            for (const auto& operationsEntry: operations) {
+                if (operationsEntry.second.state != nullptr) {
+                    states.push_back(operationsEntry.second.state);
+                }
+            }
+            for (const auto& state: states) {
+                Break(state);
+            }
+        }
+
+        /**
+         * This is the body of the network thread.  It submits operations
+         * requested by other threads, together with any follow-up
+         * operations, waits for operations to complete, and handles them.
+         * Operations which could not be submitted because the submission
+         * queue was full are tried again after the next time the kernel
+         * is entered, before any new requests, so none is lost.  If the
+         * kernel can't be entered at all, every connection is broken.
+         */
+        void Run() {
+            PrepareWake();
+            for (;;) {
+                RetryOperations();
+                std::vector< std::shared_ptr< ConnectionState > > newReceiveRequests;
+                std::vector< std::shared_ptr< ConnectionState > > newSendRequests;
+                {
+                    std::lock_guard< decltype(mutex) > lock(mutex);
+                    if (stopping) {
+                        break;
+                    }
+                    newReceiveRequests.swap(receiveRequests);
+                    newSendRequests.swap(sendRequests);
+                }
+                for (const auto& state: newReceiveRequests) {
+                    PrepareReceive(state);
+                }
+                for (const auto& state: newSendRequests) {
+                    PrepareSend(state);
+                }
+                ++systemCalls;
+                if (!ring.Enter(true)) {
+                    Fail(errno);
+                    break;
+                }
+                io_uring_cqe cqe;
+                while (ring.GetCqe(cqe)) {
+                    OnCompletion(cqe);
+                }
+            }
+        }
+    };
+
+    /**
+     * This is a network connection whose input and output is driven
+     * by the network thread of a UringNetwork.
+     */
+    struct UringConnection
+        : public SystemAbstractions::INetworkConnection
+        , public Smtp::DrainNotifier
+        , public Smtp::FileSender
+        , public Smtp::KernelTlsOffload
+    {
+        // Properties
+
+        /**
+         * This is the engine which drives the connection.
+         */
+        std::weak_ptr< Loop > loop;
+
+        /**
+         * This is the state of the connection shared with the operations
+         * in progress for it.
+         */
+        std::shared_ptr< ConnectionState > state = std::make_shared< ConnectionState >();
+
+        /**
+         * This is the local address to which to bind the connection,
+         * or zero to let the system pick one.
+         */
+        uint32_t sourceAddress = 0;
+
+        /**
+         * This is a helper object used to generate and publish
+         * diagnostic messages.
+         */
+        SystemAbstractions::DiagnosticsSender diagnosticsSender;
+
+        // Methods
+
+        /**
+         * This is the constructor.
+         *
+         * @param[in] loop
+         *     This is the engine which drives the connection.
+         *
+         * @param[in] sourceAddress
+         *     This is the local address to which to bind the connection,
+         *     or zero to let the system pick one.
+         */
+        UringConnection(
+            std::weak_ptr< Loop > loop,
+            uint32_t sourceAddress
+        )
+            : loop(loop)
+            , sourceAddress(sourceAddress)
+            , diagnosticsSender("Smtp::UringNetwork")
+        {
+        }
+
+        /**
+         * This is the destructor.
+         */
+        ~UringConnection() noexcept {
+            std::lock_guard< decltype(state->mutex) > lock(state->mutex);
+            state->messageReceivedDelegate = nullptr;
+            state->brokenDelegate = nullptr;
+            if (state->fd >= 0) {
+                (void)shutdown(state->fd, SHUT_RDWR);
+            }
+        }
+
+        /**
+         * Return the address of the given end of the connection.
+         *
+         * @param[in] peer
+         *     This indicates whether to return the address of the peer
+         *     (true) or the local end (false).
+         *
+         * @param[out] address
+         *     This is where to store the address.
+         */
+        void GetAddress(bool peer, sockaddr_in& address) const {
+            memset(&address, 0, sizeof(address));
+            socklen_t addressLength = sizeof(address);
+            if (peer) {
+                (void)getpeername(state->fd, (sockaddr*)&address, &addressLength);
+            } else {
+                (void)getsockname(state->fd, (sockaddr*)&address, &addressLength);
+            }
+        }
+
+        // SystemAbstractions::INetworkConnection
+
+        virtual SystemAbstractions::DiagnosticsSender::UnsubscribeDelegate SubscribeToDiagnostics(
+            SystemAbstractions::DiagnosticsSender::DiagnosticMessageDelegate delegate,
+            size_t minLevel = 0
+        ) override {
+            return diagnosticsSender.SubscribeToDiagnostics(delegate, minLevel);
+        }
+
+        virtual bool Connect(uint32_t peerAddress, uint16_t peerPort) override {
+            const auto fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                diagnosticsSender.SendDiagnosticInformationFormatted(
+                    SystemAbstractions::DiagnosticsSender::Levels::ERROR,
+                    "error creating socket (%s)",
+                    strerror(errno)
+                );
+                return false;
+            }
+            const int one = 1;
+            (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            if (sourceAddress != 0) {
+                sockaddr_in sourceSocketAddress;
+                memset(&sourceSocketAddress, 0, sizeof(sourceSocketAddress));
+                sourceSocketAddress.sin_family = AF_INET;
+                sourceSocketAddress.sin_addr.s_addr = htonl(sourceAddress);
+                if (bind(fd, (const sockaddr*)&sourceSocketAddress, sizeof(sourceSocketAddress)) != 0) {
+                    diagnosticsSender.SendDiagnosticInformationFormatted(
+                        SystemAbstractions::DiagnosticsSender::Levels::ERROR,
+                        "error binding socket (%s)",
+                        strerror(errno)
+                    );
+                    (void)close(fd);
+                    return false;
+                }
+            }
+            sockaddr_in peerSocketAddress;
+            memset(&peerSocketAddress, 0, sizeof(peerSocketAddress));
+            peerSocketAddress.sin_family = AF_INET;
+            peerSocketAddress.sin_addr.s_addr = htonl(peerAddress);
+            peerSocketAddress.sin_port = htons(peerPort);
+            if (connect(fd, (const sockaddr*)&peerSocketAddress, sizeof(peerSocketAddress)) != 0) {
+                diagnosticsSender.SendDiagnosticInformationFormatted(
+                    SystemAbstractions::DiagnosticsSender::Levels::ERROR,
+                    "error connecting (%s)",
+                    strerror(errno)
+                );
+                (void)close(fd);
+                return false;
+            }
+            std::lock_guard< decltype(state->mutex) > lock(state->mutex);
+            state->fd = fd;
+            return true;
+        }
+
+        virtual bool Process(
+            MessageReceivedDelegate messageReceivedDelegate,
+            BrokenDelegate brokenDelegate
+        ) override {
+            const auto loop = this->loop.lock();
+            if (loop == nullptr) {
+                return false;
+            }
+            {
+                std::lock_guard< decltype(state->mutex) > lock(state->mutex);
+                if (
+                    (state->fd < 0)
+                    || state->closed
+                ) {
+                    return false;
+                }
+                state->messageReceivedDelegate = messageReceivedDelegate;
+                state->brokenDelegate = brokenDelegate;
+            }
+            if (!loop->RequestReceive(state)) {
+                std::lock_guard< decltype(state->mutex) > lock(state->mutex);
+                state->messageReceivedDelegate = nullptr;
+                state->brokenDelegate = nullptr;
+                return false;
+            }
+            return true;
+        }
+
+        virtual uint32_t GetPeerAddress() const override {
+            sockaddr_in address;
+            GetAddress(true, address);
+            return ntohl(address.sin_addr.s_addr);
+        }
+
+        virtual uint16_t GetPeerPort() const override {
+            sockaddr_in address;
+            GetAddress(true, address);
+            return ntohs(address.sin_port);
+        }
+
+        virtual bool IsConnected() const override {
+            std::lock_guard< decltype(state->mutex) > lock(state->mutex);
+            return (
+                (state->fd >= 0)
+                && !state->closed
+            );
+        }
+
+        virtual uint32_t GetBoundAddress() const override {
+            sockaddr_in address;
+            GetAddress(false, address);
+            return ntohl(address.sin_addr.s_addr);
+        }
+
+        virtual uint16_t GetBoundPort() const override {
+            sockaddr_in address;
+            GetAddress(false, address);
+            return ntohs(address.sin_port);
+        }
+
+        virtual void SendMessage(const std::vector< uint8_t >& message) override {
+            if (message.empty()) {
+                return;
+            }
+            const auto loop = this->loop.lock();
+            if (loop == nullptr) {
+                return;
+            }
+            {
+                std::lock_guard< decltype(state->mutex) > lock(state->mutex);
+                if (
+                    (state->fd < 0)
+                    || state->closed
+                ) {
+                    return;
+                }
+                PendingSend pendingSend;
+                pendingSend.data = std::make_shared< const std::vector< uint8_t > >(message);
+                state->sendQueue.push_back(std::move(pendingSend));
+                if (state->sending) {
+                    return;
+                }
+                state->sending = true;
+            }
+            (void)loop->RequestSend(state);
+        }
+
+        virtual void Close(bool clean = false) override {
+            std::lock_guard< decltype(state->mutex) > lock(state->mutex);
+            if (state->fd < 0) {
+                return;
+            }
+            state->closed = true;
+            if (
+                clean
+                && state->sending
+            ) {
+                state->closeWhenSent = true;
+            } else {
+                (void)shutdown(state->fd, SHUT_RDWR);
+            }
+        }
+
+        // Smtp::DrainNotifier
+
+        virtual bool NotifyWhenDrained(DrainedDelegate onDrained) override {
+            {
+                std::lock_guard< decltype(state->mutex) > lock(state->mutex);
+                if (state->fd < 0) {
+                    return false;
+                }
+                if (state->sending) {
+                    state->drainedDelegates.push_back(onDrained);
+                    return true;
+                }
+            }
+            onDrained();
+            return true;
+        }
+
+        // Smtp::FileSender
+
+        virtual bool SendFile(
+            const std::string& path,
+            uint64_t offset,
+            uint64_t length
+        ) override {
+            const auto loop = this->loop.lock();
+            if (
+                (loop == nullptr)
+                || !loop->spliceSupported
+            ) {
+                return false;
+            }
+            if (length == 0) {
+                return true;
+            }
+            PendingSend pendingSend;
+            pendingSend.file = std::make_shared< OpenFile >();
+            pendingSend.file->fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (pendingSend.file->fd < 0) {
+                diagnosticsSender.SendDiagnosticInformationFormatted(
+                    SystemAbstractions::DiagnosticsSender::Levels::ERROR,
+                    "error opening file '%s' (%s)",
+                    path.c_str(),
+                    strerror(errno)
+                );
+                return false;
+            }
+            pendingSend.fileOffset = offset;
+            pendingSend.length = (size_t)length;
+            {
+                std::lock_guard< decltype(state->mutex) > lock(state->mutex);
+                if (
+                    (state->fd < 0)
+                    || state->closed
+                ) {
+                    return false;
+                }
+                state->sendQueue.push_back(std::move(pendingSend));
+                if (state->sending) {
+                    return true;
+                }
+                state->sending = true;
+            }
+            return loop->RequestSend(state);
+        }
+
+        // Smtp::KernelTlsOffload
+
+        virtual bool EnableKernelTls(const Session& session) override {
+#ifdef SMTP_HAVE_LINUX_TLS_H
+            std::vector< uint8_t > transmitCryptoInfo;
+            std::vector< uint8_t > receiveCryptoInfo;
+            if (
+                !MakeCryptoInfo(session, session.transmit, transmitCryptoInfo)
+                || (
+                    session.offloadReceive
+                    && !MakeCryptoInfo(session, session.receive, receiveCryptoInfo)
+                )
+            ) {
+                return false;
+            }
+            std::lock_guard< decltype(state->mutex) > lock(state->mutex);
+            if (
+                (state->fd < 0)
+                || state->sending
+                || state->closed
+            ) {
+                return false;
+            }
+            if (setsockopt(state->fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) != 0) {
+                diagnosticsSender.SendDiagnosticInformationFormatted(
+                    SystemAbstractions::DiagnosticsSender::Levels::WARNING,
+                    "kernel TLS not available (%s)",
+                    strerror(errno)
+                );
+                return false;
+            }
+            // The TLS layer, once attached to the socket but given no keys,
+            // leaves the socket working as before, so failing here still
+            // changes nothing.
+            if (
+                setsockopt(
+                    state->fd, SOL_TLS, TLS_TX,
+                    transmitCryptoInfo.data(), (socklen_t)transmitCryptoInfo.size()
+                ) != 0
+            ) {
+                diagnosticsSender.SendDiagnosticInformationFormatted(
+                    SystemAbstractions::DiagnosticsSender::Levels::WARNING,
+                    "kernel TLS transmit offload refused (%s)",
+                    strerror(errno)
+                );
+                return false;
+            }
+            if (
+                session.offloadReceive
+                && (
+                    setsockopt(
+                        state->fd, SOL_TLS, TLS_RX,
+                        receiveCryptoInfo.data(), (socklen_t)receiveCryptoInfo.size()
+                    ) != 0
+                )
+            ) {
+                // The kernel is already encrypting what's sent, which can't
+                // be undone, so the connection can no longer be used.
+                diagnosticsSender.SendDiagnosticInformationFormatted(
+                    SystemAbstractions::DiagnosticsSender::Levels::ERROR,
+                    "kernel TLS receive offload refused (%s)",
+                    strerror(errno)
+                );
+                (void)shutdown(state->fd, SHUT_RDWR);
+                return false;
+            }
+            return true;
+#else /* SMTP_HAVE_LINUX_TLS_H */
+            (void)session;
+            return false;
+#endif /* SMTP_HAVE_LINUX_TLS_H */
+        }
+    };
+
+}
+#endif /* SMTP_HAVE_LINUX_IO_URING_H */
+
+namespace Smtp {
+
+    /**
+     * This contains the private properties of a UringNetwork instance.
+     */
+    struct UringNetwork::Impl {
+#ifdef SMTP_HAVE_LINUX_IO_URING_H
+        /**
+         * This is the engine shared by all connections made by the network,
+         * or nullptr if io_uring could not be set up.
+         */
+        std::shared_ptr< Loop > loop;
+#endif /* SMTP_HAVE_LINUX_IO_URING_H */
+    };
+
+    UringNetwork::~UringNetwork() noexcept {
+#ifdef SMTP_HAVE_LINUX_IO_URING_H
+        if (
+            (impl_ != nullptr)
+            && (impl_->loop != nullptr)
+        ) {
+            impl_->loop->Stop();
+        }
+#endif /* SMTP_HAVE_LINUX_IO_URING_H */
+    }
+    UringNetwork::UringNetwork(UringNetwork&& other) noexcept = default;
+    UringNetwork& UringNetwork::operator=(UringNetwork&& other) noexcept = default;
+
+    UringNetwork::UringNetwork(
+        size_t receiveBufferCount,
+        size_t receiveBufferSize
+    )
+        : impl_(new Impl)
+    {
+#ifdef SMTP_HAVE_LINUX_IO_URING_H
+        const auto loop = std::make_shared< Loop >();
+        if (loop->Start(receiveBufferCount, receiveBufferSize)) {
+            impl_->loop = loop;
+        }
+#else /* SMTP_HAVE_LINUX_IO_URING_H */
+        (void)receiveBufferCount;
+        (void)receiveBufferSize;
+#endif /* SMTP_HAVE_LINUX_IO_URING_H */
+    }
+
+    bool UringNetwork::IsSupported() const {
+#ifdef SMTP_HAVE_LINUX_IO_URING_H
+        return (impl_->loop != nullptr);
+#else /* SMTP_HAVE_LINUX_IO_URING_H */
+        return false;
+#endif /* SMTP_HAVE_LINUX_IO_URING_H */
+    }
+
+    void UringNetwork::SetZeroCopyThreshold(size_t zeroCopyThreshold) {
+#ifdef SMTP_HAVE_LINUX_IO_URING_H
+        if (impl_->loop != nullptr) {
+            impl_->loop->zeroCopyThreshold = zeroCopyThreshold;
+        }
+#else /* SMTP_HAVE_LINUX_IO_URING_H */
+        (void)zeroCopyThreshold;
+#endif /* SMTP_HAVE_LINUX_IO_URING_H */
+    }
+
+    std::shared_ptr< SystemAbstractions::INetworkConnection > UringNetwork::MakeConnection(
+        uint32_t sourceAddress
+    ) {
+#ifdef SMTP_HAVE_LINUX_IO_URING_H
+        if (impl_->loop != nullptr) {
+            return std::make_shared< UringConnection >(impl_->loop, sourceAddress);
+        }
+#endif /* SMTP_HAVE_LINUX_IO_URING_H */
+        (void)sourceAddress;
+        return std::make_shared< SystemAbstractions::NetworkConnection >();
+    }
+
+    SystemAbstractions::DiagnosticsSender::UnsubscribeDelegate UringNetwork::SubscribeToDiagnostics(
+        SystemAbstractions::DiagnosticsSender::DiagnosticMessageDelegate delegate,
+        size_t minLevel
+    ) {
+#ifdef SMTP_HAVE_LINUX_IO_URING_H
+        if (impl_->loop != nullptr) {
+            return impl_->loop->diagnosticsSender.SubscribeToDiagnostics(delegate, minLevel);
+        }
+#endif /* SMTP_HAVE_LINUX_IO_URING_H */
+        (void)delegate;
+        (void)minLevel;
+        return []{};
+    }
+
+    auto UringNetwork::GetStatistics() const -> Statistics {
+        Statistics statistics;
+#ifdef SMTP_HAVE_LINUX_IO_URING_H
+        if (impl_->loop != nullptr) {
+            statistics.systemCalls = impl_->loop->systemCalls;
+            statistics.operations = impl_->loop->operationsSubmitted;
+            statistics.registeredBufferReceives = impl_->loop->registeredBufferReceives;
+            statistics.zeroCopySends = impl_->loop->zeroCopySends;
+            statistics.splicedBytes = impl_->loop->splicedBytes;
+        }
+#endif /* SMTP_HAVE_LINUX_IO_URING_H */
+        return statistics;
+    }
+
+}
@@ -0,0 +1,132 @@
+/**
+ * @file WorkerPool.cpp
+ *
+ * This module contains the implementation of the Smtp::WorkerPool class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <Smtp/WorkerPool.hpp>
+#include <stddef.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace Smtp {
+
+    /**
+     * This contains the private properties of a WorkerPool instance.
+     */
+    struct WorkerPool::Impl {
+        // Properties
+
+        /**
+         * This is used to protect the other properties of this structure
+         * when accessed simultaneously by multiple threads.
+         */
+        std::mutex mutex;
+
+        /**
+         * This is used to wake up the worker threads when there are tasks
+         * to run or when they should stop.
+         */
+        std::condition_variable condition;
+
+        /**
+         * These are the tasks waiting to be run, in the order posted.
+         */
+        std::deque< std::function< void() > > tasks;
+
+        /**
+         * This is set when the worker threads should stop, once every
+         * task waiting to be run has been run.
+         */
+        bool stopping = false;
+
+        /**
+         * These are the threads which run the tasks.
+         */
+        std::vector< std::thread > workers;
+
+        // Methods
+
+        /**
+         * This is the body of each worker thread.
+         */
+        void Run() {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            for (;;) {
+                condition.wait(
+                    lock,
+                    [this]{
+                        return (
+                            stopping
+                            || !tasks.empty()
+                        );
+                    }
+                );
+                if (tasks.empty()) {
+                    break;
+                }
+                auto task = std::move(tasks.front());
+                tasks.pop_front();
+                lock.unlock();
+                task();
+                lock.lock();
+            }
+        }
+    };
+
+    WorkerPool::~WorkerPool() noexcept {
+        if (impl_ == nullptr) {
+            return;
+        }
+        {
+            std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+            impl_->stopping = true;
+        }
+        impl_->condition.notify_all();
+        for (auto& worker: impl_->workers) {
+            if (worker.get_id() == std::this_thread::get_id()) {
+                // The pool is being destroyed by one of its own tasks.
+                // That worker can't wait for itself; it keeps the private
+                // properties alive and stops once its task is done.
+                worker.detach();
+            } else {
+                worker.join();
+            }
+        }
+    }
+    WorkerPool::WorkerPool(WorkerPool&& other) noexcept = default;
+    WorkerPool& WorkerPool::operator=(WorkerPool&& other) noexcept = default;
+
+    WorkerPool::WorkerPool(size_t workerCount)
+        : impl_(new Impl)
+    {
+        if (workerCount == 0) {
+            workerCount = 1;
+        }
+        const auto impl = impl_;
+        for (size_t i = 0; i < workerCount; ++i) {
+            impl_->workers.emplace_back(
+                [impl]{
+                    impl->Run();
+                }
+            );
+        }
+    }
+
+    void WorkerPool::Post(std::function< void() > task) {
+        {
+            std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+            impl_->tasks.push_back(std::move(task));
+        }
+        impl_->condition.notify_one();
+    }
+
+}
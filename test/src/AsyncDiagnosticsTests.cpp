@@ -0,0 +1,247 @@
+/**
+ * @file AsyncDiagnosticsTests.cpp
+ *
+ * This module contains the unit tests of the Smtp::AsyncDiagnostics class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <gtest/gtest.h>
+#include <memory>
+#include <mutex>
+#include <Smtp/AsyncDiagnostics.hpp>
+#include <Smtp/Client.hpp>
+#include <string>
+#include <SystemAbstractions/DiagnosticsSender.hpp>
+#include <thread>
+#include <vector>
+
+TEST(AsyncDiagnosticsTests, MessagesDeliveredInOrderOnLoggerThread) {
+    Smtp::AsyncDiagnostics asyncDiagnostics;
+    std::mutex mutex;
+    std::vector< std::string > messages;
+    std::thread::id deliveryThread;
+    SystemAbstractions::DiagnosticsSender sender("Test");
+    sender.SubscribeToDiagnostics(
+        asyncDiagnostics.Wrap(
+            [&](
+                std::string senderName,
+                size_t level,
+                std::string message
+            ){
+                std::lock_guard< decltype(mutex) > lock(mutex);
+                deliveryThread = std::this_thread::get_id();
+                messages.push_back(
+                    senderName + ":" + std::to_string(level) + ": " + message
+                );
+            }
+        )
+    );
+    sender.SendDiagnosticInformationString(1, "Hello");
+    sender.SendDiagnosticInformationString(5, "World");
+    asyncDiagnostics.Flush();
+    std::lock_guard< decltype(mutex) > lock(mutex);
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "Test:1: Hello",
+            "Test:5: World",
+        }),
+        messages
+    );
+    EXPECT_NE(std::this_thread::get_id(), deliveryThread);
+    EXPECT_EQ(0, asyncDiagnostics.GetDroppedCount());
+}
+
+TEST(AsyncDiagnosticsTests, MessagesDroppedAndCountedWhenFull) {
+    Smtp::AsyncDiagnostics asyncDiagnostics(4);
+    std::mutex mutex;
+    std::vector< std::string > messages;
+    std::promise< void > unblock;
+    auto unblocked = unblock.get_future().share();
+    std::promise< void > blocked;
+    SystemAbstractions::DiagnosticsSender sender("Test");
+    sender.SubscribeToDiagnostics(
+        asyncDiagnostics.Wrap(
+            [&](
+                std::string,
+                size_t,
+                std::string message
+            ){
+                if (message == "first") {
+                    blocked.set_value();
+                    unblocked.wait();
+                }
+                std::lock_guard< decltype(mutex) > lock(mutex);
+                messages.push_back(message);
+            }
+        )
+    );
+    sender.SendDiagnosticInformationString(1, "first");
+    blocked.get_future().wait();
+    for (size_t i = 0; i < 10; ++i) {
+        sender.SendDiagnosticInformationString(1, std::to_string(i));
+    }
+    EXPECT_EQ(6, asyncDiagnostics.GetDroppedCount());
+    unblock.set_value();
+    asyncDiagnostics.Flush();
+    std::lock_guard< decltype(mutex) > lock(mutex);
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "first",
+            "0",
+            "1",
+            "2",
+            "3",
+            "6 diagnostic messages dropped",
+        }),
+        messages
+    );
+}
+
+TEST(AsyncDiagnosticsTests, MessagesDiscardedOnceDestroyed) {
+    SystemAbstractions::DiagnosticsSender::DiagnosticMessageDelegate delegate;
+    size_t messagesDelivered = 0;
+    {
+        Smtp::AsyncDiagnostics asyncDiagnostics;
+        delegate = asyncDiagnostics.Wrap(
+            [&](
+                std::string,
+                size_t,
+                std::string
+            ){
+                ++messagesDelivered;
+            }
+        );
+        delegate("Test", 1, "Hello");
+        asyncDiagnostics.Flush();
+    }
+    delegate("Test", 1, "World");
+    EXPECT_EQ(1, messagesDelivered);
+}
+
+TEST(AsyncDiagnosticsTests, UnwrappedDelegateReceivesNoMoreMessages) {
+    Smtp::AsyncDiagnostics asyncDiagnostics;
+    std::mutex mutex;
+    std::vector< std::string > messages;
+    std::promise< void > unblock;
+    auto unblocked = unblock.get_future().share();
+    std::promise< void > blocked;
+    const auto wrappedDelegate = asyncDiagnostics.Wrap(
+        [&](
+            std::string,
+            size_t,
+            std::string message
+        ){
+            if (message == "first") {
+                blocked.set_value();
+                unblocked.wait();
+            }
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            messages.push_back(message);
+        }
+    );
+    wrappedDelegate("Test", 1, "first");
+    blocked.get_future().wait();
+    wrappedDelegate("Test", 1, "second");
+    auto unwrapped = std::async(
+        std::launch::async,
+        [&]{
+            asyncDiagnostics.Unwrap(wrappedDelegate);
+        }
+    );
+    EXPECT_NE(
+        std::future_status::ready,
+        unwrapped.wait_for(std::chrono::milliseconds(50))
+    );
+    unblock.set_value();
+    ASSERT_EQ(
+        std::future_status::ready,
+        unwrapped.wait_for(std::chrono::milliseconds(1000))
+    );
+    wrappedDelegate("Test", 1, "third");
+    asyncDiagnostics.Flush();
+    std::lock_guard< decltype(mutex) > lock(mutex);
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "first",
+        }),
+        messages
+    );
+}
+
+TEST(AsyncDiagnosticsTests, DelegateReleasedOnceNoLongerUsed) {
+    Smtp::AsyncDiagnostics asyncDiagnostics;
+    const auto captured = std::make_shared< int >(42);
+    auto wrappedDelegate = asyncDiagnostics.Wrap(
+        [captured](
+            std::string,
+            size_t,
+            std::string
+        ){
+        }
+    );
+    wrappedDelegate("Test", 1, "Hello");
+    asyncDiagnostics.Flush();
+    EXPECT_EQ(2, captured.use_count());
+    wrappedDelegate = nullptr;
+    EXPECT_EQ(1, captured.use_count());
+}
+
+TEST(AsyncDiagnosticsTests, EachMessageWakesIdleLogger) {
+    Smtp::AsyncDiagnostics asyncDiagnostics;
+    std::mutex mutex;
+    std::condition_variable condition;
+    size_t messagesDelivered = 0;
+    SystemAbstractions::DiagnosticsSender sender("Test");
+    sender.SubscribeToDiagnostics(
+        asyncDiagnostics.Wrap(
+            [&](
+                std::string,
+                size_t,
+                std::string
+            ){
+                std::lock_guard< decltype(mutex) > lock(mutex);
+                ++messagesDelivered;
+                condition.notify_all();
+            }
+        )
+    );
+    for (size_t i = 0; i < 1000; ++i) {
+        sender.SendDiagnosticInformationString(1, "Hello");
+        std::unique_lock< decltype(mutex) > lock(mutex);
+        ASSERT_TRUE(
+            condition.wait_for(
+                lock,
+                std::chrono::seconds(1),
+                [&]{ return (messagesDelivered == i + 1); }
+            )
+        ) << i;
+    }
+}
+
+TEST(AsyncDiagnosticsTests, FlushCalledByDelegateReturns) {
+    Smtp::AsyncDiagnostics asyncDiagnostics;
+    std::promise< void > flushed;
+    SystemAbstractions::DiagnosticsSender sender("Test");
+    sender.SubscribeToDiagnostics(
+        asyncDiagnostics.Wrap(
+            [&](
+                std::string,
+                size_t,
+                std::string
+            ){
+                asyncDiagnostics.Flush();
+                flushed.set_value();
+            }
+        )
+    );
+    sender.SendDiagnosticInformationString(1, "Hello");
+    auto wasFlushed = flushed.get_future();
+    EXPECT_EQ(
+        std::future_status::ready,
+        wasFlushed.wait_for(std::chrono::seconds(1))
+    );
+}
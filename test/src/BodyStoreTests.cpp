@@ -0,0 +1,176 @@
+/**
+ * @file BodyStoreTests.cpp
+ *
+ * This module contains the unit tests of the Smtp::BodyStore class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <fstream>
+#include <gtest/gtest.h>
+#include <iterator>
+#include <Smtp/BodyStore.hpp>
+#include <string>
+#include <SystemAbstractions/File.hpp>
+
+/**
+ * This is the test fixture for these tests, providing common
+ * setup and teardown for each test.
+ */
+struct BodyStoreTests
+    : public ::testing::Test
+{
+    // Properties
+
+    /**
+     * This is a directory made for the test, in which a store may keep
+     * its files.
+     */
+    std::string directory;
+
+    // ::testing::Test
+
+    virtual void SetUp() override {
+        directory = (
+            SystemAbstractions::File::GetExeParentDirectory()
+            + "/TestArea-BodyStoreTests-"
+            + ::testing::UnitTest::GetInstance()->current_test_info()->name()
+        );
+        (void)SystemAbstractions::File::DeleteDirectory(directory);
+        ASSERT_TRUE(SystemAbstractions::File::CreateDirectory(directory));
+    }
+
+    virtual void TearDown() override {
+        ASSERT_TRUE(SystemAbstractions::File::DeleteDirectory(directory));
+    }
+};
+
+TEST_F(BodyStoreTests, StoresProcessedBody) {
+    Smtp::BodyStore store;
+    const auto key = store.Add("Hello,\n.World!");
+    const auto body = store.Get(key);
+    ASSERT_FALSE(body == nullptr);
+    EXPECT_EQ("Hello,\r\n..World!\r\n", *body);
+}
+
+TEST_F(BodyStoreTests, IdenticalBodiesStoredOnce) {
+    Smtp::BodyStore store;
+    const auto firstKey = store.Add("Hello, World!\r\n");
+    const auto secondKey = store.Add("Hello, World!\n");
+    const auto thirdKey = store.Add("Goodbye, World!\r\n");
+    EXPECT_EQ(firstKey, secondKey);
+    EXPECT_NE(firstKey, thirdKey);
+    EXPECT_EQ(2, store.GetBodyCount());
+    EXPECT_EQ(32, store.GetStoredBytes());
+    EXPECT_EQ(store.Get(firstKey), store.Get(secondKey));
+}
+
+TEST_F(BodyStoreTests, BodyRemovedOnceAllReferencesReleased) {
+    Smtp::BodyStore store;
+    const auto key = store.Add("Hello, World!\r\n");
+    (void)store.Add("Hello, World!\r\n");
+    const auto body = store.Get(key);
+    store.Release(key);
+    EXPECT_FALSE(store.Get(key) == nullptr);
+    store.Release(key);
+    EXPECT_TRUE(store.Get(key) == nullptr);
+    EXPECT_EQ(0, store.GetBodyCount());
+    EXPECT_EQ(0, store.GetStoredBytes());
+    EXPECT_EQ("Hello, World!\r\n", *body);
+}
+
+TEST_F(BodyStoreTests, BodiesKeptInDirectory) {
+    std::string key;
+    {
+        Smtp::BodyStore store;
+        store.Configure(directory);
+        key = store.Add("Hello, World!\r\n");
+    }
+    Smtp::BodyStore store;
+    store.Configure(directory);
+    const auto body = store.Get(key);
+    ASSERT_FALSE(body == nullptr);
+    EXPECT_EQ("Hello, World!\r\n", *body);
+    store.Release(key);
+    EXPECT_FALSE((bool)std::ifstream(directory + "/" + key));
+}
+
+TEST_F(BodyStoreTests, FileOfBodyKeptInDirectory) {
+    Smtp::BodyStore store;
+    const auto unbackedKey = store.Add("Hello, World!\r\n");
+    EXPECT_TRUE(store.GetFile(unbackedKey).path.empty());
+    store.Release(unbackedKey);
+    store.Configure(directory);
+    const auto key = store.Add("Hello,\n.World!");
+    const auto bodyFile = store.GetFile(key);
+    ASSERT_FALSE(bodyFile.path.empty());
+    EXPECT_EQ(18, bodyFile.length);
+    std::ifstream file(bodyFile.path, std::ios::binary);
+    const std::string contents(
+        (std::istreambuf_iterator< char >(file)),
+        std::istreambuf_iterator< char >()
+    );
+    EXPECT_EQ("Hello,\r\n..World!\r\n", contents);
+    store.Release(key);
+    EXPECT_TRUE(store.GetFile(key).path.empty());
+}
+
+TEST_F(BodyStoreTests, ReferencesKeptInDirectory) {
+    std::string key;
+    {
+        Smtp::BodyStore store;
+        store.Configure(directory);
+        key = store.Add("Hello, World!\r\n");
+        (void)store.Add("Hello, World!\r\n");
+        (void)store.Add("Hello, World!\r\n");
+        store.Release(key);
+    }
+    Smtp::BodyStore store;
+    store.Configure(directory);
+    store.Release(key);
+    EXPECT_FALSE(store.Get(key) == nullptr);
+    EXPECT_TRUE((bool)std::ifstream(directory + "/" + key));
+    store.Release(key);
+    EXPECT_TRUE(store.Get(key) == nullptr);
+    EXPECT_FALSE((bool)std::ifstream(directory + "/" + key));
+}
+
+TEST_F(BodyStoreTests, AddReportsBodyNotWritten) {
+    Smtp::BodyStore store;
+    store.Configure(directory + "/missing");
+    EXPECT_EQ("", store.Add("Hello, World!\r\n"));
+    EXPECT_EQ(0, store.GetBodyCount());
+    EXPECT_EQ(0, store.GetStoredBytes());
+}
+
+TEST_F(BodyStoreTests, ReferencesWrittenWithEachChange) {
+    Smtp::BodyStore store;
+    store.Configure(directory);
+    const auto key = store.Add("Hello, World!\r\n");
+    const auto readReferences = [this, key]{
+        std::ifstream file(directory + "/" + key + ".refs");
+        size_t references = 0;
+        (void)(file >> references);
+        return references;
+    };
+    EXPECT_EQ(1, readReferences());
+    (void)store.Add("Hello, World!\r\n");
+    (void)store.Add("Hello, World!\r\n");
+    EXPECT_EQ(3, readReferences());
+    store.Release(key);
+    EXPECT_EQ(2, readReferences());
+}
+
+TEST_F(BodyStoreTests, BodiesInDirectoryNotHeldInMemory) {
+    Smtp::BodyStore store;
+    store.Configure(directory);
+    const auto key = store.Add("Hello, World!\r\n");
+    (void)store.Add("Hello, World!\r\n");
+    EXPECT_EQ(0, store.GetBodyCount());
+    EXPECT_EQ(0, store.GetStoredBytes());
+    const auto body = store.Get(key);
+    ASSERT_FALSE(body == nullptr);
+    EXPECT_EQ("Hello, World!\r\n", *body);
+    EXPECT_EQ(body, store.Get(key));
+    EXPECT_EQ(0, store.GetBodyCount());
+}
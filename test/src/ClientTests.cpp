@@ -9,19 +9,123 @@
 #include "Common.hpp"
 
 #include <algorithm>
+#include <condition_variable>
 #include <future>
 #include <gtest/gtest.h>
 #include <memory>
+#include <map>
 #include <MessageHeaders/MessageHeaders.hpp>
+#include <mutex>
+#include <Smtp/BodyStore.hpp>
 #include <Smtp/Client.hpp>
+#include <Smtp/DestinationHealth.hpp>
+#include <Smtp/DrainNotifier.hpp>
+#include <Smtp/SpanSink.hpp>
 #include <stdint.h>
 #include <string>
+#include <SystemAbstractions/NetworkConnection.hpp>
 #include <SystemAbstractions/NetworkEndpoint.hpp>
+#include <thread>
 #include <TlsDecorator/TlsDecorator.hpp>
+#include <utility>
 #include <vector>
 
 namespace SmtpTests {
 
+    /**
+     * This is a span sink used to test the client, which keeps all
+     * the spans it receives.
+     */
+    struct MockSpanSink
+        : public Smtp::SpanSink
+    {
+        // Properties
+
+        std::mutex mutex;
+        std::vector< Span > spans;
+
+        // Smtp::SpanSink
+
+        virtual void RecordSpan(const Span& span) override {
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            spans.push_back(span);
+        }
+    };
+
+    /**
+     * This is a network connection used to test the client, which keeps
+     * the functions it's asked to call once everything queued has been
+     * sent, for the test to call when it chooses.
+     */
+    struct DrainNotifyingConnection
+        : public SystemAbstractions::NetworkConnection
+        , public Smtp::DrainNotifier
+    {
+        // Properties
+
+        std::mutex mutex;
+        std::condition_variable waitCondition;
+        std::vector< DrainedDelegate > drainedDelegates;
+
+        // Methods
+
+        /**
+         * Wait for the client to ask to be told when everything queued
+         * has been sent, and then tell it.
+         *
+         * @return
+         *     An indication of whether or not the client asked to be told
+         *     before a reasonable amount of time had elapsed is returned.
+         */
+        bool ReportDrained() {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            if (
+                !waitCondition.wait_for(
+                    lock,
+                    std::chrono::milliseconds(1000),
+                    [this]{ return !drainedDelegates.empty(); }
+                )
+            ) {
+                return false;
+            }
+            const auto onDrained = drainedDelegates.front();
+            drainedDelegates.erase(drainedDelegates.begin());
+            lock.unlock();
+            onDrained();
+            return true;
+        }
+
+        // Smtp::DrainNotifier
+
+        virtual bool NotifyWhenDrained(DrainedDelegate onDrained) override {
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            drainedDelegates.push_back(onDrained);
+            waitCondition.notify_all();
+            return true;
+        }
+    };
+
+    /**
+     * This is each line of the body made by MakeLargeBody, without
+     * its line ending.
+     */
+    const std::string largeBodyLine(98, 'x');
+
+    /**
+     * Make an e-mail body large enough that the client sends it in
+     * several chunks: 2000 copies of largeBodyLine, each ending in CRLF.
+     *
+     * @return
+     *     The body is returned.
+     */
+    std::string MakeLargeBody() {
+        std::string body;
+        for (size_t i = 0; i < 2000; ++i) {
+            body += largeBodyLine + "\r\n";
+        }
+        return body;
+    }
+
     /**
      * This is the test fixture for these tests, providing common
      * setup and teardown for each test.
@@ -98,6 +202,26 @@ namespace SmtpTests {
         EXPECT_FALSE(FutureReady(readyOrBroken));
     }
 
+    TEST_F(ClientTests, MultiLineGreetingSuccess) {
+        StartServer(false);
+        ASSERT_TRUE(EstablishConnection(false));
+        auto readyOrBroken = client.GetReadyOrBrokenFuture();
+        auto& connection = *clients[0].connection;
+        SendTextMessage(connection, "220-mail.example.com Simple Mail Transfer Service Ready\r\n");
+        SendTextMessage(connection, "220-Unsolicited bulk e-mail is not welcome here\r\n");
+        SendTextMessage(connection, "220 Have a nice day\r\n");
+        const auto messages = AwaitMessages(0, 1);
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "EHLO [127.0.0.1]\r\n",
+            }),
+            messages
+        );
+        SendTextMessage(connection, "250 mail.example.com\r\n");
+        EXPECT_TRUE(FutureReady(readyOrBroken, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(readyOrBroken.get());
+    }
+
     TEST_F(ClientTests, GreetingFailure) {
         StartServer(false);
         ASSERT_TRUE(EstablishConnection(false));
@@ -217,6 +341,14 @@ namespace SmtpTests {
         SendTextMessage(connection, "250 OK\r\n"); // response to MAIL FROM:<alex@example.com>
         (void)AwaitMessages(0, 1);
         SendTextMessage(connection, "550 No such user here\r\n"); // response to RCPT TO:<bob@example.com>
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "RSET\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+        EXPECT_FALSE(FutureReady(sendWasCompleted, std::chrono::milliseconds(100)));
+        SendTextMessage(connection, "250 OK\r\n"); // response to RSET
         EXPECT_TRUE(FutureReady(sendWasCompleted, std::chrono::milliseconds(1000)));
         EXPECT_FALSE(sendWasCompleted.get());
         EXPECT_TRUE(FutureReady(readyOrBroken, std::chrono::milliseconds(1000)));
@@ -252,6 +384,13 @@ namespace SmtpTests {
         SendTextMessage(connection, "250 OK\r\n"); // response to RCPT TO:<bob@example.com>
         (void)AwaitMessages(0, 1);
         SendTextMessage(connection, "550 No such user\r\n"); // response to RCPT TO:<carol@example.com>
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "RSET\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+        SendTextMessage(connection, "250 OK\r\n"); // response to RSET
         EXPECT_TRUE(FutureReady(sendWasCompleted, std::chrono::milliseconds(1000)));
         EXPECT_FALSE(sendWasCompleted.get());
         EXPECT_TRUE(FutureReady(readyOrBroken, std::chrono::milliseconds(1000)));
@@ -298,6 +437,13 @@ namespace SmtpTests {
         SendTextMessage(connection, "250 OK\r\n"); // response to RCPT TO:<carol@example.com>
         (void)AwaitMessages(0, 1);
         SendTextMessage(connection, "500 Go away, you smell\r\n"); // response to DATA
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "RSET\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+        SendTextMessage(connection, "250 OK\r\n"); // response to RSET
         ASSERT_TRUE(FutureReady(sendWasCompleted, std::chrono::milliseconds(1000)));
         EXPECT_FALSE(sendWasCompleted.get());
         EXPECT_TRUE(FutureReady(readyOrBroken, std::chrono::milliseconds(1000)));
@@ -443,6 +589,306 @@ namespace SmtpTests {
         );
     }
 
+    TEST_F(ClientTests, SendMailWhileAnotherIsInProgressIsQueued) {
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        auto& connection = *clients[0].connection;
+        MessageHeaders::MessageHeaders firstHeaders;
+        firstHeaders.AddHeader("From", "<alex@example.com>");
+        firstHeaders.AddHeader("To", "<bob@example.com>");
+        MessageHeaders::MessageHeaders secondHeaders;
+        secondHeaders.AddHeader("From", "<alex@example.com>");
+        secondHeaders.AddHeader("To", "<carol@example.com>");
+        auto firstSendWasCompleted = client.SendMail(firstHeaders, "Hello, Bob!\r\n");
+        auto secondSendWasCompleted = client.SendMail(secondHeaders, "Hello, Carol!\r\n");
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "MAIL FROM:<alex@example.com>\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+        SendTextMessage(connection, "250 OK\r\n"); // response to MAIL FROM:<alex@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "250 OK\r\n"); // response to RCPT TO:<bob@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "354 Start mail input; end with <CRLF>.<CRLF>\r\n"); // response to DATA
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "From: <alex@example.com>\r\n",
+                "To: <bob@example.com>\r\n",
+                "\r\n",
+                "Hello, Bob!\r\n",
+                ".\r\n",
+            }),
+            AwaitMessages(0, 5)
+        );
+        EXPECT_FALSE(FutureReady(firstSendWasCompleted));
+        SendTextMessage(connection, "250 OK\r\n"); // response to headers/body
+        ASSERT_TRUE(FutureReady(firstSendWasCompleted, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(firstSendWasCompleted.get());
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "MAIL FROM:<alex@example.com>\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+        EXPECT_FALSE(FutureReady(secondSendWasCompleted));
+    }
+
+    TEST_F(ClientTests, LargeEnvelopePipelinedInOrder) {
+        extraServerOptions.push_back("PIPELINING");
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        MessageHeaders::MessageHeaders headers;
+        headers.AddHeader("From", "<alex@example.com>");
+        std::vector< std::string > expectedMessages{
+            "MAIL FROM:<alex@example.com>\r\n",
+        };
+        for (size_t i = 0; i < 1000; ++i) {
+            const auto recipient = "<user" + std::to_string(i) + "@example.com>";
+            headers.AddHeader("To", recipient);
+            expectedMessages.push_back("RCPT TO:" + recipient + "\r\n");
+        }
+        auto sendWasCompleted = client.SendMail(headers, "Hello, World!\r\n");
+        EXPECT_EQ(
+            expectedMessages,
+            AwaitMessages(0, expectedMessages.size())
+        );
+        EXPECT_FALSE(FutureReady(sendWasCompleted));
+    }
+
+    TEST_F(ClientTests, PipeliningKeywordMatchedWithoutRegardToCase) {
+        extraServerOptions.push_back("Pipelining");
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        MessageHeaders::MessageHeaders headers;
+        headers.AddHeader("From", "<alex@example.com>");
+        headers.AddHeader("To", "<bob@example.com>");
+        auto sendWasCompleted = client.SendMail(headers, "Hello, World!\r\n");
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "MAIL FROM:<alex@example.com>\r\n",
+                "RCPT TO:<bob@example.com>\r\n",
+            }),
+            AwaitMessages(0, 2)
+        );
+    }
+
+    TEST_F(ClientTests, PipelinedEnvelope) {
+        extraServerOptions.push_back("PIPELINING");
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        auto& connection = *clients[0].connection;
+        MessageHeaders::MessageHeaders headers;
+        headers.AddHeader("From", "<alex@example.com>");
+        headers.AddHeader("To", "<bob@example.com>");
+        headers.AddHeader("To", "<carol@example.com>");
+        auto sendWasCompleted = client.SendMail(headers, "Hello, World!\r\n");
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "MAIL FROM:<alex@example.com>\r\n",
+                "RCPT TO:<bob@example.com>\r\n",
+                "RCPT TO:<carol@example.com>\r\n",
+            }),
+            AwaitMessages(0, 3)
+        );
+        SendTextMessage(connection, "250 OK\r\n"); // response to MAIL FROM:<alex@example.com>
+        SendTextMessage(connection, "250 OK\r\n"); // response to RCPT TO:<bob@example.com>
+        EXPECT_TRUE(AwaitMessages(0, 1, std::chrono::milliseconds(100)).empty());
+        SendTextMessage(connection, "250 OK\r\n"); // response to RCPT TO:<carol@example.com>
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "DATA\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+        EXPECT_FALSE(FutureReady(sendWasCompleted));
+    }
+
+    TEST_F(ClientTests, PipelinedEnvelopeRecipientRejected) {
+        extraServerOptions.push_back("PIPELINING");
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        auto& connection = *clients[0].connection;
+        MessageHeaders::MessageHeaders headers;
+        headers.AddHeader("From", "<alex@example.com>");
+        headers.AddHeader("To", "<bob@example.com>");
+        headers.AddHeader("To", "<carol@example.com>");
+        auto sendWasCompleted = client.SendMail(headers, "Hello, World!\r\n");
+        (void)AwaitMessages(0, 3);
+        auto readyOrBroken = client.GetReadyOrBrokenFuture();
+        SendTextMessage(
+            connection,
+            (
+                "250 OK\r\n" // response to MAIL FROM:<alex@example.com>
+                "550 No such user here\r\n" // response to RCPT TO:<bob@example.com>
+            )
+        );
+        EXPECT_FALSE(FutureReady(sendWasCompleted, std::chrono::milliseconds(100)));
+        SendTextMessage(connection, "250 OK\r\n"); // response to RCPT TO:<carol@example.com>
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "RSET\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+        SendTextMessage(connection, "250 OK\r\n"); // response to RSET
+        ASSERT_TRUE(FutureReady(sendWasCompleted, std::chrono::milliseconds(1000)));
+        EXPECT_FALSE(sendWasCompleted.get());
+        EXPECT_TRUE(FutureReady(readyOrBroken, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(readyOrBroken.get());
+        EXPECT_TRUE(AwaitMessages(0, 1, std::chrono::milliseconds(100)).empty());
+    }
+
+    TEST_F(ClientTests, RecipientRejectedResetBeforeNextQueuedSendMail) {
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        auto& connection = *clients[0].connection;
+        MessageHeaders::MessageHeaders firstHeaders;
+        firstHeaders.AddHeader("From", "<alex@example.com>");
+        firstHeaders.AddHeader("To", "<bob@example.com>");
+        MessageHeaders::MessageHeaders secondHeaders;
+        secondHeaders.AddHeader("From", "<alex@example.com>");
+        secondHeaders.AddHeader("To", "<carol@example.com>");
+        auto firstSendWasCompleted = client.SendMail(firstHeaders, "Hello, Bob!\r\n");
+        auto secondSendWasCompleted = client.SendMail(secondHeaders, "Hello, Carol!\r\n");
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "250 OK\r\n"); // response to MAIL FROM:<alex@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "550 No such user here\r\n"); // response to RCPT TO:<bob@example.com>
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "RSET\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+        EXPECT_TRUE(AwaitMessages(0, 1, std::chrono::milliseconds(100)).empty());
+        SendTextMessage(connection, "250 OK\r\n"); // response to RSET
+        ASSERT_TRUE(FutureReady(firstSendWasCompleted, std::chrono::milliseconds(1000)));
+        EXPECT_FALSE(firstSendWasCompleted.get());
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "MAIL FROM:<alex@example.com>\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+        SendTextMessage(connection, "250 OK\r\n"); // response to MAIL FROM:<alex@example.com>
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "RCPT TO:<carol@example.com>\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+        EXPECT_FALSE(FutureReady(secondSendWasCompleted));
+    }
+
+    TEST_F(ClientTests, PipelinedNextEnvelopeSentWithEndOfData) {
+        extraServerOptions.push_back("PIPELINING");
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        auto& connection = *clients[0].connection;
+        MessageHeaders::MessageHeaders firstHeaders;
+        firstHeaders.AddHeader("From", "<alex@example.com>");
+        firstHeaders.AddHeader("To", "<bob@example.com>");
+        MessageHeaders::MessageHeaders secondHeaders;
+        secondHeaders.AddHeader("From", "<alex@example.com>");
+        secondHeaders.AddHeader("To", "<carol@example.com>");
+        auto firstSendWasCompleted = client.SendMail(firstHeaders, "Hello, Bob!\r\n");
+        auto secondSendWasCompleted = client.SendMail(secondHeaders, "Hello, Carol!\r\n");
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "MAIL FROM:<alex@example.com>\r\n",
+                "RCPT TO:<bob@example.com>\r\n",
+            }),
+            AwaitMessages(0, 2)
+        );
+        SendTextMessage(
+            connection,
+            (
+                "250 OK\r\n" // response to MAIL FROM:<alex@example.com>
+                "250 OK\r\n" // response to RCPT TO:<bob@example.com>
+            )
+        );
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "354 Start mail input; end with <CRLF>.<CRLF>\r\n"); // response to DATA
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "From: <alex@example.com>\r\n",
+                "To: <bob@example.com>\r\n",
+                "\r\n",
+                "Hello, Bob!\r\n",
+                ".\r\n",
+                "MAIL FROM:<alex@example.com>\r\n",
+                "RCPT TO:<carol@example.com>\r\n",
+            }),
+            AwaitMessages(0, 7)
+        );
+        EXPECT_FALSE(FutureReady(firstSendWasCompleted));
+        SendTextMessage(
+            connection,
+            (
+                "250 OK\r\n" // response to first e-mail headers/body
+                "250 OK\r\n" // response to MAIL FROM:<alex@example.com>
+                "250 OK\r\n" // response to RCPT TO:<carol@example.com>
+            )
+        );
+        ASSERT_TRUE(FutureReady(firstSendWasCompleted, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(firstSendWasCompleted.get());
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "DATA\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+        EXPECT_FALSE(FutureReady(secondSendWasCompleted));
+    }
+
+    TEST_F(ClientTests, PipelinedRepliesAttributedWhenPreviousTransactionFails) {
+        extraServerOptions.push_back("PIPELINING");
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        auto& connection = *clients[0].connection;
+        MessageHeaders::MessageHeaders firstHeaders;
+        firstHeaders.AddHeader("From", "<alex@example.com>");
+        firstHeaders.AddHeader("To", "<bob@example.com>");
+        MessageHeaders::MessageHeaders secondHeaders;
+        secondHeaders.AddHeader("From", "<alex@example.com>");
+        secondHeaders.AddHeader("To", "<carol@example.com>");
+        auto firstSendWasCompleted = client.SendMail(firstHeaders, "Hello, Bob!\r\n");
+        (void)AwaitMessages(0, 2);
+        SendTextMessage(
+            connection,
+            (
+                "250 OK\r\n" // response to MAIL FROM:<alex@example.com>
+                "250 OK\r\n" // response to RCPT TO:<bob@example.com>
+            )
+        );
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "354 Start mail input; end with <CRLF>.<CRLF>\r\n"); // response to DATA
+        (void)AwaitMessages(0, 5);
+        auto secondSendWasCompleted = client.SendMail(secondHeaders, "Hello, Carol!\r\n");
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "MAIL FROM:<alex@example.com>\r\n",
+                "RCPT TO:<carol@example.com>\r\n",
+            }),
+            AwaitMessages(0, 2)
+        );
+        SendTextMessage(
+            connection,
+            (
+                "554 Transaction failed\r\n" // response to first e-mail headers/body
+                "250 OK\r\n" // response to MAIL FROM:<alex@example.com>
+                "250 OK\r\n" // response to RCPT TO:<carol@example.com>
+            )
+        );
+        ASSERT_TRUE(FutureReady(firstSendWasCompleted, std::chrono::milliseconds(1000)));
+        EXPECT_FALSE(firstSendWasCompleted.get());
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "DATA\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+        SendTextMessage(connection, "354 Start mail input; end with <CRLF>.<CRLF>\r\n"); // response to DATA
+        (void)AwaitMessages(0, 5);
+        SendTextMessage(connection, "250 OK\r\n"); // response to second e-mail headers/body
+        ASSERT_TRUE(FutureReady(secondSendWasCompleted, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(secondSendWasCompleted.get());
+    }
+
     TEST_F(ClientTests, Disconnect) {
         StartServer(false);
         ASSERT_TRUE(EstablishConnection(false));
@@ -465,6 +911,7 @@ namespace SmtpTests {
 
         // Act
         ASSERT_TRUE(EstablishConnection(false));
+        ASSERT_TRUE(AwaitConnections(2));
         auto& secondConnection = *clients[1].connection;
         SendTextMessage(
             secondConnection,
@@ -479,4 +926,629 @@ namespace SmtpTests {
         );
     }
 
+    TEST_F(ClientTests, CancelQueuedSendMail) {
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        MessageHeaders::MessageHeaders firstHeaders;
+        firstHeaders.AddHeader("From", "<alex@example.com>");
+        firstHeaders.AddHeader("To", "<bob@example.com>");
+        MessageHeaders::MessageHeaders secondHeaders;
+        secondHeaders.AddHeader("From", "<alex@example.com>");
+        secondHeaders.AddHeader("To", "<carol@example.com>");
+        Smtp::CancellationToken cancellationToken;
+        auto firstSendWasCompleted = client.SendMail(firstHeaders, "Hello, Bob!\r\n");
+        auto secondSendWasCompleted = client.SendMail(
+            secondHeaders,
+            "Hello, Carol!\r\n",
+            cancellationToken
+        );
+        (void)AwaitMessages(0, 1);
+        cancellationToken.Cancel();
+        ASSERT_TRUE(FutureReady(secondSendWasCompleted));
+        EXPECT_FALSE(secondSendWasCompleted.get());
+        EXPECT_FALSE(FutureReady(firstSendWasCompleted));
+    }
+
+    TEST_F(ClientTests, SendMailWithCancelledTokenFails) {
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        MessageHeaders::MessageHeaders headers;
+        headers.AddHeader("From", "<alex@example.com>");
+        headers.AddHeader("To", "<bob@example.com>");
+        Smtp::CancellationToken cancellationToken;
+        cancellationToken.Cancel();
+        auto sendWasCompleted = client.SendMail(headers, "Hello, World!\r\n", cancellationToken);
+        ASSERT_TRUE(FutureReady(sendWasCompleted));
+        EXPECT_FALSE(sendWasCompleted.get());
+        EXPECT_TRUE(AwaitMessages(0, 1, std::chrono::milliseconds(100)).empty());
+    }
+
+    TEST_F(ClientTests, CancelDuringEnvelopeSendsReset) {
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        auto& connection = *clients[0].connection;
+        MessageHeaders::MessageHeaders headers;
+        headers.AddHeader("From", "<alex@example.com>");
+        headers.AddHeader("To", "<bob@example.com>");
+        Smtp::CancellationToken cancellationToken;
+        auto sendWasCompleted = client.SendMail(headers, "Hello, World!\r\n", cancellationToken);
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "MAIL FROM:<alex@example.com>\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+        cancellationToken.Cancel();
+        EXPECT_FALSE(FutureReady(sendWasCompleted, std::chrono::milliseconds(100)));
+        SendTextMessage(connection, "250 OK\r\n"); // response to MAIL FROM:<alex@example.com>
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "RSET\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+        auto readyOrBroken = client.GetReadyOrBrokenFuture();
+        SendTextMessage(connection, "250 OK\r\n"); // response to RSET
+        ASSERT_TRUE(FutureReady(sendWasCompleted, std::chrono::milliseconds(1000)));
+        EXPECT_FALSE(sendWasCompleted.get());
+        ASSERT_TRUE(FutureReady(readyOrBroken, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(readyOrBroken.get());
+        EXPECT_FALSE(clients[0].broken);
+    }
+
+    TEST_F(ClientTests, CancelAfterDataGoAheadRequestedClosesConnection) {
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        auto& connection = *clients[0].connection;
+        MessageHeaders::MessageHeaders headers;
+        headers.AddHeader("From", "<alex@example.com>");
+        headers.AddHeader("To", "<bob@example.com>");
+        Smtp::CancellationToken cancellationToken;
+        auto sendWasCompleted = client.SendMail(headers, "Hello, World!\r\n", cancellationToken);
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "250 OK\r\n"); // response to MAIL FROM:<alex@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "250 OK\r\n"); // response to RCPT TO:<bob@example.com>
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "DATA\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+        cancellationToken.Cancel();
+        SendTextMessage(connection, "354 Start mail input; end with <CRLF>.<CRLF>\r\n"); // response to DATA
+        ASSERT_TRUE(FutureReady(sendWasCompleted, std::chrono::milliseconds(1000)));
+        EXPECT_FALSE(sendWasCompleted.get());
+        EXPECT_TRUE(AwaitBroken(0));
+        EXPECT_TRUE(AwaitMessages(0, 1, std::chrono::milliseconds(100)).empty());
+    }
+
+    TEST_F(ClientTests, CancelConnectBeforeGreeting) {
+        StartServer(false);
+        Smtp::CancellationToken cancellationToken;
+        auto connectionDidComplete = client.Connect(
+            "localhost",
+            serverPort,
+            cancellationToken
+        );
+        ASSERT_TRUE(FutureReady(connectionDidComplete, std::chrono::milliseconds(1000)));
+        ASSERT_TRUE(connectionDidComplete.get());
+        ASSERT_TRUE(AwaitConnections(1));
+        auto readyOrBroken = client.GetReadyOrBrokenFuture();
+        cancellationToken.Cancel();
+        ASSERT_TRUE(FutureReady(readyOrBroken, std::chrono::milliseconds(1000)));
+        EXPECT_FALSE(readyOrBroken.get());
+        EXPECT_TRUE(AwaitBroken(0));
+    }
+
+    TEST_F(ClientTests, SendMailWithStoredBody) {
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        Smtp::BodyStore store;
+        const auto key = store.Add("Hello,\n.World!");
+        MessageHeaders::MessageHeaders headers;
+        headers.AddHeader("From", "<alex@example.com>");
+        headers.AddHeader("To", "<bob@example.com>");
+        auto sendWasCompleted = client.SendMail(headers, store.Get(key));
+        (void)AwaitMessages(0, 1);
+        auto& connection = *clients[0].connection;
+        SendTextMessage(connection, "250 OK\r\n"); // response to MAIL FROM:<alex@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "250 OK\r\n"); // response to RCPT TO:<bob@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "354 Start mail input; end with <CRLF>.<CRLF>\r\n"); // response to DATA
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "From: <alex@example.com>\r\n",
+                "To: <bob@example.com>\r\n",
+                "\r\n",
+                "Hello,\r\n",
+                "..World!\r\n",
+                ".\r\n",
+            }),
+            AwaitMessages(0, 6)
+        );
+        SendTextMessage(connection, "250 OK\r\n"); // response to data
+        ASSERT_TRUE(FutureReady(sendWasCompleted, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(sendWasCompleted.get());
+    }
+
+    TEST_F(ClientTests, SendMailWithBodyFile) {
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        const auto directory = MakeTestDirectory();
+        ASSERT_FALSE(directory.empty());
+        Smtp::BodyStore store;
+        store.Configure(directory);
+        auto body = MakeLargeBody();
+        body += ".World!";
+        const auto key = store.Add(body);
+        MessageHeaders::MessageHeaders headers;
+        headers.AddHeader("From", "<alex@example.com>");
+        headers.AddHeader("To", "<bob@example.com>");
+        auto sendWasCompleted = client.SendMail(headers, store.GetFile(key));
+        (void)AwaitMessages(0, 1);
+        auto& connection = *clients[0].connection;
+        SendTextMessage(connection, "250 OK\r\n"); // response to MAIL FROM:<alex@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "250 OK\r\n"); // response to RCPT TO:<bob@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "354 Start mail input; end with <CRLF>.<CRLF>\r\n"); // response to DATA
+        const auto linesReceived = AwaitMessages(0, 2005);
+        ASSERT_EQ(2005, linesReceived.size());
+        EXPECT_EQ("\r\n", linesReceived[2]);
+        EXPECT_EQ(2000, std::count(linesReceived.begin(), linesReceived.end(), largeBodyLine + "\r\n"));
+        EXPECT_EQ("..World!\r\n", linesReceived[2003]);
+        EXPECT_EQ(".\r\n", linesReceived.back());
+        SendTextMessage(connection, "250 OK\r\n"); // response to data
+        ASSERT_TRUE(FutureReady(sendWasCompleted, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(sendWasCompleted.get());
+        store.Release(key);
+    }
+
+    TEST_F(ClientTests, SendMailBodyLargerThanOneChunk) {
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        MessageHeaders::MessageHeaders headers;
+        headers.AddHeader("From", "<alex@example.com>");
+        headers.AddHeader("To", "<bob@example.com>");
+        const auto body = MakeLargeBody();
+        auto sendWasCompleted = client.SendMail(headers, body);
+        (void)AwaitMessages(0, 1);
+        auto& connection = *clients[0].connection;
+        SendTextMessage(connection, "250 OK\r\n"); // response to MAIL FROM:<alex@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "250 OK\r\n"); // response to RCPT TO:<bob@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "354 Start mail input; end with <CRLF>.<CRLF>\r\n"); // response to DATA
+        const auto linesReceived = AwaitMessages(0, 2004);
+        ASSERT_EQ(2004, linesReceived.size());
+        EXPECT_EQ("\r\n", linesReceived[2]);
+        EXPECT_EQ(2000, std::count(linesReceived.begin(), linesReceived.end(), largeBodyLine + "\r\n"));
+        EXPECT_EQ(".\r\n", linesReceived.back());
+        SendTextMessage(connection, "250 OK\r\n"); // response to data
+        ASSERT_TRUE(FutureReady(sendWasCompleted, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(sendWasCompleted.get());
+    }
+
+    TEST_F(ClientTests, SendMailBodyChunksFedAsConnectionDrains) {
+        const auto drainNotifyingConnection = std::make_shared< DrainNotifyingConnection >();
+        transport->connectionFactory = [drainNotifyingConnection]{
+            return drainNotifyingConnection;
+        };
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        MessageHeaders::MessageHeaders headers;
+        headers.AddHeader("From", "<alex@example.com>");
+        headers.AddHeader("To", "<bob@example.com>");
+        const auto body = MakeLargeBody();
+        auto sendWasCompleted = client.SendMail(headers, body);
+        (void)AwaitMessages(0, 1);
+        auto& connection = *clients[0].connection;
+        SendTextMessage(connection, "250 OK\r\n"); // response to MAIL FROM:<alex@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "250 OK\r\n"); // response to RCPT TO:<bob@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "354 Start mail input; end with <CRLF>.<CRLF>\r\n"); // response to DATA
+        std::vector< std::string > linesReceived;
+        for (size_t i = 0; i < 3; ++i) {
+            const auto moreLinesReceived = AwaitMessages(0, 1);
+            linesReceived.insert(
+                linesReceived.end(),
+                moreLinesReceived.begin(),
+                moreLinesReceived.end()
+            );
+            EXPECT_EQ(
+                linesReceived.end(),
+                std::find(linesReceived.begin(), linesReceived.end(), ".\r\n")
+            );
+            ASSERT_TRUE(drainNotifyingConnection->ReportDrained()) << i;
+        }
+        while (linesReceived.size() < 2004) {
+            const auto moreLinesReceived = AwaitMessages(0, 2004 - linesReceived.size());
+            if (moreLinesReceived.empty()) {
+                break;
+            }
+            linesReceived.insert(
+                linesReceived.end(),
+                moreLinesReceived.begin(),
+                moreLinesReceived.end()
+            );
+        }
+        ASSERT_EQ(2004, linesReceived.size());
+        EXPECT_EQ(2000, std::count(linesReceived.begin(), linesReceived.end(), largeBodyLine + "\r\n"));
+        EXPECT_EQ(".\r\n", linesReceived.back());
+        SendTextMessage(connection, "250 OK\r\n"); // response to data
+        ASSERT_TRUE(FutureReady(sendWasCompleted, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(sendWasCompleted.get());
+    }
+
+    TEST_F(ClientTests, CancelDuringLargeBodyStopsSendingIt) {
+        const auto drainNotifyingConnection = std::make_shared< DrainNotifyingConnection >();
+        transport->connectionFactory = [drainNotifyingConnection]{
+            return drainNotifyingConnection;
+        };
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        MessageHeaders::MessageHeaders headers;
+        headers.AddHeader("From", "<alex@example.com>");
+        headers.AddHeader("To", "<bob@example.com>");
+        const auto body = MakeLargeBody();
+        Smtp::CancellationToken cancellationToken;
+        auto sendWasCompleted = client.SendMail(headers, body, cancellationToken);
+        (void)AwaitMessages(0, 1);
+        auto& connection = *clients[0].connection;
+        SendTextMessage(connection, "250 OK\r\n"); // response to MAIL FROM:<alex@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "250 OK\r\n"); // response to RCPT TO:<bob@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "354 Start mail input; end with <CRLF>.<CRLF>\r\n"); // response to DATA
+        ASSERT_TRUE(drainNotifyingConnection->ReportDrained());
+        cancellationToken.Cancel();
+        ASSERT_TRUE(FutureReady(sendWasCompleted, std::chrono::milliseconds(1000)));
+        EXPECT_FALSE(sendWasCompleted.get());
+        EXPECT_TRUE(AwaitBroken(0));
+        const auto linesReceived = AwaitMessages(0, 2004, std::chrono::milliseconds(100));
+        EXPECT_LT(linesReceived.size(), 2004);
+        EXPECT_EQ(
+            linesReceived.end(),
+            std::find(linesReceived.begin(), linesReceived.end(), ".\r\n")
+        );
+    }
+
+    TEST_F(ClientTests, NextEnvelopePipelinedOnlyAfterLargeBodyEnds) {
+        const auto drainNotifyingConnection = std::make_shared< DrainNotifyingConnection >();
+        transport->connectionFactory = [drainNotifyingConnection]{
+            return drainNotifyingConnection;
+        };
+        extraServerOptions.push_back("PIPELINING");
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        MessageHeaders::MessageHeaders headers;
+        headers.AddHeader("From", "<alex@example.com>");
+        headers.AddHeader("To", "<bob@example.com>");
+        const auto body = MakeLargeBody();
+        auto firstSendWasCompleted = client.SendMail(headers, body);
+        (void)AwaitMessages(0, 2);
+        auto& connection = *clients[0].connection;
+        SendTextMessage(
+            connection,
+            (
+                "250 OK\r\n" // response to MAIL FROM:<alex@example.com>
+                "250 OK\r\n" // response to RCPT TO:<bob@example.com>
+            )
+        );
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "354 Start mail input; end with <CRLF>.<CRLF>\r\n"); // response to DATA
+        std::vector< std::string > linesReceived;
+        auto moreLinesReceived = AwaitMessages(0, 1);
+        linesReceived.insert(
+            linesReceived.end(),
+            moreLinesReceived.begin(),
+            moreLinesReceived.end()
+        );
+        MessageHeaders::MessageHeaders secondHeaders;
+        secondHeaders.AddHeader("From", "<carol@example.com>");
+        secondHeaders.AddHeader("To", "<dave@example.com>");
+        auto secondSendWasCompleted = client.SendMail(secondHeaders, "Hello, World!\r\n");
+        while (drainNotifyingConnection->ReportDrained()) {
+            moreLinesReceived = AwaitMessages(0, 1);
+            linesReceived.insert(
+                linesReceived.end(),
+                moreLinesReceived.begin(),
+                moreLinesReceived.end()
+            );
+        }
+        while (linesReceived.size() < 2006) {
+            moreLinesReceived = AwaitMessages(0, 2006 - linesReceived.size());
+            if (moreLinesReceived.empty()) {
+                break;
+            }
+            linesReceived.insert(
+                linesReceived.end(),
+                moreLinesReceived.begin(),
+                moreLinesReceived.end()
+            );
+        }
+        ASSERT_EQ(2006, linesReceived.size());
+        EXPECT_EQ(2000, std::count(linesReceived.begin(), linesReceived.end(), largeBodyLine + "\r\n"));
+        EXPECT_EQ(
+            std::vector< std::string >({
+                ".\r\n",
+                "MAIL FROM:<carol@example.com>\r\n",
+                "RCPT TO:<dave@example.com>\r\n",
+            }),
+            std::vector< std::string >(linesReceived.end() - 3, linesReceived.end())
+        );
+        EXPECT_TRUE(AwaitMessages(0, 1, std::chrono::milliseconds(100)).empty());
+        SendTextMessage(connection, "250 OK\r\n"); // response to data
+        ASSERT_TRUE(FutureReady(firstSendWasCompleted, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(firstSendWasCompleted.get());
+        EXPECT_FALSE(FutureReady(secondSendWasCompleted));
+    }
+
+    TEST_F(ClientTests, FinalReplyLatencyExcludesSendingLargeBody) {
+        const auto destinationHealth = std::make_shared< Smtp::DestinationHealth >();
+        client.SetDestinationHealth(destinationHealth);
+        const auto drainNotifyingConnection = std::make_shared< DrainNotifyingConnection >();
+        transport->connectionFactory = [drainNotifyingConnection]{
+            return drainNotifyingConnection;
+        };
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        MessageHeaders::MessageHeaders headers;
+        headers.AddHeader("From", "<alex@example.com>");
+        headers.AddHeader("To", "<bob@example.com>");
+        const auto body = MakeLargeBody();
+        auto sendWasCompleted = client.SendMail(headers, body);
+        (void)AwaitMessages(0, 1);
+        auto& connection = *clients[0].connection;
+        SendTextMessage(connection, "250 OK\r\n"); // response to MAIL FROM:<alex@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "250 OK\r\n"); // response to RCPT TO:<bob@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "354 Start mail input; end with <CRLF>.<CRLF>\r\n"); // response to DATA
+
+        // The client asks to be told when the connection drains only while
+        // some of the body is still to be queued, so it can't start timing
+        // the final reply until after the first drain is reported.  Hold
+        // that back a while, so that timing from any earlier point, such
+        // as the reply to DATA, shows up as too long a latency.
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        const auto firstDrainReported = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < 3; ++i) {
+            ASSERT_TRUE(drainNotifyingConnection->ReportDrained()) << i;
+        }
+        std::vector< std::string > linesReceived;
+        while (
+            linesReceived.empty()
+            || (linesReceived.back() != ".\r\n")
+        ) {
+            const auto moreLinesReceived = AwaitMessages(0, 2004);
+            ASSERT_FALSE(moreLinesReceived.empty());
+            linesReceived.insert(
+                linesReceived.end(),
+                moreLinesReceived.begin(),
+                moreLinesReceived.end()
+            );
+        }
+        SendTextMessage(connection, "250 OK\r\n"); // response to data
+        ASSERT_TRUE(FutureReady(sendWasCompleted, std::chrono::milliseconds(1000)));
+        const auto sendCompleted = std::chrono::steady_clock::now();
+        EXPECT_TRUE(sendWasCompleted.get());
+        const auto statistics = destinationHealth->GetStatistics("localhost");
+        EXPECT_GT(statistics.finalReplyLatency, 0.0);
+        EXPECT_LE(
+            statistics.finalReplyLatency,
+            std::chrono::duration< double >(sendCompleted - firstDrainReported).count()
+        );
+    }
+
+    TEST_F(ClientTests, IdleClientReleasesBuffers) {
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        const auto idleFootprint = client.GetMemoryFootprint();
+        MessageHeaders::MessageHeaders headers;
+        headers.AddHeader("From", "<alex@example.com>");
+        headers.AddHeader("To", "<bob@example.com>");
+        const auto body = MakeLargeBody();
+        auto sendWasCompleted = client.SendMail(headers, body);
+        EXPECT_GT(client.GetMemoryFootprint(), idleFootprint + body.length());
+        (void)AwaitMessages(0, 1);
+        auto& connection = *clients[0].connection;
+        SendTextMessage(connection, "250 OK\r\n"); // response to MAIL FROM:<alex@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "250 OK\r\n"); // response to RCPT TO:<bob@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "354 Start mail input; end with <CRLF>.<CRLF>\r\n"); // response to DATA
+        (void)AwaitMessages(0, 2004);
+        auto readyOrBroken = client.GetReadyOrBrokenFuture();
+        SendTextMessage(connection, "250 OK\r\n"); // response to data
+        ASSERT_TRUE(FutureReady(sendWasCompleted, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(sendWasCompleted.get());
+        ASSERT_TRUE(FutureReady(readyOrBroken, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(readyOrBroken.get());
+        EXPECT_LE(client.GetMemoryFootprint(), idleFootprint);
+    }
+
+    TEST_F(ClientTests, SendMailTakingOwnership) {
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        MessageHeaders::MessageHeaders headers;
+        headers.AddHeader("From", "<alex@example.com>");
+        headers.AddHeader("To", "<bob@example.com>");
+        std::string body("Hello, World!\r\n");
+        auto sendWasCompleted = client.SendMail(std::move(headers), std::move(body));
+        (void)AwaitMessages(0, 1);
+        auto& connection = *clients[0].connection;
+        SendTextMessage(connection, "250 OK\r\n"); // response to MAIL FROM:<alex@example.com>
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "RCPT TO:<bob@example.com>\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+        SendTextMessage(connection, "250 OK\r\n"); // response to RCPT TO:<bob@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "354 Start mail input; end with <CRLF>.<CRLF>\r\n"); // response to DATA
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "From: <alex@example.com>\r\n",
+                "To: <bob@example.com>\r\n",
+                "\r\n",
+                "Hello, World!\r\n",
+                ".\r\n",
+            }),
+            AwaitMessages(0, 5)
+        );
+        SendTextMessage(connection, "250 OK\r\n"); // response to data
+        ASSERT_TRUE(FutureReady(sendWasCompleted, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(sendWasCompleted.get());
+    }
+
+    TEST_F(ClientTests, SpansRecordedForConnectionAndEmail) {
+        const auto spanSink = std::make_shared< MockSpanSink >();
+        client.SetSpanSink(spanSink);
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        MessageHeaders::MessageHeaders headers;
+        headers.AddHeader("From", "<alex@example.com>");
+        headers.AddHeader("To", "<bob@example.com>");
+        headers.AddHeader("Message-ID", "<1234@example.com>");
+        auto sendWasCompleted = client.SendMail(headers, "Hello, World!\r\n");
+        (void)AwaitMessages(0, 1);
+        auto& connection = *clients[0].connection;
+        SendTextMessage(connection, "250 OK\r\n"); // response to MAIL FROM:<alex@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "250 OK\r\n"); // response to RCPT TO:<bob@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "354 Start mail input; end with <CRLF>.<CRLF>\r\n"); // response to DATA
+        (void)AwaitMessages(0, 6);
+        SendTextMessage(connection, "250 OK\r\n"); // response to data
+        ASSERT_TRUE(FutureReady(sendWasCompleted, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(sendWasCompleted.get());
+        std::lock_guard< decltype(spanSink->mutex) > lock(spanSink->mutex);
+        const auto& spans = spanSink->spans;
+        std::vector< std::string > names;
+        for (const auto& span: spans) {
+            names.push_back(span.name);
+        }
+        ASSERT_EQ(
+            std::vector< std::string >({
+                "connect",
+                "greeting",
+                "ehlo",
+                "envelope",
+                "data",
+                "final-reply",
+            }),
+            names
+        );
+        EXPECT_EQ(32, spans[0].traceId.length());
+        EXPECT_EQ(spans[0].traceId, spans[1].traceId);
+        EXPECT_EQ(spans[0].traceId, spans[2].traceId);
+        EXPECT_NE(spans[0].traceId, spans[3].traceId);
+        EXPECT_EQ(spans[3].traceId, spans[4].traceId);
+        EXPECT_EQ(spans[3].traceId, spans[5].traceId);
+        EXPECT_EQ("localhost", spans[0].attributes.at("host"));
+        EXPECT_EQ("true", spans[0].attributes.at("success"));
+        EXPECT_EQ("220", spans[1].attributes.at("code"));
+        EXPECT_EQ("250", spans[2].attributes.at("code"));
+        EXPECT_EQ("1", spans[3].attributes.at("recipients"));
+        EXPECT_EQ("<1234@example.com>", spans[3].attributes.at("message-id"));
+        EXPECT_EQ("354", spans[4].attributes.at("code"));
+        EXPECT_EQ("15", spans[4].attributes.at("size"));
+        EXPECT_EQ("250", spans[5].attributes.at("code"));
+        for (size_t i = 0; i < 6; ++i) {
+            EXPECT_EQ("127.0.0.1", spans[i].attributes.at("peer")) << i;
+        }
+        EXPECT_EQ(0, spans[0].attributes.count("connection"));
+        for (size_t i = 3; i < 6; ++i) {
+            EXPECT_EQ(spans[0].traceId, spans[i].attributes.at("connection")) << i;
+        }
+    }
+
+    TEST_F(ClientTests, LmtpModeReportsOutcomePerRecipient) {
+        client.SetLmtpMode(true);
+        std::vector< std::pair< std::string, int > > outcomes;
+        client.SetRecipientOutcomeDelegate(
+            [&outcomes](
+                const MessageHeaders::MessageHeaders&,
+                const std::string& recipient,
+                const Smtp::Client::ParsedMessage& reply
+            ){
+                outcomes.push_back(std::make_pair(recipient, reply.code));
+            }
+        );
+        StartServer(false);
+        ASSERT_TRUE(EstablishConnection(false));
+        auto& connection = *clients[0].connection;
+        SendTextMessage(connection, "220 mail.example.com LMTP Service Ready\r\n");
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "LHLO [127.0.0.1]\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+        auto readyOrBroken = client.GetReadyOrBrokenFuture();
+        SendTextMessage(connection, "250 mail.example.com\r\n");
+        ASSERT_TRUE(FutureReady(readyOrBroken, std::chrono::milliseconds(1000)));
+        ASSERT_TRUE(readyOrBroken.get());
+        MessageHeaders::MessageHeaders headers;
+        headers.AddHeader("From", "<alex@example.com>");
+        headers.AddHeader("To", "<bob@example.com>");
+        headers.AddHeader("To", "<carol@example.com>");
+        auto sendWasCompleted = client.SendMail(headers, "Hello, World!\r\n");
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "250 OK\r\n"); // response to MAIL FROM:<alex@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "250 OK\r\n"); // response to RCPT TO:<bob@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "250 OK\r\n"); // response to RCPT TO:<carol@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "354 Start mail input; end with <CRLF>.<CRLF>\r\n"); // response to DATA
+        (void)AwaitMessages(0, 6);
+        SendTextMessage(connection, "250 Delivered to bob\r\n"); // response to data for bob
+        EXPECT_FALSE(FutureReady(sendWasCompleted, std::chrono::milliseconds(100)));
+        readyOrBroken = client.GetReadyOrBrokenFuture();
+        SendTextMessage(connection, "452 Carol's mailbox is full\r\n"); // response to data for carol
+        ASSERT_TRUE(FutureReady(sendWasCompleted, std::chrono::milliseconds(1000)));
+        EXPECT_FALSE(sendWasCompleted.get());
+        ASSERT_TRUE(FutureReady(readyOrBroken, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(readyOrBroken.get());
+        EXPECT_EQ(
+            (std::vector< std::pair< std::string, int > >({
+                {"<bob@example.com>", 250},
+                {"<carol@example.com>", 452},
+            })),
+            outcomes
+        );
+    }
+
+    TEST_F(ClientTests, RecipientOutcomesReportedInSmtpMode) {
+        std::vector< std::pair< std::string, int > > outcomes;
+        client.SetRecipientOutcomeDelegate(
+            [&outcomes](
+                const MessageHeaders::MessageHeaders&,
+                const std::string& recipient,
+                const Smtp::Client::ParsedMessage& reply
+            ){
+                outcomes.push_back(std::make_pair(recipient, reply.code));
+            }
+        );
+        extraServerOptions.push_back("PIPELINING");
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        auto& connection = *clients[0].connection;
+        MessageHeaders::MessageHeaders headers;
+        headers.AddHeader("From", "<alex@example.com>");
+        headers.AddHeader("To", "<bob@example.com>");
+        headers.AddHeader("To", "<carol@example.com>");
+        auto sendWasCompleted = client.SendMail(headers, "Hello, World!\r\n");
+        (void)AwaitMessages(0, 3);
+        SendTextMessage(
+            connection,
+            (
+                "250 OK\r\n" // response to MAIL FROM:<alex@example.com>
+                "550 No such user here\r\n" // response to RCPT TO:<bob@example.com>
+                "250 OK\r\n" // response to RCPT TO:<carol@example.com>
+            )
+        );
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "250 OK\r\n"); // response to RSET
+        ASSERT_TRUE(FutureReady(sendWasCompleted, std::chrono::milliseconds(1000)));
+        EXPECT_FALSE(sendWasCompleted.get());
+        EXPECT_EQ(
+            (std::vector< std::pair< std::string, int > >({
+                {"<bob@example.com>", 550},
+            })),
+            outcomes
+        );
+    }
+
 }
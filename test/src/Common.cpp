@@ -17,6 +17,7 @@
 #include <Smtp/Client.hpp>
 #include <stdint.h>
 #include <string>
+#include <SystemAbstractions/File.hpp>
 #include <SystemAbstractions/NetworkEndpoint.hpp>
 #include <TlsDecorator/TlsDecorator.hpp>
 #include <vector>
@@ -28,7 +29,7 @@ namespace SmtpTests {
         uint16_t port
     ) {
         std::shared_ptr< SystemAbstractions::INetworkConnection > serverConnection
-            = std::make_shared< SystemAbstractions::NetworkConnection >();
+            = connectionFactory();
         std::shared_ptr < TlsDecorator::TlsDecorator > tls;
         if (useTls) {
             tls = std::make_shared< TlsDecorator::TlsDecorator >();
@@ -249,6 +250,9 @@ namespace SmtpTests {
         }
         SendTextMessage(connection, "250-mail.example.com\r\n");
         SendTextMessage(connection, "250-FOO Poggers\r\n");
+        for (const auto& option: extraServerOptions) {
+            SendTextMessage(connection, "250-" + option + "\r\n");
+        }
         SendTextMessage(connection, "250 BAR\r\n");
         if (verifyMessageReadyToBeSent) {
             if (!FutureReady(readyOrBroken, std::chrono::milliseconds(1000))) {
@@ -386,9 +390,28 @@ namespace SmtpTests {
         client.Configure(transport);
     }
 
+    std::string Common::MakeTestDirectory() {
+        const auto testInfo = ::testing::UnitTest::GetInstance()->current_test_info();
+        testDirectory = (
+            SystemAbstractions::File::GetExeParentDirectory()
+            + "/TestArea-"
+            + testInfo->test_case_name()
+            + "-"
+            + testInfo->name()
+        );
+        (void)SystemAbstractions::File::DeleteDirectory(testDirectory);
+        if (!SystemAbstractions::File::CreateDirectory(testDirectory)) {
+            return "";
+        }
+        return testDirectory;
+    }
+
     void Common::TearDown() {
         server.Close();
         clients.clear();
+        if (!testDirectory.empty()) {
+            (void)SystemAbstractions::File::DeleteDirectory(testDirectory);
+        }
     }
 
 }
@@ -9,6 +9,7 @@
 
 #include <algorithm>
 #include <condition_variable>
+#include <functional>
 #include <future>
 #include <gtest/gtest.h>
 #include <memory>
@@ -16,6 +17,7 @@
 #include <Smtp/Client.hpp>
 #include <stdint.h>
 #include <string>
+#include <SystemAbstractions/NetworkConnection.hpp>
 #include <SystemAbstractions/NetworkEndpoint.hpp>
 #include <TlsDecorator/TlsDecorator.hpp>
 #include <vector>
@@ -36,6 +38,16 @@ namespace SmtpTests {
         );
     }
 
+    template< typename T > bool FutureReady(
+        std::shared_future< T >& future,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(0)
+    ) {
+        return (
+            future.wait_for(timeout)
+            == std::future_status::ready
+        );
+    }
+
     /**
      * This holds information about one client that is connected
      * to the server used in the text fixture for these tests.
@@ -71,6 +83,11 @@ namespace SmtpTests {
     {
         bool useTls = false;
         std::string caCerts;
+        std::function<
+            std::shared_ptr< SystemAbstractions::INetworkConnection >()
+        > connectionFactory = []{
+            return std::make_shared< SystemAbstractions::NetworkConnection >();
+        };
         std::shared_ptr< SystemAbstractions::INetworkConnection > lastServerConnection;
 
         // Smtp::Client::Transport
@@ -107,6 +124,19 @@ namespace SmtpTests {
          */
         uint16_t serverPort = 0;
 
+        /**
+         * These are any additional options (other than FOO and BAR) the
+         * server should list in reply to EHLO when
+         * EstablishConnectionPrepareToSend is called.
+         */
+        std::vector< std::string > extraServerOptions;
+
+        /**
+         * If not empty, this is the path to the directory made for the
+         * test by MakeTestDirectory, which is deleted after the test.
+         */
+        std::string testDirectory;
+
         /**
          * This collects information about any connections
          * established (presumably by the unit under test) to the server.
@@ -162,6 +192,16 @@ namespace SmtpTests {
 
         void StartServer(bool useTls);
 
+        /**
+         * Make an empty directory for the current test alone, which is
+         * deleted after the test.
+         *
+         * @return
+         *     The path to the directory made is returned, or an empty
+         *     string is returned if it could not be made.
+         */
+        std::string MakeTestDirectory();
+
         // ::testing::Test
 
         virtual void SetUp() override;
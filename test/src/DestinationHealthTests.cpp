@@ -0,0 +1,256 @@
+/**
+ * @file DestinationHealthTests.cpp
+ *
+ * This module contains the unit tests of the Smtp::DestinationHealth class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "Common.hpp"
+
+#include <chrono>
+#include <gtest/gtest.h>
+#include <memory>
+#include <MessageHeaders/MessageHeaders.hpp>
+#include <Smtp/DestinationHealth.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace SmtpTests {
+
+    /**
+     * This is the test fixture for these tests, providing common
+     * setup and teardown for each test.
+     */
+    struct DestinationHealthTests
+        : public Common
+    {
+        // Properties
+
+        std::shared_ptr< Smtp::DestinationHealth > destinationHealth = std::make_shared< Smtp::DestinationHealth >();
+
+        // ::testing::Test
+
+        virtual void SetUp() override {
+            Common::SetUp();
+            destinationHealth->SetCircuitBreakerPolicy(
+                3,
+                0.5,
+                std::chrono::milliseconds(50)
+            );
+        }
+    };
+
+    TEST_F(DestinationHealthTests, FasterHostsRankedFirst) {
+        destinationHealth->RecordConnect("slow.example.com", std::chrono::milliseconds(900), true);
+        destinationHealth->RecordGreeting("slow.example.com", std::chrono::milliseconds(100), 220);
+        destinationHealth->RecordConnect("fast.example.com", std::chrono::milliseconds(10), true);
+        destinationHealth->RecordGreeting("fast.example.com", std::chrono::milliseconds(10), 220);
+        destinationHealth->RecordConnect("flaky.example.com", std::chrono::milliseconds(10), true);
+        destinationHealth->RecordGreeting("flaky.example.com", std::chrono::milliseconds(10), 220);
+        destinationHealth->RecordFinalReply("flaky.example.com", std::chrono::milliseconds(10), 451);
+        destinationHealth->RecordFinalReply("flaky.example.com", std::chrono::milliseconds(10), 250);
+        EXPECT_NEAR(1.0, destinationHealth->GetScore("slow.example.com"), 0.001);
+        EXPECT_NEAR(0.02, destinationHealth->GetScore("fast.example.com"), 0.001);
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "new.example.com",
+                "fast.example.com",
+                "flaky.example.com",
+                "slow.example.com",
+            }),
+            destinationHealth->RankHosts({
+                "slow.example.com",
+                "flaky.example.com",
+                "fast.example.com",
+                "new.example.com",
+            })
+        );
+    }
+
+    TEST_F(DestinationHealthTests, CircuitOpensAfterConsecutiveFailures) {
+        destinationHealth->RecordConnect("mx.example.com", std::chrono::milliseconds(10), false);
+        destinationHealth->RecordConnect("mx.example.com", std::chrono::milliseconds(10), true);
+        destinationHealth->RecordGreeting("mx.example.com", std::chrono::milliseconds(10), 554);
+        EXPECT_TRUE(destinationHealth->IsAvailable("mx.example.com"));
+        destinationHealth->RecordConnect("mx.example.com", std::chrono::milliseconds(10), false);
+        EXPECT_TRUE(destinationHealth->GetStatistics("mx.example.com").circuitOpen);
+        EXPECT_FALSE(destinationHealth->IsAvailable("mx.example.com"));
+        EXPECT_TRUE(destinationHealth->RankHosts({"mx.example.com"}).empty());
+    }
+
+    TEST_F(DestinationHealthTests, CircuitOpensOnHighTransientFailureRate) {
+        for (size_t i = 0; i < 2; ++i) {
+            destinationHealth->RecordReply("mx.example.com", 451);
+        }
+        EXPECT_TRUE(destinationHealth->IsAvailable("mx.example.com"));
+        destinationHealth->RecordReply("mx.example.com", 451);
+        EXPECT_FALSE(destinationHealth->IsAvailable("mx.example.com"));
+    }
+
+    TEST_F(DestinationHealthTests, CircuitAllowsOneTrialAfterOpenTime) {
+        for (size_t i = 0; i < 3; ++i) {
+            destinationHealth->RecordConnect("mx.example.com", std::chrono::milliseconds(10), false);
+        }
+        EXPECT_FALSE(destinationHealth->IsAvailable("mx.example.com"));
+        EXPECT_FALSE(destinationHealth->TryAcquireHost("mx.example.com"));
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        EXPECT_TRUE(destinationHealth->IsAvailable("mx.example.com"));
+        EXPECT_TRUE(destinationHealth->IsAvailable("mx.example.com"));
+        EXPECT_TRUE(destinationHealth->TryAcquireHost("mx.example.com"));
+        EXPECT_FALSE(destinationHealth->IsAvailable("mx.example.com"));
+        EXPECT_FALSE(destinationHealth->TryAcquireHost("mx.example.com"));
+        destinationHealth->RecordConnect("mx.example.com", std::chrono::milliseconds(10), false);
+        EXPECT_FALSE(destinationHealth->IsAvailable("mx.example.com"));
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        EXPECT_TRUE(destinationHealth->TryAcquireHost("mx.example.com"));
+        destinationHealth->RecordConnect("mx.example.com", std::chrono::milliseconds(10), true);
+        destinationHealth->RecordGreeting("mx.example.com", std::chrono::milliseconds(10), 220);
+        EXPECT_FALSE(destinationHealth->GetStatistics("mx.example.com").circuitOpen);
+        EXPECT_TRUE(destinationHealth->TryAcquireHost("mx.example.com"));
+        EXPECT_TRUE(destinationHealth->TryAcquireHost("mx.example.com"));
+    }
+
+    TEST_F(DestinationHealthTests, AbandonedTrialExpires) {
+        for (size_t i = 0; i < 3; ++i) {
+            destinationHealth->RecordConnect("mx.example.com", std::chrono::milliseconds(10), false);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        EXPECT_TRUE(destinationHealth->TryAcquireHost("mx.example.com"));
+        EXPECT_FALSE(destinationHealth->TryAcquireHost("mx.example.com"));
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        EXPECT_TRUE(destinationHealth->IsAvailable("mx.example.com"));
+        EXPECT_TRUE(destinationHealth->TryAcquireHost("mx.example.com"));
+        EXPECT_FALSE(destinationHealth->TryAcquireHost("mx.example.com"));
+        EXPECT_TRUE(destinationHealth->GetStatistics("mx.example.com").circuitOpen);
+    }
+
+    TEST_F(DestinationHealthTests, RankingDoesNotClaimTrial) {
+        for (size_t i = 0; i < 3; ++i) {
+            destinationHealth->RecordConnect("a.example.com", std::chrono::milliseconds(10), false);
+        }
+        destinationHealth->RecordConnect("b.example.com", std::chrono::milliseconds(10), true);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        for (size_t i = 0; i < 2; ++i) {
+            EXPECT_EQ(
+                std::vector< std::string >({
+                    "a.example.com",
+                    "b.example.com",
+                }),
+                destinationHealth->RankHosts({
+                    "a.example.com",
+                    "b.example.com",
+                })
+            );
+        }
+        EXPECT_TRUE(destinationHealth->TryAcquireHost("a.example.com"));
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "b.example.com",
+            }),
+            destinationHealth->RankHosts({
+                "a.example.com",
+                "b.example.com",
+            })
+        );
+    }
+
+    TEST_F(DestinationHealthTests, ConcurrencyGrowsWhileThroughputImproves) {
+        destinationHealth->SetConcurrencyPolicy(1, 4, std::chrono::milliseconds(50), 0.5);
+        EXPECT_EQ(1, destinationHealth->GetConcurrencyLimit("mx.example.com"));
+        EXPECT_TRUE(destinationHealth->TryAcquireConnection("mx.example.com"));
+        EXPECT_FALSE(destinationHealth->TryAcquireConnection("mx.example.com"));
+        for (size_t i = 0; i < 2; ++i) {
+            destinationHealth->RecordFinalReply("mx.example.com", std::chrono::milliseconds(10), 250);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(60));
+        EXPECT_EQ(2, destinationHealth->GetConcurrencyLimit("mx.example.com"));
+        EXPECT_TRUE(destinationHealth->TryAcquireConnection("mx.example.com"));
+        for (size_t i = 0; i < 6; ++i) {
+            destinationHealth->RecordFinalReply("mx.example.com", std::chrono::milliseconds(10), 250);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(60));
+        EXPECT_EQ(3, destinationHealth->GetConcurrencyLimit("mx.example.com"));
+        EXPECT_TRUE(destinationHealth->TryAcquireConnection("mx.example.com"));
+        for (size_t i = 0; i < 3; ++i) {
+            destinationHealth->RecordFinalReply("mx.example.com", std::chrono::milliseconds(10), 250);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(60));
+        const auto statistics = destinationHealth->GetStatistics("mx.example.com");
+        EXPECT_EQ(3, statistics.concurrencyLimit);
+        EXPECT_EQ(3, statistics.activeConnections);
+        EXPECT_GT(statistics.throughput, 0.0);
+    }
+
+    TEST_F(DestinationHealthTests, ConcurrencyHeldWhilePoolNotUsingEveryConnection) {
+        destinationHealth->SetConcurrencyPolicy(1, 4, std::chrono::milliseconds(50), 0.5);
+        EXPECT_TRUE(destinationHealth->TryAcquireConnection("mx.example.com"));
+        destinationHealth->ReleaseConnection("mx.example.com");
+        std::this_thread::sleep_for(std::chrono::milliseconds(60));
+        for (size_t i = 0; i < 4; ++i) {
+            destinationHealth->RecordFinalReply("mx.example.com", std::chrono::milliseconds(10), 250);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(60));
+        EXPECT_EQ(1, destinationHealth->GetConcurrencyLimit("mx.example.com"));
+        EXPECT_EQ(0, destinationHealth->GetStatistics("mx.example.com").activeConnections);
+    }
+
+    TEST_F(DestinationHealthTests, ConcurrencyCutOnOverloadSigns) {
+        destinationHealth->SetConcurrencyPolicy(1, 8, std::chrono::milliseconds(50), 0.5);
+        size_t accepted = 1;
+        for (size_t limit = 1; limit < 4; ++limit) {
+            ASSERT_EQ(limit, destinationHealth->GetConcurrencyLimit("mx.example.com"));
+            EXPECT_TRUE(destinationHealth->TryAcquireConnection("mx.example.com"));
+            for (size_t i = 0; i < accepted; ++i) {
+                destinationHealth->RecordFinalReply("mx.example.com", std::chrono::milliseconds(10), 250);
+            }
+            accepted *= 2;
+            std::this_thread::sleep_for(std::chrono::milliseconds(60));
+        }
+        ASSERT_EQ(4, destinationHealth->GetConcurrencyLimit("mx.example.com"));
+        destinationHealth->RecordReply("mx.example.com", 421);
+        EXPECT_EQ(2, destinationHealth->GetConcurrencyLimit("mx.example.com"));
+        destinationHealth->RecordConnect("mx.example.com", std::chrono::milliseconds(10), false);
+        EXPECT_EQ(2, destinationHealth->GetConcurrencyLimit("mx.example.com"));
+        std::this_thread::sleep_for(std::chrono::milliseconds(60));
+        destinationHealth->RecordConnect("mx.example.com", std::chrono::milliseconds(10), false);
+        EXPECT_EQ(1, destinationHealth->GetConcurrencyLimit("mx.example.com"));
+        EXPECT_FALSE(destinationHealth->TryAcquireConnection("mx.example.com"));
+    }
+
+    TEST_F(DestinationHealthTests, ConcurrencyCutWhenLatencyRises) {
+        destinationHealth->SetConcurrencyPolicy(1, 8, std::chrono::milliseconds(50), 0.5);
+        EXPECT_TRUE(destinationHealth->TryAcquireConnection("mx.example.com"));
+        destinationHealth->RecordFinalReply("mx.example.com", std::chrono::milliseconds(10), 250);
+        std::this_thread::sleep_for(std::chrono::milliseconds(60));
+        ASSERT_EQ(2, destinationHealth->GetConcurrencyLimit("mx.example.com"));
+        EXPECT_TRUE(destinationHealth->TryAcquireConnection("mx.example.com"));
+        for (size_t i = 0; i < 4; ++i) {
+            destinationHealth->RecordFinalReply("mx.example.com", std::chrono::milliseconds(50), 250);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(60));
+        EXPECT_EQ(1, destinationHealth->GetConcurrencyLimit("mx.example.com"));
+    }
+
+    TEST_F(DestinationHealthTests, ClientRecordsServerPerformance) {
+        client.SetDestinationHealth(destinationHealth);
+        auto sendWasCompleted = StartSendingEmail();
+        auto& connection = *clients[0].connection;
+        SendTextMessage(connection, "250 OK\r\n"); // response to MAIL FROM:<alex@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "250 OK\r\n"); // response to RCPT TO:<bob@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "451 Try again later\r\n"); // response to RCPT TO:<carol@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "250 OK\r\n"); // response to RSET
+        ASSERT_TRUE(FutureReady(sendWasCompleted, std::chrono::milliseconds(1000)));
+        const auto statistics = destinationHealth->GetStatistics("localhost");
+        EXPECT_EQ(1, statistics.connectAttempts);
+        EXPECT_EQ(4, statistics.replies);
+        EXPECT_GT(statistics.transientFailureRate, 0.0);
+        EXPECT_EQ(0, statistics.consecutiveFailures);
+        EXPECT_FALSE(statistics.circuitOpen);
+    }
+
+}
@@ -14,6 +14,7 @@
 #include <memory>
 #include <MessageHeaders/MessageHeaders.hpp>
 #include <Smtp/Client.hpp>
+#include <Smtp/WorkerPool.hpp>
 #include <stdint.h>
 #include <string>
 #include <SystemAbstractions/NetworkEndpoint.hpp>
@@ -60,6 +61,7 @@ namespace {
         bool performedExtraStage = false;
         std::function< void(const std::string& data) > onSendMessage;
         std::function< void(bool success) > onStageComplete;
+        std::vector< Smtp::Client::ParsedMessage > serverMessages;
 
         // Smtp::Client::Extension
 
@@ -96,6 +98,7 @@ namespace {
             const Smtp::Client::MessageContext& context,
             const Smtp::Client::ParsedMessage& message
         ) override {
+            serverMessages.push_back(message);
             if (message.code != 250) {
                 return false;
             }
@@ -153,6 +156,92 @@ namespace {
         }
     };
 
+    struct SlowSigningExtension
+        : public Smtp::Client::Extension
+    {
+        // Properties
+
+        Smtp::WorkerPool workerPool;
+        std::promise< void > keyReady;
+        std::shared_future< void > keyAvailable = keyReady.get_future().share();
+
+        // Smtp::Client::Extension
+
+        virtual void ModifyMessageAsync(
+            const Smtp::Client::MessageContext& context,
+            const std::string& input,
+            std::function< void(const std::string& output) > onModified
+        ) override {
+            if (input.substr(0, 4) != "MAIL") {
+                onModified(input);
+                return;
+            }
+            const auto keyAvailable = this->keyAvailable;
+            workerPool.Post(
+                [keyAvailable, input, onModified]{
+                    keyAvailable.wait();
+                    onModified(input + " foo=bar");
+                }
+            );
+        }
+    };
+
+    struct SlowPolicyCheckExtension
+        : public Smtp::Client::Extension
+    {
+        // Properties
+
+        Smtp::WorkerPool workerPool;
+        bool performedExtraStage = false;
+        std::promise< void > policyChecked;
+        std::shared_future< void > policyCheckDone = policyChecked.get_future().share();
+        std::function< void(bool success) > onStageComplete;
+
+        // Smtp::Client::Extension
+
+        virtual bool IsExtraProtocolStageNeededHere(
+            const Smtp::Client::MessageContext& context
+        ) override {
+            if (
+                performedExtraStage
+                || (context.protocolStage != Smtp::Client::ProtocolStage::ReadyToSend)
+            ) {
+                return false;
+            }
+            performedExtraStage = true;
+            return true;
+        }
+
+        virtual void GoAhead(
+            std::function< void(const std::string& data) > onSendMessage,
+            std::function< void(bool success) > onStageComplete
+        ) override {
+            this->onStageComplete = onStageComplete;
+            workerPool.Post(
+                [onSendMessage]{
+                    onSendMessage("PogChamp\r\n");
+                }
+            );
+        }
+
+        virtual void HandleServerMessageAsync(
+            const Smtp::Client::MessageContext&,
+            const Smtp::Client::ParsedMessage& message,
+            std::function< void(bool success) > onHandled
+        ) override {
+            const auto policyCheckDone = this->policyCheckDone;
+            const auto onStageComplete = this->onStageComplete;
+            const auto success = (message.code == 250);
+            workerPool.Post(
+                [policyCheckDone, onStageComplete, success, onHandled]{
+                    policyCheckDone.wait();
+                    onStageComplete(success);
+                    onHandled(true);
+                }
+            );
+        }
+    };
+
 }
 
 namespace SmtpTests {
@@ -200,6 +289,29 @@ namespace SmtpTests {
         EXPECT_FALSE(FutureReady(readyOrBroken));
     }
 
+    TEST_F(ExtensionTests, ExtensionReceivesMultiLineReplyOnce) {
+        auto readyOrBroken = client.GetReadyOrBrokenFuture();
+        const auto extension = std::make_shared< BarPreMessageExtension >();
+        client.RegisterExtension("BAR", extension);
+        ASSERT_TRUE(EstablishConnectionPrepareToSend(false));
+        auto& connection = *clients[0].connection;
+        auto messages = AwaitMessages(0, 1);
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "PogChamp\r\n",
+            }),
+            messages
+        );
+        SendTextMessage(connection, "250-Kappa\r\n");
+        SendTextMessage(connection, "250-Keepo\r\n");
+        SendTextMessage(connection, "250 OK\r\n");
+        ASSERT_TRUE(FutureReady(readyOrBroken, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(readyOrBroken.get());
+        ASSERT_EQ(1, extension->serverMessages.size());
+        EXPECT_EQ(250, extension->serverMessages[0].code);
+        EXPECT_EQ("Kappa\nKeepo\nOK", extension->serverMessages[0].text);
+    }
+
     TEST_F(ExtensionTests, ExtensionProtocolStageHardFailure) {
         auto readyOrBroken = client.GetReadyOrBrokenFuture();
         const auto extension = std::make_shared< BarPreMessageExtension >();
@@ -310,6 +422,60 @@ namespace SmtpTests {
         EXPECT_EQ("Poggers", extension->parameters);
     }
 
+    TEST_F(ExtensionTests, AsyncModifyMessageHoldsBackLaterMessages) {
+        const auto extension = std::make_shared< SlowSigningExtension >();
+        client.RegisterExtension("FOO", extension);
+        extraServerOptions.push_back("PIPELINING");
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        MessageHeaders::MessageHeaders headers;
+        headers.AddHeader("From", "<alex@example.com>");
+        headers.AddHeader("To", "<bob@example.com>");
+        auto sendWasCompleted = client.SendMail(headers, "Hello, World!\r\n");
+        EXPECT_TRUE(AwaitMessages(0, 1, std::chrono::milliseconds(100)).empty());
+        extension->keyReady.set_value();
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "MAIL FROM:<alex@example.com> foo=bar\r\n",
+                "RCPT TO:<bob@example.com>\r\n",
+            }),
+            AwaitMessages(0, 2)
+        );
+    }
+
+    TEST_F(ExtensionTests, AsyncServerMessageHandlingHoldsBackProtocol) {
+        auto readyOrBroken = client.GetReadyOrBrokenFuture();
+        const auto extension = std::make_shared< SlowPolicyCheckExtension >();
+        client.RegisterExtension("BAR", extension);
+        ASSERT_TRUE(EstablishConnectionPrepareToSend(false));
+        auto& connection = *clients[0].connection;
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "PogChamp\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+        SendTextMessage(connection, "250 OK\r\n");
+        EXPECT_FALSE(FutureReady(readyOrBroken, std::chrono::milliseconds(100)));
+        extension->policyChecked.set_value();
+        ASSERT_TRUE(FutureReady(readyOrBroken, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(readyOrBroken.get());
+    }
+
+    TEST_F(ExtensionTests, ExtensionMatchedWithoutRegardToCase) {
+        const auto extension = std::make_shared< FooExtension >();
+        client.RegisterExtension("Foo", extension);
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        EXPECT_EQ("Poggers", extension->parameters);
+    }
+
+    TEST_F(ExtensionTests, WellKnownExtensionMatchedWithoutRegardToCase) {
+        const auto extension = std::make_shared< FooExtension >();
+        client.RegisterExtension("8bitmime", extension);
+        extraServerOptions.push_back("8BITMIME Kappa");
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        EXPECT_EQ("Kappa", extension->parameters);
+    }
+
     TEST_F(ExtensionTests, ExtensionResetAtStart) {
         const auto extension = std::make_shared< FooExtension >();
         client.RegisterExtension("FOO", extension);
@@ -318,4 +484,94 @@ namespace SmtpTests {
         EXPECT_TRUE(extension->wasReset);
     }
 
+    TEST_F(ExtensionTests, ExtensionFactoryMakesInstancePerConnection) {
+        std::vector< std::shared_ptr< FooExtension > > instances;
+        client.RegisterExtensionFactory(
+            "FOO",
+            [&instances]{
+                const auto extension = std::make_shared< FooExtension >();
+                instances.push_back(extension);
+                return extension;
+            }
+        );
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        ASSERT_EQ(1, instances.size());
+        EXPECT_EQ("Poggers", instances[0]->parameters);
+        EXPECT_FALSE(instances[0]->wasReset);
+        MessageHeaders::MessageHeaders headers;
+        headers.AddHeader("From", "<alex@example.com>");
+        auto sendWasCompleted = client.SendMail(headers, "Hello, World!");
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "MAIL FROM:<alex@example.com> foo=bar\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+    }
+
+    TEST_F(ExtensionTests, ExtensionFactoryNotUsedIfServerDoesNotSupportExtension) {
+        size_t instancesMade = 0;
+        client.RegisterExtensionFactory(
+            "SPAM",
+            [&instancesMade]{
+                ++instancesMade;
+                return std::make_shared< FooExtension >();
+            }
+        );
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        EXPECT_EQ(0, instancesMade);
+    }
+
+    TEST_F(ExtensionTests, ExtensionFactoryFoundInSharedRegistry) {
+        std::vector< std::shared_ptr< FooExtension > > instances;
+        const auto extensionRegistry = std::make_shared< Smtp::Client::ExtensionRegistry >();
+        extensionRegistry->Register(
+            "foo",
+            [&instances]{
+                const auto extension = std::make_shared< FooExtension >();
+                instances.push_back(extension);
+                return extension;
+            }
+        );
+        client.SetExtensionRegistry(extensionRegistry);
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        ASSERT_EQ(1, instances.size());
+        EXPECT_EQ("Poggers", instances[0]->parameters);
+        MessageHeaders::MessageHeaders headers;
+        headers.AddHeader("From", "<alex@example.com>");
+        auto sendWasCompleted = client.SendMail(headers, "Hello, World!");
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "MAIL FROM:<alex@example.com> foo=bar\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+    }
+
+    TEST_F(ExtensionTests, ExtensionRegisteredWithClientPreferredOverSharedRegistry) {
+        size_t instancesMadeByRegistry = 0;
+        const auto extensionRegistry = std::make_shared< Smtp::Client::ExtensionRegistry >();
+        extensionRegistry->Register(
+            "FOO",
+            [&instancesMadeByRegistry]{
+                ++instancesMadeByRegistry;
+                return std::make_shared< FooExtension >();
+            }
+        );
+        client.SetExtensionRegistry(extensionRegistry);
+        const auto extension = std::make_shared< FooExtension >();
+        client.RegisterExtension("FOO", extension);
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        EXPECT_EQ(0, instancesMadeByRegistry);
+        EXPECT_EQ("Poggers", extension->parameters);
+    }
+
+    TEST_F(ExtensionTests, KeywordExtensionTableMadeOnlyWhenNeeded) {
+        const auto extension = std::make_shared< FooExtension >();
+        client.RegisterExtension("FOO", extension);
+        const auto footprintWithoutTable = client.GetMemoryFootprint();
+        client.RegisterExtension("AUTH", extension);
+        EXPECT_GT(client.GetMemoryFootprint(), footprintWithoutTable);
+    }
+
 }
@@ -0,0 +1,385 @@
+/**
+ * @file NetworkTransportTests.cpp
+ *
+ * This module contains the unit tests of the Smtp::NetworkTransport class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "Common.hpp"
+
+#include <chrono>
+#include <future>
+#include <gtest/gtest.h>
+#include <memory>
+#include <Smtp/DestinationHealth.hpp>
+#include <Smtp/MemoryResolver.hpp>
+#include <Smtp/NetworkTransport.hpp>
+#include <Smtp/SourceAddressPool.hpp>
+#include <stdint.h>
+#include <string>
+#include <SystemAbstractions/NetworkConnection.hpp>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    /**
+     * This is the address which the mock connection treats as "blackholed",
+     * never completing a connection attempt to it.
+     */
+    constexpr uint32_t blackholedAddress = 0x0A000001;
+
+    /**
+     * This is a network connection used to test connection racing.  All
+     * connections are actually made to the loopback address, but
+     * connection attempts to the "blackholed" address stall and then fail.
+     */
+    struct MockConnection
+        : public SystemAbstractions::NetworkConnection
+    {
+        // SystemAbstractions::INetworkConnection
+
+        virtual bool Connect(uint32_t peerAddress, uint16_t peerPort) override {
+            if (peerAddress == blackholedAddress) {
+                std::this_thread::sleep_for(std::chrono::seconds(2));
+                return false;
+            }
+            return SystemAbstractions::NetworkConnection::Connect(0x7F000001, peerPort);
+        }
+    };
+
+    /**
+     * This is a network connection used to test source address selection.
+     * All connections are actually made from the usual loopback address,
+     * but report being bound to the source address picked for them.
+     */
+    struct MockSourceBoundConnection
+        : public MockConnection
+    {
+        // Properties
+
+        uint32_t sourceAddress = 0;
+
+        // Methods
+
+        explicit MockSourceBoundConnection(uint32_t sourceAddress)
+            : sourceAddress(sourceAddress)
+        {
+        }
+
+        // SystemAbstractions::INetworkConnection
+
+        virtual uint32_t GetBoundAddress() const override {
+            return sourceAddress;
+        }
+    };
+
+}
+
+namespace SmtpTests {
+
+    /**
+     * This is the test fixture for these tests, providing common
+     * setup and teardown for each test.
+     */
+    struct NetworkTransportTests
+        : public Common
+    {
+        // Properties
+
+        std::shared_ptr< Smtp::MemoryResolver > resolver = std::make_shared< Smtp::MemoryResolver >();
+        std::shared_ptr< Smtp::NetworkTransport > networkTransport = std::make_shared< Smtp::NetworkTransport >();
+
+        // ::testing::Test
+
+        virtual void SetUp() override {
+            Common::SetUp();
+            networkTransport->Configure(resolver);
+            networkTransport->SetConnectionFactory(
+                []{
+                    return std::make_shared< MockConnection >();
+                }
+            );
+            networkTransport->SetConnectionRaceTiming(
+                std::chrono::milliseconds(50),
+                std::chrono::milliseconds(1000)
+            );
+        }
+    };
+
+    TEST_F(NetworkTransportTests, ConnectsUsingResolver) {
+        StartServer(false);
+        resolver->SetAddresses("mail.example.com", {0x7F000001});
+        EXPECT_TRUE(networkTransport->Connect("nowhere.example.com", serverPort) == nullptr);
+        const auto connection = networkTransport->Connect("mail.example.com", serverPort);
+        ASSERT_FALSE(connection == nullptr);
+        EXPECT_TRUE(AwaitConnections(1));
+    }
+
+    TEST_F(NetworkTransportTests, ConnectFailsWithoutResolver) {
+        networkTransport->Configure(nullptr);
+        EXPECT_TRUE(networkTransport->Connect("mail.example.com", 25) == nullptr);
+    }
+
+    TEST_F(NetworkTransportTests, RaceSkipsBlackholedAddress) {
+        StartServer(false);
+        resolver->SetAddresses("mail.example.com", {blackholedAddress, 0x0A000002});
+        const auto port = serverPort;
+        const auto networkTransport = this->networkTransport;
+        auto connected = std::async(
+            std::launch::async,
+            [networkTransport, port]{
+                return networkTransport->Connect("mail.example.com", port);
+            }
+        );
+        ASSERT_TRUE(AwaitConnections(1));
+        SendTextMessage(
+            *clients[0].connection,
+            "220 mail.example.com Simple Mail Transfer Service Ready\r\n"
+        );
+        ASSERT_TRUE(FutureReady(connected, std::chrono::milliseconds(1000)));
+        EXPECT_FALSE(connected.get() == nullptr);
+    }
+
+    TEST_F(NetworkTransportTests, RaceStartsNoMoreThanMaxAttempts) {
+        StartServer(false);
+        resolver->SetAddresses("mail.example.com", {blackholedAddress, 0x0A000002});
+        networkTransport->SetMaxAttemptsInProgress(1);
+        networkTransport->SetConnectionRaceTiming(
+            std::chrono::milliseconds(10),
+            std::chrono::milliseconds(200)
+        );
+        EXPECT_TRUE(networkTransport->Connect("mail.example.com", serverPort) == nullptr);
+        EXPECT_FALSE(AwaitConnections(1));
+    }
+
+    TEST_F(NetworkTransportTests, RaceWonByFirstGreeting) {
+        StartServer(false);
+        resolver->SetAddresses("mail.example.com", {0x0A000002, 0x0A000003});
+        const auto port = serverPort;
+        const auto networkTransport = this->networkTransport;
+        auto connected = std::async(
+            std::launch::async,
+            [networkTransport, port]{
+                return networkTransport->Connect("mail.example.com", port);
+            }
+        );
+        ASSERT_TRUE(AwaitConnections(2));
+        EXPECT_FALSE(FutureReady(connected, std::chrono::milliseconds(100)));
+        SendTextMessage(
+            *clients[1].connection,
+            "220 mail.example.com Simple Mail Transfer Service Ready\r\n"
+        );
+        ASSERT_TRUE(FutureReady(connected, std::chrono::milliseconds(1000)));
+        const auto connection = connected.get();
+        ASSERT_FALSE(connection == nullptr);
+        EXPECT_EQ(clients[1].connection->GetPeerPort(), connection->GetBoundPort());
+        EXPECT_TRUE(AwaitBroken(0));
+        EXPECT_FALSE(AwaitBroken(1, std::chrono::milliseconds(100)));
+    }
+
+    TEST_F(NetworkTransportTests, RaceLostIfNoServerGreets) {
+        StartServer(false);
+        resolver->SetAddresses("mail.example.com", {0x0A000002, 0x0A000003});
+        networkTransport->SetConnectionRaceTiming(
+            std::chrono::milliseconds(50),
+            std::chrono::milliseconds(200)
+        );
+        EXPECT_TRUE(networkTransport->Connect("mail.example.com", serverPort) == nullptr);
+        ASSERT_TRUE(AwaitConnections(2));
+        EXPECT_TRUE(AwaitBroken(0));
+        EXPECT_TRUE(AwaitBroken(1));
+    }
+
+    TEST_F(NetworkTransportTests, ClientReceivesGreetingFromRaceWinner) {
+        StartServer(false);
+        resolver->SetAddresses("mail.example.com", {0x0A000002, 0x0A000003});
+        client.Configure(networkTransport);
+        auto connectionDidComplete = client.Connect("mail.example.com", serverPort);
+        ASSERT_TRUE(AwaitConnections(2));
+        SendTextMessage(
+            *clients[0].connection,
+            "220 mail.example.com Simple Mail Transfer Service Ready\r\n"
+        );
+        ASSERT_TRUE(FutureReady(connectionDidComplete, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(connectionDidComplete.get());
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "EHLO [127.0.0.1]\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+    }
+
+    TEST_F(NetworkTransportTests, ClientReceivesRefusalIfNoServerGreets) {
+        StartServer(false);
+        resolver->SetAddresses("mail.example.com", {0x0A000002, 0x0A000003});
+        networkTransport->SetConnectionRaceTiming(
+            std::chrono::milliseconds(50),
+            std::chrono::milliseconds(200)
+        );
+        client.Configure(networkTransport);
+        auto readyOrBroken = client.GetReadyOrBrokenFuture();
+        auto connectionDidComplete = client.Connect("mail.example.com", serverPort);
+        ASSERT_TRUE(AwaitConnections(2));
+        SendTextMessage(
+            *clients[1].connection,
+            "554 Go away you silly person\r\n"
+        );
+        ASSERT_TRUE(FutureReady(connectionDidComplete, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(connectionDidComplete.get());
+        ASSERT_TRUE(FutureReady(readyOrBroken, std::chrono::milliseconds(1000)));
+        EXPECT_FALSE(readyOrBroken.get());
+        EXPECT_TRUE(AwaitBroken(0));
+    }
+
+    TEST_F(NetworkTransportTests, RefusalSkippedIfAnotherServerGreets) {
+        StartServer(false);
+        resolver->SetAddresses("mail.example.com", {0x0A000002, 0x0A000003});
+        client.Configure(networkTransport);
+        auto connectionDidComplete = client.Connect("mail.example.com", serverPort);
+        ASSERT_TRUE(AwaitConnections(2));
+        SendTextMessage(
+            *clients[0].connection,
+            "421 mail.example.com Service not available\r\n"
+        );
+        EXPECT_FALSE(FutureReady(connectionDidComplete, std::chrono::milliseconds(100)));
+        SendTextMessage(
+            *clients[1].connection,
+            "220 mail.example.com Simple Mail Transfer Service Ready\r\n"
+        );
+        ASSERT_TRUE(FutureReady(connectionDidComplete, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(connectionDidComplete.get());
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "EHLO [127.0.0.1]\r\n",
+            }),
+            AwaitMessages(1, 1)
+        );
+        EXPECT_TRUE(AwaitBroken(0));
+    }
+
+    TEST_F(NetworkTransportTests, GreetingDelayTimedFromConnecting) {
+        StartServer(false);
+        resolver->SetAddresses("mail.example.com", {0x0A000002, 0x0A000003});
+        const auto destinationHealth = std::make_shared< Smtp::DestinationHealth >();
+        client.SetDestinationHealth(destinationHealth);
+        client.Configure(networkTransport);
+        auto connectionDidComplete = client.Connect("mail.example.com", serverPort);
+        ASSERT_TRUE(AwaitConnections(2));
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        SendTextMessage(
+            *clients[0].connection,
+            "220 mail.example.com Simple Mail Transfer Service Ready\r\n"
+        );
+        ASSERT_TRUE(FutureReady(connectionDidComplete, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(connectionDidComplete.get());
+        (void)AwaitMessages(0, 1);
+        const auto statistics = destinationHealth->GetStatistics("mail.example.com");
+        EXPECT_LT(statistics.connectTime, 0.15);
+        EXPECT_GE(statistics.greetingDelay, 0.2);
+    }
+
+    TEST_F(NetworkTransportTests, ConnectionsSpreadAcrossSourceAddresses) {
+        StartServer(false);
+        resolver->SetAddresses("mail.example.com", {0x7F000001});
+        const auto sourceAddressPool = std::make_shared< Smtp::SourceAddressPool >();
+        sourceAddressPool->SetAddresses({0x7F000002, 0x7F000003});
+        sourceAddressPool->SetLimits(1, 0, std::chrono::milliseconds(1000));
+        networkTransport->SetSourceAddressPool(
+            sourceAddressPool,
+            [](uint32_t sourceAddress){
+                return std::make_shared< MockSourceBoundConnection >(sourceAddress);
+            }
+        );
+        auto firstConnection = networkTransport->Connect("mail.example.com", serverPort);
+        ASSERT_FALSE(firstConnection == nullptr);
+        EXPECT_EQ(0x7F000002, firstConnection->GetBoundAddress());
+        const auto secondConnection = networkTransport->Connect("mail.example.com", serverPort);
+        ASSERT_FALSE(secondConnection == nullptr);
+        EXPECT_EQ(0x7F000003, secondConnection->GetBoundAddress());
+        EXPECT_TRUE(networkTransport->Connect("mail.example.com", serverPort) == nullptr);
+        firstConnection->Close();
+        EXPECT_EQ(0, sourceAddressPool->GetUsage(0x7F000002, "mail.example.com").activeConnections);
+        firstConnection = nullptr;
+        EXPECT_EQ(0, sourceAddressPool->GetUsage(0x7F000002, "mail.example.com").activeConnections);
+        const auto thirdConnection = networkTransport->Connect("mail.example.com", serverPort);
+        ASSERT_FALSE(thirdConnection == nullptr);
+        EXPECT_EQ(0x7F000002, thirdConnection->GetBoundAddress());
+    }
+
+    TEST_F(NetworkTransportTests, RaceAttemptsTakeSourceAddressesOfTheirOwn) {
+        StartServer(false);
+        resolver->SetAddresses("mail.example.com", {0x0A000002, 0x0A000003});
+        const auto sourceAddressPool = std::make_shared< Smtp::SourceAddressPool >();
+        sourceAddressPool->SetAddresses({0x7F000002, 0x7F000003});
+        sourceAddressPool->SetLimits(1, 0, std::chrono::milliseconds(1000));
+        networkTransport->SetSourceAddressPool(
+            sourceAddressPool,
+            [](uint32_t sourceAddress){
+                return std::make_shared< MockSourceBoundConnection >(sourceAddress);
+            }
+        );
+        const auto port = serverPort;
+        const auto networkTransport = this->networkTransport;
+        auto connected = std::async(
+            std::launch::async,
+            [networkTransport, port]{
+                return networkTransport->Connect("mail.example.com", port);
+            }
+        );
+        ASSERT_TRUE(AwaitConnections(2));
+        EXPECT_EQ(1, sourceAddressPool->GetUsage(0x7F000002, "mail.example.com").activeConnections);
+        EXPECT_EQ(1, sourceAddressPool->GetUsage(0x7F000003, "mail.example.com").activeConnections);
+        SendTextMessage(
+            *clients[0].connection,
+            "220 mail.example.com Simple Mail Transfer Service Ready\r\n"
+        );
+        ASSERT_TRUE(FutureReady(connected, std::chrono::milliseconds(1000)));
+        const auto connection = connected.get();
+        ASSERT_FALSE(connection == nullptr);
+        const auto winnerSourceAddress = connection->GetBoundAddress();
+        const auto loserSourceAddress = (
+            (winnerSourceAddress == 0x7F000002)
+            ? 0x7F000003
+            : 0x7F000002
+        );
+        EXPECT_EQ(1, sourceAddressPool->GetUsage(winnerSourceAddress, "mail.example.com").activeConnections);
+        EXPECT_EQ(0, sourceAddressPool->GetUsage(loserSourceAddress, "mail.example.com").activeConnections);
+        connection->Close();
+        EXPECT_EQ(0, sourceAddressPool->GetUsage(winnerSourceAddress, "mail.example.com").activeConnections);
+    }
+
+    TEST_F(NetworkTransportTests, ClientGreetsWithSourceAddress) {
+        StartServer(false);
+        resolver->SetAddresses("mail.example.com", {0x7F000001});
+        const auto sourceAddressPool = std::make_shared< Smtp::SourceAddressPool >();
+        sourceAddressPool->SetAddresses({0x7F000002});
+        networkTransport->SetSourceAddressPool(
+            sourceAddressPool,
+            [](uint32_t sourceAddress){
+                return std::make_shared< MockSourceBoundConnection >(sourceAddress);
+            }
+        );
+        client.Configure(networkTransport);
+        auto connectionDidComplete = client.Connect("mail.example.com", serverPort);
+        ASSERT_TRUE(FutureReady(connectionDidComplete, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(connectionDidComplete.get());
+        ASSERT_TRUE(AwaitConnections(1));
+        SendTextMessage(
+            *clients[0].connection,
+            "220 mail.example.com Simple Mail Transfer Service Ready\r\n"
+        );
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "EHLO [127.0.0.2]\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+        EXPECT_EQ(1, sourceAddressPool->GetUsage(0x7F000002, "mail.example.com").activeConnections);
+        client.Disconnect();
+        EXPECT_EQ(0, sourceAddressPool->GetUsage(0x7F000002, "mail.example.com").activeConnections);
+    }
+
+}
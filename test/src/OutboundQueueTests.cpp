@@ -0,0 +1,215 @@
+/**
+ * @file OutboundQueueTests.cpp
+ *
+ * This module contains the unit tests of the Smtp::OutboundQueue class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "Common.hpp"
+
+#include <chrono>
+#include <gtest/gtest.h>
+#include <memory>
+#include <MessageHeaders/MessageHeaders.hpp>
+#include <Smtp/OutboundQueue.hpp>
+#include <string>
+#include <vector>
+
+namespace {
+
+    /**
+     * Make an e-mail from Alex to the given recipient, bound for
+     * the given destination.
+     *
+     * @param[in] destination
+     *     This identifies the destination of the e-mail.
+     *
+     * @param[in] recipient
+     *     This is the mailbox of the recipient of the e-mail.
+     *
+     * @return
+     *     The e-mail made is returned.
+     */
+    Smtp::OutboundQueue::Message MakeMessage(
+        const std::string& destination,
+        const std::string& recipient
+    ) {
+        Smtp::OutboundQueue::Message message;
+        message.destination = destination;
+        message.headers.AddHeader("From", "<alex@example.com>");
+        message.headers.AddHeader("To", "<" + recipient + ">");
+        message.body = std::make_shared< const std::string >("Hello!\r\n");
+        return message;
+    }
+
+    /**
+     * Return the recipients of the given e-mails, in order.
+     *
+     * @param[in] messages
+     *     These are the e-mails whose recipients to return.
+     *
+     * @return
+     *     The recipients of the given e-mails are returned.
+     */
+    std::vector< std::string > GetRecipients(
+        const std::vector< Smtp::OutboundQueue::Message >& messages
+    ) {
+        std::vector< std::string > recipients;
+        for (const auto& message: messages) {
+            recipients.push_back(message.headers.GetHeaderValue("To"));
+        }
+        return recipients;
+    }
+
+}
+
+namespace SmtpTests {
+
+    /**
+     * This is the test fixture for these tests, providing common
+     * setup and teardown for each test.
+     */
+    struct OutboundQueueTests
+        : public Common
+    {
+        // Properties
+
+        Smtp::OutboundQueue queue;
+    };
+
+    TEST_F(OutboundQueueTests, EmailsTakenByDestinationInOrderAdded) {
+        queue.Add(MakeMessage("mx1.example.com", "bob@example.com"));
+        queue.Add(MakeMessage("mx2.example.com", "carol@example.org"));
+        queue.Add(MakeMessage("MX1.example.com", "dave@example.com"));
+        EXPECT_EQ(3, queue.GetPendingCount());
+        EXPECT_EQ(2, queue.GetPendingCount("mx1.example.com"));
+        EXPECT_EQ("mx1.example.com", queue.GetOldestDestination());
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "<bob@example.com>",
+                "<dave@example.com>",
+            }),
+            GetRecipients(queue.Take("Mx1.Example.Com"))
+        );
+        EXPECT_EQ(1, queue.GetPendingCount());
+        EXPECT_EQ(0, queue.GetPendingCount("mx1.example.com"));
+        EXPECT_EQ("mx2.example.com", queue.GetOldestDestination());
+        EXPECT_TRUE(queue.Take("mx1.example.com").empty());
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "<carol@example.org>",
+            }),
+            GetRecipients(queue.Take("mx2.example.com"))
+        );
+        EXPECT_EQ(0, queue.GetPendingCount());
+        EXPECT_EQ("", queue.GetOldestDestination());
+    }
+
+    TEST_F(OutboundQueueTests, TakeLimitedToMaxMessages) {
+        queue.Add(MakeMessage("mx.example.com", "bob@example.com"));
+        queue.Add(MakeMessage("mx.example.com", "carol@example.com"));
+        queue.Add(MakeMessage("mx.example.com", "dave@example.com"));
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "<bob@example.com>",
+                "<carol@example.com>",
+            }),
+            GetRecipients(queue.Take("mx.example.com", 2))
+        );
+        EXPECT_EQ(1, queue.GetPendingCount("mx.example.com"));
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "<dave@example.com>",
+            }),
+            GetRecipients(queue.Take("mx.example.com", 2))
+        );
+    }
+
+    TEST_F(OutboundQueueTests, PendingEmailsSentBackToBackOnOneConnection) {
+        queue.Add(MakeMessage("localhost", "bob@example.com"));
+        queue.Add(MakeMessage("elsewhere.example.com", "carol@example.org"));
+        queue.Add(MakeMessage("localhost", "dave@example.com"));
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        auto& connection = *clients[0].connection;
+        auto sendsCompleted = queue.SendPending(client, "localhost");
+        ASSERT_EQ(2, sendsCompleted.size());
+        EXPECT_EQ(1, queue.GetPendingCount());
+        for (size_t i = 0; i < 2; ++i) {
+            EXPECT_EQ(
+                std::vector< std::string >({
+                    "MAIL FROM:<alex@example.com>\r\n",
+                }),
+                AwaitMessages(0, 1)
+            );
+            SendTextMessage(connection, "250 OK\r\n"); // response to MAIL FROM
+            (void)AwaitMessages(0, 1);
+            SendTextMessage(connection, "250 OK\r\n"); // response to RCPT TO
+            (void)AwaitMessages(0, 1);
+            SendTextMessage(connection, "354 Start mail input; end with <CRLF>.<CRLF>\r\n"); // response to DATA
+            (void)AwaitMessages(0, 5);
+            SendTextMessage(connection, "250 OK\r\n"); // response to headers/body
+            ASSERT_TRUE(FutureReady(sendsCompleted[i], std::chrono::milliseconds(1000)));
+            EXPECT_EQ(Smtp::Client::SendResult::Sent, sendsCompleted[i].get());
+        }
+        EXPECT_EQ(1, clients.size());
+    }
+
+    TEST_F(OutboundQueueTests, EmailsRejectedTemporarilyPutBackInQueue) {
+        queue.Add(MakeMessage("localhost", "bob@example.com"));
+        queue.Add(MakeMessage("localhost", "carol@example.com"));
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        auto& connection = *clients[0].connection;
+        auto sendsCompleted = queue.SendPending(client, "localhost");
+        ASSERT_EQ(2, sendsCompleted.size());
+        EXPECT_EQ(0, queue.GetPendingCount());
+        EXPECT_EQ(2, queue.GetInFlightCount());
+        EXPECT_TRUE(queue.Take("localhost").empty());
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "451 Try again later\r\n"); // response to MAIL FROM
+        ASSERT_TRUE(FutureReady(sendsCompleted[0], std::chrono::milliseconds(1000)));
+        EXPECT_EQ(Smtp::Client::SendResult::TransientFailure, sendsCompleted[0].get());
+        EXPECT_EQ(1, queue.GetPendingCount());
+        EXPECT_EQ(1, queue.GetInFlightCount());
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "<bob@example.com>",
+            }),
+            GetRecipients(queue.Take("localhost"))
+        );
+    }
+
+    TEST_F(OutboundQueueTests, EmailsRejectedPermanentlyDropped) {
+        queue.Add(MakeMessage("localhost", "bob@example.com"));
+        queue.Add(MakeMessage("localhost", "carol@example.com"));
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        auto& connection = *clients[0].connection;
+        auto sendsCompleted = queue.SendPending(client, "localhost");
+        ASSERT_EQ(2, sendsCompleted.size());
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "250 OK\r\n"); // response to MAIL FROM
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "550 No such user here\r\n"); // response to RCPT TO
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "250 OK\r\n"); // response to RSET
+        ASSERT_TRUE(FutureReady(sendsCompleted[0], std::chrono::milliseconds(1000)));
+        EXPECT_EQ(Smtp::Client::SendResult::PermanentFailure, sendsCompleted[0].get());
+        EXPECT_EQ(0, queue.GetPendingCount());
+        EXPECT_EQ(1, queue.GetInFlightCount());
+        EXPECT_TRUE(queue.Take("localhost").empty());
+    }
+
+    TEST_F(OutboundQueueTests, EmailsNotSentWhenConnectionLostPutBackInQueue) {
+        queue.Add(MakeMessage("localhost", "bob@example.com"));
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        auto sendsCompleted = queue.SendPending(client, "localhost");
+        ASSERT_EQ(1, sendsCompleted.size());
+        (void)AwaitMessages(0, 1);
+        client.Disconnect();
+        ASSERT_TRUE(FutureReady(sendsCompleted[0], std::chrono::milliseconds(1000)));
+        EXPECT_EQ(Smtp::Client::SendResult::TransientFailure, sendsCompleted[0].get());
+        EXPECT_EQ(1, queue.GetPendingCount());
+        EXPECT_EQ(0, queue.GetInFlightCount());
+    }
+
+}
@@ -0,0 +1,273 @@
+/**
+ * @file ResolverTests.cpp
+ *
+ * This module contains the unit tests of the Smtp::Resolver implementations.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <gtest/gtest.h>
+#include <memory>
+#include <mutex>
+#include <Smtp/CachingResolver.hpp>
+#include <Smtp/MemoryResolver.hpp>
+#include <Smtp/SystemResolver.hpp>
+#include <set>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    /**
+     * This is a resolver used to test the caching resolver.  It counts the
+     * lookups asked of it, and holds onto them until told to answer.
+     */
+    struct MockUpstreamResolver
+        : public Smtp::Resolver
+    {
+        // Properties
+
+        std::mutex mutex;
+        size_t lookups = 0;
+        bool answerImmediately = true;
+        Smtp::MemoryResolver answers;
+        std::vector< std::pair< std::string, ResolutionDelegate > > lookupsHeld;
+
+        // Methods
+
+        void AnswerHeldLookups() {
+            decltype(lookupsHeld) lookupsToAnswer;
+            {
+                std::lock_guard< decltype(mutex) > lock(mutex);
+                lookupsToAnswer.swap(lookupsHeld);
+            }
+            for (const auto& lookup: lookupsToAnswer) {
+                answers.Resolve(lookup.first, lookup.second);
+            }
+        }
+
+        // Smtp::Resolver
+
+        virtual void Resolve(
+            const std::string& hostNameOrAddress,
+            ResolutionDelegate onResolved
+        ) override {
+            {
+                std::lock_guard< decltype(mutex) > lock(mutex);
+                ++lookups;
+                if (!answerImmediately) {
+                    lookupsHeld.emplace_back(hostNameOrAddress, onResolved);
+                    return;
+                }
+            }
+            answers.Resolve(hostNameOrAddress, onResolved);
+        }
+    };
+
+    /**
+     * Look up the given host with the given resolver, and return the
+     * addresses found.
+     */
+    std::vector< uint32_t > Lookup(
+        Smtp::Resolver& resolver,
+        const std::string& hostNameOrAddress
+    ) {
+        std::vector< uint32_t > addresses;
+        resolver.Resolve(
+            hostNameOrAddress,
+            [&addresses](const Smtp::Resolver::Answer& answer){
+                addresses = answer.addresses;
+            }
+        );
+        return addresses;
+    }
+
+}
+
+namespace SmtpTests {
+
+    /**
+     * This is the test fixture for these tests, providing common
+     * setup and teardown for each test.
+     */
+    struct ResolverTests
+        : public ::testing::Test
+    {
+        // Properties
+
+        std::shared_ptr< MockUpstreamResolver > upstream = std::make_shared< MockUpstreamResolver >();
+        Smtp::CachingResolver cachingResolver;
+
+        // ::testing::Test
+
+        virtual void SetUp() override {
+            upstream->answers.SetAddresses("mail.example.com", {0x0A000001});
+            cachingResolver.Configure(upstream);
+        }
+    };
+
+    TEST_F(ResolverTests, MemoryResolverAnswersFromTable) {
+        Smtp::MemoryResolver resolver;
+        resolver.SetAddresses("mail.example.com", {0x0A000001, 0x0A000002});
+        EXPECT_EQ(
+            std::vector< uint32_t >({0x0A000001, 0x0A000002}),
+            Lookup(resolver, "mail.example.com")
+        );
+        EXPECT_EQ(
+            std::vector< uint32_t >({0x7F000001}),
+            Lookup(resolver, "127.0.0.1")
+        );
+        EXPECT_TRUE(Lookup(resolver, "nowhere.example.com").empty());
+    }
+
+    TEST_F(ResolverTests, MemoryResolverLoadsHostsFile) {
+        const std::string path = "SmtpTestsHosts.txt";
+        {
+            std::ofstream file(path);
+            file << "# Test hosts\n";
+            file << "10.0.0.1 mail.example.com mx1.example.com\n";
+            file << "10.0.0.2 mail.example.com # backup\n";
+            file << "bogus.address nowhere.example.com\n";
+        }
+        Smtp::MemoryResolver resolver;
+        EXPECT_TRUE(resolver.LoadHostsFile(path));
+        (void)remove(path.c_str());
+        EXPECT_EQ(
+            std::vector< uint32_t >({0x0A000001, 0x0A000002}),
+            Lookup(resolver, "mail.example.com")
+        );
+        EXPECT_EQ(
+            std::vector< uint32_t >({0x0A000001}),
+            Lookup(resolver, "mx1.example.com")
+        );
+        EXPECT_TRUE(Lookup(resolver, "nowhere.example.com").empty());
+        EXPECT_FALSE(resolver.LoadHostsFile(path));
+    }
+
+    TEST_F(ResolverTests, CachingResolverReusesPositiveAnswers) {
+        EXPECT_EQ(
+            std::vector< uint32_t >({0x0A000001}),
+            Lookup(cachingResolver, "mail.example.com")
+        );
+        EXPECT_EQ(
+            std::vector< uint32_t >({0x0A000001}),
+            Lookup(cachingResolver, "mail.example.com")
+        );
+        EXPECT_EQ(1, upstream->lookups);
+    }
+
+    TEST_F(ResolverTests, CachingResolverReusesNegativeAnswers) {
+        cachingResolver.Configure(upstream, std::chrono::milliseconds(50));
+        EXPECT_TRUE(Lookup(cachingResolver, "nowhere.example.com").empty());
+        EXPECT_TRUE(Lookup(cachingResolver, "nowhere.example.com").empty());
+        EXPECT_EQ(1, upstream->lookups);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        EXPECT_TRUE(Lookup(cachingResolver, "nowhere.example.com").empty());
+        EXPECT_EQ(2, upstream->lookups);
+    }
+
+    TEST_F(ResolverTests, CachingResolverAnswerExpires) {
+        upstream->answers.SetAddresses(
+            "mail.example.com",
+            {0x0A000001},
+            std::chrono::milliseconds(50)
+        );
+        (void)Lookup(cachingResolver, "mail.example.com");
+        upstream->answers.SetAddresses("mail.example.com", {0x0A000002});
+        EXPECT_EQ(
+            std::vector< uint32_t >({0x0A000001}),
+            Lookup(cachingResolver, "mail.example.com")
+        );
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        EXPECT_EQ(
+            std::vector< uint32_t >({0x0A000002}),
+            Lookup(cachingResolver, "mail.example.com")
+        );
+        EXPECT_EQ(2, upstream->lookups);
+    }
+
+    TEST_F(ResolverTests, CachingResolverJoinsLookupInProgress) {
+        upstream->answerImmediately = false;
+        size_t answersDelivered = 0;
+        for (size_t i = 0; i < 100; ++i) {
+            cachingResolver.Resolve(
+                "mail.example.com",
+                [&answersDelivered](const Smtp::Resolver::Answer& answer){
+                    if (answer.addresses == std::vector< uint32_t >({0x0A000001})) {
+                        ++answersDelivered;
+                    }
+                }
+            );
+        }
+        EXPECT_EQ(0, answersDelivered);
+        EXPECT_EQ(1, upstream->lookups);
+        upstream->AnswerHeldLookups();
+        EXPECT_EQ(100, answersDelivered);
+    }
+
+    TEST_F(ResolverTests, CachingResolverAnswersLookupsInProgressWhenDestroyed) {
+        upstream->answerImmediately = false;
+        size_t answersDelivered = 0;
+        {
+            Smtp::CachingResolver resolver;
+            resolver.Configure(upstream);
+            for (size_t i = 0; i < 2; ++i) {
+                resolver.Resolve(
+                    "mail.example.com",
+                    [&answersDelivered](const Smtp::Resolver::Answer& answer){
+                        if (answer.addresses.empty()) {
+                            ++answersDelivered;
+                        }
+                    }
+                );
+            }
+            EXPECT_EQ(0, answersDelivered);
+        }
+        EXPECT_EQ(2, answersDelivered);
+        upstream->AnswerHeldLookups();
+        EXPECT_EQ(2, answersDelivered);
+    }
+
+    TEST_F(ResolverTests, SystemResolverLooksUpOnBoundedThreads) {
+        Smtp::SystemResolver resolver(1);
+        std::mutex mutex;
+        std::condition_variable answered;
+        std::set< std::thread::id > lookupThreads;
+        size_t answersDelivered = 0;
+        for (size_t i = 0; i < 10; ++i) {
+            resolver.Resolve(
+                "127.0.0.1",
+                [&mutex, &answered, &lookupThreads, &answersDelivered](
+                    const Smtp::Resolver::Answer& answer
+                ){
+                    std::lock_guard< decltype(mutex) > lock(mutex);
+                    (void)lookupThreads.insert(std::this_thread::get_id());
+                    if (answer.addresses == std::vector< uint32_t >({0x7F000001})) {
+                        ++answersDelivered;
+                    }
+                    answered.notify_all();
+                }
+            );
+        }
+        std::unique_lock< decltype(mutex) > lock(mutex);
+        ASSERT_TRUE(
+            answered.wait_for(
+                lock,
+                std::chrono::seconds(1),
+                [&answersDelivered]{
+                    return (answersDelivered == 10);
+                }
+            )
+        );
+        ASSERT_EQ(1, lookupThreads.size());
+        EXPECT_NE(std::this_thread::get_id(), *lookupThreads.begin());
+    }
+
+}
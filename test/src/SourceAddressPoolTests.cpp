@@ -0,0 +1,61 @@
+/**
+ * @file SourceAddressPoolTests.cpp
+ *
+ * This module contains the unit tests of the Smtp::SourceAddressPool class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <chrono>
+#include <gtest/gtest.h>
+#include <Smtp/SourceAddressPool.hpp>
+#include <stdint.h>
+#include <thread>
+
+TEST(SourceAddressPoolTests, LeastBusySourceAddressPicked) {
+    Smtp::SourceAddressPool pool;
+    pool.SetAddresses({0x7F000002, 0x7F000003});
+    uint32_t sourceAddress = 0;
+    ASSERT_TRUE(pool.Acquire("mx1.example.com", sourceAddress));
+    EXPECT_EQ(0x7F000002, sourceAddress);
+    ASSERT_TRUE(pool.Acquire("mx1.example.com", sourceAddress));
+    EXPECT_EQ(0x7F000003, sourceAddress);
+    ASSERT_TRUE(pool.Acquire("mx2.example.com", sourceAddress));
+    EXPECT_EQ(0x7F000002, sourceAddress);
+    pool.Release(0x7F000002, "mx1.example.com");
+    ASSERT_TRUE(pool.Acquire("mx1.example.com", sourceAddress));
+    EXPECT_EQ(0x7F000002, sourceAddress);
+    EXPECT_EQ(1, pool.GetUsage(0x7F000002, "mx1.example.com").activeConnections);
+    EXPECT_EQ(2, pool.GetUsage(0x7F000002, "mx1.example.com").recentConnections);
+    EXPECT_EQ(1, pool.GetUsage(0x7F000003, "mx1.example.com").activeConnections);
+    EXPECT_EQ(1, pool.GetUsage(0x7F000002, "mx2.example.com").activeConnections);
+    EXPECT_EQ(0, pool.GetUsage(0x7F000003, "mx2.example.com").activeConnections);
+}
+
+TEST(SourceAddressPoolTests, ConcurrencyLimitedPerSourceAndDestination) {
+    Smtp::SourceAddressPool pool;
+    pool.SetAddresses({0x7F000002, 0x7F000003});
+    pool.SetLimits(1, 0, std::chrono::milliseconds(1000));
+    uint32_t sourceAddress = 0;
+    ASSERT_TRUE(pool.Acquire("mx1.example.com", sourceAddress));
+    ASSERT_TRUE(pool.Acquire("mx1.example.com", sourceAddress));
+    EXPECT_FALSE(pool.Acquire("mx1.example.com", sourceAddress));
+    EXPECT_TRUE(pool.Acquire("mx2.example.com", sourceAddress));
+    pool.Release(0x7F000003, "mx1.example.com");
+    ASSERT_TRUE(pool.Acquire("mx1.example.com", sourceAddress));
+    EXPECT_EQ(0x7F000003, sourceAddress);
+}
+
+TEST(SourceAddressPoolTests, ConnectionRateLimitedPerSourceAndDestination) {
+    Smtp::SourceAddressPool pool;
+    pool.SetAddresses({0x7F000002, 0x7F000003});
+    pool.SetLimits(0, 1, std::chrono::milliseconds(50));
+    uint32_t sourceAddress = 0;
+    ASSERT_TRUE(pool.Acquire("mx1.example.com", sourceAddress));
+    pool.Release(sourceAddress, "mx1.example.com");
+    ASSERT_TRUE(pool.Acquire("mx1.example.com", sourceAddress));
+    pool.Release(sourceAddress, "mx1.example.com");
+    EXPECT_FALSE(pool.Acquire("mx1.example.com", sourceAddress));
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    EXPECT_TRUE(pool.Acquire("mx1.example.com", sourceAddress));
+}
@@ -0,0 +1,253 @@
+/**
+ * @file UringNetworkTests.cpp
+ *
+ * This module contains the unit tests of the Smtp::UringNetwork class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include "Common.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <memory>
+#include <MessageHeaders/MessageHeaders.hpp>
+#include <Smtp/BodyStore.hpp>
+#include <Smtp/KernelTlsOffload.hpp>
+#include <Smtp/MemoryResolver.hpp>
+#include <Smtp/NetworkTransport.hpp>
+#include <Smtp/UringNetwork.hpp>
+#include <stdio.h>
+#include <string>
+#include <string.h>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/tls.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif /* __linux__ */
+
+/**
+ * Skip the rest of the current test if the system doesn't support
+ * io_uring, marking the test as skipped where Google Test can, or
+ * otherwise saying so in the output.
+ */
+#ifdef GTEST_SKIP
+#define SKIP_UNLESS_URING_SUPPORTED() \
+    if (!uringNetwork->IsSupported()) { \
+        GTEST_SKIP() << "io_uring is not supported"; \
+    }
+#else /* not GTEST_SKIP */
+#define SKIP_UNLESS_URING_SUPPORTED() \
+    if (!uringNetwork->IsSupported()) { \
+        (void)printf("[  SKIPPED ] io_uring is not supported\n"); \
+        return; \
+    }
+#endif /* GTEST_SKIP / not GTEST_SKIP */
+
+namespace SmtpTests {
+
+    /**
+     * This is the test fixture for these tests, providing common
+     * setup and teardown for each test.
+     */
+    struct UringNetworkTests
+        : public Common
+    {
+        // Properties
+
+        std::shared_ptr< Smtp::UringNetwork > uringNetwork = std::make_shared< Smtp::UringNetwork >(4, 4096);
+        std::shared_ptr< Smtp::MemoryResolver > resolver = std::make_shared< Smtp::MemoryResolver >();
+        std::shared_ptr< Smtp::NetworkTransport > networkTransport = std::make_shared< Smtp::NetworkTransport >();
+
+        // ::testing::Test
+
+        virtual void SetUp() override {
+            Common::SetUp();
+            resolver->SetAddresses("localhost", {0x7F000001});
+            networkTransport->Configure(resolver);
+            const auto uringNetwork = this->uringNetwork;
+            networkTransport->SetConnectionFactory(
+                [uringNetwork]{
+                    return uringNetwork->MakeConnection();
+                }
+            );
+            client.Configure(networkTransport);
+        }
+    };
+
+    TEST_F(UringNetworkTests, SendMail) {
+        SKIP_UNLESS_URING_SUPPORTED();
+        uringNetwork->SetZeroCopyThreshold(16384);
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        MessageHeaders::MessageHeaders headers;
+        headers.AddHeader("From", "<alex@example.com>");
+        headers.AddHeader("To", "<bob@example.com>");
+        const std::string line(98, 'x');
+        std::string body;
+        for (size_t i = 0; i < 2000; ++i) {
+            body += line + "\r\n";
+        }
+        auto sendWasCompleted = client.SendMail(headers, body);
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "MAIL FROM:<alex@example.com>\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+        auto& connection = *clients[0].connection;
+        SendTextMessage(connection, "250 OK\r\n"); // response to MAIL FROM:<alex@example.com>
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "RCPT TO:<bob@example.com>\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+        SendTextMessage(connection, "250 OK\r\n"); // response to RCPT TO:<bob@example.com>
+        EXPECT_EQ(
+            std::vector< std::string >({
+                "DATA\r\n",
+            }),
+            AwaitMessages(0, 1)
+        );
+        SendTextMessage(connection, "354 Start mail input; end with <CRLF>.<CRLF>\r\n"); // response to DATA
+        const auto linesReceived = AwaitMessages(0, 2004);
+        ASSERT_EQ(2004, linesReceived.size());
+        EXPECT_EQ(2000, std::count(linesReceived.begin(), linesReceived.end(), line + "\r\n"));
+        EXPECT_EQ(".\r\n", linesReceived.back());
+        SendTextMessage(connection, "250 OK\r\n"); // response to data
+        ASSERT_TRUE(FutureReady(sendWasCompleted, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(sendWasCompleted.get());
+        const auto statistics = uringNetwork->GetStatistics();
+        EXPECT_GT(statistics.operations, 0);
+        EXPECT_GT(statistics.registeredBufferReceives, 0);
+    }
+
+    TEST_F(UringNetworkTests, SendMailWithBodyFile) {
+        SKIP_UNLESS_URING_SUPPORTED();
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        const auto directory = MakeTestDirectory();
+        ASSERT_FALSE(directory.empty());
+        Smtp::BodyStore store;
+        store.Configure(directory);
+        const std::string line(98, 'x');
+        std::string body;
+        for (size_t i = 0; i < 2000; ++i) {
+            body += line + "\r\n";
+        }
+        const auto key = store.Add(body);
+        MessageHeaders::MessageHeaders headers;
+        headers.AddHeader("From", "<alex@example.com>");
+        headers.AddHeader("To", "<bob@example.com>");
+        auto sendWasCompleted = client.SendMail(headers, store.GetFile(key));
+        (void)AwaitMessages(0, 1);
+        auto& connection = *clients[0].connection;
+        SendTextMessage(connection, "250 OK\r\n"); // response to MAIL FROM:<alex@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "250 OK\r\n"); // response to RCPT TO:<bob@example.com>
+        (void)AwaitMessages(0, 1);
+        SendTextMessage(connection, "354 Start mail input; end with <CRLF>.<CRLF>\r\n"); // response to DATA
+        const auto linesReceived = AwaitMessages(0, 2004);
+        ASSERT_EQ(2004, linesReceived.size());
+        EXPECT_EQ(2000, std::count(linesReceived.begin(), linesReceived.end(), line + "\r\n"));
+        EXPECT_EQ(".\r\n", linesReceived.back());
+        SendTextMessage(connection, "250 OK\r\n"); // response to data
+        ASSERT_TRUE(FutureReady(sendWasCompleted, std::chrono::milliseconds(1000)));
+        EXPECT_TRUE(sendWasCompleted.get());
+        EXPECT_EQ(body.length(), uringNetwork->GetStatistics().splicedBytes);
+        store.Release(key);
+    }
+
+    TEST_F(UringNetworkTests, ConnectionBrokenByServer) {
+        SKIP_UNLESS_URING_SUPPORTED();
+        ASSERT_TRUE(EstablishConnectionPrepareToSend());
+        auto readyOrBroken = client.GetReadyOrBrokenFuture();
+        clients[0].connection->Close();
+        ASSERT_TRUE(FutureReady(readyOrBroken, std::chrono::milliseconds(1000)));
+        EXPECT_FALSE(readyOrBroken.get());
+    }
+
+    TEST_F(UringNetworkTests, ConnectionNotConnectedOnceClosed) {
+        SKIP_UNLESS_URING_SUPPORTED();
+        StartServer(false);
+        const auto connection = uringNetwork->MakeConnection();
+        ASSERT_TRUE(connection->Connect(0x7F000001, serverPort));
+        ASSERT_TRUE(AwaitConnections(1));
+        EXPECT_TRUE(connection->IsConnected());
+        connection->Close();
+        EXPECT_FALSE(connection->IsConnected());
+        EXPECT_TRUE(AwaitBroken(0));
+    }
+
+    TEST_F(UringNetworkTests, ConnectionBoundToSourceAddress) {
+        SKIP_UNLESS_URING_SUPPORTED();
+        StartServer(false);
+        const auto connection = uringNetwork->MakeConnection(0x7F000002);
+        ASSERT_TRUE(connection->Connect(0x7F000001, serverPort));
+        EXPECT_EQ(0x7F000002, connection->GetBoundAddress());
+        ASSERT_TRUE(AwaitConnections(1));
+    }
+
+#ifdef __linux__
+    TEST_F(UringNetworkTests, KernelTlsOffloadOrFallback) {
+        SKIP_UNLESS_URING_SUPPORTED();
+        const auto listener = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT_GE(listener, 0);
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(0x7F000001);
+        ASSERT_EQ(0, bind(listener, (const sockaddr*)&address, sizeof(address)));
+        ASSERT_EQ(0, listen(listener, 1));
+        socklen_t addressLength = sizeof(address);
+        ASSERT_EQ(0, getsockname(listener, (sockaddr*)&address, &addressLength));
+        const auto connection = uringNetwork->MakeConnection();
+        ASSERT_TRUE(connection->Connect(0x7F000001, ntohs(address.sin_port)));
+        const auto peer = accept(listener, nullptr, nullptr);
+        ASSERT_GE(peer, 0);
+        const auto kernelTlsOffload = std::dynamic_pointer_cast< Smtp::KernelTlsOffload >(connection);
+        ASSERT_FALSE(kernelTlsOffload == nullptr);
+        Smtp::KernelTlsOffload::Session session;
+        session.transmit.key.assign(15, 0x01);
+        session.transmit.iv.assign(12, 0x02);
+        EXPECT_FALSE(kernelTlsOffload->EnableKernelTls(session));
+        session.transmit.key.assign(16, 0x01);
+        if (kernelTlsOffload->EnableKernelTls(session)) {
+            // Have the kernel decrypt at the other end with the same keys.
+            tls12_crypto_info_aes_gcm_128 cryptoInfo;
+            memset(&cryptoInfo, 0, sizeof(cryptoInfo));
+            cryptoInfo.info.version = TLS_1_2_VERSION;
+            cryptoInfo.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+            memset(cryptoInfo.key, 0x01, sizeof(cryptoInfo.key));
+            memset(cryptoInfo.salt, 0x02, sizeof(cryptoInfo.salt));
+            memset(cryptoInfo.iv, 0x02, sizeof(cryptoInfo.iv));
+            ASSERT_EQ(0, setsockopt(peer, SOL_TCP, TCP_ULP, "tls", sizeof("tls")));
+            ASSERT_EQ(0, setsockopt(peer, SOL_TLS, TLS_RX, &cryptoInfo, sizeof(cryptoInfo)));
+        }
+        const std::string message = "Hello, World!\r\n";
+        connection->SendMessage(std::vector< uint8_t >(message.begin(), message.end()));
+        timeval timeout;
+        timeout.tv_sec = 1;
+        timeout.tv_usec = 0;
+        (void)setsockopt(peer, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        std::string received;
+        while (received.length() < message.length()) {
+            char buffer[64];
+            const auto amount = recv(peer, buffer, sizeof(buffer), 0);
+            if (amount <= 0) {
+                break;
+            }
+            received.append(buffer, (size_t)amount);
+        }
+        EXPECT_EQ(message, received);
+        (void)close(peer);
+        (void)close(listener);
+    }
+#endif /* __linux__ */
+
+}
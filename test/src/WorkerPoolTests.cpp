@@ -0,0 +1,62 @@
+/**
+ * @file WorkerPoolTests.cpp
+ *
+ * This module contains the unit tests of the Smtp::WorkerPool class.
+ *
+ * © 2019 by Richard Walters
+ */
+
+#include <future>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <Smtp/WorkerPool.hpp>
+#include <thread>
+#include <vector>
+
+TEST(WorkerPoolTests, TasksRunInOrderOnWorkerThread) {
+    Smtp::WorkerPool workerPool;
+    std::mutex mutex;
+    std::vector< int > tasksRun;
+    std::promise< std::thread::id > workerThread;
+    for (int i = 0; i < 3; ++i) {
+        workerPool.Post(
+            [&, i]{
+                std::lock_guard< decltype(mutex) > lock(mutex);
+                tasksRun.push_back(i);
+            }
+        );
+    }
+    workerPool.Post(
+        [&]{
+            workerThread.set_value(std::this_thread::get_id());
+        }
+    );
+    auto workerThreadId = workerThread.get_future();
+    ASSERT_EQ(
+        std::future_status::ready,
+        workerThreadId.wait_for(std::chrono::milliseconds(1000))
+    );
+    EXPECT_NE(std::this_thread::get_id(), workerThreadId.get());
+    std::lock_guard< decltype(mutex) > lock(mutex);
+    EXPECT_EQ(
+        std::vector< int >({0, 1, 2}),
+        tasksRun
+    );
+}
+
+TEST(WorkerPoolTests, TasksWaitingWhenDestroyedAreRun) {
+    size_t tasksRun = 0;
+    {
+        Smtp::WorkerPool workerPool(2);
+        for (size_t i = 0; i < 10; ++i) {
+            workerPool.Post(
+                [&tasksRun]{
+                    static std::mutex mutex;
+                    std::lock_guard< decltype(mutex) > lock(mutex);
+                    ++tasksRun;
+                }
+            );
+        }
+    }
+    EXPECT_EQ(10, tasksRun);
+}